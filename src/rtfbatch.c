@@ -0,0 +1,496 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                        DECLARATIONS & MACROS                        ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "rtfproc.h"
+#include "rtfpairs.h"
+#include "utillib.h"
+
+#define BATCH_IOBUFZ         (1 << 16)    // Per worker, reused for every file
+
+// One input file and where its output goes
+typedef struct batchjob {
+    char              * in;
+    char              * out;
+    dev_t               dev;         // Identify the input, to make sure no
+    ino_t               ino;         // output will overwrite it
+    uint64_t            bytes;
+    uint64_t            nanos;
+    int                 err;
+} batchjob;
+
+typedef struct batch {
+    batchjob          * jobs;
+    size_t              njobs;
+    size_t              cap;
+    size_t              next;        // Next job to hand out
+    const rtfdict     * dict;
+    const char        * outdir;
+    bool                quiet;
+    pthread_mutex_t     lock;        // Guards next and the report
+} batch;
+
+// Each worker has one object, reset between files rather than remade
+typedef struct batchworker {
+    batch             * B;
+    pthread_t           thread;
+    rtfobj            * R;
+    char              * inbuf;
+    char              * outbuf;
+} batchworker;
+
+static void *batch_worker(void *arg);
+static int batch_one(batchworker *W, batchjob *J);
+static bool add_input(batch *B, const char *path);
+static bool add_tree(batch *B, const char *root, const char *rel);
+static bool add_job(batch *B, const char *in, const char *rel);
+static batchjob *find_clash(batch *B);
+static batchjob *find_overwrite(batch *B);
+static int compare_file(const void *a, const void *b);
+static int compare_out(const void *a, const void *b);
+static char *join_path(const char *dir, const char *name);
+static bool make_parents(const char *path);
+static bool is_rtf(const char *name);
+static uint64_t now_nanos(void);
+static int usage(const char *argv0);
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                                 MAIN                                ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv) {
+    batch        B = { 0 };
+    batchworker *W;
+    batchjob    *J;
+    char       **pairs;
+    rtfdict     *dict;
+    const char  *replfile = NULL;
+    long         jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t     start, elapsed, bytes = 0;
+    size_t       nworkers, nfailed = 0;
+    int          opt;
+
+    while ((opt = getopt(argc, argv, "r:j:o:q")) != -1) {
+        switch (opt) {
+            case 'r':  replfile = optarg;                     break;
+            case 'j':  jobs     = strtol(optarg, NULL, 10);   break;
+            case 'o':  B.outdir = optarg;                     break;
+            case 'q':  B.quiet  = true;                       break;
+            default:   return usage(argv[0]);
+        }
+    }
+    if (!replfile || !B.outdir || optind == argc || jobs < 1) return usage(argv[0]);
+
+    // One compiled set, shared by every worker
+    if (!(pairs = load_rtfpairs(replfile, NULL))) {
+        fprintf(stderr, "Could not load replacements from \'%s\'\n", replfile);
+        return 2;
+    }
+    dict = new_rtfdict((const char **)pairs);
+    free_rtfpairs(pairs);
+    if (!dict) {
+        fprintf(stderr, "Could not compile replacements from \'%s\'\n", replfile);
+        return 2;
+    }
+    B.dict = dict;
+
+    for (int i = optind; i < argc; i++) {
+        if (!add_input(&B, argv[i])) {
+            fprintf(stderr, "Could not read input \'%s\'\n", argv[i]);
+            return 2;
+        }
+    }
+
+    // Two jobs writing one file would race, so refuse rather than guess
+    if ((J = find_clash(&B))) {
+        fprintf(stderr, "Inputs \'%s\' and \'%s\' would both write \'%s\'\n",
+                J[0].in, J[1].in, J[0].out);
+        return 2;
+    }
+
+    // Opening an output for writing empties it, so no output may be an input
+    if ((J = find_overwrite(&B))) {
+        fprintf(stderr, "Output \'%s\' would overwrite an input\n", J->out);
+        return 2;
+    }
+
+    nworkers = (size_t)jobs < B.njobs ? (size_t)jobs : B.njobs;
+    if (!(W = calloc(nworkers + 1, sizeof *W))) return 2;
+    pthread_mutex_init(&B.lock, NULL);
+
+    start = now_nanos();
+    for (size_t i = 0; i < nworkers; i++) {
+        W[i].B = &B;
+        if (pthread_create(&W[i].thread, NULL, batch_worker, &W[i])) {
+            fprintf(stderr, "Could not start worker\n");
+            return 2;
+        }
+    }
+    for (size_t i = 0; i < nworkers; i++) pthread_join(W[i].thread, NULL);
+    elapsed = now_nanos() - start;
+
+    for (size_t i = 0; i < B.njobs; i++) {
+        if (B.jobs[i].err) nfailed++;
+        else               bytes += B.jobs[i].bytes;
+        free(B.jobs[i].in);
+        free(B.jobs[i].out);
+    }
+    fprintf(stderr, "%zu files, %zu failed, %.1f MB in %.3f s (%.1f MB/s) with %zu jobs\n",
+            B.njobs, nfailed, bytes / 1e6, elapsed / 1e9,
+            elapsed ? bytes / 1e6 / (elapsed / 1e9) : 0.0, nworkers);
+
+    pthread_mutex_destroy(&B.lock);
+    free(B.jobs);
+    free(W);
+    delete_rtfdict(dict);
+
+    return nfailed ? 1 : 0;
+}
+
+
+
+static int usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s -r FILE -o OUTDIR [-j JOBS] [-q] INPUT...\n"
+        "Replaces keys in RTF files in parallel, using the keys and values in\n"
+        "FILE (TSV or JSON). INPUT is an RTF file, a directory to search for\n"
+        ".rtf files, or @LIST to read inputs from LIST, one per line. Output\n"
+        "keeps each file's path below the directory it was found in. No two\n"
+        "inputs may map to the same output, and no output may be an input.\n"
+        "-q only reports failures and the totals.\n",
+        argv0);
+    return 2;
+}
+
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                              PROCESSING                             ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+static void *batch_worker(void *arg) {
+    batchworker *W = arg;
+    batch       *B = W->B;
+    batchjob    *J;
+
+    BEGIN_FUNCTION
+
+    W->inbuf  = malloc(BATCH_IOBUFZ);
+    W->outbuf = malloc(BATCH_IOBUFZ);
+    W->R      = new_rtfobj(NULL, NULL, NULL);
+    if (W->R) set_rtfobj_dictionary(W->R, B->dict);
+
+    for (;;) {
+        pthread_mutex_lock(&B->lock);
+        J = (B->next < B->njobs) ? &B->jobs[B->next++] : NULL;
+        pthread_mutex_unlock(&B->lock);
+        if (!J) break;
+
+        J->err = (W->inbuf && W->outbuf && W->R) ? batch_one(W, J) : ENOMEM;
+
+        pthread_mutex_lock(&B->lock);
+        if (J->err)         printf("FAILED      %s: %s\n", J->in, strerror(J->err));
+        else if (!B->quiet) printf("%9.3f ms  %s\n", J->nanos / 1e6, J->in);
+        pthread_mutex_unlock(&B->lock);
+    }
+
+    delete_rtfobj(W->R);
+    free(W->inbuf);
+    free(W->outbuf);
+
+    RETURN(NULL);
+}
+
+
+
+static int batch_one(batchworker *W, batchjob *J) {
+    rtfobj   *R = W->R;
+    FILE     *fin;
+    FILE     *fout;
+    uint64_t  start = now_nanos();
+    int       err;
+
+    BEGIN_FUNCTION
+
+    if (!make_parents(J->out))          FAIL(errno, "Could not create directory for \'%s\'", J->out);
+    if (!(fin = fopen(J->in, "rb")))    FAIL(errno, "Could not read \'%s\'", J->in);
+    if (!(fout = fopen(J->out, "wb"))) {
+        err = errno;
+        fclose(fin);
+        FAIL(err, "Could not write \'%s\'", J->out);
+    }
+    setvbuf(fin,  W->inbuf,  _IOFBF, BATCH_IOBUFZ);
+    setvbuf(fout, W->outbuf, _IOFBF, BATCH_IOBUFZ);
+
+    rtfobj_reset(R, fin, fout, NULL);
+    rtfreplace(R);
+    err = R->fatalerr;
+    rtfobj_reset(R, NULL, NULL, NULL);
+
+    J->bytes = (uint64_t)ftell(fin);
+    fclose(fin);
+    if (fclose(fout) && !err) err = errno;
+    J->nanos = now_nanos() - start;
+
+    RETURN(err);
+}
+
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                                INPUTS                               ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+static bool add_input(batch *B, const char *path) {
+    struct stat st;
+    FILE       *f;
+    char       *line = NULL;
+    size_t      linez = 0;
+    ssize_t     len;
+    bool        ok = true;
+    const char *base;
+
+    BEGIN_FUNCTION
+
+    // @LIST names more inputs, one per line
+    if (path[0] == '@') {
+        if (!(f = fopen(path + 1, "rb"))) RETURN(false);
+        while (ok && (len = getline(&line, &linez, f)) >= 0) {
+            while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) line[--len] = '\0';
+            if (len > 0) ok = add_input(B, line);
+        }
+        free(line);
+        fclose(f);
+        RETURN(ok);
+    }
+
+    if (stat(path, &st)) RETURN(false);
+    if (S_ISDIR(st.st_mode)) RETURN(add_tree(B, path, ""));
+
+    base = strrchr(path, '/');
+    RETURN(add_job(B, path, base ? base + 1 : path));
+}
+
+
+
+static bool add_tree(batch *B, const char *root, const char *rel) {
+    DIR           *d;
+    struct dirent *de;
+    struct stat    st;
+    char          *dir, *in, *sub;
+    bool           ok = true;
+
+    BEGIN_FUNCTION
+
+    if (!(dir = join_path(root, rel))) RETURN(false);
+    if (!(d = opendir(dir))) { free(dir); RETURN(false); }
+
+    while (ok && (de = readdir(d))) {
+        if (de->d_name[0] == '.') continue;
+        in  = join_path(dir, de->d_name);
+        sub = join_path(rel, de->d_name);
+        if (!in || !sub)                                 ok = false;
+        else if (!stat(in, &st) && S_ISDIR(st.st_mode)) ok = add_tree(B, root, sub);
+        else if (is_rtf(de->d_name))                     ok = add_job(B, in, sub);
+        free(in);
+        free(sub);
+    }
+    closedir(d);
+    free(dir);
+
+    RETURN(ok);
+}
+
+
+
+static bool add_job(batch *B, const char *in, const char *rel) {
+    struct stat st;
+    batchjob   *jobs;
+    batchjob   *J;
+
+    BEGIN_FUNCTION
+
+    if (stat(in, &st)) RETURN(false);
+
+    if (B->njobs == B->cap) {
+        B->cap = B->cap ? 2 * B->cap : 64;
+        if (!(jobs = realloc(B->jobs, B->cap * sizeof *jobs))) RETURN(false);
+        B->jobs = jobs;
+    }
+    J = &B->jobs[B->njobs];
+    memzero(J, sizeof *J);
+    J->in  = strdup(in);
+    J->out = join_path(B->outdir, rel);
+    J->dev = st.st_dev;
+    J->ino = st.st_ino;
+    if (!J->in || !J->out) { free(J->in); free(J->out); RETURN(false); }
+    B->njobs++;
+
+    RETURN(true);
+}
+
+
+
+static batchjob *find_clash(batch *B) {
+    size_t i;
+
+    BEGIN_FUNCTION
+
+    // Sorting by output puts any two jobs with the same one side by side.
+    // Workers take jobs in any order anyway, so the order lost is no loss.
+    if (B->njobs > 1) qsort(B->jobs, B->njobs, sizeof *B->jobs, compare_out);
+    for (i = 1; i < B->njobs; i++) {
+        if (!strcmp(B->jobs[i-1].out, B->jobs[i].out)) RETURN(&B->jobs[i-1]);
+    }
+
+    RETURN(NULL);
+}
+
+
+
+static batchjob *find_overwrite(batch *B) {
+    struct stat st;
+    batchjob    key;
+    size_t      i;
+
+    BEGIN_FUNCTION
+
+    // Paths can name one file many ways, so compare files instead. An
+    // output that doesn't exist yet can't be an input.
+    if (B->njobs > 1) qsort(B->jobs, B->njobs, sizeof *B->jobs, compare_file);
+    for (i = 0; i < B->njobs; i++) {
+        if (stat(B->jobs[i].out, &st)) continue;
+        key.dev = st.st_dev;
+        key.ino = st.st_ino;
+        if (bsearch(&key, B->jobs, B->njobs, sizeof *B->jobs, compare_file)) RETURN(&B->jobs[i]);
+    }
+
+    RETURN(NULL);
+}
+
+
+
+static int compare_out(const void *a, const void *b) {
+    return strcmp(((const batchjob *)a)->out, ((const batchjob *)b)->out);
+}
+
+
+
+static int compare_file(const void *a, const void *b) {
+    const batchjob *x = a;
+    const batchjob *y = b;
+
+    if (x->dev != y->dev) return x->dev < y->dev ? -1 : 1;
+    if (x->ino != y->ino) return x->ino < y->ino ? -1 : 1;
+    return 0;
+}
+
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                           HELPER FUNCTIONS                          ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+static char *join_path(const char *dir, const char *name) {
+    size_t dirlen  = strlen(dir);
+    size_t namelen = strlen(name);
+    char  *path;
+
+    // An empty dir is the root of a tree, so name stands alone
+    if (!(path = malloc(dirlen + namelen + 2))) return NULL;
+    memcpy(path, dir, dirlen);
+    if (dirlen && *name) path[dirlen++] = '/';
+    memcpy(path + dirlen, name, namelen + 1);
+
+    return path;
+}
+
+
+
+static bool make_parents(const char *path) {
+    char buf[4096];
+    char *p;
+
+    // Workers may race to make the same directory, which is fine
+    if (strlen(path) >= sizeof buf) { errno = ENAMETOOLONG; return false; }
+    strcpy(buf, path);
+    for (p = strchr(buf + 1, '/'); p; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        if (mkdir(buf, 0777) && errno != EEXIST) return false;
+        *p = '/';
+    }
+
+    return true;
+}
+
+
+
+static bool is_rtf(const char *name) {
+    size_t len = strlen(name);
+
+    return len > 4 && !strcasecmp(name + len - 4, ".rtf");
+}
+
+
+
+static uint64_t now_nanos(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
@@ -0,0 +1,675 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                        DECLARATIONS & MACROS                        ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "rtfproc.h"
+#include "rtfcache.h"
+#include "utillib.h"
+
+#if !defined(_WIN32) && (defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__)))
+#define RTFCACHE_PID
+#include <unistd.h>
+#endif
+
+#define CACHE_CHUNKZ         65536        // Read size when hashing input
+#define CACHE_MIN_BUCKETS    64
+
+// SHA-256 (FIPS 180-4) of the input, fed a chunk at a time
+typedef struct cachesha {
+    uint32_t            h[8];
+    uint8_t             block[64];
+    size_t              blockn;      // Bytes waiting in block[]
+    uint64_t            len;         // Bytes fed in all
+} cachesha;
+
+// Entries are kept in a hash table for lookup and on a list from most to
+// least recently used for eviction. The output follows the entry itself.
+typedef struct cacheentry {
+    rtfcachekey         key;
+    struct cacheentry * newer;
+    struct cacheentry * older;
+    struct cacheentry * chain;       // Next in the same bucket
+    size_t              outlen;
+    char                out[];
+} cacheentry;
+
+struct rtfcache {
+    size_t              maxbytes;
+    char              * dir;         // Disk tier, if not NULL
+    cacheentry       ** buckets;
+    size_t              nbuckets;    // Always a power of two
+    cacheentry        * newest;
+    cacheentry        * oldest;
+    rtfcachestats       stats;
+};
+
+// Override pair, for putting them in a canonical order
+typedef struct cachepair {
+    const char        * key;
+    const char        * val;
+    size_t              idx;
+} cachepair;
+
+static bool cache_hash_input(FILE *fin, rtfcachekey *key);
+static cacheentry *cache_find(rtfcache *C, const rtfcachekey *key);
+static void cache_store(rtfcache *C, const rtfcachekey *key, const char *out, size_t outlen);
+static void cache_unlink(rtfcache *C, cacheentry *e);
+static void cache_push(rtfcache *C, cacheentry *e);
+static bool cache_grow(rtfcache *C);
+static char *cache_path(const rtfcache *C, const rtfcachekey *key);
+static char *cache_load(const rtfcache *C, const rtfcachekey *key, size_t *outlen);
+static void cache_save(const rtfcache *C, const rtfcachekey *key, const char *out, size_t outlen);
+static int cmppair(const void *a, const void *b);
+static void sha_init(cachesha *S);
+static void sha_update(cachesha *S, const void *buf, size_t len);
+static void sha_final(cachesha *S, uint8_t digest[RTFCACHE_SHAZ]);
+static void sha_block(cachesha *S, const uint8_t *p);
+static uint64_t cache_src64(const rtfcachekey *key);
+
+#define cache_bucket(C, key) \
+    ((cache_src64(key) ^ ((key)->valhash * UINT64_C(0x9e3779b97f4a7c15))) & ((C)->nbuckets - 1))
+#define cache_same_key(a, b) \
+    (!memcmp((a)->srchash, (b)->srchash, RTFCACHE_SHAZ) && \
+     (a)->srclen == (b)->srclen && (a)->valhash == (b)->valhash)
+#define sha_rotr(x, n)       (((x) >> (n)) | ((x) << (32 - (n))))
+#define cache_entry_size(e)  (sizeof(cacheentry) + (e)->outlen)
+
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                    CACHE CREATION & DESTRUCTION                     ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+rtfcache *new_rtfcache(size_t maxbytes, const char *dir) {
+    rtfcache *C;
+
+    BEGIN_FUNCTION
+
+    // maxbytes of 0 keeps nothing in memory; a NULL dir nothing on disk
+    C = malloc(sizeof *C);
+    if (!C) FAIL(NULL, "Failed allocating cache.");
+    memzero(C, sizeof *C);
+
+    C->maxbytes = maxbytes;
+    C->nbuckets = CACHE_MIN_BUCKETS;
+    C->buckets  = calloc(C->nbuckets, sizeof *C->buckets);
+    if (dir) C->dir = strdup(dir);
+    if (!C->buckets || (dir && !C->dir)) {
+        delete_rtfcache(C);
+        FAIL(NULL, "Failed allocating cache.");
+    }
+
+    RETURN(C);
+}
+
+
+
+void delete_rtfcache(rtfcache *C) {
+    cacheentry *e;
+
+    BEGIN_FUNCTION
+
+    if (!C) RETURN();
+
+    while ((e = C->newest)) {
+        C->newest = e->older;
+        free(e);
+    }
+    free(C->buckets);
+    free(C->dir);
+    free(C);
+
+    RETURN();
+}
+
+
+
+rtfcachestats rtfcache_stats(const rtfcache *C) {
+    return C->stats;
+}
+
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                          CACHED REPLACEMENT                         ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+int rtfreplace_cached(rtfcache *C, rtfobj *R) {
+    rtfcachekey key;
+    cacheentry *e;
+    FILE       *fout;
+    FILE       *ftmp;
+    char       *out = NULL;
+    size_t      outlen = 0;
+    long        start;
+    long        end;
+    int         err = 0;
+
+    BEGIN_FUNCTION
+
+    // Only output to fout is cached. Anything else the object would do
+    // (text output, output hooks, picture hooks and readers) needs a real
+    // pass, as does input that can't be read twice.
+    if (!R->fout || R->ftxt || R->hooks.raw || R->hooks.match ||
+        R->picthook || R->pictreader ||
+        (start = ftell(R->fin)) < 0) {
+        C->stats.bypassed++;
+        rtfreplace(R);
+        RETURN(R->fatalerr);
+    }
+
+    if (!cache_hash_input(R->fin, &key)) FAIL(EIO, "Could not read input");
+    key.valhash = rtfcache_values_hash(R);
+
+    // Memory, then disk
+    if ((e = cache_find(C, &key))) {
+        cache_unlink(C, e);
+        cache_push(C, e);
+        C->stats.hits++;
+        if (fwrite(e->out, 1, e->outlen, R->fout) != e->outlen) FAIL(EIO, "Could not write output");
+        RETURN(0);
+    }
+
+    if (C->dir && (out = cache_load(C, &key, &outlen))) {
+        C->stats.diskhits++;
+        cache_store(C, &key, out, outlen);
+        if (fwrite(out, 1, outlen, R->fout) != outlen) err = EIO;
+        free(out);
+        if (err) FAIL(err, "Could not write output");
+        RETURN(0);
+    }
+
+    // Process it, with the output diverted so it can be kept as well
+    if (fseek(R->fin, start, SEEK_SET)) FAIL(EIO, "Could not rewind input");
+    if (!(ftmp = tmpfile())) FAIL(EIO, "Could not create temporary file");
+
+    fout = R->fout;
+    R->fout = ftmp;
+    rtfreplace(R);
+    R->fout = fout;
+
+    if (fflush(ftmp) || (end = ftell(ftmp)) < 0 || fseek(ftmp, 0, SEEK_SET)) {
+        err = EIO;
+    } else if (!(out = malloc((size_t)end + 1))) {
+        err = ENOMEM;
+    } else {
+        outlen = fread(out, 1, (size_t)end, ftmp);
+        if (outlen != (size_t)end) err = EIO;
+    }
+    fclose(ftmp);
+
+    // Whatever was written goes out either way; only a complete pass is kept
+    if (!err && fwrite(out, 1, outlen, R->fout) != outlen) err = EIO;
+    if (!err && !R->fatalerr) {
+        C->stats.misses++;
+        cache_store(C, &key, out, outlen);
+        if (C->dir) cache_save(C, &key, out, outlen);
+    }
+    else {
+        C->stats.bypassed++;
+    }
+    free(out);
+
+    if (err) FAIL(err, "Could not capture output");
+
+    RETURN(R->fatalerr);
+}
+
+
+
+uint64_t rtfcache_values_hash(const rtfobj *R) {
+    cachepair *pairs;
+    uint64_t   h = RTFHASH_INIT;
+    uint64_t   limits[4];
+    size_t     i;
+    bool       sorted;
+
+    BEGIN_FUNCTION
+
+    // Besides the keys and values, the match policy and buffer limits can
+    // change the output, so they count too
+    limits[0] = (uint64_t)R->matchpolicy;
+    limits[1] = R->rawmax;
+    limits[2] = R->txtmax;
+    limits[3] = R->cmdmax;
+    h = rtfhash(h, limits, sizeof limits);
+
+    // The object's own keys only matter in the order they were added where
+    // that order decides between them. Otherwise they are hashed sorted,
+    // so the same set hashes the same however it was put together.
+    // (Dictionary keys are sorted already.)
+    sorted = R->matchpolicy == RTF_MATCH_LONGEST || R->matchpolicy == RTF_MATCH_SHORTEST ||
+             (R->matchpolicy == RTF_MATCH_DEFAULT && R->dict);
+    pairs = sorted ? malloc((R->srchz + 1) * sizeof *pairs) : NULL;
+
+    for (i = 0; i < R->srchz; i++) {
+        if (pairs) pairs[i] = (cachepair){ R->srch_key[i], R->srch_val[i], i };
+        else {
+            h = rtfhash(h, R->srch_key[i], strlen(R->srch_key[i]) + 1);
+            h = rtfhash(h, R->srch_val[i], strlen(R->srch_val[i]) + 1);
+        }
+    }
+    if (pairs) {
+        qsort(pairs, R->srchz, sizeof *pairs, cmppair);
+        for (i = 0; i < R->srchz; i++) {
+            h = rtfhash(h, pairs[i].key, strlen(pairs[i].key) + 1);
+            h = rtfhash(h, pairs[i].val, strlen(pairs[i].val) + 1);
+        }
+        free(pairs);
+    }
+
+    // A separator, so overrides and dictionary can't trade places. The
+    // dictionary's entries were hashed when it was built.
+    h = rtfhash(h, "", 1);
+    if (R->dict) h = rtfhash(h, &R->dict->hash, sizeof R->dict->hash);
+
+    RETURN(h);
+}
+
+
+
+static bool cache_hash_input(FILE *fin, rtfcachekey *key) {
+    char     buf[CACHE_CHUNKZ];
+    cachesha S;
+    size_t   n;
+
+    BEGIN_FUNCTION
+
+    sha_init(&S);
+    key->srclen = 0;
+    while ((n = fread(buf, 1, sizeof buf, fin)) > 0) {
+        sha_update(&S, buf, n);
+        key->srclen += n;
+    }
+    sha_final(&S, key->srchash);
+
+    RETURN(!ferror(fin));
+}
+
+
+
+static uint64_t cache_src64(const rtfcachekey *key) {
+    uint64_t h;
+
+    // Any 64 bits of a SHA-256 digest are as good as any other
+    memcpy(&h, key->srchash, sizeof h);
+
+    return h;
+}
+
+
+
+static int cmppair(const void *a, const void *b) {
+    const cachepair *p = a;
+    const cachepair *q = b;
+    int c = strcmp(p->key, q->key);
+
+    // Equal keys stay in the order they were added, which decides them
+    if (c) return c;
+    return (p->idx > q->idx) - (p->idx < q->idx);
+}
+
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                             MEMORY TIER                             ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+static cacheentry *cache_find(rtfcache *C, const rtfcachekey *key) {
+    cacheentry *e;
+
+    for (e = C->buckets[cache_bucket(C, key)]; e; e = e->chain) {
+        if (cache_same_key(&e->key, key)) return e;
+    }
+
+    return NULL;
+}
+
+
+
+static void cache_store(rtfcache *C, const rtfcachekey *key, const char *out, size_t outlen) {
+    cacheentry **pp;
+    cacheentry  *e;
+    size_t       z = sizeof *e + outlen;
+
+    BEGIN_FUNCTION
+
+    // Too big to keep at all, or already here
+    if (z > C->maxbytes || cache_find(C, key)) RETURN();
+
+    // Evict from the old end until it fits
+    while (C->stats.bytes + z > C->maxbytes && (e = C->oldest)) {
+        for (pp = &C->buckets[cache_bucket(C, &e->key)]; *pp != e; pp = &(*pp)->chain);
+        *pp = e->chain;
+        cache_unlink(C, e);
+        C->stats.entries--;
+        C->stats.bytes -= cache_entry_size(e);
+        C->stats.evictions++;
+        free(e);
+    }
+
+    if (C->stats.entries >= C->nbuckets && !cache_grow(C)) RETURN();
+    if (!(e = malloc(z))) RETURN();
+
+    e->key    = *key;
+    e->outlen = outlen;
+    memcpy(e->out, out, outlen);
+
+    e->chain = C->buckets[cache_bucket(C, key)];
+    C->buckets[cache_bucket(C, key)] = e;
+    cache_push(C, e);
+    C->stats.entries++;
+    C->stats.bytes += z;
+
+    RETURN();
+}
+
+
+
+static void cache_unlink(rtfcache *C, cacheentry *e) {
+    if (e->newer) e->newer->older = e->older;
+    else          C->newest = e->older;
+    if (e->older) e->older->newer = e->newer;
+    else          C->oldest = e->newer;
+    e->newer = e->older = NULL;
+}
+
+
+
+static void cache_push(rtfcache *C, cacheentry *e) {
+    e->older = C->newest;
+    e->newer = NULL;
+    if (C->newest) C->newest->newer = e;
+    else           C->oldest = e;
+    C->newest = e;
+}
+
+
+
+static bool cache_grow(rtfcache *C) {
+    cacheentry **newbuckets;
+    cacheentry  *e;
+    cacheentry  *next;
+    size_t       i;
+    size_t       oldn = C->nbuckets;
+
+    BEGIN_FUNCTION
+
+    newbuckets = calloc(2 * oldn, sizeof *newbuckets);
+    if (!newbuckets) FAIL(false, "Out of memory growing cache table");
+
+    C->nbuckets = 2 * oldn;
+    for (i = 0; i < oldn; i++) {
+        for (e = C->buckets[i]; e; e = next) {
+            next = e->chain;
+            e->chain = newbuckets[cache_bucket(C, &e->key)];
+            newbuckets[cache_bucket(C, &e->key)] = e;
+        }
+    }
+    free(C->buckets);
+    C->buckets = newbuckets;
+
+    RETURN(true);
+}
+
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                              DISK TIER                              ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+static char *cache_path(const rtfcache *C, const rtfcachekey *key) {
+    size_t z = strlen(C->dir) + 2 * RTFCACHE_SHAZ + 48;
+    char  *path = malloc(z);
+    char  *p;
+    size_t i;
+
+    if (path) {
+        p = path + snprintf(path, z, "%s/", C->dir);
+        for (i = 0; i < RTFCACHE_SHAZ; i++) p += snprintf(p, 3, "%02x", key->srchash[i]);
+        snprintf(p, 48, "%016llx%016llx.rtfc",
+                 (unsigned long long)key->valhash, (unsigned long long)key->srclen);
+    }
+
+    return path;
+}
+
+
+
+static char *cache_load(const rtfcache *C, const rtfcachekey *key, size_t *outlen) {
+    rtfcachehdr hdr;
+    char       *path;
+    char       *out = NULL;
+    FILE       *f;
+
+    BEGIN_FUNCTION
+
+    if (!(path = cache_path(C, key))) RETURN(NULL);
+    f = fopen(path, "rb");
+    free(path);
+    if (!f) RETURN(NULL);
+
+    // Anything that doesn't check out is treated as not there
+    if (fread(&hdr, sizeof hdr, 1, f) == 1 &&
+        !memcmp(hdr.magic, RTFCACHE_MAGIC, sizeof RTFCACHE_MAGIC) &&
+        hdr.version == RTFCACHE_VERSION &&
+        hdr.hdrz == sizeof hdr &&
+        cache_same_key(&hdr.key, key) &&
+        hdr.outlen < SIZE_MAX &&
+        (out = malloc((size_t)hdr.outlen + 1)) &&
+        fread(out, 1, (size_t)hdr.outlen, f) == hdr.outlen) {
+        *outlen = (size_t)hdr.outlen;
+    }
+    else {
+        free(out);
+        out = NULL;
+    }
+    fclose(f);
+
+    RETURN(out);
+}
+
+
+
+static void cache_save(const rtfcache *C, const rtfcachekey *key, const char *out, size_t outlen) {
+    rtfcachehdr hdr = { 0 };
+    char       *path;
+    char       *tmppath;
+    size_t      z;
+    FILE       *f;
+    bool        ok;
+
+    BEGIN_FUNCTION
+
+    if (!(path = cache_path(C, key))) RETURN();
+    z = strlen(path) + 32;
+    if (!(tmppath = malloc(z))) { free(path); RETURN(); }
+
+    // Written under another name and renamed into place, so a reader never
+    // sees a partial entry
+#ifdef RTFCACHE_PID
+    snprintf(tmppath, z, "%s.%ld.tmp", path, (long)getpid());
+#else
+    snprintf(tmppath, z, "%s.tmp", path);
+#endif
+
+    memcpy(hdr.magic, RTFCACHE_MAGIC, sizeof RTFCACHE_MAGIC);
+    hdr.version = RTFCACHE_VERSION;
+    hdr.hdrz    = (uint32_t)sizeof hdr;
+    hdr.key     = *key;
+    hdr.outlen  = outlen;
+
+    if ((f = fopen(tmppath, "wb"))) {
+        ok = fwrite(&hdr, sizeof hdr, 1, f) == 1 && fwrite(out, 1, outlen, f) == outlen;
+        ok = !fclose(f) && ok;
+        if (!ok || rename(tmppath, path)) {
+            remove(tmppath);
+            LOG("Could not write cache entry \'%s\'", path);
+        }
+    }
+
+    free(tmppath);
+    free(path);
+
+    RETURN();
+}
+
+
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                               SHA-256                               ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+static const uint32_t sha_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+
+
+static void sha_init(cachesha *S) {
+    static const uint32_t h0[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    memcpy(S->h, h0, sizeof h0);
+    S->blockn = 0;
+    S->len    = 0;
+}
+
+
+
+static void sha_update(cachesha *S, const void *buf, size_t len) {
+    const uint8_t *p = buf;
+    size_t         n;
+
+    S->len += len;
+
+    // Top up a partial block first, then take whole blocks straight from buf
+    if (S->blockn) {
+        n = 64 - S->blockn < len ? 64 - S->blockn : len;
+        memcpy(S->block + S->blockn, p, n);
+        S->blockn += n;
+        p   += n;
+        len -= n;
+        if (S->blockn < 64) return;
+        sha_block(S, S->block);
+        S->blockn = 0;
+    }
+    for (; len >= 64; p += 64, len -= 64) sha_block(S, p);
+
+    memcpy(S->block, p, len);
+    S->blockn = len;
+}
+
+
+
+static void sha_final(cachesha *S, uint8_t digest[RTFCACHE_SHAZ]) {
+    uint64_t bits = S->len * 8;
+    size_t   i;
+
+    // A 1 bit, zeros up to 8 bytes short of a block, then the length
+    S->block[S->blockn++] = 0x80;
+    if (S->blockn > 56) {
+        memset(S->block + S->blockn, 0, 64 - S->blockn);
+        sha_block(S, S->block);
+        S->blockn = 0;
+    }
+    memset(S->block + S->blockn, 0, 56 - S->blockn);
+    for (i = 0; i < 8; i++) S->block[56 + i] = (uint8_t)(bits >> (56 - 8 * i));
+    sha_block(S, S->block);
+
+    for (i = 0; i < 8; i++) {
+        digest[4*i]   = (uint8_t)(S->h[i] >> 24);
+        digest[4*i+1] = (uint8_t)(S->h[i] >> 16);
+        digest[4*i+2] = (uint8_t)(S->h[i] >> 8);
+        digest[4*i+3] = (uint8_t)(S->h[i]);
+    }
+}
+
+
+
+static void sha_block(cachesha *S, const uint8_t *p) {
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h, t1, t2;
+    size_t   i;
+
+    for (i = 0; i < 16; i++) {
+        w[i] = (uint32_t)p[4*i] << 24 | (uint32_t)p[4*i+1] << 16 | (uint32_t)p[4*i+2] << 8 | p[4*i+3];
+    }
+    for (i = 16; i < 64; i++) {
+        w[i] = w[i-16] + (sha_rotr(w[i-15], 7) ^ sha_rotr(w[i-15], 18) ^ (w[i-15] >> 3))
+             + w[i-7]  + (sha_rotr(w[i-2], 17) ^ sha_rotr(w[i-2], 19)  ^ (w[i-2] >> 10));
+    }
+
+    a = S->h[0]; b = S->h[1]; c = S->h[2]; d = S->h[3];
+    e = S->h[4]; f = S->h[5]; g = S->h[6]; h = S->h[7];
+    for (i = 0; i < 64; i++) {
+        t1 = h + (sha_rotr(e, 6) ^ sha_rotr(e, 11) ^ sha_rotr(e, 25)) + ((e & f) ^ (~e & g)) + sha_k[i] + w[i];
+        t2 = (sha_rotr(a, 2) ^ sha_rotr(a, 13) ^ sha_rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    S->h[0] += a; S->h[1] += b; S->h[2] += c; S->h[3] += d;
+    S->h[4] += e; S->h[5] += f; S->h[6] += g; S->h[7] += h;
+}
@@ -0,0 +1,93 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#ifndef RTFCACHE_H__
+#define RTFCACHE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "rtfproc.h"
+
+
+
+#define   RTFCACHE_MAGIC    "RTFCACH"
+#define   RTFCACHE_VERSION  2
+#define   RTFCACHE_SHAZ     32
+
+
+// CACHE KEY
+// Output depends only on the input bytes and on what the object replaces
+// them with, so that is all the key holds. See rtfcache_values_hash(). The
+// input is hashed with SHA-256 rather than rtfhash(), since a hit serves
+// stored output without looking at the input again, and inputs that
+// collide in 64 bits are easy to make.
+typedef struct rtfcachekey {
+    uint8_t         srchash[RTFCACHE_SHAZ]; // SHA-256 of the input RTF
+    uint64_t        srclen;      // Length of the input RTF
+    uint64_t        valhash;     // rtfcache_values_hash() of the object
+} rtfcachekey;
+
+
+// DISK ENTRY LAYOUT
+//
+// One file per entry, named for its key, in the cache directory. Integers
+// are in host byte order.
+//
+//   rtfcachehdr
+//   char         out[outlen]            output of rtfreplace()
+typedef struct rtfcachehdr {
+    char            magic[8];
+    uint32_t        version;
+    uint32_t        hdrz;        // sizeof(rtfcachehdr), guards layout drift
+    rtfcachekey     key;
+    uint64_t        outlen;
+} rtfcachehdr;
+
+
+// CACHE STATISTICS
+typedef struct rtfcachestats {
+    uint64_t        hits;        // Served from memory
+    uint64_t        diskhits;    // Served from the directory
+    uint64_t        misses;      // Processed, then stored
+    uint64_t        bypassed;    // Processed, but can't be cached
+    uint64_t        evictions;   // Dropped from memory to make room
+    size_t          entries;     // Now in memory...
+    size_t          bytes;       // ...and their size
+} rtfcachestats;
+
+
+// Opaque; see rtfcache.c
+typedef struct rtfcache rtfcache;
+
+
+
+// FUNCTION DECLARATIONS
+rtfcache *new_rtfcache(size_t maxbytes, const char *dir);
+void      delete_rtfcache(rtfcache *C);
+int       rtfreplace_cached(rtfcache *C, rtfobj *R);
+uint64_t  rtfcache_values_hash(const rtfobj *R);
+rtfcachestats rtfcache_stats(const rtfcache *C);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,453 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                        DECLARATIONS & MACROS                        ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/types.h>
+#include "rtfproc.h"
+#include "rtfindex.h"
+#include "utillib.h"
+
+// Index under construction
+typedef struct idxbuild {
+    rtfindex     *  X;
+    size_t          grpcap;
+    size_t          ckptcap;
+    size_t          fonttblcap;
+    size_t          fontcap;
+    uint32_t        depth;       // Open groups
+    bool            ingrp;       // grps[ngrps - 1] is still open
+    uint64_t        start;       // Input offset where building began
+    size_t          rawpos0;     // R->rawpos + R->ri at that point
+    int             err;
+} idxbuild;
+
+#define idx_offset(B, R)     ((B)->start + ((R)->rawpos + (R)->ri - (B)->rawpos0))
+
+static void idx_step(rtfobj *R, void *data, int mode);
+static void idx_raw(rtfobj *R, const char *buf, size_t len, void *data);
+static void idx_add_group(idxbuild *B, uint64_t offset);
+static void idx_add_ckpt(idxbuild *B, rtfobj *R, uint32_t kind);
+static bool idx_same_fonttbl(const idxbuild *B, const rtfobj *R);
+static bool idx_is_cmd(const char *cmd, const char *word);
+static bool idx_grow(void *pp, size_t *cap, size_t need, size_t elemz, idxbuild *B);
+static bool idx_valid(const rtfindex *X);
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                           BUILDING INDEXES                          ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+rtfindex *build_rtfindex(rtfobj *R) {
+    idxbuild  B = { 0 };
+    rtfindex *X;
+    rtfhooks  savedhooks;
+    FILE     *savedftxt;
+    off_t     pos;
+
+    BEGIN_FUNCTION
+
+    X = malloc(sizeof *X);
+    if (!X) FAIL(NULL, "Failed allocating index object.");
+    memzero(X, sizeof *X);
+
+    B.X = X;
+    X->hdr.srchash = RTFHASH_INIT;
+
+    pos = ftello(R->fin);
+    B.start   = (pos > 0) ? (uint64_t)pos : 0;
+    B.rawpos0 = R->rawpos + R->ri;
+
+    // Walk the whole input without producing any output
+    savedhooks = R->hooks;
+    savedftxt  = R->ftxt;
+    R->hooks.raw   = idx_raw;
+    R->hooks.match = NULL;
+    R->hooks.data  = &B;
+    R->ftxt = NULL;
+
+    rtfprocess(R, idx_step, &B);
+
+    R->hooks = savedhooks;
+    R->ftxt  = savedftxt;
+
+    if (B.err || R->fatalerr) {
+        delete_rtfindex(X);
+        FAIL(NULL, "Failed building index (error %d)", B.err ? B.err : R->fatalerr);
+    }
+
+    memcpy(X->hdr.magic, RTFINDEX_MAGIC, sizeof RTFINDEX_MAGIC);
+    X->hdr.version = RTFINDEX_VERSION;
+    X->hdr.hdrz    = (uint32_t)sizeof X->hdr;
+
+    RETURN(X);
+}
+
+
+
+static void idx_step(rtfobj *R, void *data, int mode) {
+    idxbuild *B = data;
+    rtfindex *X = B->X;
+
+    BEGIN_FUNCTION
+
+    if (mode == RTF_PROC_START) {
+        idx_add_ckpt(B, R, RTFIDX_START);
+    }
+
+    else if (mode == RTF_PROC_STEP && R->ri > 0) {
+        // Buffers are emptied after every step, so raw[] holds exactly the
+        // token just processed: a brace, a control word, or a text byte.
+        X->hdr.srchash = rtfhash(X->hdr.srchash, R->raw, R->ri);
+        X->hdr.srclen += R->ri;
+
+        if (R->raw[0] == '{') {
+            if (++B->depth == 2) idx_add_group(B, idx_offset(B, R) - 1);
+        }
+        else if (R->raw[0] == '}') {
+            if (B->depth == 2 && B->ingrp) {
+                X->grps[X->hdr.ngrps - 1].end = idx_offset(B, R);
+                B->ingrp = false;
+            }
+            if (B->depth > 0) B->depth--;
+        }
+        else if (R->raw[0] == '\\' && !R->attr->notxt) {
+            if      (idx_is_cmd(R->cmd, "\\sect")) idx_add_ckpt(B, R, RTFIDX_SECT);
+            else if (idx_is_cmd(R->cmd, "\\page")) idx_add_ckpt(B, R, RTFIDX_PAGE);
+        }
+    }
+
+    reset_txt_buffer_by(R, R->ti);
+    reset_raw_buffer_by(R, R->ri);
+
+    if (B->err && !R->fatalerr) R->fatalerr = B->err;
+
+    RETURN();
+}
+
+
+
+static void idx_raw(rtfobj *R, const char *buf, size_t len, void *data) {
+    idxbuild *B = data;
+
+    BEGIN_FUNCTION
+
+    (void)R;
+
+    // Raw RTF flushed ahead of text still counts as source
+    B->X->hdr.srchash = rtfhash(B->X->hdr.srchash, buf, len);
+    B->X->hdr.srclen += len;
+
+    RETURN();
+}
+
+
+
+static void idx_add_group(idxbuild *B, uint64_t offset) {
+    rtfindex *X = B->X;
+
+    BEGIN_FUNCTION
+
+    if (!idx_grow(&X->grps, &B->grpcap, X->hdr.ngrps + 1, sizeof *X->grps, B)) RETURN();
+
+    X->grps[X->hdr.ngrps].beg = offset;
+    X->grps[X->hdr.ngrps].end = offset;
+    X->hdr.ngrps++;
+    B->ingrp = true;
+
+    RETURN();
+}
+
+
+
+static void idx_add_ckpt(idxbuild *B, rtfobj *R, uint32_t kind) {
+    rtfindex      *X = B->X;
+    rtfidxckpt    *ck;
+    rtfidxfonttbl *ft;
+
+    BEGIN_FUNCTION
+
+    if (!idx_grow(&X->ckpts, &B->ckptcap, X->hdr.nckpts + 1, sizeof *X->ckpts, B)) RETURN();
+
+    // Font tables are shared between checkpoints until they change
+    if (!idx_same_fonttbl(B, R)) {
+        if (!idx_grow(&X->fonttbls, &B->fonttblcap, X->hdr.nfonttbls + 1, sizeof *X->fonttbls, B)) RETURN();
+        if (B->fontcap < X->hdr.nfonts + R->fonttbl_n) {
+            size_t fontcap = B->fontcap;
+            if (!idx_grow(&X->fontf, &fontcap, X->hdr.nfonts + R->fonttbl_n, sizeof *X->fontf, B)) RETURN();
+            if (!idx_grow(&X->fontcharset, &B->fontcap, X->hdr.nfonts + R->fonttbl_n, sizeof *X->fontcharset, B)) RETURN();
+        }
+
+        ft = &X->fonttbls[X->hdr.nfonttbls++];
+        ft->off = X->hdr.nfonts;
+        ft->n   = R->fonttbl_n;
+        if (R->fonttbl_n) {
+            memcpy(&X->fontf[ft->off],       R->fonttbl_f,       R->fonttbl_n * sizeof *X->fontf);
+            memcpy(&X->fontcharset[ft->off], R->fonttbl_charset, R->fonttbl_n * sizeof *X->fontcharset);
+        }
+        X->hdr.nfonts += R->fonttbl_n;
+    }
+
+    ck = &X->ckpts[X->hdr.nckpts++];
+    summarize_rtfobj(R, &ck->state);
+    ck->state.offset = idx_offset(B, R);
+    ck->kind    = kind;
+    ck->fonttbl = (uint32_t)(X->hdr.nfonttbls - 1);
+
+    RETURN();
+}
+
+
+
+static bool idx_same_fonttbl(const idxbuild *B, const rtfobj *R) {
+    const rtfindex      *X = B->X;
+    const rtfidxfonttbl *ft;
+
+    if (X->hdr.nfonttbls == 0) return false;
+
+    ft = &X->fonttbls[X->hdr.nfonttbls - 1];
+
+    return ft->n == R->fonttbl_n &&
+           (R->fonttbl_n == 0 ||
+            (!memcmp(&X->fontf[ft->off],       R->fonttbl_f,       R->fonttbl_n * sizeof *X->fontf) &&
+             !memcmp(&X->fontcharset[ft->off], R->fonttbl_charset, R->fonttbl_n * sizeof *X->fontcharset)));
+}
+
+
+
+static bool idx_is_cmd(const char *cmd, const char *word) {
+    size_t len = strlen(word);
+
+    return !strncmp(cmd, word, len) && (cmd[len] == '\0' || isspace((unsigned char)cmd[len]));
+}
+
+
+
+static bool idx_grow(void *pp, size_t *cap, size_t need, size_t elemz, idxbuild *B) {
+    void  **p = pp;
+    void   *newp;
+    size_t  newcap;
+
+    BEGIN_FUNCTION
+
+    if (need <= *cap) RETURN(true);
+
+    newcap = *cap ? *cap : 16;
+    while (newcap < need) newcap *= 2;
+
+    newp = realloc(*p, newcap * elemz);
+    if (!newp) {
+        B->err = ENOMEM;
+        FAIL(false, "Out of memory growing index");
+    }
+    *p = newp;
+    *cap = newcap;
+
+    RETURN(true);
+}
+
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                      SAVING & LOADING INDEXES                       ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+int write_rtfindex(const rtfindex *X, FILE *fidx) {
+    const rtfindexhdr *h = &X->hdr;
+
+    BEGIN_FUNCTION
+
+    if (fwrite(h,                sizeof *h,                1,             fidx) != 1             ||
+        fwrite(X->grps,          sizeof *X->grps,          h->ngrps,      fidx) != h->ngrps      ||
+        fwrite(X->ckpts,         sizeof *X->ckpts,         h->nckpts,     fidx) != h->nckpts     ||
+        fwrite(X->fonttbls,      sizeof *X->fonttbls,      h->nfonttbls,  fidx) != h->nfonttbls  ||
+        fwrite(X->fontf,         sizeof *X->fontf,         h->nfonts,     fidx) != h->nfonts     ||
+        fwrite(X->fontcharset,   sizeof *X->fontcharset,   h->nfonts,     fidx) != h->nfonts) {
+        FAIL(EIO, "Failed writing index");
+    }
+
+    RETURN(0);
+}
+
+
+
+rtfindex *read_rtfindex(FILE *fidx) {
+    rtfindex    *X;
+    rtfindexhdr *h;
+    const uint64_t maxn = SIZE_MAX / 64;
+
+    BEGIN_FUNCTION
+
+    X = malloc(sizeof *X);
+    if (!X) FAIL(NULL, "Failed allocating index object.");
+    memzero(X, sizeof *X);
+    h = &X->hdr;
+
+    if (fread(h, sizeof *h, 1, fidx) != 1 ||
+        memcmp(h->magic, RTFINDEX_MAGIC, sizeof RTFINDEX_MAGIC) ||
+        h->version != RTFINDEX_VERSION ||
+        h->hdrz != sizeof *h ||
+        h->ngrps > maxn || h->nckpts > maxn || h->nfonttbls > maxn || h->nfonts > maxn) {
+        free(X);
+        FAIL(NULL, "Not a compatible index");
+    }
+
+    // One extra element each, so that empty tables still get a pointer
+    X->grps        = malloc(((size_t)h->ngrps + 1)     * sizeof *X->grps);
+    X->ckpts       = malloc(((size_t)h->nckpts + 1)    * sizeof *X->ckpts);
+    X->fonttbls    = malloc(((size_t)h->nfonttbls + 1) * sizeof *X->fonttbls);
+    X->fontf       = malloc(((size_t)h->nfonts + 1)    * sizeof *X->fontf);
+    X->fontcharset = malloc(((size_t)h->nfonts + 1)    * sizeof *X->fontcharset);
+    if (!X->grps || !X->ckpts || !X->fonttbls || !X->fontf || !X->fontcharset) {
+        delete_rtfindex(X);
+        FAIL(NULL, "Out of memory loading index");
+    }
+
+    if (fread(X->grps,        sizeof *X->grps,        h->ngrps,     fidx) != h->ngrps     ||
+        fread(X->ckpts,       sizeof *X->ckpts,       h->nckpts,    fidx) != h->nckpts    ||
+        fread(X->fonttbls,    sizeof *X->fonttbls,    h->nfonttbls, fidx) != h->nfonttbls ||
+        fread(X->fontf,       sizeof *X->fontf,       h->nfonts,    fidx) != h->nfonts    ||
+        fread(X->fontcharset, sizeof *X->fontcharset, h->nfonts,    fidx) != h->nfonts    ||
+        !idx_valid(X)) {
+        delete_rtfindex(X);
+        FAIL(NULL, "Index is truncated or corrupt");
+    }
+
+    RETURN(X);
+}
+
+
+
+void delete_rtfindex(rtfindex *X) {
+    BEGIN_FUNCTION
+
+    if (X) {
+        free(X->grps);
+        free(X->ckpts);
+        free(X->fonttbls);
+        free(X->fontf);
+        free(X->fontcharset);
+    }
+    free(X);
+
+    RETURN();
+}
+
+
+
+static bool idx_valid(const rtfindex *X) {
+    const rtfidxfonttbl *ft;
+    size_t i;
+
+    if (X->hdr.nckpts == 0) return false;
+
+    for (i = 0; i < X->hdr.nfonttbls; i++) {
+        ft = &X->fonttbls[i];
+        if (ft->off > X->hdr.nfonts || ft->n > X->hdr.nfonts - ft->off) return false;
+    }
+    // A checkpoint lies within the source, and each group open there took
+    // at least one byte of it to open
+    for (i = 0; i < X->hdr.nckpts; i++) {
+        if (X->ckpts[i].fonttbl >= X->hdr.nfonttbls ||
+            X->ckpts[i].state.offset > X->hdr.srclen ||
+            X->ckpts[i].state.depth > X->ckpts[i].state.offset) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                            USING INDEXES                            ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+int rtfindex_extract(const rtfindex *X, rtfobj *R, size_t first, size_t last) {
+    const rtfidxckpt    *ck;
+    const rtfidxfonttbl *ft;
+    uint64_t end;
+
+    BEGIN_FUNCTION
+
+    if (first >= X->hdr.nckpts || last <= first) {
+        FAIL(EINVAL, "Invalid checkpoint range %zu to %zu", first, last);
+    }
+
+    ck  = &X->ckpts[first];
+    ft  = &X->fonttbls[ck->fonttbl];
+    end = (last < X->hdr.nckpts) ? X->ckpts[last].state.offset : UINT64_MAX;
+
+    if ((uint64_t)(off_t)ck->state.offset != ck->state.offset ||
+        fseeko(R->fin, (off_t)ck->state.offset, SEEK_SET)) {
+        R->fatalerr = EIO;
+        FAIL(EIO, "Could not seek to offset %llu", (unsigned long long)ck->state.offset);
+    }
+
+    if (resume_rtfobj(R, &ck->state, &X->fontf[ft->off], &X->fontcharset[ft->off], (size_t)ft->n)) {
+        FAIL(R->fatalerr, "Could not restore parser state");
+    }
+
+    rtfreplace_until(R, end);
+    rtfflush(R);
+
+    if (R->fatalerr) FAIL(R->fatalerr, "Encountered a fatal error");
+
+    RETURN(0);
+}
+
+
+
+bool rtfindex_is_stale(const rtfindex *X, FILE *fsrc) {
+    char buf[16384];
+    uint64_t h = RTFHASH_INIT;
+    uint64_t len = 0;
+    size_t n;
+
+    BEGIN_FUNCTION
+
+    while ((n = fread(buf, 1, sizeof buf, fsrc)) > 0) {
+        h = rtfhash(h, buf, n);
+        len += n;
+    }
+
+    RETURN(ferror(fsrc) || len != X->hdr.srclen || h != X->hdr.srchash);
+}
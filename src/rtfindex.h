@@ -0,0 +1,106 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#ifndef RTFINDEX_H__
+#define RTFINDEX_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "rtfproc.h"
+
+
+
+#define   RTFINDEX_MAGIC    "RTFINDX"
+#define   RTFINDEX_VERSION  1
+
+#define   RTFIDX_START      0    // Checkpoint kinds
+#define   RTFIDX_SECT       1
+#define   RTFIDX_PAGE       2
+
+
+// INDEX FILE LAYOUT
+//
+// An index records, for one RTF file, the input range of each group directly
+// inside the document group, and a checkpoint at the start of the input and
+// just past each \sect and \page in the body. Checkpoints refer to font
+// tables by number, since a document rarely has more than one. All integers
+// are in host byte order.
+//
+//   rtfindexhdr
+//   rtfidxgrp      grps[ngrps]
+//   rtfidxckpt     ckpts[nckpts]
+//   rtfidxfonttbl  fonttbls[nfonttbls]
+//   int32_t        fontf[nfonts]        font numbers...
+//   int32_t        fontcharset[nfonts]  ...and their \fcharsetN
+typedef struct rtfindexhdr {
+    char            magic[8];
+    uint32_t        version;
+    uint32_t        hdrz;        // sizeof(rtfindexhdr), guards layout drift
+    uint64_t        srchash;     // rtfhash() of the source RTF
+    uint64_t        srclen;      // Length of the source RTF
+    uint64_t        ngrps;
+    uint64_t        nckpts;
+    uint64_t        nfonttbls;
+    uint64_t        nfonts;
+} rtfindexhdr;
+
+typedef struct rtfidxgrp {
+    uint64_t        beg;         // Offset of the opening brace
+    uint64_t        end;         // Offset just past the closing brace
+} rtfidxgrp;
+
+typedef struct rtfidxckpt {
+    rtfsummary      state;       // state.offset is where parsing resumes
+    uint32_t        kind;        // RTFIDX_START, RTFIDX_SECT, RTFIDX_PAGE
+    uint32_t        fonttbl;     // Index into fonttbls[]
+} rtfidxckpt;
+
+typedef struct rtfidxfonttbl {
+    uint64_t        off;         // Entries [off, off + n) of fontf[] and
+    uint64_t        n;           // fontcharset[]
+} rtfidxfonttbl;
+
+
+// INDEX (in memory)
+typedef struct rtfindex {
+    rtfindexhdr        hdr;
+    rtfidxgrp       *  grps;
+    rtfidxckpt      *  ckpts;
+    rtfidxfonttbl   *  fonttbls;
+    int32_t         *  fontf;
+    int32_t         *  fontcharset;
+} rtfindex;
+
+
+
+// FUNCTION DECLARATIONS
+rtfindex *build_rtfindex(rtfobj *R);
+int       write_rtfindex(const rtfindex *X, FILE *fidx);
+rtfindex *read_rtfindex(FILE *fidx);
+void      delete_rtfindex(rtfindex *X);
+int       rtfindex_extract(const rtfindex *X, rtfobj *R, size_t first, size_t last);
+bool      rtfindex_is_stale(const rtfindex *X, FILE *fsrc);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,342 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                        DECLARATIONS & MACROS                        ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include "rtfproc.h"
+#include "rtfpairs.h"
+#include "utillib.h"
+
+// Pairs as they are read, before sorting
+typedef struct pairlist {
+    char             ** strs;        // key, value, key, value, ...
+    size_t              n;           // Number of pairs
+    size_t              cap;
+} pairlist;
+
+typedef struct pairent {
+    char              * key;
+    char              * val;
+    size_t              seq;         // Order read, so later ones win
+} pairent;
+
+static bool add_pair(pairlist *L, char *key, char *val);
+static bool parse_tsv(char *text, pairlist *L);
+static bool parse_json(const char *text, pairlist *L);
+static char *json_string(const char **p);
+static void skip_space(const char **p);
+static char *unescape_tsv(char *s);
+static size_t put_utf8(char *out, uint32_t cdpt);
+static int cmpent(const void *a, const void *b);
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                          LOADING & FREEING                          ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+char **load_rtfpairs(const char *path, size_t *npairs) {
+    FILE     *f;
+    char     *text;
+    char    **out;
+    pairent  *ents;
+    pairlist  L = { 0 };
+    long      len;
+    size_t    i, n;
+    bool      json, ok;
+    const char *ext;
+
+    BEGIN_FUNCTION
+
+    if (!(f = fopen(path, "rb"))) FAIL(NULL, "Could not read \'%s\'", path);
+    if (fseek(f, 0, SEEK_END) || (len = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) ||
+        !(text = malloc((size_t)len + 1))) {
+        fclose(f);
+        FAIL(NULL, "Could not read \'%s\'", path);
+    }
+    ok = fread(text, 1, (size_t)len, f) == (size_t)len;
+    fclose(f);
+    text[len] = '\0';
+    if (!ok) { free(text); FAIL(NULL, "Could not read \'%s\'", path); }
+
+    ext  = strrchr(path, '.');
+    json = (ext && !strcmp(ext, ".json"));
+    for (i = 0; !json && isspace((unsigned char)text[i]); i++);
+    json = json || text[i] == '{';
+
+    ok = json ? parse_json(text, &L) : parse_tsv(text, &L);
+    free(text);
+
+    // Sort, keeping only the last of each key
+    ents = malloc((L.n + 1) * sizeof *ents);
+    out  = malloc((2 * L.n + 1) * sizeof *out);
+    if (!ok || !ents || !out) {
+        for (i = 0; i < 2 * L.n; i++) free(L.strs[i]);
+        free(L.strs);
+        free(ents);
+        free(out);
+        FAIL(NULL, "Could not parse \'%s\'", path);
+    }
+    for (i = 0; i < L.n; i++) ents[i] = (pairent){ L.strs[2*i], L.strs[2*i+1], i };
+    qsort(ents, L.n, sizeof *ents, cmpent);
+
+    for (i = n = 0; i < L.n; i++) {
+        if (i + 1 < L.n && !strcmp(ents[i].key, ents[i+1].key)) {
+            free(ents[i].key);
+            free(ents[i].val);
+            continue;
+        }
+        out[2*n]   = ents[i].key;
+        out[2*n+1] = ents[i].val;
+        n++;
+    }
+    out[2*n] = NULL;
+    free(ents);
+    free(L.strs);
+
+    if (npairs) *npairs = n;
+
+    RETURN(out);
+}
+
+
+
+void free_rtfpairs(char **pairs) {
+    BEGIN_FUNCTION
+
+    if (!pairs) RETURN();
+
+    for (size_t i = 0; pairs[i]; i++) free(pairs[i]);
+    free(pairs);
+
+    RETURN();
+}
+
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                               PARSING                               ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+static bool add_pair(pairlist *L, char *key, char *val) {
+    char **strs;
+
+    BEGIN_FUNCTION
+
+    if (!key || !val) { free(key); free(val); RETURN(false); }
+
+    if (L->n == L->cap) {
+        L->cap = L->cap ? 2 * L->cap : 64;
+        if (!(strs = realloc(L->strs, 2 * L->cap * sizeof *strs))) {
+            free(key);
+            free(val);
+            FAIL(false, "Out of memory reading pairs");
+        }
+        L->strs = strs;
+    }
+    L->strs[2 * L->n]     = key;
+    L->strs[2 * L->n + 1] = val;
+    L->n++;
+
+    RETURN(true);
+}
+
+
+
+static bool parse_tsv(char *text, pairlist *L) {
+    char  *line;
+    char  *next;
+    char  *tab;
+    size_t len;
+    size_t lineno = 0;
+
+    BEGIN_FUNCTION
+
+    for (line = text; line && *line; line = next) {
+        lineno++;
+        if ((next = strchr(line, '\n'))) *next++ = '\0';
+        len = strlen(line);
+        if (len > 0 && line[len-1] == '\r') line[--len] = '\0';
+        if (len == 0 || line[0] == '#') continue;
+
+        if (!(tab = strchr(line, '\t'))) FAIL(false, "No tab on line %zu", lineno);
+        *tab = '\0';
+        if (!add_pair(L, strdup(unescape_tsv(line)), strdup(unescape_tsv(tab + 1)))) RETURN(false);
+    }
+
+    RETURN(true);
+}
+
+
+
+static bool parse_json(const char *text, pairlist *L) {
+    const char *p = text;
+    char       *key;
+    char       *val;
+
+    BEGIN_FUNCTION
+
+    skip_space(&p);
+    if (*p++ != '{') FAIL(false, "Expected a JSON object");
+    skip_space(&p);
+
+    while (*p != '}') {
+        if (!(key = json_string(&p))) FAIL(false, "Expected a string key");
+        skip_space(&p);
+        if (*p++ != ':') { free(key); FAIL(false, "Expected ':' after a key"); }
+        skip_space(&p);
+        if (!(val = json_string(&p))) { free(key); FAIL(false, "Expected a string value"); }
+        if (!add_pair(L, key, val)) RETURN(false);
+        skip_space(&p);
+        if (*p == ',') { p++; skip_space(&p); if (*p == '"') continue; }
+        if (*p != '}') FAIL(false, "Expected ',' or '}'");
+    }
+    p++;
+
+    skip_space(&p);
+    if (*p) FAIL(false, "Trailing data after JSON object");
+
+    RETURN(true);
+}
+
+
+
+static char *json_string(const char **p) {
+    const char *s = *p;
+    char       *out;
+    char       *w;
+    uint32_t    cdpt;
+    uint32_t    lo;
+    size_t      len;
+
+    BEGIN_FUNCTION
+
+    if (*s++ != '"') RETURN(NULL);
+
+    // Escapes never lengthen a string, so its raw length is enough
+    for (len = 0; s[len] && s[len] != '"'; len++) if (s[len] == '\\' && s[len+1]) len++;
+    if (!s[len]) FAIL(NULL, "Unterminated JSON string");
+    if (!(out = malloc(len + 1))) FAIL(NULL, "Out of memory reading JSON");
+
+    for (w = out; *s != '"'; ) {
+        if (*s != '\\') { *w++ = *s++; continue; }
+        s++;
+        switch (*s++) {
+            case '"':   *w++ = '"';   break;
+            case '\\':  *w++ = '\\';  break;
+            case '/':   *w++ = '/';   break;
+            case 'b':   *w++ = '\b';  break;
+            case 'f':   *w++ = '\f';  break;
+            case 'n':   *w++ = '\n';  break;
+            case 'r':   *w++ = '\r';  break;
+            case 't':   *w++ = '\t';  break;
+            case 'u':
+                if (strspn(s, "0123456789abcdefABCDEF") < 4 || sscanf(s, "%4x", &cdpt) != 1) {
+                    free(out);
+                    FAIL(NULL, "Bad \\u escape in JSON string");
+                }
+                s += 4;
+                if (cdpt >= 0xD800 && cdpt < 0xDC00 && s[0] == '\\' && s[1] == 'u' &&
+                    sscanf(s + 2, "%4x", &lo) == 1 && lo >= 0xDC00 && lo < 0xE000) {
+                    cdpt = 0x10000 + ((cdpt - 0xD800) << 10) + (lo - 0xDC00);
+                    s += 6;
+                }
+                w += put_utf8(w, cdpt);
+                break;
+            default:
+                free(out);
+                FAIL(NULL, "Bad escape in JSON string");
+        }
+    }
+    *w = '\0';
+    *p = s + 1;
+
+    RETURN(out);
+}
+
+
+
+static void skip_space(const char **p) {
+    while (isspace((unsigned char)**p)) (*p)++;
+}
+
+
+
+static char *unescape_tsv(char *s) {
+    char *r = s;
+    char *w = s;
+
+    while (*r) {
+        if (r[0] != '\\' || !r[1]) { *w++ = *r++; continue; }
+        switch (r[1]) {
+            case 't':   *w++ = '\t';  break;
+            case 'n':   *w++ = '\n';  break;
+            default:    *w++ = r[1];  break;
+        }
+        r += 2;
+    }
+    *w = '\0';
+
+    return s;
+}
+
+
+
+static size_t put_utf8(char *out, uint32_t cdpt) {
+    // Never longer than the six-byte escape it came from
+    if (cdpt < 0x80)    { out[0] = (char)cdpt; return 1; }
+    if (cdpt < 0x800)   { out[0] = (char)(0xC0 | cdpt >> 6);
+                          out[1] = (char)(0x80 | (cdpt & 0x3F)); return 2; }
+    if (cdpt < 0x10000) { out[0] = (char)(0xE0 | cdpt >> 12);
+                          out[1] = (char)(0x80 | (cdpt >> 6 & 0x3F));
+                          out[2] = (char)(0x80 | (cdpt & 0x3F)); return 3; }
+    out[0] = (char)(0xF0 | cdpt >> 18);
+    out[1] = (char)(0x80 | (cdpt >> 12 & 0x3F));
+    out[2] = (char)(0x80 | (cdpt >> 6 & 0x3F));
+    out[3] = (char)(0x80 | (cdpt & 0x3F));
+    return 4;
+}
+
+
+
+static int cmpent(const void *a, const void *b) {
+    const pairent *x = a;
+    const pairent *y = b;
+    int c = strcmp(x->key, y->key);
+
+    // Same key: earlier first, so the last of a run is the one kept
+    if (c) return c;
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
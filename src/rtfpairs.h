@@ -0,0 +1,54 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#ifndef RTFPAIRS_H__
+#define RTFPAIRS_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "rtfproc.h"
+
+
+
+// REPLACEMENT FILES
+//
+// Either a JSON object of string values,
+//
+//   { "«Date»": "13 Sep 21", "«SSIC»": "1000" }
+//
+// or TSV, one key and value per line separated by a tab, with \t, \n, and
+// \\ as escapes. Blank lines and lines starting with '#' are skipped. Files
+// ending in .json, or starting with '{', are read as JSON.
+//
+// Pairs come back sorted by key, with later duplicates replacing earlier
+// ones, ready for new_rtfdict() or add_rtfobj_replacements().
+
+
+
+// FUNCTION DECLARATIONS
+char  **load_rtfpairs(const char *path, size_t *npairs);
+void    free_rtfpairs(char **pairs);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
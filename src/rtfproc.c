@@ -28,9 +28,12 @@
 /////////////////////////////////////////////////////////////////////////////
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <ctype.h>
 #include <errno.h>
 #include <assert.h>
+#include <time.h>
+#include <inttypes.h>
 #include "rtfproc.h"
 #include "trex.h"
 #include "cpgtou.h"
@@ -53,21 +56,78 @@ static void proc_cmd_fcharset(rtfobj *R);
 static void proc_cmd_cchs(rtfobj *R);
 static void proc_cmd_deff(rtfobj *R);
 static void proc_cmd_shuntblock(rtfobj *R);
+static void proc_cmd_pict(rtfobj *R);
+static void proc_cmd_shppict(rtfobj *R);
+static void add_to_pict(const char *s, size_t len, rtfobj *R);
+static void finish_pict(rtfobj *R);
+static void release_pict(rtfobj *R);
+static void output_buf(rtfobj *R, const char *buf, size_t len);
+static void proc_pict_property(rtfobj *R);
+static void read_pict_hex(int c, rtfobj *R);
+static void read_pict_bin(rtfobj *R);
+static void pass_pict_through(rtfobj *R, const char *buf, size_t len);
+static void deliver_pict(rtfobj *R, const uint8_t *buf, size_t len);
+static void end_pict_read(rtfobj *R, bool truncated);
+static size_t decode_hex(const char *hex, size_t n, uint8_t *out, int *nibble);
+static void proc_cmd_infodest(rtfobj *R);
+static bool proc_cmd_info(rtfobj *R);
 static void proc_cmd_newpar(rtfobj *R);
 static void proc_cmd_newline(rtfobj *R);
 static void proc_cmd_unknown(rtfobj *R);
 static void push_attr(rtfobj *R);
+static void discard_parse_state(rtfobj *R);
 static void pop_attr(rtfobj *R);
 static int  pattern_match(rtfobj *R);
+static int  layered_match(rtfobj *R, bool final);
+static int  policy_match(rtfobj *R, bool final);
+static void settle_match(rtfobj *R);
+static void note_txt_ends(rtfobj *R);
+static int  need_txtrawend(rtfobj *R);
+static uint32_t dict_child(const rtfdict *D, uint32_t node, uint8_t b);
+static void output_match_by(rtfobj *R, size_t len);
+static size_t next_key_candidate(const rtfobj *R, size_t offset);
+static void note_key_first(rtfobj *R, const char *key);
 static void output_match(rtfobj *R);
 static void output_raw_by(rtfobj *R, size_t amt);
+static void shift_raw_buffer(rtfobj *R, size_t amt);
+static void discard_raw(rtfobj *R, const char *buf, size_t len, void *data);
+static void scan_match(rtfobj *R, size_t key, int nbraces, void *data);
 static void add_to_txt(int c, rtfobj *R);
 static void add_string_to_txt(const char *s, rtfobj *R);
 static void add_to_cmd(int c, rtfobj *R);
 static void add_to_raw(int c, rtfobj *R);
 static void add_cmdstring_to_raw(const char *s, rtfobj *R);
+static void track_raw_braces(int c, rtfobj *R);
+static bool reserve_raw(rtfobj *R, size_t need);
+static bool reserve_txt(rtfobj *R, size_t need);
+static bool reserve_cmd(rtfobj *R, size_t need);
+static bool reserve_fonttbl(rtfobj *R, size_t need);
+static size_t grown_capacity(size_t cur, size_t max, size_t need);
+static void *grow_buffer(const rtfalloc *A, void *buf, size_t oldn, size_t newn, size_t elemz);
+static inline void *mem_alloc(const rtfalloc *A, size_t z);
+static inline void *mem_resize(const rtfalloc *A, void *p, size_t z);
+static inline void mem_free(const rtfalloc *A, void *p);
+static char *mem_strdup(const rtfalloc *A, const char *s);
+static void info_pop(rtfobj *R, const rtfattr *oldattr);
+static size_t find_infodest(const char *c);
+static bool snap_valid(const rtfsnaphdr *hdr, size_t len);
 static int32_t get_num_arg(const char *s);
 static uint8_t get_hex_arg(const char *s);
+static void enforce_limits(rtfobj *R);
+static bool within_memlimit(rtfobj *R, size_t more);
+static size_t memory_in_use(const rtfobj *R);
+static uint64_t monotonic_now(void);
+static void *libc_alloc(void *ctx, size_t z);
+static void *libc_resize(void *ctx, void *p, size_t z);
+static void libc_release(void *ctx, void *p);
+static void *arena_alloc(void *ctx, size_t z);
+static void *arena_resize(void *ctx, void *p, size_t z);
+static void arena_release(void *ctx, void *p);
+#ifdef RTFPROC_TRACE
+static uint64_t trace_now(void);
+static void trace_span(const char *name, uint64_t start, const char *arg);
+static int  trace_fgetc(FILE *f);
+#endif
 
 #define RGX_MATCH(x, y)      (rexmatch((const unsigned char *) y, (const unsigned char *) x))
 #define CHR_MATCH(x, y)      (x[0] == y && x[1] == 0)
@@ -77,11 +137,169 @@ static uint8_t get_hex_arg(const char *s);
 #define fputc(x, y)          putc_unlocked(x, y)
 #endif
 
+// Keep rarely-taken paths (e.g., buffer growth) from being inlined into the
+// per-byte functions that call them
+#if defined(__GNUC__) || defined(__clang__)
+#define COLDPATH             __attribute__((noinline, cold))
+#else
+#define COLDPATH
+#endif
+
+#define MIN_BUFFER_SIZE      64
+
+// Timeline tracing (see rtftrace_start()). Spans are only recorded in builds
+// with RTFPROC_TRACE defined; otherwise these expand to nothing.
+#ifdef RTFPROC_TRACE
+#define TRACE_BEGIN(t)             uint64_t t = tracer.fout ? trace_now() : 0
+#define TRACE_END(t, name, arg)    do { if (tracer.fout) trace_span(name, t, arg); } while (0)
+#define next_input(R)              trace_fgetc(R->fin)
+#else
+#define TRACE_BEGIN(t)
+#define TRACE_END(t, name, arg)
+#define next_input(R)              fgetc(R->fin)
+#endif
+
+// Value of each hex digit (anything else is 0; see is_hex_escape())
+static const uint8_t hexval[256] = {
+    ['0'] = 0,  ['1'] = 1,  ['2'] = 2,  ['3'] = 3,  ['4'] = 4,
+    ['5'] = 5,  ['6'] = 6,  ['7'] = 7,  ['8'] = 8,  ['9'] = 9,
+    ['A'] = 10, ['B'] = 11, ['C'] = 12, ['D'] = 13, ['E'] = 14, ['F'] = 15,
+    ['a'] = 10, ['b'] = 11, ['c'] = 12, ['d'] = 13, ['e'] = 14, ['f'] = 15,
+};
+
+// Whether a command read by read_command() is \'hh
+#define is_hex_escape(cmd)   (isxdigit((unsigned char)(cmd)[2]) && isxdigit((unsigned char)(cmd)[3]))
+
 #define reset_raw_buffer(R)  reset_raw_buffer_by(R, R->ri)
 #define reset_txt_buffer(R)  reset_txt_buffer_by(R, R->ti)
 #define reset_cmd_buffer(R)  reset_cmd_buffer_by(R, R->ci)
 #define output_raw(R)        output_raw_by(R, R->ri)
 
+// Precision and start for printing up to the last 80 bytes of raw[]
+#define raw_tail(R)          (int)((R)->ri < 80 ? (R)->ri : 80), &(R)->raw[(R)->ri < 80 ? 0 : (R)->ri - 80]
+
+// Index into raw[] of the text byte at txt[i]
+#define txt_raw_idx(R, i)    ((size_t)(uint32_t)(R->txtrawmap[i] - (uint32_t)R->rawpos))
+
+// Index into raw[] just past the token that produced txt[i]
+#define txt_raw_end(R, i)    ((size_t)(uint32_t)(R->txtrawend[i] - (uint32_t)R->rawpos))
+
+// Whether matching can end a match before the text does, and so needs
+// txtrawend[]: always through layered_match(), with a dictionary, and
+// only while a match is pending through policy_match()
+#define uses_txtrawend(R)    (R->dict || R->matchpolicy != RTF_MATCH_DEFAULT)
+#define forget_matches(R)    (R->txtmatched = 0, R->walkz = 0)
+
+// Input consumed so far, counting a picture group held back from raw[]
+#define input_offset(R)      ((R)->rawpos + (R)->ri + (R)->pictz)
+
+// Picture payload is read and decoded this many bytes at a time
+#define PICT_CHUNK           4096
+
+// Limits on input, tokens, and time are checked once per token. Reading
+// the clock costs more than a token, so it only happens every so often.
+#define check_limits(R)      do { if ((R)->limited) enforce_limits(R); } while (0)
+#define LIMIT_CLOCK_STEPS    1024
+#define is_limit_error(e)    ((e) == RTF_ELIMIT_DEPTH || (e) == RTF_ELIMIT_BYTES || \
+                              (e) == RTF_ELIMIT_STEPS || (e) == RTF_ELIMIT_TIME  || \
+                              (e) == RTF_ELIMIT_MEMORY)
+
+#ifdef RTFPROC_TRACE
+// State for rtftrace_start()
+typedef struct tracespan {
+    const char   *  name;
+    uint64_t        start;        // Nanoseconds since rtftrace_start()
+    uint64_t        dur;
+    char            arg[24];      // E.g., the control word, or empty
+} tracespan;
+
+// There is one trace at a time, shared by every RTF object in the process
+static struct {
+    FILE         *  fout;
+    uint64_t        minns;
+    uint64_t        epoch;
+    tracespan    *  spans;
+    size_t          n;
+    size_t          cap;
+    size_t          dropped;
+} tracer;
+#endif
+
+// Bump allocator: blocks are carved from a list of chunks, each block
+// preceded by its size. Only the most recent block can grow in place or
+// be given back; everything else is released with the arena.
+typedef struct arenachunk {
+    struct arenachunk *prev;
+    size_t          z;            // Usable bytes in data[]
+    size_t          top;          // Bytes of data[] in use
+    size_t          last;         // Offset of the most recent block's header
+    max_align_t     data[];
+} arenachunk;
+
+struct rtfarena {
+    size_t          cap;          // Most the chunks may add up to
+    size_t          used;         // What they do add up to
+    arenachunk   *  chunk;        // Current chunk; older ones via prev
+};
+
+static const rtfalloc libc_allocator = { libc_alloc, libc_resize, libc_release, NULL };
+
+// State for rtfscan()
+typedef struct scanstate {
+    rtfmatch     *  matches;
+    size_t          n;
+    size_t          cap;
+    size_t       *  counts;
+    size_t          seen;        // # of distinct keys seen so far
+    bool            keep;        // Caller wants match positions
+} scanstate;
+
+// State for rtfgetinfo()
+typedef struct infostate {
+    rtfinfo      *  I;
+    char         *  buf;         // Text of the field being collected
+    size_t          n;
+    size_t          cap;
+    bool            done;        // Reached the end of the header
+} infostate;
+
+// \info destinations and values collected by rtfgetinfo()
+enum { INFO_TEXT, INFO_TIME, INFO_NUM };
+
+static const struct infodest {
+    const char     *name;
+    int             kind;
+    size_t          off;
+} infodests[] = {
+    { "title",      INFO_TEXT,  offsetof(rtfinfo, title)        },
+    { "subject",    INFO_TEXT,  offsetof(rtfinfo, subject)      },
+    { "author",     INFO_TEXT,  offsetof(rtfinfo, author)       },
+    { "manager",    INFO_TEXT,  offsetof(rtfinfo, manager)      },
+    { "company",    INFO_TEXT,  offsetof(rtfinfo, company)      },
+    { "operator",   INFO_TEXT,  offsetof(rtfinfo, operatorname) },
+    { "category",   INFO_TEXT,  offsetof(rtfinfo, category)     },
+    { "keywords",   INFO_TEXT,  offsetof(rtfinfo, keywords)     },
+    { "comment",    INFO_TEXT,  offsetof(rtfinfo, comment)      },
+    { "doccomm",    INFO_TEXT,  offsetof(rtfinfo, doccomm)      },
+    { "hlinkbase",  INFO_TEXT,  offsetof(rtfinfo, hlinkbase)    },
+    { "creatim",    INFO_TIME,  offsetof(rtfinfo, creatim)      },
+    { "revtim",     INFO_TIME,  offsetof(rtfinfo, revtim)       },
+    { "printim",    INFO_TIME,  offsetof(rtfinfo, printim)      },
+    { "buptim",     INFO_TIME,  offsetof(rtfinfo, buptim)       },
+    { "version",    INFO_NUM,   offsetof(rtfinfo, version)      },
+    { "edmins",     INFO_NUM,   offsetof(rtfinfo, edmins)       },
+    { "nofpages",   INFO_NUM,   offsetof(rtfinfo, nofpages)     },
+    { "nofwords",   INFO_NUM,   offsetof(rtfinfo, nofwords)     },
+    { "nofchars",   INFO_NUM,   offsetof(rtfinfo, nofchars)     },
+    { "yr",         INFO_NUM,   offsetof(rtftime, yr)           },
+    { "mo",         INFO_NUM,   offsetof(rtftime, mo)           },
+    { "dy",         INFO_NUM,   offsetof(rtftime, dy)           },
+    { "hr",         INFO_NUM,   offsetof(rtftime, hr)           },
+    { "min",        INFO_NUM,   offsetof(rtftime, min)          },
+    { "sec",        INFO_NUM,   offsetof(rtftime, sec)          },
+};
+#define INFO_TIMEPART  20   // First of the rtftime members above
+
 
 
 /////////////////////////////////////////////////////////////////////////////
@@ -91,31 +309,77 @@ static uint8_t get_hex_arg(const char *s);
 /////////////////////////////////////////////////////////////////////////////
 
 rtfobj *new_rtfobj(FILE *fin, FILE *fout, FILE *ftxt) {
-    rtfobj *R;
+    rtfopts opts = { 0 };
+
+    BEGIN_FUNCTION
+
+    opts.iobufz = STDIO_BUFFER_SIZE;
+
+    RETURN(new_rtfobj_opts(fin, fout, ftxt, &opts));
+}
+
+
+
+rtfobj *new_rtfobj_info(FILE *fin) {
+    rtfopts opts = { 0 };
+
+    BEGIN_FUNCTION
+
+    // For rtfgetinfo(), which stops at the end of the header. A small
+    // stdio buffer keeps it from reading much of the body from disk.
+    opts.iobufz = INFO_BUFFER_SIZE;
+
+    RETURN(new_rtfobj_opts(fin, NULL, NULL, &opts));
+}
+
+
+
+rtfobj *new_rtfobj_opts(FILE *fin, FILE *fout, FILE *ftxt, const rtfopts *opts) {
+    rtfobj   *R;
+    rtfarena *arena = NULL;
+    rtfalloc  alloc = opts->alloc.alloc ? opts->alloc : libc_allocator;
 
     BEGIN_FUNCTION
 
-    R = malloc(sizeof *R);
+    // An object with its own arena lives in it, along with everything else
+    if (opts->arenaz) {
+        if (!(arena = new_rtfarena(opts->arenaz))) FAIL(NULL, "Failed allocating arena for new RTF Object.");
+        alloc = rtfarena_allocator(arena);
+    }
+
+    R = mem_alloc(&alloc, sizeof *R);
 
-    if (!R) { FAIL(NULL, "Failed allocating new RTF Object."); }
+    if (!R) { delete_rtfarena(arena); FAIL(NULL, "Failed allocating new RTF Object."); }
 
     // Initialize the whole thing to zero
     memzero(R, sizeof *R);
+    R->alloc = alloc;
+    R->arena = arena;
 
     // Set up file streams
     R->fin  = fin;
     R->fout = fout;
     R->ftxt = ftxt;
 
-    setvbuf(R->fin,  NULL, _IOFBF, (1<<21));
-    if (R->fout) setvbuf(R->fout, NULL, _IOFBF, (1<<21));
-    if (R->ftxt) setvbuf(R->ftxt, NULL, _IOFBF, (1<<21));
-
-    R->rawz = RAW_BUFFER_SIZE;
-    R->txtz = TXT_BUFFER_SIZE;
-    R->cmdz = CMD_BUFFER_SIZE;
+    R->iobufz = opts->iobufz;
+    if (opts->iobufz) {
+        if (R->fin)  setvbuf(R->fin,  NULL, _IOFBF, opts->iobufz);
+        if (R->fout) setvbuf(R->fout, NULL, _IOFBF, opts->iobufz);
+        if (R->ftxt) setvbuf(R->ftxt, NULL, _IOFBF, opts->iobufz);
+    }
 
-    R->fonttbl_z = FONTTBL_SIZE;
+    // Buffers themselves are allocated lazily; see reserve_raw(), etc.
+    // txtrawmap[] holds 32-bit input offsets, so the raw buffer can't be
+    // allowed to grow past what they can address.
+    R->rawmax = opts->rawz ? opts->rawz : RAW_BUFFER_SIZE;
+    R->txtmax = opts->txtz ? opts->txtz : TXT_BUFFER_SIZE;
+    R->cmdmax = opts->cmdz ? opts->cmdz : CMD_BUFFER_SIZE;
+    if (R->rawmax > UINT32_MAX)     R->rawmax = UINT32_MAX;
+    if (R->rawmax < RAW_BUFFER_MIN) R->rawmax = RAW_BUFFER_MIN;
+    if (R->txtmax < TXT_BUFFER_MIN) R->txtmax = TXT_BUFFER_MIN;
+    if (R->cmdmax < CMD_BUFFER_MIN) R->cmdmax = CMD_BUFFER_MIN;
+
+    R->fonttbl_max = opts->fonttblz ? opts->fonttblz : FONTTBL_SIZE;
     R->defaultfont = -1;
 
     // RTF 1.9 Spec: "A default of 1 should be assumed if no \ucN keyword has
@@ -135,6 +399,7 @@ rtfobj *new_rtfobj(FILE *fin, FILE *fout, FILE *ftxt) {
 
 size_t add_rtfobj_replacements(rtfobj *R, const char **replacements) {
     size_t i;
+    size_t j;
     size_t newitems;
     char  **newkey;
     char  **newval;
@@ -146,13 +411,13 @@ size_t add_rtfobj_replacements(rtfobj *R, const char **replacements) {
     newitems = newitems / 2;
 
     // Try to reallocate both arrays
-    newkey = realloc(R->srch_key, (R->srchz + newitems) * sizeof *R->srch_key);
+    newkey = mem_resize(&R->alloc, R->srch_key, (R->srchz + newitems) * sizeof *R->srch_key);
     if (!newkey) {
         R->fatalerr = ENOMEM;
         FAIL(0UL, "Out of memory allocating search key/value pointers!");
     } else {
         R->srch_key = newkey;
-        newval = realloc(R->srch_val, (R->srchz + newitems) * sizeof *R->srch_val);
+        newval = mem_resize(&R->alloc, R->srch_val, (R->srchz + newitems) * sizeof *R->srch_val);
         if (!newval) {
             R->fatalerr = ENOMEM;
             FAIL(0UL, "Out of memory allocating search key/value pointers!");
@@ -161,17 +426,25 @@ size_t add_rtfobj_replacements(rtfobj *R, const char **replacements) {
         }
     }
 
-    // Add the new elements to the arrays
+    // Add the new elements to the arrays. Running out partway (an arena
+    // with a cap, say) leaves the object as it was before the call.
     for (i = 0; i < newitems; i++) {
-        // TODO: Check returns and make sure its safe
-        R->srch_key[R->srchz + i] = strdup(replacements[2*i]);
-        R->srch_val[R->srchz + i] = strdup(replacements[2*i+1]);
-        // R->srch_key[R->srchz + i] = replacements[2*i];
-        // R->srch_val[R->srchz + i] = replacements[2*i+1];
+        R->srch_key[R->srchz + i] = mem_strdup(&R->alloc, replacements[2*i]);
+        R->srch_val[R->srchz + i] = mem_strdup(&R->alloc, replacements[2*i+1]);
+        if (!R->srch_key[R->srchz + i] || !R->srch_val[R->srchz + i]) {
+            for (j = i + 1; j-- > 0; ) {
+                mem_free(&R->alloc, R->srch_val[R->srchz + j]);
+                mem_free(&R->alloc, R->srch_key[R->srchz + j]);
+            }
+            R->fatalerr = ENOMEM;
+            FAIL(0UL, "Out of memory copying replacement strings!");
+        }
     }
+    for (i = 0; i < newitems; i++) note_key_first(R, replacements[2*i]);
 
     // Set the new size of the arrays
     R->srchz += newitems;
+    forget_matches(R);
 
     RETURN(newitems);
 }
@@ -191,12 +464,12 @@ size_t add_one_rtfobj_replacement(rtfobj *R, const char *key, const char *val) {
 
     for (i = 0; i < R->srchz; i++) {
         if (!strcmp(key, R->srch_key[i])) {
-            tmpval = strdup(val);
+            tmpval = mem_strdup(&R->alloc, val);
             if (!tmpval) {
                 R->fatalerr = ENOMEM;
                 FAIL(0UL, "Out of memory copying replacement value string!");
             } else {
-                free(R->srch_val[i]);
+                mem_free(&R->alloc, R->srch_val[i]);
                 R->srch_val[i] = tmpval;
                 RETURN(1UL);
             }
@@ -204,7 +477,7 @@ size_t add_one_rtfobj_replacement(rtfobj *R, const char *key, const char *val) {
     }
 
     // Try to reallocate both arrays
-    newkey = realloc(R->srch_key, (R->srchz + 1) * sizeof *R->srch_key);
+    newkey = mem_resize(&R->alloc, R->srch_key, (R->srchz + 1) * sizeof *R->srch_key);
     if (!newkey) {
         R->fatalerr = ENOMEM;
         FAIL(0UL, "Out of memory allocating search key pointers!");
@@ -212,7 +485,7 @@ size_t add_one_rtfobj_replacement(rtfobj *R, const char *key, const char *val) {
 
     R->srch_key = newkey;
 
-    newval = realloc(R->srch_val, (R->srchz + 1) * sizeof *R->srch_val);
+    newval = mem_resize(&R->alloc, R->srch_val, (R->srchz + 1) * sizeof *R->srch_val);
     if (!newval) {
         R->fatalerr = ENOMEM;
         FAIL(0UL, "Out of memory allocating replacement value pointers!");
@@ -220,47 +493,126 @@ size_t add_one_rtfobj_replacement(rtfobj *R, const char *key, const char *val) {
 
     R->srch_val = newval;
 
-    tmpkey = strdup(key);
+    tmpkey = mem_strdup(&R->alloc, key);
 
     if (!tmpkey) {
         R->fatalerr = ENOMEM;
         FAIL(0UL, "Out of memory copying search key string!");
     }
 
-    tmpval = strdup(val);
+    tmpval = mem_strdup(&R->alloc, val);
 
     if (!tmpval) {
         R->fatalerr = ENOMEM;
-        free(tmpkey);
+        mem_free(&R->alloc, tmpkey);
         FAIL(0UL, "Out of memory copying replacement value string!");
     }
 
     R->srch_key[R->srchz] = tmpkey;
     R->srch_val[R->srchz] = tmpval;
+    note_key_first(R, key);
 
     R->srchz += 1;
+    forget_matches(R);
 
     RETURN(1UL);
 }
 
 
 
+const char *find_rtfobj_replacement(const rtfobj *R, const char *key) {
+    size_t i;
+
+    BEGIN_FUNCTION
+
+    // Keys added to the object override the dictionary's
+    for (i = 0; i < R->srchz; i++) {
+        if (!strcmp(key, R->srch_key[i])) RETURN(R->srch_val[i]);
+    }
+
+    if (R->dict) RETURN(find_rtfdict_value(R->dict, key));
+
+    RETURN(NULL);
+}
+
+
+
+
+
+// Keys are numbered with the object's own first, then the dictionary's
+size_t rtfobj_nkeys(const rtfobj *R) {
+    return R->srchz + (R->dict ? R->dict->n : 0);
+}
+
+
+
+const char *rtfobj_key(const rtfobj *R, size_t i) {
+    return (i < R->srchz) ? R->srch_key[i] : &R->dict->pool[R->dict->strs[2*(i - R->srchz)]];
+}
+
+
+
+const char *rtfobj_val(const rtfobj *R, size_t i) {
+    return (i < R->srchz) ? R->srch_val[i] : &R->dict->pool[R->dict->strs[2*(i - R->srchz)+1]];
+}
+
+
+
+
+
+void rtfobj_reset(rtfobj *R, FILE *fin, FILE *fout, FILE *ftxt) {
+    BEGIN_FUNCTION
+
+    // Ready for another document. The replacements, dictionary, hooks,
+    // limits, and buffers (at whatever size they've grown to) all stay;
+    // only what the last document dirtied is cleared. The streams are
+    // used with whatever buffering the caller gave them.
+    discard_parse_state(R);
+    R->fonttbl_n        = 0;
+    R->defaultfont      = -1;
+    R->documentcodepage = 0;
+
+    R->steps    = 0;
+    R->deadline = R->limits.maxnanos ? monotonic_now() + R->limits.maxnanos : 0;
+
+    R->fin    = fin;
+    R->fout   = fout;
+    R->ftxt   = ftxt;
+    R->iobufz = 0;
+
+    RETURN();
+}
+
 
 
 void delete_rtfobj(rtfobj *R) {
+    rtfalloc alloc;
 
     BEGIN_FUNCTION
 
-    if (R) {
-        for (size_t i=0; i < R->srchz; i++) {
-            free(R->srch_key[i]);
-            free(R->srch_val[i]);
-        }
-        free(R->srch_key);
-        free(R->srch_val);
-        while (R->attr->outer) pop_attr(R);
+    if (!R) RETURN();
+
+    // Everything, the object included, goes with its arena
+    if (R->arena) { delete_rtfarena(R->arena); RETURN(); }
+
+    for (size_t i=0; i < R->srchz; i++) {
+        mem_free(&R->alloc, R->srch_key[i]);
+        mem_free(&R->alloc, R->srch_val[i]);
     }
-    free(R);
+    mem_free(&R->alloc, R->srch_key);
+    mem_free(&R->alloc, R->srch_val);
+    while (R->attr->outer) pop_attr(R);
+    mem_free(&R->alloc, R->raw);
+    mem_free(&R->alloc, R->txt);
+    mem_free(&R->alloc, R->cmd);
+    mem_free(&R->alloc, R->txtrawmap);
+    mem_free(&R->alloc, R->txtrawend);
+    mem_free(&R->alloc, R->fonttbl_f);
+    mem_free(&R->alloc, R->fonttbl_charset);
+    mem_free(&R->alloc, R->pict);
+
+    alloc = R->alloc;
+    mem_free(&alloc, R);
 
     RETURN();
 }
@@ -274,206 +626,257 @@ void delete_rtfobj(rtfobj *R) {
 
 /////////////////////////////////////////////////////////////////////////////
 ////                                                                     ////
-////            MAIN PROCESSING LOOPS & LIBRARY ENTRY POINTS             ////
+////                   REPLACEMENT DICTIONARY FUNCTIONS                  ////
 ////                                                                     ////
 /////////////////////////////////////////////////////////////////////////////
 
-void rtfreplace(rtfobj *R) {
-    int c;
+rtfdict *new_rtfdict(const char **sortedpairs) {
+    BEGIN_FUNCTION
+
+    RETURN(new_rtfdict_alloc(sortedpairs, NULL));
+}
+
+
+
+rtfdict *new_rtfdict_alloc(const char **sortedpairs, const rtfalloc *A) {
+    rtfdict  *D = NULL;
+    uint32_t *lo = NULL;
+    uint32_t *hi = NULL;
+    uint32_t *depth = NULL;
+    size_t    n, i, j, k, v, len, poolz, maxnodes, nnodes;
+    uint8_t   b;
+    void     *shrunk;
 
     BEGIN_FUNCTION
 
-    while ((c = fgetc(R->fin)) != EOF) {
+    for (n = 0; sortedpairs[n] != NULL; n++);
+    n = n / 2;
 
-        switch (c) {
-            case '{':           dispatch_scope(c, R);      break;
-            case '}':           dispatch_scope(c, R);      break;
-            case '\\':          dispatch_command(R);       break;
-            default:            dispatch_text(c, R);       break;
+    // Every key byte adds at most one node, so this bounds the trie
+    poolz = 0;
+    maxnodes = 1;
+    for (i = 0; i < n; i++) {
+        if (i > 0 && strcmp(sortedpairs[2*i-2], sortedpairs[2*i]) >= 0) {
+            FAIL(NULL, "Dictionary keys must be sorted and unique (at \'%s\')", sortedpairs[2*i]);
         }
+        len = strlen(sortedpairs[2*i]);
+        maxnodes += len;
+        poolz += len + 1 + strlen(sortedpairs[2*i+1]) + 1;
+    }
+    if (maxnodes > UINT32_MAX) FAIL(NULL, "Dictionary too large");
+
+    if (!A || !A->alloc) A = &libc_allocator;
+
+    D = mem_alloc(A, sizeof *D);
+    if (!D) FAIL(NULL, "Failed allocating dictionary.");
+    memzero(D, sizeof *D);
+    D->alloc = *A;
+
+    D->pool   = mem_alloc(A, poolz + 1);
+    D->strs   = mem_alloc(A, (2 * n + 1) * sizeof *D->strs);
+    D->nodes  = mem_alloc(A, maxnodes * sizeof *D->nodes);
+    D->labels = mem_alloc(A, maxnodes);
+    lo        = mem_alloc(A, maxnodes * sizeof *lo);
+    hi        = mem_alloc(A, maxnodes * sizeof *hi);
+    depth     = mem_alloc(A, maxnodes * sizeof *depth);
+    if (!D->pool || !D->strs || !D->nodes || !D->labels || !lo || !hi || !depth) {
+        mem_free(A, depth);
+        mem_free(A, hi);
+        mem_free(A, lo);
+        delete_rtfdict(D);
+        FAIL(NULL, "Out of memory building dictionary");
+    }
 
-        pattern_match(R);
+    for (i = 0, j = 0; i < 2 * n; i++) {
+        len = strlen(sortedpairs[i]) + 1;
+        D->strs[i] = j;
+        memcpy(&D->pool[j], sortedpairs[i], len);
+        j += len;
+    }
+    D->n = n;
+
+    // Hashed once here, so that rtfcache_values_hash() needn't walk every
+    // entry of a large dictionary on every call
+    D->hash = rtfhash(RTFHASH_INIT, D->pool, j);
+
+    // Build breadth-first. Each node stands for the range of keys [lo, hi)
+    // sharing its depth-byte prefix. Because the keys are sorted, the key
+    // equal to the prefix (if any) comes first and each child's keys are
+    // contiguous, so every key byte is examined once.
+    lo[0] = 0;
+    hi[0] = (uint32_t)n;
+    depth[0] = 0;
+    nnodes = 1;
+
+    for (v = 0; v < nnodes; v++) {
+        k = lo[v];
+        D->nodes[v].entry = 0;
+        if (k < hi[v] && D->pool[D->strs[2*k] + depth[v]] == '\0') {
+            D->nodes[v].entry = (uint32_t)(k + 1);
+            k++;
+        }
 
-        if (R->fatalerr) {
-            output_raw(R);
-            FAIL(VOID, "Encountered a fatal error");
+        D->nodes[v].first = (uint32_t)(nnodes - 1);
+        while (k < hi[v]) {
+            b = (uint8_t)D->pool[D->strs[2*k] + depth[v]];
+            for (j = k + 1; j < hi[v] && (uint8_t)D->pool[D->strs[2*j] + depth[v]] == b; j++);
+
+            D->labels[nnodes - 1] = b;
+            lo[nnodes]    = (uint32_t)k;
+            hi[nnodes]    = (uint32_t)j;
+            depth[nnodes] = depth[v] + 1;
+            nnodes++;
+            k = j;
         }
+        D->nodes[v].nkids = (uint32_t)(nnodes - 1) - D->nodes[v].first;
     }
 
-    output_raw(R);
+    mem_free(A, depth);
+    mem_free(A, hi);
+    mem_free(A, lo);
 
-    RETURN();
+    D->nnodes = nnodes;
+    if ((shrunk = mem_resize(A, D->nodes, nnodes * sizeof *D->nodes))) D->nodes = shrunk;
+    if ((shrunk = mem_resize(A, D->labels, nnodes))) D->labels = shrunk;
+
+    RETURN(D);
 }
 
 
-void rtfprocess(rtfobj *R, void (*processfunction)(rtfobj *, void *, int), void *passthru) {
-    int c;
+
+void delete_rtfdict(rtfdict *D) {
+    rtfalloc alloc;
 
     BEGIN_FUNCTION
 
-    processfunction(R, passthru, RTF_PROC_START);
-    while ((c = fgetc(R->fin)) != EOF) {
-        switch (c) {
-            case '{':           dispatch_scope(c, R);      break;
-            case '}':           dispatch_scope(c, R);      break;
-            case '\\':          dispatch_command(R);       break;
-            default:            dispatch_text(c, R);       break;
-        }
+    if (!D) RETURN();
 
-        processfunction(R, passthru, RTF_PROC_STEP);
-        if (R->fatalerr) {
-            processfunction(R, passthru, RTF_PROC_END);
-            FAIL(VOID, "Encountered a fatal error");
-        }
-    }
-    processfunction(R, passthru, RTF_PROC_END);
+    alloc = D->alloc;
+    mem_free(&alloc, D->labels);
+    mem_free(&alloc, D->nodes);
+    mem_free(&alloc, D->strs);
+    mem_free(&alloc, D->pool);
+    mem_free(&alloc, D);
 
     RETURN();
 }
 
 
-/////////////////////////////////////////////////////////////////////////////
-////                                                                     ////
-////                         DISPATCH FUNCTIONS                          ////
-////                                                                     ////
-/////////////////////////////////////////////////////////////////////////////
 
-static void dispatch_scope(int c, rtfobj *R) {
+const char *find_rtfdict_value(const rtfdict *D, const char *key) {
+    uint32_t node = 0;
+
     BEGIN_FUNCTION
 
-    add_to_raw(c, R);
-    if      (c == '{')  push_attr(R);
-    else if (c == '}')  pop_attr(R);
+    for (; *key; key++) {
+        if (!(node = dict_child(D, node, (uint8_t)*key))) RETURN(NULL);
+    }
 
-    RETURN();
+    if (!D->nodes[node].entry) RETURN(NULL);
+
+    RETURN(&D->pool[D->strs[2 * (D->nodes[node].entry - 1) + 1]]);
 }
 
 
 
-static void dispatch_command(rtfobj *R) {
+int set_rtfobj_dictionary(rtfobj *R, const rtfdict *D) {
+    char     first[2] = { 0 };
+    uint32_t e;
+
     BEGIN_FUNCTION
 
-    read_command(R);
+    R->dict = D;
+    R->txtended = 0;
+    forget_matches(R);
 
-    if (!R->attr->nocmd) proc_command(R);
+    if (!D) RETURN(0);
 
-    // ----- RAW/TXT BUFFER COORDINATION -----
-    // We won't know whether to flush or keep raw data until after we look at
-    // the text it contains. Deferring adding content to the raw output buffer
-    // until AFTER the text or command is known keeps this cleaner. Then we
-    // can, e.g., flush the existing raw buffer the first time text is added,
-    // knowing that we won't be flushing the raw RTF code that *corresponds*
-    // to the text we just added.
-    add_cmdstring_to_raw(R->cmd, R);
+    if (need_txtrawend(R)) FAIL(ENOMEM, "Out of memory attaching dictionary");
 
-    RETURN();
+    for (e = 0; e < D->nodes[0].nkids; e++) {
+        first[0] = (char)D->labels[D->nodes[0].first + e];
+        note_key_first(R, first);
+    }
+
+    RETURN(0);
 }
 
 
 
-static void dispatch_text(int c, rtfobj *R) {
+int set_rtfobj_match_policy(rtfobj *R, int policy) {
     BEGIN_FUNCTION
 
-    if (R->attr->notxt) { add_to_raw(c, R); RETURN(); }
-
-    // Ignore newlines and carriage returns in RTF code. Consider tabs and
-    // vertical tabs to be interchangeable with spaces. Treat everything else
-    // literally.
-    switch(c) {
-        case '\r':
-        case '\n':
-            break;
-        case '\t':
-            add_to_txt(0x09, R);
-            break;
-        case '\v':
-            add_to_txt(' ', R);
-            break;
-        default:
-            add_to_txt(c, R);
+    if (policy < RTF_MATCH_DEFAULT || policy > RTF_MATCH_SHORTEST) {
+        FAIL(EINVAL, "Invalid match policy %d", policy);
     }
-    add_to_raw(c, R);
 
-    RETURN();
+    R->matchpolicy = policy;
+    R->txtended = 0;
+    forget_matches(R);
+
+    if (uses_txtrawend(R) && need_txtrawend(R)) FAIL(ENOMEM, "Out of memory setting match policy");
+
+    RETURN(0);
 }
 
 
 
+int set_rtfobj_limits(rtfobj *R, const rtflimits *L) {
+    BEGIN_FUNCTION
 
+    // NULL lifts all limits. Otherwise the step count and the clock start
+    // over, so the same limits can be set again for each document.
+    if (L) R->limits = *L;
+    else   memzero(&R->limits, sizeof R->limits);
 
+    R->steps    = 0;
+    R->deadline = R->limits.maxnanos ? monotonic_now() + R->limits.maxnanos : 0;
+    R->limited  = R->limits.maxbytes || R->limits.maxsteps || R->limits.maxnanos;
 
+    RETURN(0);
+}
 
 
-/////////////////////////////////////////////////////////////////////////////
-////                                                                     ////
-////                       PATTERN MATCH FUNCTION                        ////
-////                                                                     ////
-/////////////////////////////////////////////////////////////////////////////
 
-static int pattern_match(rtfobj *R) {
-    size_t offset;
-    size_t curkey;
-    size_t i;
+int set_rtfobj_pict_hook(rtfobj *R, rtfpicthook hook, void *data) {
+    BEGIN_FUNCTION
+
+    if (R->pictdepth) FAIL(EBUSY, "Can't change picture hook inside a picture group");
+
+    R->picthook = hook;
+    R->pictdata = data;
+
+    RETURN(0);
+}
 
+
+
+int set_rtfobj_pict_reader(rtfobj *R, rtfpictreader reader, void *data) {
     BEGIN_FUNCTION
 
-    if (R->ti < 1 || R->attr->notxt) RETURN(PARTIAL);
+    if (R->pictreaddepth) FAIL(EBUSY, "Can't change picture reader inside a picture group");
 
-    for (offset = 0; offset < R->ti; offset++) {
-        for (curkey = 0; curkey < R->srchz; curkey++) {
+    R->pictreader     = reader;
+    R->pictreaderdata = data;
 
-            // Inline early-fail strcmp. Library function is slow on macOS.
-            // KEY: i = index of '\0' OR first non-matching character
-            for (i = 0;
-                 R->txt[offset+i] == R->srch_key[curkey][i] &&
-                 R->txt[offset+i] != '\0';
-                 i++);
+    RETURN(0);
+}
 
-            // We can tell if there's a match by whether i is the index of a
-            // mismatch or the end of the string.  If it's the end of the
-            // string, then there is a complete match, and we need to output
-            // the appropriate replacement.
-            // The fastest/easiest way to determine that is whether the index
-            // is equal between the two strings.  If it is, then a mismatch is
-            // not what caused the above loop to break; it must have been the
-            // null terminator.
-            if (R->txt[offset+i] == R->srch_key[curkey][i]) {
-                // But if we're at an offeset within the text buffer, we need
-                // to output the raw data corresponding to the text buffer
-                // before the offset.
-                if (offset > 0) {
-                    output_raw_by(R, R->txtrawmap[ offset ]);
-                    reset_raw_buffer_by(R, R->txtrawmap[ offset ]);
-                    reset_txt_buffer_by(R, offset);
-                }
-                R->srch_match = curkey;
-                output_match(R);
-                reset_raw_buffer(R);
-                reset_txt_buffer(R);
-                RETURN(MATCH);
-            }
-            else if (R->txt[offset+i] == '\0') { // Not both '\0' but txt[j] is '\0'
-                // Reached the end of the text buffer (the data we've read in so
-                // far) without finding a mismatch, but haven't reached the end
-                // of the replacement key. That means it's a partial match.
-                // TODO: Continue checking to see if we have a complete match
-                // later in the replacement list. Alternatively, we could sort
-                // the replacement list by shortest to longest key.
-                if (offset > 0) {
-                    output_raw_by(R, R->txtrawmap[ offset ]);
-                    reset_raw_buffer_by(R, R->txtrawmap[ offset ]);
-                    reset_txt_buffer_by(R, offset);
-                }
-                RETURN(PARTIAL);
-            }
-        }
-    }
 
-    output_raw(R);
-    reset_raw_buffer(R);
-    reset_txt_buffer(R);
 
-    RETURN(NOMATCH);
+static int need_txtrawend(rtfobj *R) {
+    BEGIN_FUNCTION
+
+    // Matches that may end before the text does need to know where each
+    // text byte ends in the raw buffer (see layered_match())
+    if (R->txtz && !R->txtrawend) {
+        if (!within_memlimit(R, R->txtz * sizeof *R->txtrawend)) RETURN(R->fatalerr);
+        R->txtrawend = mem_alloc(&R->alloc, R->txtz * sizeof *R->txtrawend);
+        if (!R->txtrawend) { R->fatalerr = ENOMEM; RETURN(ENOMEM); }
+        memzero(R->txtrawend, R->txtz * sizeof *R->txtrawend);
+    }
+
+    RETURN(0);
 }
 
 
@@ -485,413 +888,2744 @@ static int pattern_match(rtfobj *R) {
 
 /////////////////////////////////////////////////////////////////////////////
 ////                                                                     ////
-////                  COMMAND DISPATCH HELPER FUNCTIONS                  ////
+////            MAIN PROCESSING LOOPS & LIBRARY ENTRY POINTS             ////
 ////                                                                     ////
 /////////////////////////////////////////////////////////////////////////////
 
-static void read_command(rtfobj *R) {
+void rtfreplace(rtfobj *R) {
     int c;
 
     BEGIN_FUNCTION
 
-    reset_cmd_buffer(R);
+    while ((c = next_input(R)) != EOF) {
 
-    add_to_cmd('\\', R);
+        switch (c) {
+            case '{':           dispatch_scope(c, R);      break;
+            case '}':           dispatch_scope(c, R);      break;
+            case '\\':          dispatch_command(R);       break;
+            default:            dispatch_text(c, R);       break;
+        }
 
-    if ((c=fgetc(R->fin)) == EOF) { R->fatalerr = EIO; FAIL(VOID, "Unexpected EOF"); }
+        TRACE_BEGIN(tmatch);
+        pattern_match(R);
+        TRACE_END(tmatch, "match", NULL);
+        check_limits(R);
 
-    switch (c) {
-        case '{':  // Escaped literal
-        case '}':  // Escaped literal
-        case '\\': // Escaped literal
-        case '~':  // Special one-character stand-in
-        case '_':  // Special one-character stand-in
-        case '-':  // Special one-character stand-in
-        case '*':  // Special one-character command
-        case '\n': // Line Feed --> newline
-            add_to_cmd(c, R);
-            break;
-        case '\r': // Carriage Return --> newline
-            add_to_cmd(c, R);
+        if (R->fatalerr) {
+            // Stopped by a limit, everything read so far is still good
+            if (is_limit_error(R->fatalerr) && uses_txtrawend(R)) settle_match(R);
+            output_raw(R);
+            release_pict(R);
+            FAIL(VOID, "Encountered a fatal error");
+        }
+    }
 
-            // Check if next character is a newline, to avoid double newlines
-            // for platforms with CRLF line terminators.
-            if ((c=fgetc(R->fin)) == EOF) { R->fatalerr = EIO; FAIL(VOID, "EOF after \\\\r"); }
+    // No more text can arrive to extend a pending match
+    if (uses_txtrawend(R)) settle_match(R);
 
-            if (c == '\n') {
-                add_to_cmd(c, R);
+    output_raw(R);
+    release_pict(R);
+
+    RETURN();
+}
+
+
+void rtfreplace_until(rtfobj *R, uint64_t end) {
+    int c;
+
+    BEGIN_FUNCTION
+
+    // Same as rtfreplace(), but stops at a token boundary once the input
+    // offset reaches end. A partial match stays in the buffers, so that a
+    // later call can complete it; use rtfflush() to give up on it.
+    while (input_offset(R) < end && (c = next_input(R)) != EOF) {
+
+        switch (c) {
+            case '{':           dispatch_scope(c, R);      break;
+            case '}':           dispatch_scope(c, R);      break;
+            case '\\':          dispatch_command(R);       break;
+            default:            dispatch_text(c, R);       break;
+        }
+
+        TRACE_BEGIN(tmatch);
+        pattern_match(R);
+        TRACE_END(tmatch, "match", NULL);
+        check_limits(R);
+
+        if (R->fatalerr) {
+            // Stopped by a limit, everything read so far is still good
+            if (is_limit_error(R->fatalerr) && uses_txtrawend(R)) settle_match(R);
+            output_raw(R);
+            release_pict(R);
+            FAIL(VOID, "Encountered a fatal error");
+        }
+    }
+
+    RETURN();
+}
+
+
+void rtfflush(rtfobj *R) {
+    BEGIN_FUNCTION
+
+    if (uses_txtrawend(R)) settle_match(R);
+
+    output_raw(R);
+    reset_raw_buffer(R);
+    reset_txt_buffer(R);
+    release_pict(R);
+
+    RETURN();
+}
+
+
+void rtfprocess(rtfobj *R, void (*processfunction)(rtfobj *, void *, int), void *passthru) {
+    int c;
+
+    BEGIN_FUNCTION
+
+    processfunction(R, passthru, RTF_PROC_START);
+    while ((c = next_input(R)) != EOF) {
+        switch (c) {
+            case '{':           dispatch_scope(c, R);      break;
+            case '}':           dispatch_scope(c, R);      break;
+            case '\\':          dispatch_command(R);       break;
+            default:            dispatch_text(c, R);       break;
+        }
+
+        processfunction(R, passthru, RTF_PROC_STEP);
+        check_limits(R);
+        if (R->fatalerr) {
+            processfunction(R, passthru, RTF_PROC_END);
+            FAIL(VOID, "Encountered a fatal error");
+        }
+    }
+    processfunction(R, passthru, RTF_PROC_END);
+
+    RETURN();
+}
+
+
+size_t rtfscan(rtfobj *R, rtfmatch **matches, size_t *counts, bool stopwhenallseen) {
+    scanstate S = { 0 };
+    rtfhooks  savedhooks;
+    FILE     *savedftxt;
+    size_t   *owncounts = NULL;
+    int c;
+
+    BEGIN_FUNCTION
+
+    // Stopping early needs per-key counts even if the caller doesn't
+    if (!counts && stopwhenallseen) {
+        counts = owncounts = mem_alloc(&R->alloc, (rtfobj_nkeys(R) + 1) * sizeof *counts);
+        if (!counts) { R->fatalerr = ENOMEM; FAIL(0UL, "Out of memory allocating scan counts"); }
+    }
+
+    // Reuse the replacement machinery, but record matches instead of
+    // writing anything out.
+    S.keep   = (matches != NULL);
+    S.counts = counts;
+    if (counts) memzero(counts, rtfobj_nkeys(R) * sizeof *counts);
+
+    savedhooks = R->hooks;
+    savedftxt  = R->ftxt;
+    R->hooks.raw   = discard_raw;
+    R->hooks.match = scan_match;
+    R->hooks.data  = &S;
+    R->ftxt = NULL;
+
+    while ((c = next_input(R)) != EOF) {
+
+        switch (c) {
+            case '{':           dispatch_scope(c, R);      break;
+            case '}':           dispatch_scope(c, R);      break;
+            case '\\':          dispatch_command(R);       break;
+            default:            dispatch_text(c, R);       break;
+        }
+
+        TRACE_BEGIN(tmatch);
+        pattern_match(R);
+        TRACE_END(tmatch, "match", NULL);
+        check_limits(R);
+
+        if (R->fatalerr) break;
+        if (stopwhenallseen && S.seen == rtfobj_nkeys(R)) break;
+    }
+
+    R->hooks = savedhooks;
+    R->ftxt  = savedftxt;
+    mem_free(&R->alloc, owncounts);
+
+    if (matches) *matches = S.matches;
+
+    if (R->fatalerr) FAIL(S.n, "Encountered a fatal error");
+
+    RETURN(S.n);
+}
+
+
+
+int rtfgetinfo(rtfobj *R, rtfinfo *I) {
+    infostate S = { 0 };
+    rtfhooks  savedhooks;
+    FILE     *savedftxt;
+    char     *newbuf;
+    int c;
+
+    BEGIN_FUNCTION
+
+    memzero(I, sizeof *I);
+    S.I = I;
+
+    // Reading stops at the end of the header, but stdio may read ahead by
+    // a whole buffer, which for new_rtfobj() is most of a typical document
+    if (R->iobufz > INFO_BUFFER_SIZE) {
+        LOG("Input buffer of %zu bytes may read well past the header; see new_rtfobj_info()", R->iobufz);
+    }
+
+    // Decode the header the usual way, so the \info destinations get the
+    // same code page and \u handling as body text, but keep only the text
+    // inside those destinations. Stop as soon as the header is over.
+    savedhooks = R->hooks;
+    savedftxt  = R->ftxt;
+    R->hooks.raw   = discard_raw;
+    R->hooks.match = NULL;
+    R->ftxt = NULL;
+    R->info = &S;
+
+    while (!S.done && (c = next_input(R)) != EOF) {
+
+        switch (c) {
+            case '{':           dispatch_scope(c, R);      break;
+            case '}':           dispatch_scope(c, R);      break;
+            case '\\':          dispatch_command(R);       break;
+            default:            dispatch_text(c, R);       break;
+        }
+
+        if (R->ti > 0) {
+            if (R->attr->infofield) {
+                if (S.n + R->ti + 1 > S.cap) {
+                    S.cap = 2 * (S.n + R->ti + 1);
+                    newbuf = mem_resize(&R->alloc, S.buf, S.cap);
+                    if (!newbuf) { R->fatalerr = ENOMEM; break; }
+                    S.buf = newbuf;
+                }
+                memcpy(&S.buf[S.n], R->txt, R->ti);
+                S.n += R->ti;
             }
-            else {
-                ungetc(c, R->fin);
+            else if (!R->attr->ininfo) {
+                // Document text outside of any header destination
+                S.done = true;
             }
+            reset_txt_buffer(R);
+        }
+        reset_raw_buffer(R);
+        check_limits(R);
 
-            break;
-        case '\'':
-            add_to_cmd(c, R);
+        if (R->fatalerr) break;
+    }
 
-            if ((c=fgetc(R->fin)) == EOF) { R->fatalerr = EIO; FAIL(VOID, "EOF AFTER \\' command"); }
-            add_to_cmd(c, R);
+    R->hooks = savedhooks;
+    R->ftxt  = savedftxt;
+    R->info  = NULL;
+    mem_free(&R->alloc, S.buf);
 
-            if ((c=fgetc(R->fin)) == EOF) { R->fatalerr = EIO; FAIL(VOID, "EOF AFTER \\'_ command"); }
-            add_to_cmd(c, R);
+    if (R->fatalerr) FAIL(R->fatalerr, "Encountered a fatal error");
 
-            break;
-        default:
-            if (!isalnum(c)) { R->fatalerr = EINVAL; FAIL(VOID, "Invalid command format |%s|...", R->cmd); }
-            add_to_cmd(c, R);
+    RETURN(0);
+}
 
-            // Greedily add input bytes to command buffer, so long as they're valid
-            while ((c = fgetc(R->fin)) != EOF) {
-                if (isalnum(c) || c == '-') add_to_cmd(c, R);
-                else break;
-            }
 
-            // Stopped getting valid command bytes. What now? Depends on if it's an EOF
-            // or a space or something else. "Something else" is probably a backslash
-            // for the next command, so we need to put it back on the input stream.
-            if (c == EOF)         LOG("Unexpected EOF") && (R->fatalerr = EIO);
-            else if (isspace(c))  add_to_cmd(c, R);
-            else                  ungetc(c, R->fin);
 
-            break;
+void clear_rtfinfo(rtfinfo *I) {
+    size_t i;
+
+    BEGIN_FUNCTION
+
+    for (i = 0; i < sizeof infodests / sizeof *infodests; i++) {
+        if (infodests[i].kind == INFO_TEXT) free(*(char **)((char *)I + infodests[i].off));
     }
+    memzero(I, sizeof *I);
 
     RETURN();
 }
 
 
 
-static void proc_command(rtfobj *R) {
-    // Set pointer for internal use so that we don't have to deal with
-    // backslashes at the beginning of our regular expression matching
-    char *c = &R->cmd[1];
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                 STATE SUMMARY & SNAPSHOT FUNCTIONS                  ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+void summarize_rtfobj(const rtfobj *R, rtfsummary *S) {
+    const rtfattr *a;
 
     BEGIN_FUNCTION
 
-    if (0);
-    else if (CHR_MATCH(c,'{'))                   proc_cmd_escapedliteral(R);
-    else if (CHR_MATCH(c,'}'))                   proc_cmd_escapedliteral(R);
-    else if (CHR_MATCH(c,'\\'))                  proc_cmd_escapedliteral(R);
-    else if (CHR_MATCH(c,'~'))                   proc_cmd_specialstandin(R);
-    else if (CHR_MATCH(c,'_'))                   proc_cmd_specialstandin(R);
-    else if (CHR_MATCH(c,'-'))                   proc_cmd_specialstandin(R);
-    else if (CHR_MATCH(c,'\r'))                  proc_cmd_newline(R);
-    else if (CHR_MATCH(c,'\n'))                  proc_cmd_newline(R);
-    else if (RGX_MATCH(c,"^\'\\x\\x"))           proc_cmd_apostrophe(R);
-    else if (RGX_MATCH(c,"^u-?\\d+\\s?$"))       proc_cmd_u(R);
-    else if (RGX_MATCH(c,"^uc\\d+\\s?$"))        proc_cmd_uc(R);
-    else if (RGX_MATCH(c,"^f\\d+\\s?$"))         proc_cmd_f(R);
-    else if (RGX_MATCH(c,"^fcharset\\d+\\s?$"))  proc_cmd_fcharset(R);
-    else if (RGX_MATCH(c,"^cchs\\d+\\s?$"))      proc_cmd_cchs(R);
-    else if (RGX_MATCH(c,"^deff\\d+\\s?$"))      proc_cmd_deff(R);
-    else if (RGX_MATCH(c,"^fonttbl\\s?$"))       proc_cmd_fonttbl(R);
-    else if (RGX_MATCH(c,"^par\\s?$"))           proc_cmd_newpar(R);
-    else if (RGX_MATCH(c,"^line\\s?$"))          proc_cmd_newline(R);
-    else if (RGX_MATCH(c,"^pict\\s?$"))          proc_cmd_shuntblock(R);
-    else if (RGX_MATCH(c,"^colortbl\\s?$"))      proc_cmd_shuntblock(R);
-    else if (RGX_MATCH(c,"^stylesheet\\s?$"))    proc_cmd_shuntblock(R);
-    else if (RGX_MATCH(c,"^title\\s?$"))         proc_cmd_shuntblock(R);
-    else if (RGX_MATCH(c,"^subject\\s?$"))       proc_cmd_shuntblock(R);
-    else if (RGX_MATCH(c,"^author\\s?$"))        proc_cmd_shuntblock(R);
-    else if (RGX_MATCH(c,"^manager\\s?$"))       proc_cmd_shuntblock(R);
-    else if (RGX_MATCH(c,"^company\\s?$"))       proc_cmd_shuntblock(R);
-    else if (RGX_MATCH(c,"^operator\\s?$"))      proc_cmd_shuntblock(R);
-    else if (RGX_MATCH(c,"^category\\s?$"))      proc_cmd_shuntblock(R);
-    else if (RGX_MATCH(c,"^keywords\\s?$"))      proc_cmd_shuntblock(R);
-    else if (RGX_MATCH(c,"^comment\\s?$"))       proc_cmd_shuntblock(R);
-    else if (RGX_MATCH(c,"^doccomm\\s?$"))       proc_cmd_shuntblock(R);
-    else if (RGX_MATCH(c,"^hlinkbase\\s?$"))     proc_cmd_shuntblock(R);
-    else if (RGX_MATCH(c,"^creatim\\s?$"))       proc_cmd_shuntblock(R);
-    else if (RGX_MATCH(c,"^revtim\\s?$"))        proc_cmd_shuntblock(R);
-    else if (RGX_MATCH(c,"^printim\\s?$"))       proc_cmd_shuntblock(R);
-    else if (RGX_MATCH(c,"^buptim\\s?$"))        proc_cmd_shuntblock(R);
-    else if (RGX_MATCH(c,"^userprops\\s?$"))     proc_cmd_shuntblock(R);
-    else if (RGX_MATCH(c,"^bin\\s?$"))           proc_cmd_shuntblock(R);
-    else                                         proc_cmd_unknown(R);
+    memzero(S, sizeof *S);
 
-    // If the command is \* then the entire block is optional, but...
-    // if we then recognize the command, revoke any 'optional' status.
-    if (RGX_MATCH(c, "^*$"))             R->attr->blkoptional = true;
-    else                                 R->attr->blkoptional = false;
+    S->offset = R->rawpos + R->ri;
+    for (a = R->attr; a != &R->topattr; a = a->outer) S->depth++;
+    S->uc               = (int32_t)R->attr->uc;
+    S->codepage         = (int32_t)R->attr->codepage;
+    S->documentcodepage = (int32_t)R->documentcodepage;
+    S->defaultfont      = R->defaultfont;
 
     RETURN();
 }
 
 
 
-static inline void proc_cmd_escapedliteral(rtfobj *R) {
-    BEGIN_FUNCTION
+int resume_rtfobj(rtfobj *R, const rtfsummary *S, const int32_t *fonttbl_f,
+                  const int32_t *fonttbl_charset, size_t fonttbl_n) {
+    uint32_t i;
+
+    BEGIN_FUNCTION
+
+    // Rebuilding a stack deeper than the limit would only fail partway
+    if (R->limits.maxdepth && S->depth > R->limits.maxdepth) {
+        R->fatalerr = RTF_ELIMIT_DEPTH;
+        FAIL(R->fatalerr, "Summary nested deeper than the limit of %zu", R->limits.maxdepth);
+    }
+
+    // The caller has positioned R->fin at S->offset
+    discard_parse_state(R);
+    R->rawpos = (size_t)S->offset;
+
+    if (fonttbl_n > R->fonttbl_z && !reserve_fonttbl(R, fonttbl_n)) {
+        if (!R->fatalerr) R->fatalerr = EINVAL;
+        FAIL(R->fatalerr, "Font table of %zu entries exceeds limits", fonttbl_n);
+    }
+    if (fonttbl_n) {
+        memcpy(R->fonttbl_f,       fonttbl_f,       fonttbl_n * sizeof *R->fonttbl_f);
+        memcpy(R->fonttbl_charset, fonttbl_charset, fonttbl_n * sizeof *R->fonttbl_charset);
+    }
+    R->fonttbl_n        = fonttbl_n;
+    R->documentcodepage = (cpg_t)S->documentcodepage;
+    R->defaultfont      = S->defaultfont;
+
+    // Only the innermost group's state is known, so every level gets it
+    R->topattr.uc       = (size_t)S->uc;
+    R->topattr.codepage = (cpg_t)S->codepage;
+    for (i = 0; i < S->depth; i++) {
+        push_attr(R);
+        if (R->fatalerr) FAIL(R->fatalerr, "Could not rebuild attribute stack");
+    }
+
+    RETURN(0);
+}
+
+
+
+
+
+
+
+
+void *snapshot_rtfobj(const rtfobj *R, size_t *len) {
+    rtfsnaphdr    hdr = { 0 };
+    rtfsnapattr  *sa;
+    const rtfattr *a;
+    char         *snap;
+    char         *p;
+    size_t        i;
+
+    BEGIN_FUNCTION
+
+    // A held-back picture group isn't part of the snapshot format
+    if (R->pictdepth || R->pictreaddepth) FAIL(NULL, "Can't snapshot inside a picture group");
+
+    memcpy(hdr.magic, RTFSNAP_MAGIC, sizeof RTFSNAP_MAGIC);
+    hdr.version          = RTFSNAP_VERSION;
+    hdr.hdrz             = (uint32_t)sizeof hdr;
+    hdr.offset           = R->rawpos + R->ri;
+    hdr.rawpos           = R->rawpos;
+    hdr.txtpos           = R->txtpos;
+    hdr.nfonts           = (uint32_t)R->fonttbl_n;
+    hdr.ri               = (uint32_t)R->ri;
+    hdr.ti               = (uint32_t)R->ti;
+    hdr.defaultfont      = R->defaultfont;
+    hdr.documentcodepage = (int32_t)R->documentcodepage;
+    hdr.highsurrogate    = R->highsurrogate;
+    hdr.rawbraces        = R->rawbraces;
+    hdr.rawescaped       = R->rawescaped;
+    hdr.txtdeferred      = R->txtdeferred;
+    hdr.txtended         = R->txtrawend ? (uint32_t)R->txtended : 0;
+    for (a = R->attr; a; a = a->outer) hdr.nattr++;
+
+    if (R->ti > UINT32_MAX) FAIL(NULL, "Text buffer too large to snapshot");
+
+    *len = sizeof hdr
+         + hdr.nattr * sizeof *sa
+         + 2 * hdr.nfonts * sizeof(int32_t)
+         + hdr.ti * sizeof(uint32_t)
+         + hdr.txtended * sizeof(uint32_t)
+         + hdr.ri
+         + hdr.ti;
+
+    snap = malloc(*len);
+    if (!snap) FAIL(NULL, "Out of memory taking snapshot");
+
+    memcpy(snap, &hdr, sizeof hdr);
+    p = snap + sizeof hdr;
+
+    // The stack is linked innermost first; store it outermost first
+    sa = (rtfsnapattr *)p;
+    for (a = R->attr, i = hdr.nattr; a; a = a->outer) {
+        i--;
+        memzero(&sa[i], sizeof sa[i]);
+        sa[i].uc               = (uint32_t)a->uc;
+        sa[i].uccountdown      = (uint32_t)a->uccountdown;
+        sa[i].fonttbl_defn_idx = a->fonttbl_defn_idx;
+        sa[i].codepage         = (int32_t)a->codepage;
+        sa[i].fonttbl          = a->fonttbl;
+        sa[i].blkoptional      = a->blkoptional;
+        sa[i].nocmd            = a->nocmd;
+        sa[i].notxt            = a->notxt;
+        sa[i].xtra             = a->xtra;
+        sa[i].infofield        = a->infofield;
+        sa[i].ininfo           = a->ininfo;
+    }
+    p += hdr.nattr * sizeof *sa;
+
+    if (hdr.nfonts) {
+        memcpy(p, R->fonttbl_f,       hdr.nfonts * sizeof(int32_t));  p += hdr.nfonts * sizeof(int32_t);
+        memcpy(p, R->fonttbl_charset, hdr.nfonts * sizeof(int32_t));  p += hdr.nfonts * sizeof(int32_t);
+    }
+    if (hdr.ti) {
+        memcpy(p, R->txtrawmap, hdr.ti * sizeof(uint32_t));           p += hdr.ti * sizeof(uint32_t);
+    }
+    if (hdr.txtended) {
+        memcpy(p, R->txtrawend, hdr.txtended * sizeof(uint32_t));     p += hdr.txtended * sizeof(uint32_t);
+    }
+    if (hdr.ri) { memcpy(p, R->raw, hdr.ri);                          p += hdr.ri; }
+    if (hdr.ti) { memcpy(p, R->txt, hdr.ti);                          p += hdr.ti; }
+
+    RETURN(snap);
+}
+
+
+
+int restore_rtfobj(rtfobj *R, const void *snap, size_t len) {
+    const rtfsnaphdr  *hdr = snap;
+    const rtfsnapattr *sa;
+    const char        *p;
+    rtfattr           *a;
+    uint32_t           i;
+
+    BEGIN_FUNCTION
+
+    if (len < sizeof *hdr ||
+        memcmp(hdr->magic, RTFSNAP_MAGIC, sizeof RTFSNAP_MAGIC) ||
+        hdr->version != RTFSNAP_VERSION ||
+        hdr->hdrz != sizeof *hdr ||
+        hdr->nattr == 0) {
+        FAIL(EINVAL, "Not a compatible snapshot");
+    }
+
+    // Nothing is touched until the whole snapshot checks out
+    if (!snap_valid(hdr, len)) FAIL(EINVAL, "Snapshot is truncated or corrupt");
+
+    // The caller has positioned R->fin at hdr->offset
+    discard_parse_state(R);
+
+    if ((hdr->nfonts > R->fonttbl_z && !reserve_fonttbl(R, hdr->nfonts)) ||
+        (hdr->ri + 1 > R->rawz && !reserve_raw(R, hdr->ri + 1)) ||
+        (hdr->ti + 1 > R->txtz && !reserve_txt(R, hdr->ti + 1))) {
+        if (!R->fatalerr) R->fatalerr = EINVAL;
+        FAIL(R->fatalerr, "Snapshot exceeds this object's limits");
+    }
+
+    sa = (const rtfsnapattr *)(hdr + 1);
+    for (i = 0; i < hdr->nattr; i++) {
+        if (i > 0) {
+            push_attr(R);
+            if (R->fatalerr) FAIL(R->fatalerr, "Could not rebuild attribute stack");
+        }
+        a = R->attr;
+        a->uc               = sa[i].uc;
+        a->uccountdown      = sa[i].uccountdown;
+        a->fonttbl_defn_idx = sa[i].fonttbl_defn_idx;
+        a->codepage         = (cpg_t)sa[i].codepage;
+        a->fonttbl          = sa[i].fonttbl;
+        a->blkoptional      = sa[i].blkoptional;
+        a->nocmd            = sa[i].nocmd;
+        a->notxt            = sa[i].notxt;
+        a->xtra             = sa[i].xtra;
+        a->infofield        = sa[i].infofield;
+        a->ininfo           = sa[i].ininfo;
+    }
+    p = (const char *)(sa + hdr->nattr);
+
+    R->fonttbl_n = hdr->nfonts;
+    if (hdr->nfonts) {
+        memcpy(R->fonttbl_f,       p, hdr->nfonts * sizeof(int32_t));  p += hdr->nfonts * sizeof(int32_t);
+        memcpy(R->fonttbl_charset, p, hdr->nfonts * sizeof(int32_t));  p += hdr->nfonts * sizeof(int32_t);
+    }
+    if (hdr->ti) {
+        memcpy(R->txtrawmap, p, hdr->ti * sizeof(uint32_t));           p += hdr->ti * sizeof(uint32_t);
+    }
+    if (hdr->txtended) {
+        // Only meaningful if this object also matches with a dictionary
+        if (R->txtrawend) {
+            memcpy(R->txtrawend, p, hdr->txtended * sizeof(uint32_t));
+            R->txtended = hdr->txtended;
+        }
+        p += hdr->txtended * sizeof(uint32_t);
+    }
+    if (hdr->ri) { memcpy(R->raw, p, hdr->ri);                         p += hdr->ri; }
+    if (hdr->ti) { memcpy(R->txt, p, hdr->ti);                         p += hdr->ti; }
+
+    R->ri               = hdr->ri;
+    R->ti               = hdr->ti;
+    forget_matches(R);
+    R->rawpos           = (size_t)hdr->rawpos;
+    R->txtpos           = (size_t)hdr->txtpos;
+    R->defaultfont      = hdr->defaultfont;
+    R->documentcodepage = (cpg_t)hdr->documentcodepage;
+    R->highsurrogate    = hdr->highsurrogate;
+    R->rawbraces        = hdr->rawbraces;
+    R->rawescaped       = hdr->rawescaped;
+    R->txtdeferred      = hdr->txtdeferred;
+
+    RETURN(0);
+}
+
+
+
+static bool snap_valid(const rtfsnaphdr *hdr, size_t len) {
+    const rtfsnapattr *sa = (const rtfsnapattr *)(hdr + 1);
+    const uint32_t    *map;
+    uint64_t           need;
+    uint32_t           idx, last;
+    uint32_t           i;
+
+    need = sizeof *hdr
+         + (uint64_t)hdr->nattr * sizeof *sa
+         + 2 * (uint64_t)hdr->nfonts * sizeof(int32_t)
+         + (uint64_t)hdr->ti * sizeof(uint32_t)
+         + (uint64_t)hdr->txtended * sizeof(uint32_t)
+         + hdr->ri
+         + hdr->ti;
+    if (need > len || hdr->txtended > hdr->ti) return false;
+
+    // Values that end up as indices must be in range. The font being
+    // defined only counts inside the font table; \fonttbl resets it.
+    for (i = 0; i < hdr->nattr; i++) {
+        if ((sa[i].fonttbl && (sa[i].fonttbl_defn_idx < -1 ||
+                               (sa[i].fonttbl_defn_idx >= 0 &&
+                                (uint32_t)sa[i].fonttbl_defn_idx >= hdr->nfonts))) ||
+            sa[i].infofield > sizeof infodests / sizeof *infodests ||
+            sa[i].uccountdown > sa[i].uc) {
+            return false;
+        }
+    }
+
+    // Both maps hold input offsets, which must fall within raw[] in order
+    map = (const uint32_t *)((const char *)(sa + hdr->nattr) + 2 * (size_t)hdr->nfonts * sizeof(int32_t));
+    for (i = 0, last = 0; i < hdr->ti + hdr->txtended; i++) {
+        if (i == hdr->ti) last = 0;
+        idx = map[i] - (uint32_t)hdr->rawpos;
+        if (idx > hdr->ri || idx < last) return false;
+        last = idx;
+    }
+
+    return true;
+}
+
+
+
+static void discard_parse_state(rtfobj *R) {
+    BEGIN_FUNCTION
+
+    // Drop the attribute stack and any buffered input without output
+    while (R->attr != &R->topattr) pop_attr(R);
+    memzero(&R->topattr, sizeof R->topattr);
+    R->topattr.uc = 1;
+    R->attr = &R->topattr;
+
+    if (R->raw) memzero(R->raw, R->ri);
+    if (R->txt) memzero(R->txt, R->ti);
+    if (R->cmd) memzero(R->cmd, R->ci);
+    R->ri = R->ti = R->ci = 0;
+    R->txtended      = 0;
+    forget_matches(R);
+    R->rawpos        = 0;
+    R->txtpos        = 0;
+    R->rawbraces     = 0;
+    R->rawescaped    = false;
+    R->highsurrogate = 0;
+    R->txtdeferred   = false;
+    R->fatalerr      = 0;
+
+    // Likewise a picture being held back or extracted
+    R->pictz         = 0;
+    R->pictdepth     = 0;
+    R->pictreaddepth = 0;
+    R->pictbinleft   = 0;
+
+    RETURN();
+}
+
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                         DISPATCH FUNCTIONS                          ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+static void dispatch_scope(int c, rtfobj *R) {
+    char   b = (char)c;
+    size_t depth = R->depth;
+
+    BEGIN_FUNCTION
+
+    if (R->pictdepth) add_to_pict(&b, 1, R);
+    else              add_to_raw(c, R);
+
+    if      (c == '{')  { push_attr(R); R->attr->grouppos = input_offset(R) - 1; }
+    else if (c == '}')  pop_attr(R);
+
+    // Closing a picture group
+    if (c == '}' && R->pictreaddepth && depth == R->pictreaddepth) end_pict_read(R, false);
+    if (c == '}' && R->pictdepth     && depth == R->pictdepth)     finish_pict(R);
+
+    RETURN();
+}
+
+
+
+static void dispatch_command(rtfobj *R) {
+    BEGIN_FUNCTION
+
+    TRACE_BEGIN(tread);
+    read_command(R);
+    TRACE_END(tread, "tokenize", NULL);
+
+    TRACE_BEGIN(tcmd);
+
+    // Picture properties are read even though the group's commands are not
+    if (R->pictreaddepth == R->depth && R->pictreaddepth)   proc_pict_property(R);
+
+    // Hex escapes are all of the text in some documents (e.g., those saved
+    // by WordPad or TextEdit), so they don't wait on proc_command()'s search
+    if (R->attr->nocmd)                            ;
+    else if (R->cmd[1] == '\'' && is_hex_escape(R->cmd)) {
+        proc_cmd_apostrophe(R);
+        R->attr->blkoptional = false;
+    }
+    else                                           proc_command(R);
+
+    TRACE_END(tcmd, "command", R->cmd);
+
+    // ----- RAW/TXT BUFFER COORDINATION -----
+    // We won't know whether to flush or keep raw data until after we look at
+    // the text it contains. Deferring adding content to the raw output buffer
+    // until AFTER the text or command is known keeps this cleaner. Then we
+    // can, e.g., flush the existing raw buffer the first time text is added,
+    // knowing that we won't be flushing the raw RTF code that *corresponds*
+    // to the text we just added.
+    if (R->pictdepth) add_to_pict(R->cmd, strlen(R->cmd), R);
+    else              add_cmdstring_to_raw(R->cmd, R);
+
+    // The payload of \binN follows the command directly
+    if (R->pictbinleft) read_pict_bin(R);
+
+    RETURN();
+}
+
+
+
+static void dispatch_text(int c, rtfobj *R) {
+    BEGIN_FUNCTION
+
+    if (R->attr->notxt) {
+        char b = (char)c;
+        if (R->pictreaddepth == R->depth && R->pictreaddepth && isxdigit(c)) read_pict_hex(c, R);
+        else if (R->pictdepth) add_to_pict(&b, 1, R);
+        else                   add_to_raw(c, R);
+        RETURN();
+    }
+
+    // Ignore newlines and carriage returns in RTF code. Consider tabs and
+    // vertical tabs to be interchangeable with spaces. Treat everything else
+    // literally.
+    switch(c) {
+        case '\r':
+        case '\n':
+            break;
+        case '\t':
+            add_to_txt(0x09, R);
+            break;
+        case '\v':
+            add_to_txt(' ', R);
+            break;
+        default:
+            add_to_txt(c, R);
+    }
+    add_to_raw(c, R);
+
+    RETURN();
+}
+
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                       PATTERN MATCH FUNCTION                        ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+// COST. With K keys of at most L bytes, matching is linear in the input.
+// A call does nothing unless the last token added text, and otherwise
+// leaves at most L bytes of text pending, so it tries at most L offsets
+// against each key: O(K * L^2) per byte of text, where the dictionary walk
+// is O(L log 256) per offset instead and O(1) per byte for a pending match
+// at offset 0. Every raw byte is scanned for braces once as it arrives and
+// once as it leaves, and moved down once per shift while pending, which is
+// at most L times.
+static int pattern_match(rtfobj *R) {
+    size_t offset;
+    size_t curkey;
+    size_t i;
+
+    BEGIN_FUNCTION
+
+    if (R->dict) RETURN(layered_match(R, false));
+    if (R->matchpolicy != RTF_MATCH_DEFAULT) RETURN(policy_match(R, false));
+
+    if (R->ti < 1 || R->attr->notxt) RETURN(PARTIAL);
+
+    // Tokens that add no text can't change the outcome
+    if (R->ti == R->txtmatched) RETURN(PARTIAL);
+
+    // Only offsets holding a byte that begins some key are worth trying; if
+    // there are none, the whole run falls through to be flushed below.
+    for (offset = next_key_candidate(R, 0);
+         offset < R->ti;
+         offset = next_key_candidate(R, offset + 1)) {
+        for (curkey = 0; curkey < R->srchz; curkey++) {
+
+            // Inline early-fail strcmp. Library function is slow on macOS.
+            // KEY: i = index of '\0' OR first non-matching character
+            for (i = 0;
+                 R->txt[offset+i] == R->srch_key[curkey][i] &&
+                 R->txt[offset+i] != '\0';
+                 i++);
+
+            // We can tell if there's a match by whether i is the index of a
+            // mismatch or the end of the string.  If it's the end of the
+            // string, then there is a complete match, and we need to output
+            // the appropriate replacement.
+            // The fastest/easiest way to determine that is whether the index
+            // is equal between the two strings.  If it is, then a mismatch is
+            // not what caused the above loop to break; it must have been the
+            // null terminator.
+            if (R->txt[offset+i] == R->srch_key[curkey][i]) {
+                // But if we're at an offeset within the text buffer, we need
+                // to output the raw data corresponding to the text buffer
+                // before the offset.
+                if (offset > 0) {
+                    output_raw_by(R, txt_raw_idx(R, offset));
+                    reset_raw_buffer_by(R, txt_raw_idx(R, offset));
+                    reset_txt_buffer_by(R, offset);
+                }
+                R->srch_match = curkey;
+                output_match(R);
+                reset_raw_buffer(R);
+                reset_txt_buffer(R);
+                RETURN(MATCH);
+            }
+            else if (R->txt[offset+i] == '\0') { // Not both '\0' but txt[j] is '\0'
+                // Reached the end of the text buffer (the data we've read in so
+                // far) without finding a mismatch, but haven't reached the end
+                // of the replacement key. That means it's a partial match.
+                // TODO: Continue checking to see if we have a complete match
+                // later in the replacement list. Alternatively, we could sort
+                // the replacement list by shortest to longest key.
+                if (offset > 0) {
+                    output_raw_by(R, txt_raw_idx(R, offset));
+                    reset_raw_buffer_by(R, txt_raw_idx(R, offset));
+                    reset_txt_buffer_by(R, offset);
+                }
+                R->txtmatched = R->ti;
+                RETURN(PARTIAL);
+            }
+        }
+    }
+
+    output_raw(R);
+    reset_raw_buffer(R);
+    reset_txt_buffer(R);
+
+    RETURN(NOMATCH);
+}
+
+
+
+
+
+
+
+
+static int layered_match(rtfobj *R, bool final) {
+    const rtfdict *D = R->dict;
+    const char *key;
+    int      policy = R->matchpolicy ? R->matchpolicy : RTF_MATCH_LONGEST;
+    size_t   offset;
+    size_t   i;
+    size_t   k;
+    size_t   len;
+    size_t   best;
+    size_t   bestlen;
+    size_t   waitfor;
+    size_t   walkend;
+    size_t   walkbest;
+    size_t   walkbestlen;
+    uint32_t node;
+    uint32_t next;
+    bool     matched;
+    bool     any = false;
+
+    BEGIN_FUNCTION
+
+    // Text added by the step just processed ends where the raw buffer does
+    for (; R->txtended < R->ti; R->txtended++) {
+        R->txtrawend[R->txtended] = (uint32_t)(R->rawpos + R->ri);
+    }
+
+    if (R->ti < 1 || R->attr->notxt) RETURN(PARTIAL);
+
+    // Tokens that add no text can't change the outcome
+    if (!final && R->ti == R->txtmatched) RETURN(PARTIAL);
+
+    do {
+        matched = false;
+
+        for (offset = next_key_candidate(R, 0);
+             offset < R->ti;
+             offset = next_key_candidate(R, offset + 1)) {
+
+            // Key numbers here are 1 + the index given to rtfobj_key(), or
+            // 0 for none. waitfor is the first key that matches as far as
+            // the text goes but is not yet complete.
+            best = 0;
+            bestlen = 0;
+            waitfor = 0;
+
+            // Walk as far as the text allows. Keys are sorted, so the first
+            // one passed is both the shortest and the first in order, and
+            // any key further down comes after every key passed. A partial
+            // match at the start of the text picks up where the last walk
+            // stopped, so each byte is only walked once while it is pending.
+            node = 0;
+            walkend = offset;
+            if (D) {
+                i = offset;
+                if (offset == 0 && R->walkz) {
+                    node    = R->walknode;
+                    i       = R->walkz;
+                    best    = R->walkbest;
+                    bestlen = R->walkbestlen;
+                }
+                for (; i < R->ti; i++) {
+                    if (!(next = dict_child(D, node, (uint8_t)R->txt[i]))) break;
+                    node = next;
+                    if (D->nodes[node].entry && (!best || policy == RTF_MATCH_LONGEST)) {
+                        best = R->srchz + D->nodes[node].entry;
+                        bestlen = i + 1 - offset;
+                    }
+                }
+                if (!final && i == R->ti && D->nodes[node].nkids > 0) waitfor = SIZE_MAX;
+                walkend = i;
+            }
+            walkbest    = best;
+            walkbestlen = bestlen;
+
+            // The object's own keys are a small override layer on top, and
+            // count as registered before any dictionary key. On a tie in
+            // length the override wins, so a key in both takes its value.
+            for (k = 0; k < R->srchz; k++) {
+                key = R->srch_key[k];
+                for (i = offset; i < R->ti && key[i - offset] && R->txt[i] == key[i - offset]; i++);
+                len = i - offset;
+
+                if (!key[len]) {
+                    if (len == 0) continue;
+                    if ((policy == RTF_MATCH_LONGEST  && len >= bestlen) ||
+                        (policy == RTF_MATCH_SHORTEST && (!best || len <= bestlen)) ||
+                        (policy == RTF_MATCH_FIRST    && (!best || k + 1 < best))) {
+                        best = k + 1;
+                        bestlen = len;
+                    }
+                }
+                else if (!final && i == R->ti && (!waitfor || k + 1 < waitfor)) {
+                    waitfor = k + 1;
+                }
+            }
+
+            // Wait for more text if an incomplete key could still win: under
+            // LONGEST always, under SHORTEST only if nothing is complete, and
+            // under FIRST if it was registered before the best complete key.
+            if (waitfor && (!best || policy == RTF_MATCH_LONGEST ||
+                            (policy == RTF_MATCH_FIRST && waitfor < best))) {
+                if (offset > 0) {
+                    output_raw_by(R, txt_raw_idx(R, offset));
+                    reset_raw_buffer_by(R, txt_raw_idx(R, offset));
+                    reset_txt_buffer_by(R, offset);
+                }
+                R->txtmatched = R->ti;
+                if (D && walkend == offset + R->ti) {
+                    R->walkz       = R->ti;
+                    R->walknode    = node;
+                    R->walkbest    = walkbest;
+                    R->walkbestlen = walkbestlen;
+                }
+                RETURN(PARTIAL);
+            }
+
+            if (best) {
+                if (offset > 0) {
+                    output_raw_by(R, txt_raw_idx(R, offset));
+                    reset_raw_buffer_by(R, txt_raw_idx(R, offset));
+                    reset_txt_buffer_by(R, offset);
+                }
+                R->srch_match = best - 1;
+                output_match_by(R, bestlen);
+                matched = any = true;
+                break;
+            }
+        }
+
+    // Whatever follows a match may hold the start of another key
+    } while (matched && R->ti > 0);
+
+    if (R->ti == 0) RETURN(any ? MATCH : NOMATCH);
+
+    output_raw(R);
+    reset_raw_buffer(R);
+    reset_txt_buffer(R);
+
+    RETURN(any ? MATCH : NOMATCH);
+}
+
+
+
+static int policy_match(rtfobj *R, bool final) {
+    const char *key;
+    int      policy = R->matchpolicy;
+    size_t   offset;
+    size_t   i;
+    size_t   k;
+    size_t   len;
+    size_t   best;
+    size_t   bestlen;
+    size_t   waitfor;
+    bool     matched;
+    bool     any = false;
+
+    BEGIN_FUNCTION
+
+    // pattern_match()'s loop, but weighing every key at an offset under the
+    // policy rather than taking the first. Only a pending match needs to
+    // know where its text's tokens end, so txtrawend[] is filled in for
+    // those bytes alone, rather than for all text as layered_match() does.
+    if (R->ti < 1 || R->attr->notxt) RETURN(PARTIAL);
+
+    // Tokens that add no text can't change the outcome
+    if (!final && R->ti == R->txtmatched) RETURN(PARTIAL);
+
+    do {
+        matched = false;
+
+        for (offset = next_key_candidate(R, 0);
+             offset < R->ti;
+             offset = next_key_candidate(R, offset + 1)) {
+
+            // Key numbers here are 1 + the index, or 0 for none. waitfor is
+            // the first key that matches as far as the text goes but is not
+            // yet complete.
+            best = 0;
+            bestlen = 0;
+            waitfor = 0;
+
+            for (k = 0; k < R->srchz; k++) {
+                // Same early-fail compare as pattern_match(): the text is
+                // NUL-terminated, so i stops at the first difference or NUL
+                key = R->srch_key[k];
+                for (i = 0; R->txt[offset+i] == key[i] && key[i] != '\0'; i++);
+                len = i;
+
+                if (!key[len]) {
+                    if (len == 0) continue;
+                    if ((policy == RTF_MATCH_LONGEST  && len > bestlen) ||
+                        (policy == RTF_MATCH_SHORTEST && (!best || len < bestlen)) ||
+                        (policy == RTF_MATCH_FIRST    && !best)) {
+                        best = k + 1;
+                        bestlen = len;
+                    }
+                }
+                else if (!final && offset + i == R->ti && !waitfor) {
+                    waitfor = k + 1;
+                }
+
+                // Later keys can't change the outcome: under FIRST once any
+                // key gets this far, and under LONGEST once there's one to
+                // wait for
+                if ((policy == RTF_MATCH_FIRST   && (best || waitfor)) ||
+                    (policy == RTF_MATCH_LONGEST && waitfor)) {
+                    break;
+                }
+            }
+
+            // Wait for more text if an incomplete key could still win: under
+            // LONGEST always, under SHORTEST only if nothing is complete, and
+            // under FIRST if it was registered before the best complete key.
+            if (waitfor && (!best || policy == RTF_MATCH_LONGEST ||
+                            (policy == RTF_MATCH_FIRST && waitfor < best))) {
+                if (offset > 0) {
+                    output_raw_by(R, txt_raw_idx(R, offset));
+                    reset_raw_buffer_by(R, txt_raw_idx(R, offset));
+                    reset_txt_buffer_by(R, offset);
+                }
+                note_txt_ends(R);
+                R->txtmatched = R->ti;
+                RETURN(PARTIAL);
+            }
+
+            if (best) {
+                if (offset > 0) {
+                    output_raw_by(R, txt_raw_idx(R, offset));
+                    reset_raw_buffer_by(R, txt_raw_idx(R, offset));
+                    reset_txt_buffer_by(R, offset);
+                }
+                R->srch_match = best - 1;
+                if (bestlen == R->ti) {
+                    output_match(R);
+                    reset_raw_buffer(R);
+                    reset_txt_buffer(R);
+                }
+                else {
+                    // Ends before the text does: text this token added
+                    // hasn't been noted yet
+                    note_txt_ends(R);
+                    output_match_by(R, bestlen);
+                }
+                matched = any = true;
+                break;
+            }
+        }
+
+    // Whatever follows a match may hold the start of another key
+    } while (matched && R->ti > 0);
+
+    if (R->ti == 0) RETURN(any ? MATCH : NOMATCH);
+
+    output_raw(R);
+    reset_raw_buffer(R);
+    reset_txt_buffer(R);
+
+    RETURN(any ? MATCH : NOMATCH);
+}
+
+
+
+static void settle_match(rtfobj *R) {
+    BEGIN_FUNCTION
+
+    // No more text can arrive to extend a pending match
+    if (R->dict)                                  layered_match(R, true);
+    else if (R->matchpolicy != RTF_MATCH_DEFAULT) policy_match(R, true);
+
+    RETURN();
+}
+
+
+
+static void note_txt_ends(rtfobj *R) {
+    // Text not yet noted came from the step just processed, which ends
+    // where the raw buffer does
+    for (; R->txtended < R->ti; R->txtended++) {
+        R->txtrawend[R->txtended] = (uint32_t)(R->rawpos + R->ri);
+    }
+}
+
+
+
+static inline uint32_t dict_child(const rtfdict *D, uint32_t node, uint8_t b) {
+    const uint8_t *labels = &D->labels[D->nodes[node].first];
+    uint32_t n = D->nodes[node].nkids;
+    uint32_t lo = 0;
+    uint32_t hi = n;
+    uint32_t mid;
+
+    // Returns the child node, or 0 (the root, which is nobody's child)
+    if (n <= 8) {
+        for (mid = 0; mid < n; mid++) {
+            if (labels[mid] == b) return D->nodes[node].first + mid + 1;
+        }
+        return 0;
+    }
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (labels[mid] < b) lo = mid + 1;
+        else                 hi = mid;
+    }
+
+    return (lo < n && labels[lo] == b) ? D->nodes[node].first + lo + 1 : 0;
+}
+
+
+
+static void output_match_by(rtfobj *R, size_t len) {
+    size_t rawend;
+    size_t savedri;
+    int    savedbraces;
+    size_t i;
+
+    BEGIN_FUNCTION
+
+    // The match covers its text and the raw RTF up to the end of the token
+    // that produced its last byte; anything after that is left buffered.
+    // (Text after the match from that same token goes with it.)
+    rawend = txt_raw_end(R, len - 1);
+
+    if (rawend >= R->ri) {
+        output_match(R);
+        reset_raw_buffer(R);
+        reset_txt_buffer(R);
+        RETURN();
+    }
+
+    // Braces must net out over the matched part alone, and what's left
+    // keeps the rest, so the matched part is only scanned once
+    savedri = R->ri;
+    savedbraces = R->rawbraces;
+    R->rawbraces = 0;
+    for (i = 0; i < rawend; i++) {
+        if      (R->raw[i] == '\\') i++;
+        else if (R->raw[i] == '{')  R->rawbraces++;
+        else if (R->raw[i] == '}')  R->rawbraces--;
+    }
+
+    R->ri = rawend;
+    output_match(R);
+    R->ri = savedri;
+    R->rawbraces = savedbraces - R->rawbraces;
+
+    shift_raw_buffer(R, rawend);
+    reset_txt_buffer_by(R, len);
+
+    RETURN();
+}
+
+
+
+static inline size_t next_key_candidate(const rtfobj *R, size_t offset) {
+    const char *p;
+
+    if (R->nkeyfirst == 1) {
+        p = memchr(&R->txt[offset], R->keylead, R->ti - offset);
+        return p ? (size_t)(p - R->txt) : R->ti;
+    }
+
+    if (R->nkeyfirst == 0) return R->ti;
+
+    while (offset < R->ti) {
+        uint8_t b = (uint8_t)R->txt[offset];
+        if (R->keyfirst[b >> 3] & (1u << (b & 7))) break;
+        offset++;
+    }
+
+    return offset;
+}
+
+
+
+static void note_key_first(rtfobj *R, const char *key) {
+    uint8_t b = (uint8_t)key[0];
+
+    // An empty key never matches, so it adds no candidates
+    if (b == '\0' || (R->keyfirst[b >> 3] & (1u << (b & 7)))) return;
+
+    R->keyfirst[b >> 3] |= (uint8_t)(1u << (b & 7));
+    R->keylead = b;
+    R->nkeyfirst++;
+}
+
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                  COMMAND DISPATCH HELPER FUNCTIONS                  ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+static void read_command(rtfobj *R) {
+    int c;
+
+    BEGIN_FUNCTION
+
+    reset_cmd_buffer(R);
+
+    add_to_cmd('\\', R);
+
+    if ((c=fgetc(R->fin)) == EOF) { R->fatalerr = EIO; FAIL(VOID, "Unexpected EOF"); }
+
+    switch (c) {
+        case '{':  // Escaped literal
+        case '}':  // Escaped literal
+        case '\\': // Escaped literal
+        case '~':  // Special one-character stand-in
+        case '_':  // Special one-character stand-in
+        case '-':  // Special one-character stand-in
+        case '*':  // Special one-character command
+        case '\n': // Line Feed --> newline
+            add_to_cmd(c, R);
+            break;
+        case '\r': // Carriage Return --> newline
+            add_to_cmd(c, R);
+
+            // Check if next character is a newline, to avoid double newlines
+            // for platforms with CRLF line terminators.
+            if ((c=fgetc(R->fin)) == EOF) { R->fatalerr = EIO; FAIL(VOID, "EOF after \\\\r"); }
+
+            if (c == '\n') {
+                add_to_cmd(c, R);
+            }
+            else {
+                ungetc(c, R->fin);
+            }
+
+            break;
+        case '\'':
+            add_to_cmd(c, R);
+
+            if ((c=fgetc(R->fin)) == EOF) { R->fatalerr = EIO; FAIL(VOID, "EOF AFTER \\' command"); }
+            add_to_cmd(c, R);
+
+            if ((c=fgetc(R->fin)) == EOF) { R->fatalerr = EIO; FAIL(VOID, "EOF AFTER \\'_ command"); }
+            add_to_cmd(c, R);
+
+            break;
+        default:
+            if (!isalnum(c)) { R->fatalerr = EINVAL; FAIL(VOID, "Invalid command format |%s|...", R->cmd); }
+            add_to_cmd(c, R);
+
+            // Greedily add input bytes to command buffer, so long as they're valid
+            while ((c = fgetc(R->fin)) != EOF) {
+                if (isalnum(c) || c == '-') add_to_cmd(c, R);
+                else break;
+            }
+
+            // Stopped getting valid command bytes. What now? Depends on if it's an EOF
+            // or a space or something else. "Something else" is probably a backslash
+            // for the next command, so we need to put it back on the input stream.
+            if (c == EOF)         LOG("Unexpected EOF") && (R->fatalerr = EIO);
+            else if (isspace(c))  add_to_cmd(c, R);
+            else                  ungetc(c, R->fin);
+
+            break;
+    }
+
+    RETURN();
+}
+
+
+
+static void proc_command(rtfobj *R) {
+    // Set pointer for internal use so that we don't have to deal with
+    // backslashes at the beginning of our regular expression matching
+    char *c = &R->cmd[1];
+
+    BEGIN_FUNCTION
+
+    if (0);
+    else if (CHR_MATCH(c,'{'))                   proc_cmd_escapedliteral(R);
+    else if (CHR_MATCH(c,'}'))                   proc_cmd_escapedliteral(R);
+    else if (CHR_MATCH(c,'\\'))                  proc_cmd_escapedliteral(R);
+    else if (CHR_MATCH(c,'~'))                   proc_cmd_specialstandin(R);
+    else if (CHR_MATCH(c,'_'))                   proc_cmd_specialstandin(R);
+    else if (CHR_MATCH(c,'-'))                   proc_cmd_specialstandin(R);
+    else if (CHR_MATCH(c,'\r'))                  proc_cmd_newline(R);
+    else if (CHR_MATCH(c,'\n'))                  proc_cmd_newline(R);
+    else if (RGX_MATCH(c,"^\'\\x\\x"))           proc_cmd_apostrophe(R);
+    else if (RGX_MATCH(c,"^u-?\\d+\\s?$"))       proc_cmd_u(R);
+    else if (RGX_MATCH(c,"^uc\\d+\\s?$"))        proc_cmd_uc(R);
+    else if (RGX_MATCH(c,"^f\\d+\\s?$"))         proc_cmd_f(R);
+    else if (RGX_MATCH(c,"^fcharset\\d+\\s?$"))  proc_cmd_fcharset(R);
+    else if (RGX_MATCH(c,"^cchs\\d+\\s?$"))      proc_cmd_cchs(R);
+    else if (RGX_MATCH(c,"^deff\\d+\\s?$"))      proc_cmd_deff(R);
+    else if (RGX_MATCH(c,"^fonttbl\\s?$"))       proc_cmd_fonttbl(R);
+    else if (RGX_MATCH(c,"^par\\s?$"))           proc_cmd_newpar(R);
+    else if (RGX_MATCH(c,"^line\\s?$"))          proc_cmd_newline(R);
+    else if (RGX_MATCH(c,"^pict\\s?$"))          proc_cmd_pict(R);
+    else if (RGX_MATCH(c,"^shppict\\s?$"))       proc_cmd_shppict(R);
+    else if (RGX_MATCH(c,"^colortbl\\s?$"))      proc_cmd_shuntblock(R);
+    else if (RGX_MATCH(c,"^stylesheet\\s?$"))    proc_cmd_shuntblock(R);
+    else if (RGX_MATCH(c,"^title\\s?$"))         proc_cmd_infodest(R);
+    else if (RGX_MATCH(c,"^subject\\s?$"))       proc_cmd_infodest(R);
+    else if (RGX_MATCH(c,"^author\\s?$"))        proc_cmd_infodest(R);
+    else if (RGX_MATCH(c,"^manager\\s?$"))       proc_cmd_infodest(R);
+    else if (RGX_MATCH(c,"^company\\s?$"))       proc_cmd_infodest(R);
+    else if (RGX_MATCH(c,"^operator\\s?$"))      proc_cmd_infodest(R);
+    else if (RGX_MATCH(c,"^category\\s?$"))      proc_cmd_infodest(R);
+    else if (RGX_MATCH(c,"^keywords\\s?$"))      proc_cmd_infodest(R);
+    else if (RGX_MATCH(c,"^comment\\s?$"))       proc_cmd_infodest(R);
+    else if (RGX_MATCH(c,"^doccomm\\s?$"))       proc_cmd_infodest(R);
+    else if (RGX_MATCH(c,"^hlinkbase\\s?$"))     proc_cmd_infodest(R);
+    else if (RGX_MATCH(c,"^creatim\\s?$"))       proc_cmd_infodest(R);
+    else if (RGX_MATCH(c,"^revtim\\s?$"))        proc_cmd_infodest(R);
+    else if (RGX_MATCH(c,"^printim\\s?$"))       proc_cmd_infodest(R);
+    else if (RGX_MATCH(c,"^buptim\\s?$"))        proc_cmd_infodest(R);
+    else if (RGX_MATCH(c,"^userprops\\s?$"))     proc_cmd_shuntblock(R);
+    else if (RGX_MATCH(c,"^bin\\s?$"))           proc_cmd_shuntblock(R);
+    else if (R->info && proc_cmd_info(R))        ;
+    else                                         proc_cmd_unknown(R);
+
+    // If the command is \* then the entire block is optional, but...
+    // if we then recognize the command, revoke any 'optional' status.
+    if (RGX_MATCH(c, "^*$"))             R->attr->blkoptional = true;
+    else                                 R->attr->blkoptional = false;
+
+    RETURN();
+}
+
+
+
+static inline void proc_cmd_escapedliteral(rtfobj *R) {
+    BEGIN_FUNCTION
+
+    add_to_txt(R->cmd[1], R);
+
+    RETURN();
+}
+
+
+
+static inline void proc_cmd_specialstandin(rtfobj *R) {
+    BEGIN_FUNCTION
+
+    int32_t cdpt = 0;
+
+    if (R->cmd[1] == '~') cdpt = 0x00A0; // Non-breaking space
+    if (R->cmd[1] == '_') cdpt = 0x2011; // Non-breaking hyphen
+    if (R->cmd[1] == '-') cdpt = 0x00AD; // Soft hyphen
+
+    if (cdpt) add_string_to_txt((const char*)utf8_from_cdpt(cdpt), R);
+
+    RETURN();
+}
+
+
+
+static inline void proc_cmd_uc(rtfobj *R) {
+    BEGIN_FUNCTION
+
+    R->attr->uc = (size_t)get_num_arg(&R->cmd[1]);
+
+    RETURN();
+}
+
+
+
+static void proc_cmd_u(rtfobj *R) {
+    int32_t arg;
+
+    BEGIN_FUNCTION
+
+    arg = get_num_arg(&R->cmd[2]);
+
+    // RTF 1.9 Spec: "Most RTF control words accept signed 16-bit numbers as
+    // arguments. For these control words, Unicode values greater than 32767
+    // are expressed as negative numbers. For example, the character code
+    // U+F020 is given by \u-4064. To get -4064, convert F020 16 to decimal
+    // (61472) and subtract 65536."
+    if (arg < 0) arg = arg + 65536;
+
+    // RTF 1.9 Spec: RTF supports "[s]urrogate pairs like \u-10187?\u-9138?"
+    // Unicode 15.0, Sec. 23.6: "The use of surrogate pairs... is formally
+    // equivalent to [what is] defined in ISO/IEC 10646.... The high-surrogate
+    // code points are [in]] range U+D800..U+DBFF [and are always] the first
+    // element of a surrogate pair.... The low-surrogate code points are [in]
+    // range U+DC00..U+DFFF [and are] always the second element...."
+    if (0xD800 <= arg && arg <= 0xDBFF) {
+        // Argument is in the high surrogate range.  We need to tell the
+        // add_to_txt function that we're adding text (so it can do text
+        // setup, etc.), even though we don't have anything to add to the
+        // text buffer yet.
+        R->highsurrogate = arg;
+        add_to_txt(0, R);
+    } else if (0xDC00 <= arg && arg <= 0xDFFF) {
+        // Argument is in the low surrogate range
+        int32_t cdpt = cdpt_from_utf16((uint16_t)R->highsurrogate, (uint16_t)arg);
+        add_string_to_txt((const char*)utf8_from_cdpt(cdpt), R);
+    } else {
+        // Argument is likely in the Basic Multilingual Plane
+        add_string_to_txt((const char*)utf8_from_cdpt(arg), R);
+    }
+
+    R->attr->uccountdown = R->attr->uc;
+
+    RETURN();
+}
+
+
+
+static void proc_cmd_apostrophe(rtfobj *R) {
+    int32_t cdpt;
+    uint8_t arg;
+    const int32_t *mult = NULL;
+
+    BEGIN_FUNCTION
+
+    cpg_t cpg = (R->attr->codepage)?(R->attr->codepage):(R->documentcodepage);
+
+    if (R->attr->uccountdown) { R->attr->uccountdown--; RETURN(); }
+
+    arg = get_hex_arg(R->cmd);
+    cdpt = cpgtou(cpg, arg, &R->attr->xtra, &mult);
+
+    // If we are starting a double-byte sequence, then we need to tell the
+    // add_to_txt function that we're adding text (so it can do text setup,
+    // etc.), even though we don't actually have anything to add to the
+    // text buffer yet.
+    if (cdpt == cpDBSQ) {
+        add_to_txt(0, R);
+    }
+
+    // If we have multiple code points to add, add them one at a time.
+    else if (cdpt == cpMULT) {
+        for (; *mult != 0; mult++) {
+            add_string_to_txt((const char*)utf8_from_cdpt(*mult), R);
+        }
+    }
+
+    // If there's no match or the code page is unsupported, don't do anything
+    // except emit a diagnostic message (if and only if we're in debug mode).
+    else if (cdpt == cpNONE) {
+        DBUG("cpNONE: Code point %d does not exist code page %d", arg, cpg);
+    }
+    else if (cdpt == cpUNSP) {
+        DBUG("cpUNSP: Code page %d is unsupported", cpg);
+    }
+
+    // Lastly, in the general case, convert the code point to UTF-8 and add
+    // it to the text buffer.
+    else {
+        add_string_to_txt((const char*)utf8_from_cdpt(cdpt), R);
+    }
+
+    RETURN();
+}
+
+
+
+static inline void proc_cmd_fonttbl(rtfobj *R) {
+    BEGIN_FUNCTION
+
+    R->attr->notxt = true;
+    R->attr->fonttbl = true;
+    R->attr->fonttbl_defn_idx = -1;
+
+    RETURN();
+}
+
+
+
+static void proc_cmd_f(rtfobj *R) {
+    size_t i;
+    int32_t arg;
+
+    BEGIN_FUNCTION
+
+    arg = get_num_arg(&R->cmd[2]);
+
+    if (R->attr->fonttbl) {
+        // If defining a fonttbl, look for an existing font entry for f
+        for (i = 0; i < R->fonttbl_n; i++)  if (R->fonttbl_f[i] == arg) break;
+
+        // If we're at the end (i.e., not found), then add it
+        if (i == R->fonttbl_n) {
+            if (R->fonttbl_n + 1 < R->fonttbl_z || reserve_fonttbl(R, R->fonttbl_n + 2)) {
+                R->fonttbl_n++;
+                R->fonttbl_f[i]            = arg;
+                R->fonttbl_charset[i]      = cpNONE;
+                R->attr->fonttbl_defn_idx  = (int32_t)i;
+            } else {
+                FAIL(VOID, "Out of fonttbl space, not defining f%d\n", arg);
+            }
+        }
+
+        // Otherwise, we're redefining one; set the definition index
+        else {
+            R->attr->fonttbl_defn_idx  = (int32_t)i;
+        }
+    }
+
+    else {
+        for (i=0; i<R->fonttbl_n; i++) { if (R->fonttbl_f[i] == arg) break; }
+
+        if (i < R->fonttbl_n) {
+             R->attr->codepage = cpgfromcharsetnum(R->fonttbl_charset[i]);
+        }
+    }
+
+    RETURN();
+}
+
+
+
+static inline void proc_cmd_fcharset(rtfobj *R) {
+    int32_t arg;
+
+    BEGIN_FUNCTION
+
+    arg = get_num_arg(&R->cmd[9]);
+
+    // If we're defining a font table and have a valid definition index...
+    if (R->attr->fonttbl && R->attr->fonttbl_defn_idx >= 0) {
+        // Add the appropriate character set to the font table
+        R->fonttbl_charset[R->attr->fonttbl_defn_idx] = arg;
+        // Also, if we're dealing with the default font...
+        if (R->fonttbl_f[R->attr->fonttbl_defn_idx] == R->defaultfont) {
+            // Set that font's character set as the document code page.
+            R->documentcodepage = cpgfromcharsetnum(arg);
+        }
+
+    }
+
+    RETURN();
+}
+
+
+
+static inline void proc_cmd_cchs(rtfobj *R) {
+    int32_t arg;
+
+    BEGIN_FUNCTION
+
+    arg = get_num_arg(&R->cmd[5]);
+    R->attr->codepage = cpgfromcharsetnum(arg);
+
+    RETURN();
+}
+
+
+
+static inline void proc_cmd_deff(rtfobj *R) {
+    int32_t arg;
+
+    BEGIN_FUNCTION
+
+    arg = get_num_arg(&R->cmd[5]);
+    R->defaultfont = arg;
+
+    RETURN();
+}
+
+
+static inline void proc_cmd_shuntblock(rtfobj *R) {
+    BEGIN_FUNCTION
+
+    R->attr->nocmd = true;
+    R->attr->notxt = true;
+
+    RETURN();
+}
+
+
+
+static void proc_cmd_pict(rtfobj *R) {
+    size_t start;
+    size_t i;
+    bool   hold;
+
+    BEGIN_FUNCTION
+
+    proc_cmd_shuntblock(R);
+
+    // Only the outermost picture is held or read, never the document group
+    if (!R->picthook && !R->pictreader) RETURN();
+    if (R->pictdepth || R->pictreaddepth || R->depth < 2) RETURN();
+
+    // The group so far moves from the raw buffer to the picture buffer, if
+    // its "{" is still buffered (it always is, short of the raw buffer
+    // filling up just then)
+    hold = R->picthook && R->attr->grouppos >= R->rawpos;
+    if (hold) {
+        start = (size_t)(R->attr->grouppos - R->rawpos);
+        R->picthash = RTFHASH_INIT;
+        add_to_pict(&R->raw[start], R->ri - start, R);
+        if (R->fatalerr) RETURN();
+        for (i = start; i < R->ri; i++) {
+            if      (R->raw[i] == '\\') i++;
+            else if (R->raw[i] == '{')  R->rawbraces--;
+            else if (R->raw[i] == '}')  R->rawbraces++;
+        }
+        memzero(&R->raw[start], R->ri - start);
+        R->ri = start;
+    }
+
+    // A key can't continue past a picture, so whatever precedes it goes out
+    // now, as at the end of the input. That leaves the raw buffer empty
+    // until the picture's payload, which can then bypass it.
+    if (uses_txtrawend(R)) settle_match(R);
+    output_raw(R);
+    reset_raw_buffer(R);
+    reset_txt_buffer(R);
+
+    if (hold) R->pictdepth = R->depth;
+
+    if (R->pictreader) {
+        memzero(&R->pictinfo, sizeof R->pictinfo);
+        R->pictinfo.offset = R->attr->grouppos;
+        R->pictreaddepth   = R->depth;
+        R->pictnibble      = -1;
+        R->pictbinleft     = 0;
+    }
+
+    RETURN();
+}
+
+
+
+static void proc_cmd_shppict(rtfobj *R) {
+    BEGIN_FUNCTION
+
+    // Word wraps its pictures in {\*\shppict ...}. It has no text, but its
+    // commands are still read so that the \pict inside can be found.
+    R->attr->notxt = true;
+
+    RETURN();
+}
+
+
+
+static void proc_cmd_infodest(rtfobj *R) {
+    BEGIN_FUNCTION
+
+    // Metadata is only of interest to rtfgetinfo(); otherwise skip it
+    if (!R->info) { proc_cmd_shuntblock(R); RETURN(); }
+
+    R->attr->infofield = (uint8_t)find_infodest(&R->cmd[1]);
+
+    RETURN();
+}
+
+
+
+static bool proc_cmd_info(rtfobj *R) {
+    const char *c = &R->cmd[1];
+    size_t d;
+    size_t off;
+
+    BEGIN_FUNCTION
+
+    if (RGX_MATCH(c, "^info\\s?$")) {
+        R->attr->ininfo = true;
+        RETURN(true);
+    }
+
+    // Numeric values, either directly in the \info group (e.g., \nofpages)
+    // or as parts of a date (e.g., \yr within \creatim)
+    d = find_infodest(c);
+    if (d && infodests[d-1].kind == INFO_NUM && R->attr->ininfo && RGX_MATCH(c, "^\\w+-?\\d+\\s?$")) {
+        if (d - 1 < INFO_TIMEPART) {
+            off = infodests[d-1].off;
+        } else if (R->attr->infofield && infodests[R->attr->infofield-1].kind == INFO_TIME) {
+            off = infodests[R->attr->infofield-1].off + infodests[d-1].off;
+        } else {
+            RETURN(false);
+        }
+        *(int32_t *)((char *)R->info->I + off) = get_num_arg(c);
+        RETURN(true);
+    }
+
+    // Paragraph or section formatting outside of any header destination
+    // means the document body has begun
+    if (!R->attr->ininfo && (RGX_MATCH(c, "^pard\\s?$")  ||
+                             RGX_MATCH(c, "^sectd\\s?$") ||
+                             RGX_MATCH(c, "^plain\\s?$"))) {
+        R->info->done = true;
+        RETURN(true);
+    }
+
+    RETURN(false);
+}
+
+
+
+static inline void proc_cmd_newpar(rtfobj *R) {
+    BEGIN_FUNCTION
+
+    add_to_txt('\n', R);
+    add_to_txt('\n', R);
+
+    RETURN();
+}
+
+
+
+static inline void proc_cmd_newline(rtfobj *R) {
+    BEGIN_FUNCTION
+
+    add_to_txt('\n', R);
+
+    RETURN();
+}
+
+
+
+static inline void proc_cmd_unknown(rtfobj *R) {
+    BEGIN_FUNCTION
+
+    if (R->attr->blkoptional) {
+        R->attr->nocmd = true;
+        R->attr->notxt = true;
+    }
+
+    RETURN();
+}
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                     PROCESSING BUFFER FUNCTIONS                     ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+static void add_to_raw(int c, rtfobj *R) {
+    BEGIN_FUNCTION
+
+    if (R->ri + 1 >= R->rawz && !reserve_raw(R, R->ri + 2)) {
+        if (R->fatalerr) RETURN();
+        if (R->ti > 0) {
+            DBUG("Exhausted raw buffer.");
+            DBUG("R->ri = %zu. Last raw data: \'%.*s\'", R->ri, raw_tail(R));
+            DBUG("No match within limits. Flushing buffers, attempting recovery");
+            reset_txt_buffer(R);
+        }
+        ////////////////////////////////////////////////////////////////////
+        ////                         WALL OF SHAME                      ////
+        ////////////////////////////////////////////////////////////////////
+        // output_raw(R);
+        // R->ri = 0UL;
+        // R->ti = 0UL;
+        // R->ci = 0UL;
+        // memzero(R->raw, R->ri);     <-- I just fucking reset R->ri
+        // memzero(R->txt, R->ti);     <-- I just fucking reset R->ti
+        // memzero(R->cmd, R->ci);     <-- I just fucking reset R->ci
+        // I wasn't zeroing out my buffers AT ALL
+        // No wonder I was getting weird data corruption issues
+        ////////////////////////////////////////////////////////////////////
+        TRACE_BEGIN(tflush);
+        output_raw(R);
+        reset_raw_buffer(R);
+        TRACE_END(tflush, "flush", NULL);
+    }
+
+    track_raw_braces(c, R);
+    R->raw[R->ri++] = (char)c;
+
+    RETURN();
+}
+
+
+
+static void add_to_txt(int c, rtfobj *R) {
+    // Sometimes we have started adding text, but the first byte can't be
+    // added to the actual text buffer (e.g., the first surrogate in a UTF-16
+    // surrogate pair, or the first byte in a double-byte sequence).
+    // In that case, we can pass in a value of 0 for c. The function will set
+    // the deferred flag and do text setup (clean the buffers, output the
+    // pre-text raw RTF, set the txtrawmap[], etc.). But no text will be
+    // added to the text buffer.
+    // On the next run, with the deferred flag set, this function will know
+    // that adding text to the text buffer has been deferred, and it shouldn't
+    // make assumptions based on the fact that the text buffer is empty, i.e.,
+    // shouldn't run text setup again. The flag lives in the RTF object so
+    // that it can be captured by snapshot_rtfobj().
+
+    BEGIN_FUNCTION
+
+    // If we have to skip byte due to a \uc directive, then decrement
+    // the number of bytes to skip and return.
+    if (R->attr->uccountdown) { R->attr->uccountdown--; RETURN(); }
+
+    if (!R->txtdeferred) {
+        // ----- RAW/TXT BUFFER COORDINATION -----
+        // Output the raw buffer when we FIRST add text to the text buffer.
+        if (R->ri > 0   &&   R->ti == 0) {
+            output_raw(R);
+            reset_raw_buffer(R);
+        }
+
+        // Make sure we have enough space
+        if (R->ti + 1   >=   R->txtz   &&   !reserve_txt(R, R->ti + 2)) {
+            if (R->fatalerr) RETURN();
+            // LOG("No match within limits. Flushing buffers. R->ti = %zu. Last txt data: \'%s\'", R->ti, &R->txt[R->ti-80]);
+            TRACE_BEGIN(tflush);
+            output_raw(R);
+            reset_raw_buffer(R);
+            reset_txt_buffer(R);
+            TRACE_END(tflush, "flush", NULL);
+        }
+
+        // Map the current text start to the current raw location
+        R->txtrawmap[ R->ti ]  =  (uint32_t)(R->rawpos + R->ri);
+    }
+
+    if (c == 0) {
+        R->txtdeferred = true;
+        RETURN();
+    }
+
+    R->txt[ R->ti++ ] = (char)c;
+    R->txtdeferred = false;
+
+    RETURN();
+}
+
+
+
+static void add_to_cmd(int c, rtfobj *R) {
+    BEGIN_FUNCTION
+
+    if (R->ci + 1 >= R->cmdz && !reserve_cmd(R, R->ci + 2)) RETURN();
+    R->cmd[R->ci++] = (char)c;
+
+    RETURN();
+}
+
+
+
+static void add_string_to_txt(const char *s, rtfobj *R) {
+    size_t n;
+    size_t i;
+
+    // Adds a whole character (or string) at once, doing add_to_txt()'s
+    // bookkeeping once rather than per byte. A match can only begin on a
+    // character, but every byte gets the character's txtrawmap[] entry so
+    // that the map stays in order (restore_rtfobj() relies on it).
+
+    BEGIN_FUNCTION
+
+    // A skipped fallback counts as one character, however many bytes
+    if (R->attr->uccountdown) { R->attr->uccountdown--; RETURN(); }
+
+    if (!(n = strlen(s))) RETURN();
+
+    if (R->ti + n >= R->txtz && !reserve_txt(R, R->ti + n + 1)) {
+        if (R->fatalerr) RETURN();
+        ////////////////////////////////////////////////////////////////////
+        ////  RECOVERY CODE IS A HACK, NEED TO DO BETTER
+        ////////////////////////////////////////////////////////////////////
+        LOG("No match within limits. Flushing buffers. R->ti = %zu", R->ti);
+        TRACE_BEGIN(tflush);
+        output_raw(R);
+        reset_raw_buffer(R);
+        reset_txt_buffer(R);
+        R->txtdeferred = false;
+        TRACE_END(tflush, "flush", NULL);
+        ////////////////////////////////////////////////////////////////////
+        ////  RECOVERY CODE IS A HACK, NEED TO DO BETTER
+        ////////////////////////////////////////////////////////////////////
+    }
+
+    // Same text setup as add_to_txt()
+    if (!R->txtdeferred) {
+        if (R->ri > 0   &&   R->ti == 0) {
+            output_raw(R);
+            reset_raw_buffer(R);
+        }
+        R->txtrawmap[ R->ti ]  =  (uint32_t)(R->rawpos + R->ri);
+    }
+    for (i = 1; i < n; i++) R->txtrawmap[R->ti + i] = R->txtrawmap[R->ti];
+
+    memcpy(&R->txt[R->ti], s, n);
+    R->ti += n;
+    R->txtdeferred = false;
+
+    RETURN();
+}
+
+
+
+static void add_cmdstring_to_raw(const char *s, rtfobj *R) {
+    BEGIN_FUNCTION
+
+    if (R->ri+strlen(s) >= R->rawz && !reserve_raw(R, R->ri+strlen(s)+1)) {
+        if (R->fatalerr) RETURN();
+        DBUG("Exhausted raw buffer.");
+        DBUG("R->ri = %zu. Last raw data: \'%.*s\'", R->ri, raw_tail(R));
+        output_raw(R);
+        reset_raw_buffer(R);
+
+        // Any text pattern we had is now invalid, so we need to clear that
+        // as well
+        reset_txt_buffer(R);
+
+        // However, it's very important that we not remove the command that
+        // we're trying to add to the raw buffer!!!! (BUGFIX 22 December 2022)
+        // If we do, then we'll end up with a raw buffer that doesn't match
+        // what we've input from the original file, leading to semi-random
+        // corruptions.
+        // DO NOT reset_cmd_buffer(R);
+
+        if (strlen(s) >= R->rawz && !reserve_raw(R, strlen(s)+1)) {
+            if (!R->fatalerr) R->fatalerr = EINVAL;
+            FAIL(VOID, "Command longer than raw buffer |%.40s|...", s);
+        }
+    }
+
+    while (*s) {
+        track_raw_braces(*s, R);
+        R->raw[R->ri++] = *s++;
+    }
+
+    RETURN();
+}
+
+
+
+static void add_to_pict(const char *s, size_t len, rtfobj *R) {
+    size_t newcap;
+    char  *newpict;
+
+    BEGIN_FUNCTION
+
+    if (R->pictz + len > R->pictcap) {
+        newcap = R->pictcap ? R->pictcap : 4096;
+        while (newcap < R->pictz + len) newcap *= 2;
+        if (!within_memlimit(R, newcap - R->pictcap)) {
+            FAIL(VOID, "Picture of %zu bytes exceeds the memory limit", newcap);
+        }
+        newpict = mem_resize(&R->alloc, R->pict, newcap);
+        if (!newpict) {
+            R->fatalerr = ENOMEM;
+            FAIL(VOID, "Out of memory growing picture buffer to %zu", newcap);
+        }
+        R->pict = newpict;
+        R->pictcap = newcap;
+    }
+
+    // Hashed as it arrives, so the group is never read twice
+    R->picthash = rtfhash(R->picthash, s, len);
+    memcpy(&R->pict[R->pictz], s, len);
+    R->pictz += len;
+
+    RETURN();
+}
+
+
+
+static void finish_pict(rtfobj *R) {
+    rtfpict P;
+
+    BEGIN_FUNCTION
+
+    P.hash        = R->picthash;
+    P.len         = R->pictz;
+    P.offset      = R->rawpos;
+    P.rtf         = R->pict;
+    P.placeholder = NULL;
+
+    R->picthook(R, &P, R->pictdata);
+
+    if (P.placeholder) output_buf(R, P.placeholder, strlen(P.placeholder));
+    else               output_buf(R, R->pict, R->pictz);
+
+    // The raw buffer has been empty since the group began
+    R->rawpos   += R->pictz;
+    R->pictz     = 0;
+    R->pictdepth = 0;
+
+    RETURN();
+}
+
+
+
+static void release_pict(rtfobj *R) {
+    BEGIN_FUNCTION
+
+    // Input ended (or processing stopped) inside a picture: out it goes
+    // as it is, without calling the hook on an incomplete group
+    if (R->pictreaddepth) end_pict_read(R, true);
+    if (!R->pictdepth) RETURN();
+
+    output_buf(R, R->pict, R->pictz);
+    R->rawpos   += R->pictz;
+    R->pictz     = 0;
+    R->pictdepth = 0;
+
+    RETURN();
+}
+
+
+
+COLDPATH static bool reserve_raw(rtfobj *R, size_t need) {
+    size_t newz;
+    char  *newraw;
+
+    BEGIN_FUNCTION
+
+    if (need <= R->rawz) RETURN(true);
+
+    newz = grown_capacity(R->rawz, R->rawmax, need);
+    if (newz <= R->rawz) RETURN(false);
+    if (!within_memlimit(R, (newz - R->rawz) * sizeof *R->raw)) {
+        FAIL(false, "Raw buffer of %zu exceeds the memory limit", newz);
+    }
+
+    newraw = grow_buffer(&R->alloc, R->raw, R->rawz, newz, sizeof *R->raw);
+    if (!newraw) {
+        R->fatalerr = ENOMEM;
+        FAIL(false, "Out of memory growing raw buffer to %zu", newz);
+    }
+    R->raw  = newraw;
+    R->rawz = newz;
+
+    RETURN(need <= R->rawz);
+}
+
+
+
+COLDPATH static bool reserve_txt(rtfobj *R, size_t need) {
+    size_t    newz;
+    char     *newtxt;
+    uint32_t *newmap;
+    uint32_t *newend;
+
+    BEGIN_FUNCTION
+
+    if (need <= R->txtz) RETURN(true);
+
+    newz = grown_capacity(R->txtz, R->txtmax, need);
+    if (newz <= R->txtz) RETURN(false);
+    if (!within_memlimit(R, (newz - R->txtz) * (sizeof *R->txt + sizeof *R->txtrawmap +
+                             ((uses_txtrawend(R) || R->txtrawend) ? sizeof *R->txtrawend : 0)))) {
+        FAIL(false, "Text buffer of %zu exceeds the memory limit", newz);
+    }
+
+    // txtrawmap[] (and txtrawend[], with a dictionary) always has the same
+    // capacity as txt[]
+    newmap = grow_buffer(&R->alloc, R->txtrawmap, R->txtz, newz, sizeof *R->txtrawmap);
+    if (newmap) R->txtrawmap = newmap;
+    newend = (uses_txtrawend(R) || R->txtrawend) ? grow_buffer(&R->alloc, R->txtrawend, R->txtz, newz, sizeof *R->txtrawend) : NULL;
+    if (newend) R->txtrawend = newend;
+    newtxt = grow_buffer(&R->alloc, R->txt, R->txtz, newz, sizeof *R->txt);
+    if (newtxt) R->txt = newtxt;
+    if (!newmap || !newtxt || (!newend && (uses_txtrawend(R) || R->txtrawend))) {
+        R->fatalerr = ENOMEM;
+        FAIL(false, "Out of memory growing text buffer to %zu", newz);
+    }
+    R->txtz = newz;
+
+    RETURN(need <= R->txtz);
+}
+
+
+
+COLDPATH static bool reserve_cmd(rtfobj *R, size_t need) {
+    size_t newz;
+    char  *newcmd;
+
+    BEGIN_FUNCTION
+
+    if (need <= R->cmdz) RETURN(true);
+
+    // Unlike the raw and text buffers, there's no flushing the command
+    // buffer to make room. A command this long isn't valid RTF anyway.
+    newz = grown_capacity(R->cmdz, R->cmdmax, need);
+    if (newz <= R->cmdz) {
+        R->fatalerr = EINVAL;
+        FAIL(false, "Command too long |%.40s|...", R->cmd);
+    }
+
+    if (!within_memlimit(R, (newz - R->cmdz) * sizeof *R->cmd)) {
+        FAIL(false, "Command buffer of %zu exceeds the memory limit", newz);
+    }
+    newcmd = grow_buffer(&R->alloc, R->cmd, R->cmdz, newz, sizeof *R->cmd);
+    if (!newcmd) {
+        R->fatalerr = ENOMEM;
+        FAIL(false, "Out of memory growing command buffer to %zu", newz);
+    }
+    R->cmd  = newcmd;
+    R->cmdz = newz;
+
+    RETURN(need <= R->cmdz);
+}
+
+
+
+COLDPATH static bool reserve_fonttbl(rtfobj *R, size_t need) {
+    size_t   newz;
+    int32_t *newf;
+    int32_t *newcharset;
+
+    BEGIN_FUNCTION
+
+    if (need <= R->fonttbl_z) RETURN(true);
+
+    newz = grown_capacity(R->fonttbl_z, R->fonttbl_max, need);
+    if (newz <= R->fonttbl_z) RETURN(false);
+    if (!within_memlimit(R, (newz - R->fonttbl_z) * (sizeof *R->fonttbl_f + sizeof *R->fonttbl_charset))) {
+        FAIL(false, "Font table of %zu exceeds the memory limit", newz);
+    }
+
+    newf = grow_buffer(&R->alloc, R->fonttbl_f, R->fonttbl_z, newz, sizeof *R->fonttbl_f);
+    if (newf) R->fonttbl_f = newf;
+    newcharset = grow_buffer(&R->alloc, R->fonttbl_charset, R->fonttbl_z, newz, sizeof *R->fonttbl_charset);
+    if (newcharset) R->fonttbl_charset = newcharset;
+    if (!newf || !newcharset) {
+        R->fatalerr = ENOMEM;
+        FAIL(false, "Out of memory growing font table to %zu", newz);
+    }
+    R->fonttbl_z = newz;
+
+    RETURN(need <= R->fonttbl_z);
+}
+
+
+
+static size_t grown_capacity(size_t cur, size_t max, size_t need) {
+    size_t newz;
+
+    BEGIN_FUNCTION
+
+    // Double from the current size (or a small minimum) until the need is
+    // met, but never past the configured maximum.
+    newz = cur ? cur : MIN_BUFFER_SIZE;
+    while (newz < need && newz < max) newz *= 2;
+
+    RETURN(newz < max ? newz : max);
+}
+
+
+
+static void *grow_buffer(const rtfalloc *A, void *buf, size_t oldn, size_t newn, size_t elemz) {
+    char *newbuf;
+
+    BEGIN_FUNCTION
+
+    // New space is zeroed, same as the buffers' unused tails always are
+    newbuf = mem_resize(A, buf, newn * elemz);
+    if (newbuf) memzero(newbuf + oldn * elemz, (newn - oldn) * elemz);
+
+    RETURN(newbuf);
+}
+
+
+
+static inline void track_raw_braces(int c, rtfobj *R) {
+    // Keep a net count of unescaped braces in the raw buffer as bytes are
+    // appended, so output_match() doesn't have to rescan it. A backslash
+    // escapes whatever follows it, including another backslash.
+    if (R->rawescaped)  R->rawescaped = false;
+    else if (c == '\\') R->rawescaped = true;
+    else if (c == '{')  R->rawbraces++;
+    else if (c == '}')  R->rawbraces--;
+}
+
+
+
+void reset_raw_buffer_by(rtfobj *R, size_t amt) {
+    size_t i;
+
+    BEGIN_FUNCTION
+
+    if (amt == 0) RETURN();
+
+    // Take the consumed bytes' braces out of the running count. Each byte is
+    // only ever consumed once, so this is amortized O(1) per byte.  The
+    // consumed prefix always ends on a token boundary, so an escape can't
+    // straddle it.
+    if (amt >= R->ri) {
+        R->rawbraces = 0;
+        R->rawescaped = false;
+    } else {
+        for (i = 0; i < amt; i++) {
+            if      (R->raw[i] == '\\') i++;
+            else if (R->raw[i] == '{')  R->rawbraces--;
+            else if (R->raw[i] == '}')  R->rawbraces++;
+        }
+    }
+
+    shift_raw_buffer(R, amt);
+
+    RETURN();
+}
+
+
+
+static void shift_raw_buffer(rtfobj *R, size_t amt) {
+    size_t remaining;
+
+    BEGIN_FUNCTION
+
+    remaining = R->ri - amt;
+    memmove(R->raw, &R->raw[amt], remaining);
+    R->ri = remaining;
+    R->rawpos += amt;
+    memzero(&R->raw[remaining], amt);
+
+    RETURN();
+}
+
+
+
+void reset_txt_buffer_by(rtfobj *R, size_t amt) {
+    size_t remaining;
+
+    BEGIN_FUNCTION
+
+    if (amt == 0) RETURN();
+
+    if (R->ftxt) fwrite(R->txt, 1, amt, R->ftxt);
+
+    remaining = R->ti - amt;
+    memmove(R->txt, &R->txt[amt], remaining);
+    memmove(R->txtrawmap, &R->txtrawmap[amt], remaining * sizeof *R->txtrawmap);
+    if (R->txtrawend) {
+        memmove(R->txtrawend, &R->txtrawend[amt], remaining * sizeof *R->txtrawend);
+        R->txtended = (R->txtended > amt) ? R->txtended - amt : 0;
+    }
+    R->ti = remaining;
+    R->txtpos += amt;
+    forget_matches(R);
+    memzero(&R->txt[remaining], amt);
+
+    RETURN();
+}
+
+
+
+void reset_cmd_buffer_by(rtfobj *R, size_t amt) {
+    size_t remaining;
+
+    BEGIN_FUNCTION
+
+    if (amt == 0) RETURN();
+
+    remaining = R->ci - amt;
+    memmove(R->cmd, &R->cmd[amt], remaining);
+    R->ci = remaining;
+    memzero(&R->cmd[remaining], amt);
+
+    RETURN();
+}
+
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                       BUFFER OUTPUT FUNCTIONS                       ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+static void output_match(rtfobj *R) {
+    int nbraces;
+
+    BEGIN_FUNCTION
+
+    // Originally, we output the same # of braces as in our raw buffer
+    // However, unnecessary scope changes can cause fonts, etc. to be reset
+    // in the following text. Now, we output the NET number of braces, i.e.,
+    // any }{}{ nonsense will result in zero braces being output, and the
+    // original active control words will remain active.
+    //
+    // The net count is kept up to date as the raw buffer grows and shrinks
+    // (see track_raw_braces()), so we don't have to rescan it here.
+    nbraces = R->rawbraces;
+
+    if (R->hooks.match) {
+        R->hooks.match(R, R->srch_match, nbraces, R->hooks.data);
+        RETURN();
+    }
+
+    if (!R->fout) RETURN();
+
+    TRACE_BEGIN(tout);
+
+    rtfputs(rtfobj_val(R, R->srch_match), R->fout);
+
+    while (nbraces > 0)   {  fputc('{', R->fout);  nbraces--;  }
+    while (nbraces < 0)   {  fputc('}', R->fout);  nbraces++;  }
+
+    TRACE_END(tout, "output", NULL);
+
+    RETURN();
+}
+
+
+
+static void output_raw_by(rtfobj *R, size_t amt) {
+    BEGIN_FUNCTION
+
+    output_buf(R, R->raw, amt);
+
+    RETURN();
+}
+
+
+
+static void output_buf(rtfobj *R, const char *buf, size_t len) {
+    BEGIN_FUNCTION
+
+    // Previously tried looping through the R->raw buffer and using
+    // putc_unlocked() to speed up performance; however, it's actually faster
+    // to use fwrite() most of the time -- not sure why.
+    // for (size_t i = 0; i < len; i++) putc_unlocked(buf[i], R->fout);
+    // 10 iterations with fputc() takes .22 seconds +/- .01
+    // 10 iterations with fwrite() takes .18 seconds +/- .01
+    // I.e., fwrite() makes the program about 20% faster.
+    if (R->hooks.raw) { R->hooks.raw(R, buf, len, R->hooks.data); RETURN(); }
+    if (!R->fout) RETURN();
+
+    TRACE_BEGIN(tout);
+    fwrite(buf, 1, len, R->fout);
+    TRACE_END(tout, "output", NULL);
+
+    RETURN();
+}
+
+
+
+static void discard_raw(rtfobj *R, const char *buf, size_t len, void *data) {
+    (void)R; (void)buf; (void)len; (void)data;
+}
+
+
+
+static void scan_match(rtfobj *R, size_t key, int nbraces, void *data) {
+    scanstate *S = data;
+    rtfmatch  *newmatches;
+    size_t     newcap;
+
+    BEGIN_FUNCTION
+
+    (void)nbraces;
+
+    if (S->counts && S->counts[key]++ == 0) S->seen++;
+
+    if (!S->keep) { S->n++; RETURN(); }
+
+    if (S->n == S->cap) {
+        newcap = S->cap ? 2 * S->cap : 16;
+        newmatches = realloc(S->matches, newcap * sizeof *newmatches);
+        if (!newmatches) {
+            R->fatalerr = ENOMEM;
+            FAIL(VOID, "Out of memory recording scan matches");
+        }
+        S->matches = newmatches;
+        S->cap = newcap;
+    }
+
+    // At this point the raw and text buffers start exactly at the match
+    S->matches[S->n].key    = key;
+    S->matches[S->n].txtpos = R->txtpos;
+    S->matches[S->n].rawbeg = R->rawpos;
+    S->matches[S->n].rawend = R->rawpos + R->ri;
+    S->n++;
+
+    RETURN();
+}
+
+
+
+void rtfputs(const char *s, FILE *fout) {
+    const unsigned char *output = (const unsigned char *)s;
+    int32_t cdpt;
+    uint16_t hi;
+    uint16_t lo;
+    int16_t hi_out;
+    int16_t lo_out;
+    size_t i;
+
+    BEGIN_FUNCTION
+
+    for (i = 0; output[i] != '\0'; ) {
+        if (output[i] < 128) {
+            fputc((int)output[i], fout);
+            i++;
+        } else {
+            // Value outside of ASCII range, convert to UTF-16
+            cdpt = cdpt_from_utf8(output + i);
+            utf16_from_cdpt(cdpt, &hi, &lo);
+
+            // Accommodate RTF's stupid signed integer version
+            hi_out = (int16_t)((hi > 32767)?(hi - 65536):hi);
+            lo_out = (int16_t)((lo > 32767)?(lo - 65536):lo);
+
+            // Print out the UTF-16 code point (including surrogate pair,
+            // if applicable)
+            if (hi_out != 0) fprintf(fout, "{\\uc0 \\u%d}", hi_out);
+            fprintf(fout, "{\\uc0 \\u%d}", lo_out);
+
+            // Loop through the rest of any continuation bytes
+            i = i + 1;
+            while (output[i] != 0  &&  output[i]>>6 == 2) {
+                i++;
+            }
+        }
+    }
+
+    RETURN();
+}
+
+
+
+
+
 
-    add_to_txt(R->cmd[1], R);
 
-    RETURN();
-}
 
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                      ATTRIBUTE STACK FUNCTIONS                      ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
 
+static void push_attr(rtfobj *R) {
+    rtfattr *newattr;
 
-static inline void proc_cmd_specialstandin(rtfobj *R) {
     BEGIN_FUNCTION
 
-    int32_t cdpt = 0;
+    if (R->limits.maxdepth && R->depth >= R->limits.maxdepth) {
+        if (!R->fatalerr) R->fatalerr = RTF_ELIMIT_DEPTH;
+        FAIL(VOID, "Groups nested deeper than the limit of %zu", R->limits.maxdepth);
+    }
+    if (R->limits.maxmem && !within_memlimit(R, sizeof *newattr)) {
+        FAIL(VOID, "Attribute stack exceeds the memory limit");
+    }
 
-    if (R->cmd[1] == '~') cdpt = 0x00A0; // Non-breaking space
-    if (R->cmd[1] == '_') cdpt = 0x2011; // Non-breaking hyphen
-    if (R->cmd[1] == '-') cdpt = 0x00AD; // Soft hyphen
+    newattr = mem_alloc(&R->alloc, sizeof *newattr);
 
-    if (cdpt) add_string_to_txt((const char*)utf8_from_cdpt(cdpt), R);
+    if (!newattr) {
+        R->fatalerr = ENOMEM;
+        FAIL(VOID, "Out-of-memory allocating new attribute scope.");
+    }
+
+    assert(R->attr != NULL);
+
+    // "If an RTF scope delimiter character (that is, an opening or
+    // closing brace) is encountered while scanning skippable data,
+    // the skippable data is considered to end before the delimiter."
+    R->attr->uccountdown = 0;
+
+    memmove(newattr, R->attr, sizeof *newattr);
+    newattr->outer = R->attr;
+    R->attr = newattr;
+    R->depth++;
 
     RETURN();
 }
 
 
 
-static inline void proc_cmd_uc(rtfobj *R) {
+static void pop_attr(rtfobj *R) {
+    rtfattr *oldattr = NULL;
+
     BEGIN_FUNCTION
 
-    R->attr->uc = (size_t)get_num_arg(&R->cmd[1]);
+    assert(R->attr != NULL);
+
+    if (R->attr != &R->topattr) {
+        oldattr = R->attr;        // Point it at the current attribute set
+        R->attr = oldattr->outer; // Modify structure to point to outer scope
+        if (R->info) info_pop(R, oldattr);
+        mem_free(&R->alloc, oldattr); // Delete the old attribute set
+        R->depth--;
+    }
 
     RETURN();
 }
 
 
 
-static void proc_cmd_u(rtfobj *R) {
-    int32_t arg;
 
-    BEGIN_FUNCTION
 
-    arg = get_num_arg(&R->cmd[2]);
 
-    // RTF 1.9 Spec: "Most RTF control words accept signed 16-bit numbers as
-    // arguments. For these control words, Unicode values greater than 32767
-    // are expressed as negative numbers. For example, the character code
-    // U+F020 is given by \u-4064. To get -4064, convert F020 16 to decimal
-    // (61472) and subtract 65536."
-    if (arg < 0) arg = arg + 65536;
+static void info_pop(rtfobj *R, const rtfattr *oldattr) {
+    infostate *S = R->info;
+    char **dst;
 
-    // RTF 1.9 Spec: RTF supports "[s]urrogate pairs like \u-10187?\u-9138?"
-    // Unicode 15.0, Sec. 23.6: "The use of surrogate pairs... is formally
-    // equivalent to [what is] defined in ISO/IEC 10646.... The high-surrogate
-    // code points are [in]] range U+D800..U+DBFF [and are always] the first
-    // element of a surrogate pair.... The low-surrogate code points are [in]
-    // range U+DC00..U+DFFF [and are] always the second element...."
-    if (0xD800 <= arg && arg <= 0xDBFF) {
-        // Argument is in the high surrogate range.  We need to tell the
-        // add_to_txt function that we're adding text (so it can do text
-        // setup, etc.), even though we don't have anything to add to the
-        // text buffer yet.
-        R->highsurrogate = arg;
-        add_to_txt(0, R);
-    } else if (0xDC00 <= arg && arg <= 0xDFFF) {
-        // Argument is in the low surrogate range
-        int32_t cdpt = cdpt_from_utf16((uint16_t)R->highsurrogate, (uint16_t)arg);
-        add_string_to_txt((const char*)utf8_from_cdpt(cdpt), R);
-    } else {
-        // Argument is likely in the Basic Multilingual Plane
-        add_string_to_txt((const char*)utf8_from_cdpt(arg), R);
+    BEGIN_FUNCTION
+
+    // Closing a text destination: keep the first value seen for it
+    if (oldattr->infofield && oldattr->infofield != R->attr->infofield &&
+        infodests[oldattr->infofield-1].kind == INFO_TEXT) {
+        dst = (char **)((char *)S->I + infodests[oldattr->infofield-1].off);
+        if (!*dst) {
+            *dst = malloc(S->n + 1);
+            if (!*dst) { R->fatalerr = ENOMEM; FAIL(VOID, "Out of memory storing document info"); }
+            if (S->n) memcpy(*dst, S->buf, S->n);
+            (*dst)[S->n] = '\0';
+        }
+        S->n = 0;
     }
 
-    R->attr->uccountdown = R->attr->uc;
+    // Closing the \info group itself: the rest is of no interest
+    if (oldattr->ininfo && !R->attr->ininfo) S->done = true;
 
     RETURN();
 }
 
 
 
-static void proc_cmd_apostrophe(rtfobj *R) {
-    int32_t cdpt;
-    uint8_t arg;
-    const int32_t *mult = NULL;
 
-    BEGIN_FUNCTION
 
-    cpg_t cpg = (R->attr->codepage)?(R->attr->codepage):(R->documentcodepage);
 
-    if (R->attr->uccountdown) { R->attr->uccountdown--; RETURN(); }
 
-    arg = get_hex_arg(R->cmd);
-    cdpt = cpgtou(cpg, arg, &R->attr->xtra, &mult);
 
-    // If we are starting a double-byte sequence, then we need to tell the
-    // add_to_txt function that we're adding text (so it can do text setup,
-    // etc.), even though we don't actually have anything to add to the
-    // text buffer yet.
-    if (cdpt == cpDBSQ) {
-        add_to_txt(0, R);
-    }
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                          PARSING FUNCTIONS                          ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
 
-    // If we have multiple code points to add, add them one at a time.
-    else if (cdpt == cpMULT) {
-        for (; *mult != 0; mult++) {
-            add_string_to_txt((const char*)utf8_from_cdpt(*mult), R);
-        }
-    }
+static int32_t get_num_arg(const char *s) {
+    const char *validchars="0123456789-";
+    const char *p;
+    int32_t retval;
 
-    // If there's no match or the code page is unsupported, don't do anything
-    // except emit a diagnostic message (if and only if we're in debug mode).
-    else if (cdpt == cpNONE) {
-        DBUG("cpNONE: Code point %d does not exist code page %d", arg, cpg);
-    }
-    else if (cdpt == cpUNSP) {
-        DBUG("cpUNSP: Code page %d is unsupported", cpg);
-    }
+    BEGIN_FUNCTION
 
-    // Lastly, in the general case, convert the code point to UTF-8 and add
-    // it to the text buffer.
-    else {
-        add_string_to_txt((const char*)utf8_from_cdpt(cdpt), R);
-    }
+    p = s;
+    while (!strchr(validchars, *p)) p++;
 
-    RETURN();
+    sscanf(p, "%"SCNd32, &retval);
+
+    RETURN(retval);
 }
 
 
 
-static inline void proc_cmd_fonttbl(rtfobj *R) {
+static size_t find_infodest(const char *c) {
+    size_t i;
+    size_t len;
+
     BEGIN_FUNCTION
 
-    R->attr->notxt = true;
-    R->attr->fonttbl = true;
-    R->attr->fonttbl_defn_idx = -1;
+    // Returns 1 + the infodests[] index of the control word, or 0
+    for (i = 0; i < sizeof infodests / sizeof *infodests; i++) {
+        len = strlen(infodests[i].name);
+        if (!strncmp(c, infodests[i].name, len) && !isalpha(c[len])) RETURN(i + 1);
+    }
 
-    RETURN();
+    RETURN(0);
 }
 
 
 
-static void proc_cmd_f(rtfobj *R) {
-    size_t i;
-    int32_t arg;
-
+static uint8_t get_hex_arg(const char *s) {
     BEGIN_FUNCTION
 
-    arg = get_num_arg(&R->cmd[2]);
+    // s is \'hh, already checked by is_hex_escape() or proc_command()
+    RETURN((uint8_t)(hexval[(uint8_t)s[2]] << 4 | hexval[(uint8_t)s[3]]));
+}
 
-    if (R->attr->fonttbl) {
-        // If defining a fonttbl, look for an existing font entry for f
-        for (i = 0; i < R->fonttbl_n; i++)  if (R->fonttbl_f[i] == arg) break;
 
-        // If we're at the end (i.e., not found), then add it
-        if (i == R->fonttbl_n) {
-            if (R->fonttbl_n + 1 < R->fonttbl_z) {
-                R->fonttbl_n++;
-                R->fonttbl_f[i]            = arg;
-                R->fonttbl_charset[i]      = cpNONE;
-                R->attr->fonttbl_defn_idx  = (int32_t)i;
-            } else {
-                FAIL(VOID, "Out of fonttbl space, not defining f%d\n", arg);
-            }
-        }
 
-        // Otherwise, we're redefining one; set the definition index
-        else {
-            R->attr->fonttbl_defn_idx  = (int32_t)i;
-        }
-    }
 
-    else {
-        for (i=0; i<R->fonttbl_n; i++) { if (R->fonttbl_f[i] == arg) break; }
 
-        if (i < R->fonttbl_n) {
-             R->attr->codepage = cpgfromcharsetnum(R->fonttbl_charset[i]);
-        }
-    }
 
-    RETURN();
-}
 
 
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                    PICTURE EXTRACTION FUNCTIONS                     ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
 
-static inline void proc_cmd_fcharset(rtfobj *R) {
-    int32_t arg;
+static void proc_pict_property(rtfobj *R) {
+    char *c = &R->cmd[1];
+    rtfpictinfo *P = &R->pictinfo;
 
     BEGIN_FUNCTION
 
-    arg = get_num_arg(&R->cmd[9]);
-
-    // If we're defining a font table and have a valid definition index...
-    if (R->attr->fonttbl && R->attr->fonttbl_defn_idx >= 0) {
-        // Add the appropriate character set to the font table
-        R->fonttbl_charset[R->attr->fonttbl_defn_idx] = arg;
-        // Also, if we're dealing with the default font...
-        if (R->fonttbl_f[R->attr->fonttbl_defn_idx] == R->defaultfont) {
-            // Set that font's character set as the document code page.
-            R->documentcodepage = cpgfromcharsetnum(arg);
-        }
-
-    }
+    if (0);
+    else if (RGX_MATCH(c,"^emfblip\\s?$"))           P->format = RTF_PICT_EMF;
+    else if (RGX_MATCH(c,"^pngblip\\s?$"))           P->format = RTF_PICT_PNG;
+    else if (RGX_MATCH(c,"^jpegblip\\s?$"))          P->format = RTF_PICT_JPEG;
+    else if (RGX_MATCH(c,"^macpict\\s?$"))           P->format = RTF_PICT_MAC;
+    else if (RGX_MATCH(c,"^pmmetafile-?\\d+\\s?$"))  P->format = RTF_PICT_OS2, P->formatarg = get_num_arg(c);
+    else if (RGX_MATCH(c,"^wmetafile-?\\d+\\s?$"))   P->format = RTF_PICT_WMF, P->formatarg = get_num_arg(c);
+    else if (RGX_MATCH(c,"^dibitmap-?\\d+\\s?$"))    P->format = RTF_PICT_DIB, P->formatarg = get_num_arg(c);
+    else if (RGX_MATCH(c,"^wbitmap-?\\d+\\s?$"))     P->format = RTF_PICT_BMP, P->formatarg = get_num_arg(c);
+    else if (RGX_MATCH(c,"^picw-?\\d+\\s?$"))        P->picw      = get_num_arg(c);
+    else if (RGX_MATCH(c,"^pich-?\\d+\\s?$"))        P->pich      = get_num_arg(c);
+    else if (RGX_MATCH(c,"^picwgoal-?\\d+\\s?$"))    P->picwgoal  = get_num_arg(c);
+    else if (RGX_MATCH(c,"^pichgoal-?\\d+\\s?$"))    P->pichgoal  = get_num_arg(c);
+    else if (RGX_MATCH(c,"^picscalex-?\\d+\\s?$"))   P->picscalex = get_num_arg(c);
+    else if (RGX_MATCH(c,"^picscaley-?\\d+\\s?$"))   P->picscaley = get_num_arg(c);
+    else if (RGX_MATCH(c,"^bin\\d+\\s?$"))           R->pictbinleft = (uint64_t)get_num_arg(c);
 
     RETURN();
 }
 
 
 
-static inline void proc_cmd_cchs(rtfobj *R) {
-    int32_t arg;
+static void read_pict_hex(int c, rtfobj *R) {
+    char    hex[2 * PICT_CHUNK];
+    uint8_t out[PICT_CHUNK];
+    size_t  n = 0;
 
     BEGIN_FUNCTION
 
-    arg = get_num_arg(&R->cmd[5]);
-    R->attr->codepage = cpgfromcharsetnum(arg);
+    // Take the whole run of hex digits (and the line breaks Word puts in
+    // every 128 of them) in one go, rather than a byte per trip through the
+    // dispatch loop
+    hex[n++] = (char)c;
+    while (n < sizeof hex && (c = next_input(R)) != EOF) {
+        if (isxdigit(c) || c == '\n' || c == '\r' || c == ' ' || c == '\t') hex[n++] = (char)c;
+        else { ungetc(c, R->fin); break; }
+    }
+
+    pass_pict_through(R, hex, n);
+    deliver_pict(R, out, decode_hex(hex, n, out, &R->pictnibble));
 
     RETURN();
 }
 
 
 
-static inline void proc_cmd_deff(rtfobj *R) {
-    int32_t arg;
+static void read_pict_bin(rtfobj *R) {
+    char   buf[PICT_CHUNK];
+    size_t n;
 
     BEGIN_FUNCTION
 
-    arg = get_num_arg(&R->cmd[5]);
-    R->defaultfont = arg;
+    // Binary payload can hold any byte at all, so it goes straight through
+    // without being parsed
+    R->pictinfo.binary = true;
+    while (R->pictbinleft) {
+        n = R->pictbinleft < sizeof buf ? (size_t)R->pictbinleft : sizeof buf;
+        n = fread(buf, 1, n, R->fin);
+        if (n == 0) { R->pictbinleft = 0; FAIL(VOID, "Unexpected EOF in \\bin data"); }
+        R->pictbinleft -= n;
+        pass_pict_through(R, buf, n);
+        deliver_pict(R, (const uint8_t *)buf, n);
+    }
 
     RETURN();
 }
 
 
-static inline void proc_cmd_shuntblock(rtfobj *R) {
+
+static void pass_pict_through(rtfobj *R, const char *buf, size_t len) {
     BEGIN_FUNCTION
 
-    R->attr->nocmd = true;
-    R->attr->notxt = true;
+    // Picture payload is never text, so it skips the raw buffer
+    if (R->pictdepth) { add_to_pict(buf, len, R); RETURN(); }
+
+    output_raw(R);
+    reset_raw_buffer(R);
+    output_buf(R, buf, len);
+    R->rawpos += len;
 
     RETURN();
 }
 
 
 
-static inline void proc_cmd_newpar(rtfobj *R) {
+static void deliver_pict(rtfobj *R, const uint8_t *buf, size_t len) {
     BEGIN_FUNCTION
 
-    add_to_txt('\n', R);
-    add_to_txt('\n', R);
+    if (len == 0) RETURN();
+
+    R->pictreader(R, &R->pictinfo, buf, len, R->pictreaderdata);
+    R->pictinfo.decoded += len;
 
     RETURN();
 }
 
 
 
-static inline void proc_cmd_newline(rtfobj *R) {
+static void end_pict_read(rtfobj *R, bool truncated) {
     BEGIN_FUNCTION
 
-    add_to_txt('\n', R);
+    R->pictinfo.last      = true;
+    R->pictinfo.truncated = truncated;
+    R->pictreader(R, &R->pictinfo, NULL, 0, R->pictreaderdata);
+
+    R->pictreaddepth = 0;
+    R->pictbinleft   = 0;
 
     RETURN();
 }
 
 
 
-static inline void proc_cmd_unknown(rtfobj *R) {
+static size_t decode_hex(const char *hex, size_t n, uint8_t *out, int *nibble) {
+    const uint64_t ones = UINT64_C(0x0101010101010101);
+    uint64_t v, lo, digit, alpha, nib, pair;
+    uint32_t four;
+    size_t   i = 0;
+    size_t   o = 0;
+
     BEGIN_FUNCTION
 
-    if (R->attr->blkoptional) {
-        R->attr->nocmd = true;
-        R->attr->notxt = true;
+    while (i < n) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        // Eight hex digits at a time, as 64-bit lanes: each byte is tested
+        // for 0-9 as is, and for a-f once lowercased
+        while (*nibble < 0 && i + 8 <= n) {
+            memcpy(&v, &hex[i], 8);
+            lo    = v | (ones * 0x20);
+            digit = ((ones * (127 + 0x3a) - (v & ones * 127)) & ~v & ((v & ones * 127) + ones * (127 - 0x2f))) & ones * 0x80;
+            alpha = ((ones * (127 + 0x67) - (lo & ones * 127)) & ~lo & ((lo & ones * 127) + ones * (127 - 0x60))) & ones * 0x80;
+            if ((digit | alpha) != ones * 0x80) break;
+
+            // Digits are their low nibble, letters that plus nine
+            nib  = (lo & ones * 0x0f) + (alpha >> 7) * 9;
+            pair = ((nib & UINT64_C(0x000f000f000f000f)) << 4) | ((nib >> 8) & UINT64_C(0x000f000f000f000f));
+            pair = (pair | (pair >> 8))  & UINT64_C(0x0000ffff0000ffff);
+            pair = (pair | (pair >> 16)) & UINT64_C(0x00000000ffffffff);
+            four = (uint32_t)pair;
+            memcpy(&out[o], &four, 4);
+            i += 8;
+            o += 4;
+        }
+        if (i >= n) break;
+#endif
+        // Line breaks, and the odd digit left over at the end of a run
+        if (isxdigit((unsigned char)hex[i])) {
+            if (*nibble < 0) *nibble = hexval[(uint8_t)hex[i]];
+            else { out[o++] = (uint8_t)(*nibble << 4 | hexval[(uint8_t)hex[i]]); *nibble = -1; }
+        }
+        i++;
     }
 
-    RETURN();
+    RETURN(o);
 }
 
 
@@ -899,298 +3633,248 @@ static inline void proc_cmd_unknown(rtfobj *R) {
 
 
 
-/////////////////////////////////////////////////////////////////////////////
-////                                                                     ////
-////                     PROCESSING BUFFER FUNCTIONS                     ////
-////                                                                     ////
-/////////////////////////////////////////////////////////////////////////////
-
-static void add_to_raw(int c, rtfobj *R) {
-    BEGIN_FUNCTION
 
-    if (R->ri + 1 >= RAW_BUFFER_SIZE) {
-        if (R->ti > 0) {
-            DBUG("Exhausted raw buffer.");
-            DBUG("R->ri = %zu. Last raw data: \'%s\'", R->ri, &R->raw[R->ri-80]);
-            DBUG("No match within limits. Flushing buffers, attempting recovery");
-            reset_txt_buffer(R);
-        }
-        ////////////////////////////////////////////////////////////////////
-        ////                         WALL OF SHAME                      ////
-        ////////////////////////////////////////////////////////////////////
-        // output_raw(R);
-        // R->ri = 0UL;
-        // R->ti = 0UL;
-        // R->ci = 0UL;
-        // memzero(R->raw, R->ri);     <-- I just fucking reset R->ri
-        // memzero(R->txt, R->ti);     <-- I just fucking reset R->ti
-        // memzero(R->cmd, R->ci);     <-- I just fucking reset R->ci
-        // I wasn't zeroing out my buffers AT ALL
-        // No wonder I was getting weird data corruption issues
-        ////////////////////////////////////////////////////////////////////
-        output_raw(R);
-        reset_raw_buffer(R);
-    }
 
-    R->raw[R->ri++] = (char)c;
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                       RESOURCE LIMIT FUNCTIONS                      ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
 
-    RETURN();
+static void enforce_limits(rtfobj *R) {
+    R->steps++;
+
+    if (R->fatalerr) return;
+
+    if (R->limits.maxsteps && R->steps > R->limits.maxsteps) {
+        R->fatalerr = RTF_ELIMIT_STEPS;
+        LOG("Stopped after %" PRIu64 " tokens", R->limits.maxsteps);
+    }
+    else if (R->limits.maxbytes && input_offset(R) > R->limits.maxbytes) {
+        R->fatalerr = RTF_ELIMIT_BYTES;
+        LOG("Stopped past input offset %" PRIu64, R->limits.maxbytes);
+    }
+    else if (R->deadline && R->steps % LIMIT_CLOCK_STEPS == 0 && monotonic_now() >= R->deadline) {
+        R->fatalerr = RTF_ELIMIT_TIME;
+        LOG("Stopped at the deadline after %" PRIu64 " tokens", R->steps);
+    }
 }
 
 
 
-static void add_to_txt(int c, rtfobj *R) {
-    // Sometimes we have started adding text, but the first byte can't be
-    // added to the actual text buffer (e.g., the first surrogate in a UTF-16
-    // surrogate pair, or the first byte in a double-byte sequence).
-    // In that case, we can pass in a value of 0 for c. The function will set
-    // the deferred flag and do text setup (clean the buffers, output the
-    // pre-text raw RTF, set the txtrawmap[], etc.). But no text will be
-    // added to the text buffer.
-    // On the next run, with the deferred flag set, this function will know
-    // that adding text to the text buffer has been deferred, and it shouldn't
-    // make assumptions based on the fact that the text buffer is empty, i.e.,
-    // shouldn't run text setup again.
-    _Thread_local static int deferred = 0;
+static bool within_memlimit(rtfobj *R, size_t more) {
+    if (!R->limits.maxmem || memory_in_use(R) + more <= R->limits.maxmem) return true;
 
-    BEGIN_FUNCTION
+    if (!R->fatalerr) R->fatalerr = RTF_ELIMIT_MEMORY;
 
-    // If we have to skip byte due to a \uc directive, then decrement
-    // the number of bytes to skip and return.
-    if (R->attr->uccountdown) { R->attr->uccountdown--; RETURN(); }
+    return false;
+}
 
-    if (!deferred) {
-        // ----- RAW/TXT BUFFER COORDINATION -----
-        // Output the raw buffer when we FIRST add text to the text buffer.
-        if (R->ri > 0   &&   R->ti == 0) {
-            output_raw(R);
-            reset_raw_buffer(R);
-        }
 
-        // Make sure we have enough space
-        if (R->ti + 1   >=   R->txtz) {
-            // LOG("No match within limits. Flushing buffers. R->ti = %zu. Last txt data: \'%s\'", R->ti, &R->txt[R->ti-80]);
-            output_raw(R);
-            reset_raw_buffer(R);
-            reset_txt_buffer(R);
-        }
 
-        // Map the current text start to the current raw location
-        R->txtrawmap[ R->ti ]  =  R->ri;
-    }
+static size_t memory_in_use(const rtfobj *R) {
+    size_t txtbytez = sizeof *R->txt + sizeof *R->txtrawmap + (R->txtrawend ? sizeof *R->txtrawend : 0);
 
-    if (c == 0) {
-        deferred = 1;
-        RETURN();
-    }
+    return R->rawz * sizeof *R->raw + R->txtz * txtbytez + R->cmdz * sizeof *R->cmd +
+           R->fonttbl_z * (sizeof *R->fonttbl_f + sizeof *R->fonttbl_charset) +
+           R->depth * sizeof *R->attr + R->pictcap;
+}
 
-    R->txt[ R->ti++ ] = (char)c;
-    deferred = 0;
 
-    RETURN();
+
+static uint64_t monotonic_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
 }
 
 
 
-static void add_to_cmd(int c, rtfobj *R) {
-    BEGIN_FUNCTION
 
-    assert(R->ci + 1 < R->cmdz);
-    R->cmd[R->ci++] = (char)c;
 
-    RETURN();
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                     MEMORY ALLOCATION FUNCTIONS                     ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+static inline void *mem_alloc(const rtfalloc *A, size_t z) {
+    return A->alloc(A->ctx, z);
 }
 
 
 
-static void add_string_to_txt(const char *s, rtfobj *R) {
-    BEGIN_FUNCTION
+static inline void *mem_resize(const rtfalloc *A, void *p, size_t z) {
+    return p ? A->resize(A->ctx, p, z) : A->alloc(A->ctx, z);
+}
 
-    if (R->ti+strlen(s) >= R->txtz) {
-        ////////////////////////////////////////////////////////////////////
-        ////  RECOVERY CODE IS A HACK, NEED TO DO BETTER
-        ////////////////////////////////////////////////////////////////////
-        LOG("No match within limits. Flushing buffers. R->ti = %zu. Last txt data: \'%s\'", R->ti, &R->txt[R->ti-80]);
-        output_raw(R);
-        reset_raw_buffer(R);
-        reset_txt_buffer(R);
-        ////////////////////////////////////////////////////////////////////
-        ////  RECOVERY CODE IS A HACK, NEED TO DO BETTER
-        ////////////////////////////////////////////////////////////////////
-    }
 
-    while (*s) add_to_txt((int)(*s++), R);
 
-    RETURN();
+static inline void mem_free(const rtfalloc *A, void *p) {
+    if (p) A->release(A->ctx, p);
 }
 
 
 
-static void add_cmdstring_to_raw(const char *s, rtfobj *R) {
-    BEGIN_FUNCTION
+static char *mem_strdup(const rtfalloc *A, const char *s) {
+    size_t z = strlen(s) + 1;
+    char  *p = mem_alloc(A, z);
 
-    if (R->ri+strlen(s) >= R->rawz) {
-        DBUG("Exhausted raw buffer.");
-        DBUG("R->ri = %zu. Last raw data: \'%s\'", R->ri, &R->raw[R->ri-80]);
-        output_raw(R);
-        reset_raw_buffer(R);
+    if (p) memcpy(p, s, z);
 
-        // Any text pattern we had is now invalid, so we need to clear that
-        // as well
-        reset_txt_buffer(R);
+    return p;
+}
 
-        // However, it's very important that we not remove the command that
-        // we're trying to add to the raw buffer!!!! (BUGFIX 22 December 2022)
-        // If we do, then we'll end up with a raw buffer that doesn't match
-        // what we've input from the original file, leading to semi-random
-        // corruptions.
-        // DO NOT reset_cmd_buffer(R);
-    }
 
-    while (*s) R->raw[R->ri++] = *s++;
 
-    RETURN();
+static void *libc_alloc(void *ctx, size_t z) {
+    (void)ctx;
+    return malloc(z);
 }
 
 
 
-void reset_raw_buffer_by(rtfobj *R, size_t amt) {
-    size_t remaining;
+static void *libc_resize(void *ctx, void *p, size_t z) {
+    (void)ctx;
+    return realloc(p, z);
+}
 
-    BEGIN_FUNCTION
 
-    remaining = R->ri - amt;
-    memmove(R->raw, &R->raw[amt], remaining);
-    R->ri = remaining;
-    memzero(&R->raw[remaining], amt);
 
-    RETURN();
+static void libc_release(void *ctx, void *p) {
+    (void)ctx;
+    free(p);
 }
 
 
 
-void reset_txt_buffer_by(rtfobj *R, size_t amt) {
-    size_t remaining;
+rtfarena *new_rtfarena(size_t cap) {
+    rtfarena *A;
 
     BEGIN_FUNCTION
 
-    if (R->ftxt) fwrite(R->txt, 1, amt, R->ftxt);
+    // Chunks come from malloc() as needed, so an unused cap costs nothing
+    A = malloc(sizeof *A);
+    if (!A) FAIL(NULL, "Failed allocating arena.");
 
-    remaining = R->ti - amt;
-    memmove(R->txt, &R->txt[amt], remaining);
-    R->ti = remaining;
-    memzero(&R->txt[remaining], amt);
+    A->cap   = cap;
+    A->used  = 0;
+    A->chunk = NULL;
 
-    RETURN();
+    RETURN(A);
 }
 
 
 
-void reset_cmd_buffer_by(rtfobj *R, size_t amt) {
-    size_t remaining;
+void delete_rtfarena(rtfarena *A) {
+    arenachunk *c;
 
     BEGIN_FUNCTION
 
-    remaining = R->ci - amt;
-    memmove(R->cmd, &R->cmd[amt], remaining);
-    R->ci = remaining;
-    memzero(&R->cmd[remaining], amt);
+    if (!A) RETURN();
+
+    while ((c = A->chunk)) {
+        A->chunk = c->prev;
+        free(c);
+    }
+    free(A);
 
     RETURN();
 }
 
 
 
+rtfalloc rtfarena_allocator(rtfarena *A) {
+    rtfalloc alloc = { arena_alloc, arena_resize, arena_release, A };
+    return alloc;
+}
 
 
 
+size_t rtfarena_used(const rtfarena *A) {
+    return A->used;
+}
 
 
-/////////////////////////////////////////////////////////////////////////////
-////                                                                     ////
-////                       BUFFER OUTPUT FUNCTIONS                       ////
-////                                                                     ////
-/////////////////////////////////////////////////////////////////////////////
 
-static void output_match(rtfobj *R) {
-    const unsigned char *output;
-    int32_t cdpt;
-    uint16_t hi;
-    uint16_t lo;
-    int16_t hi_out;
-    int16_t lo_out;
-    size_t i;
-    int nbraces;
+#define ARENA_ALIGN          (sizeof(max_align_t))
+#define ARENA_HDRZ           ARENA_ALIGN
+#define ARENA_MIN_CHUNK      ((size_t)1 << 16)
+#define arena_round(z)       (((z) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN)
+#define arena_block(c, off)  ((char *)(c)->data + (off) + ARENA_HDRZ)
+#define arena_size(p)        (*(size_t *)((char *)(p) - ARENA_HDRZ))
+
+static void *arena_alloc(void *ctx, size_t z) {
+    rtfarena   *A = ctx;
+    arenachunk *c = A->chunk;
+    size_t      need;
+    size_t      chunkz;
+    void       *p;
+
+    if (z > SIZE_MAX / 2) return NULL;
+    need = ARENA_HDRZ + arena_round(z);
+
+    if (!c || c->z - c->top < need) {
+        // Each chunk at least doubles the last, within the cap
+        chunkz = c ? 2 * c->z : ARENA_MIN_CHUNK;
+        if (chunkz < need) chunkz = need;
+        if (A->used + sizeof *c + need > A->cap) return NULL;
+        if (A->used + sizeof *c + chunkz > A->cap) chunkz = A->cap - A->used - sizeof *c;
+
+        if (!(c = malloc(sizeof *c + chunkz))) return NULL;
+        c->prev  = A->chunk;
+        c->z     = chunkz;
+        c->top   = 0;
+        c->last  = 0;
+        A->chunk = c;
+        A->used += sizeof *c + chunkz;
+    }
 
-    BEGIN_FUNCTION
+    c->last = c->top;
+    c->top += need;
+    p = arena_block(c, c->last);
+    arena_size(p) = z;
 
-    output = (const unsigned char *)R->srch_val[R->srch_match];
+    return p;
+}
 
-    if (!R->fout) RETURN();
 
-    for (i = 0; output[i] != '\0'; ) {
-        if (output[i] < 128) {
-            fputc((int)output[i], R->fout);
-            i++;
-        } else {
-            // Value outside of ASCII range, convert to UTF-16
-            cdpt = cdpt_from_utf8(output + i);
-            utf16_from_cdpt(cdpt, &hi, &lo);
 
-            // Accommodate RTF's stupid signed integer version
-            hi_out = (int16_t)((hi > 32767)?(hi - 65536):hi);
-            lo_out = (int16_t)((lo > 32767)?(lo - 65536):lo);
+static void *arena_resize(void *ctx, void *p, size_t z) {
+    rtfarena   *A = ctx;
+    arenachunk *c = A->chunk;
+    size_t      oldz = arena_size(p);
+    void       *newp;
 
-            // Print out the UTF-16 code point (including surrogate pair,
-            // if applicable)
-            if (hi_out != 0) fprintf(R->fout, "{\\uc0 \\u%d}", hi_out);
-            fprintf(R->fout, "{\\uc0 \\u%d}", lo_out);
+    if (z <= oldz) { arena_size(p) = z; return p; }
 
-            // Loop through the rest of any continuation bytes
-            i = i + 1;
-            while (output[i] != 0  &&  output[i]>>6 == 2) {
-                i++;
-            }
-        }
+    // The most recent block can grow into the rest of its chunk
+    if (p == arena_block(c, c->last) && z <= SIZE_MAX / 2 &&
+        c->last + ARENA_HDRZ + arena_round(z) <= c->z) {
+        c->top = c->last + ARENA_HDRZ + arena_round(z);
+        arena_size(p) = z;
+        return p;
     }
 
-    // Originally, we output the same # of braces as in our raw buffer
-    // However, unnecessary scope changes can cause fonts, etc. to be reset
-    // in the following text. Now, we output the NET number of braces, i.e.,
-    // any }{}{ nonsense will result in zero braces being output, and the
-    // original active control words will remain active.
-    //
-    // NB: Be careful not to do this with escaped literal brace characters.
-    nbraces = 0;
-    for (i = 0; i < (R->ri - 1); i++) {
-        if      (R->raw[i] == '\\' && R->raw[i+1] == '\\') i++;
-        else if (R->raw[i] == '\\' && R->raw[i+1] == '{')  i++;
-        else if (R->raw[i] == '\\' && R->raw[i+1] == '}')  i++;
-        else if (R->raw[i] == '{') nbraces++;
-        else if (R->raw[i] == '}') nbraces--;
-    }
-    while (nbraces > 0)   {  fputc('{', R->fout);  nbraces--;  }
-    while (nbraces < 0)   {  fputc('}', R->fout);  nbraces++;  }
+    if (!(newp = arena_alloc(A, z))) return NULL;
+    memcpy(newp, p, oldz);
 
-    RETURN();
+    return newp;
 }
 
 
 
-static void output_raw_by(rtfobj *R, size_t amt) {
-    BEGIN_FUNCTION
-
-    // Previously tried looping through the R->raw buffer and using
-    // putc_unlocked() to speed up performance; however, it's actually faster
-    // to use fwrite() most of the time -- not sure why.
-    // for (size_t i = 0; i < amt; i++) putc_unlocked(R->raw[i], R->fout);
-    // 10 iterations with fputc() takes .22 seconds +/- .01
-    // 10 iterations with fwrite() takes .18 seconds +/- .01
-    // I.e., fwrite() makes the program about 20% faster.
-    if (!R->fout) RETURN();
-    fwrite(R->raw, 1, amt, R->fout);
+static void arena_release(void *ctx, void *p) {
+    rtfarena   *A = ctx;
+    arenachunk *c = A->chunk;
 
-    RETURN();
+    // Only the most recent block can be given back early
+    if (p == arena_block(c, c->last)) c->top = c->last;
 }
 
 
@@ -1202,93 +3886,179 @@ static void output_raw_by(rtfobj *R, size_t amt) {
 
 /////////////////////////////////////////////////////////////////////////////
 ////                                                                     ////
-////                      ATTRIBUTE STACK FUNCTIONS                      ////
+////                          HASHING FUNCTIONS                          ////
 ////                                                                     ////
 /////////////////////////////////////////////////////////////////////////////
 
-static void push_attr(rtfobj *R) {
-    rtfattr *newattr;
+uint64_t rtfhash(uint64_t h, const void *buf, size_t len) {
+    const unsigned char *p = buf;
 
     BEGIN_FUNCTION
 
-    newattr = malloc(sizeof *newattr);
-
-    if (!newattr) {
-        R->fatalerr = ENOMEM;
-        FAIL(VOID, "Out-of-memory allocating new attribute scope.");
+    // 64-bit FNV-1a. Start with RTFHASH_INIT and feed the result back in to
+    // hash data that arrives in pieces.
+    while (len--) {
+        h ^= *p++;
+        h *= UINT64_C(0x100000001b3);
     }
 
-    assert(R->attr != NULL);
+    RETURN(h);
+}
 
-    // "If an RTF scope delimiter character (that is, an opening or
-    // closing brace) is encountered while scanning skippable data,
-    // the skippable data is considered to end before the delimiter."
-    R->attr->uccountdown = 0;
 
-    memmove(newattr, R->attr, sizeof *newattr);
-    newattr->outer = R->attr;
-    R->attr = newattr;
 
-    RETURN();
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                          TRACING FUNCTIONS                          ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+#ifdef RTFPROC_TRACE
+
+int rtftrace_start(const char *filename, uint64_t minns) {
+    BEGIN_FUNCTION
+
+    if (tracer.fout) FAIL(EBUSY, "A trace is already being recorded");
+    if (!(tracer.fout = fopen(filename, "wb"))) FAIL(errno, "Could not open trace file %s", filename);
+
+    tracer.minns   = minns;
+    tracer.n       = 0;
+    tracer.dropped = 0;
+    tracer.epoch   = 0;               // So trace_now() gives the raw clock
+    tracer.epoch   = trace_now();
+
+    RETURN(0);
 }
 
 
 
-static void pop_attr(rtfobj *R) {
-    rtfattr *oldattr = NULL;
+int rtftrace_stop(void) {
+    const unsigned char *a;
+    tracespan *sp;
+    size_t i;
+    int err;
 
     BEGIN_FUNCTION
 
-    assert(R->attr != NULL);
+    if (!tracer.fout) FAIL(EINVAL, "No trace is being recorded");
+
+    // Chrome trace event format: complete ("X") events, times in µs
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", tracer.fout);
+    fputs("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,"
+          "\"args\":{\"name\":\"rtfproc\"}}", tracer.fout);
+
+    for (i = 0; i < tracer.n; i++) {
+        sp = &tracer.spans[i];
+        fprintf(tracer.fout, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+                "\"ts\":%"PRIu64".%03"PRIu64",\"dur\":%"PRIu64".%03"PRIu64,
+                sp->name, sp->start / 1000, sp->start % 1000, sp->dur / 1000, sp->dur % 1000);
+
+        if (sp->arg[0]) {
+            fputs(",\"args\":{\"cmd\":\"", tracer.fout);
+            for (a = (const unsigned char *)sp->arg; *a; a++) {
+                if (*a == '"' || *a == '\\') fprintf(tracer.fout, "\\%c", *a);
+                else if (*a < 0x20)         fprintf(tracer.fout, "\\u%04x", *a);
+                else                        fputc(*a, tracer.fout);
+            }
+            fputs("\"}", tracer.fout);
+        }
+        fputc('}', tracer.fout);
+    }
 
-    if (R->attr != &R->topattr) {
-        oldattr = R->attr;        // Point it at the current attribute set
-        R->attr = oldattr->outer; // Modify structure to point to outer scope
-        free(oldattr);            // Delete the old attribute set
+    if (tracer.dropped) {
+        fprintf(tracer.fout, ",\n{\"name\":\"dropped spans\",\"ph\":\"C\",\"pid\":1,\"tid\":1,"
+                "\"ts\":0,\"args\":{\"count\":%zu}}", tracer.dropped);
     }
 
-    RETURN();
+    fputs("\n]}\n", tracer.fout);
+
+    err = ferror(tracer.fout) ? EIO : 0;
+    if (fclose(tracer.fout) == EOF) err = EIO;
+    tracer.fout = NULL;
+    free(tracer.spans);
+    tracer.spans = NULL;
+    tracer.n = tracer.cap = 0;
+
+    if (err) FAIL(err, "Could not write trace file");
+
+    RETURN(0);
 }
 
 
 
+static uint64_t trace_now(void) {
+    struct timespec ts;
+
+#if defined(CLOCK_MONOTONIC)
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
 
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec - tracer.epoch;
+}
 
 
-/////////////////////////////////////////////////////////////////////////////
-////                                                                     ////
-////                          PARSING FUNCTIONS                          ////
-////                                                                     ////
-/////////////////////////////////////////////////////////////////////////////
 
-static int32_t get_num_arg(const char *s) {
-    const char *validchars="0123456789-";
-    const char *p;
-    int32_t retval;
+static void trace_span(const char *name, uint64_t start, const char *arg) {
+    uint64_t   end = trace_now();
+    tracespan *newspans;
+    size_t     newcap;
+    size_t     i;
 
-    BEGIN_FUNCTION
+    // Spans shorter than the threshold are not worth the space. E.g., most
+    // reads come straight from the stdio buffer, and only refills remain.
+    if (end - start < tracer.minns) return;
 
-    p = s;
-    while (!strchr(validchars, *p)) p++;
+    if (tracer.n == tracer.cap) {
+        newcap = tracer.cap ? 2 * tracer.cap : 4096;
+        newspans = realloc(tracer.spans, newcap * sizeof *newspans);
+        if (!newspans) { tracer.dropped++; return; }
+        tracer.spans = newspans;
+        tracer.cap = newcap;
+    }
 
-    sscanf(p, "%"SCNd32, &retval);
+    tracer.spans[tracer.n].name  = name;
+    tracer.spans[tracer.n].start = start;
+    tracer.spans[tracer.n].dur   = end - start;
 
-    RETURN(retval);
+    for (i = 0; arg && arg[i] && i < sizeof tracer.spans[0].arg - 1; i++) {
+        tracer.spans[tracer.n].arg[i] = arg[i];
+    }
+    tracer.spans[tracer.n].arg[i] = '\0';
+
+    tracer.n++;
 }
 
 
 
-static uint8_t get_hex_arg(const char *s) {
-    const char *validchars="0123456789ABCDEFabcdef";
-    const char *p;
-    uint32_t retval;
+static int trace_fgetc(FILE *f) {
+    int c;
 
-    BEGIN_FUNCTION
+    TRACE_BEGIN(t);
+    c = fgetc(f);
+    TRACE_END(t, "read", NULL);
+
+    return c;
+}
+
+#else
+
+int rtftrace_start(const char *filename, uint64_t minns) {
+    (void)filename; (void)minns;
+    return ENOTSUP;
+}
 
-    p = s;
-    while (!strchr(validchars, *p)) p++;
 
-    sscanf(p, "%"SCNx32, &retval);
 
-    RETURN((uint8_t)retval);
+int rtftrace_stop(void) {
+    return ENOTSUP;
 }
+
+#endif
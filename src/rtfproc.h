@@ -21,6 +21,8 @@ extern "C" {
 #endif
 
 #include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include "cpgtou.h"
 
@@ -30,6 +32,11 @@ extern "C" {
 #define   TXT_BUFFER_SIZE    2048  // Text processing buffer
 #define   CMD_BUFFER_SIZE    2048  // Command processing buffer
 #define   FONTTBL_SIZE        512  // Number of fonttbl entries
+#define   RAW_BUFFER_MIN       64  // Smallest sizes new_rtfobj_opts() will
+#define   TXT_BUFFER_MIN       16  // take, so that any valid command or
+#define   CMD_BUFFER_MIN       64  // character still fits
+#define   STDIO_BUFFER_SIZE  (1<<21) // setvbuf() size used by new_rtfobj()
+#define   INFO_BUFFER_SIZE   4096    // setvbuf() size used by new_rtfobj_info()
 
 #define   NOMATCH              -1
 #define   PARTIAL               0
@@ -39,6 +46,19 @@ extern "C" {
 #define   RTF_PROC_STEP         0
 #define   RTF_PROC_END          1
 
+// Which key wins when several match at the same position
+#define   RTF_MATCH_DEFAULT     0  // Like FIRST, or LONGEST with a dictionary
+#define   RTF_MATCH_FIRST       1  // First registered (dictionary keys last)
+#define   RTF_MATCH_LONGEST     2  // Longest, waiting out any partial match
+#define   RTF_MATCH_SHORTEST    3  // Shortest, as soon as it is complete
+
+// fatalerr values for each resource limit (see set_rtfobj_limits())
+#define   RTF_ELIMIT_DEPTH      ELOOP      // Groups nested too deep
+#define   RTF_ELIMIT_BYTES      EFBIG      // Too much input
+#define   RTF_ELIMIT_STEPS      ETIME      // Too many tokens
+#define   RTF_ELIMIT_TIME       ETIMEDOUT  // Deadline passed
+#define   RTF_ELIMIT_MEMORY     EDQUOT     // Buffers grew too large
+
 
 // ATTRIBUTE STACK ENTRY
 typedef struct rtfattr {
@@ -53,47 +73,349 @@ typedef struct rtfattr {
 
     uint8_t         xtra;
 
+    uint8_t         infofield;   // \info destination being collected
+    bool            ininfo;      // Inside the \info group
+
     cpg_t           codepage;    // Principally for WordPad, Pages, TextEdit
 
+    uint64_t        grouppos;    // Input offset of this group's "{"
+
     struct          rtfattr *outer;
 } rtfattr;
 
 
+// ALLOCATOR
+// Memory an RTF object or dictionary uses for itself is requested through
+// these hooks, each passed ctx. resize() and release() are never passed a
+// NULL pointer. Memory handed back to the caller (snapshots, scan results,
+// document info) always comes from malloc(), to be freed as documented.
+typedef struct rtfalloc {
+    void        * (* alloc)(void *ctx, size_t z);
+    void        * (* resize)(void *ctx, void *p, size_t z);
+    void          (* release)(void *ctx, void *p);
+    void         *  ctx;
+} rtfalloc;
+
+// Bump allocator with a hard cap (see new_rtfarena())
+typedef struct rtfarena rtfarena;
+
+
+// CREATION OPTIONS
+// Zero in any buffer size selects the default above, and a size below the
+// minimum above is raised to it. Zero in iobufz leaves
+// the stdio buffering of the streams as the caller set it up. With arenaz
+// set, the object gets its own arena of at most that many bytes, released
+// all at once by delete_rtfobj(); otherwise alloc is used, if it is set,
+// or else malloc() and friends.
+typedef struct rtfopts {
+    size_t          rawz;         // Max raw buffer size
+    size_t          txtz;         // Max text buffer size
+    size_t          cmdz;         // Max command buffer size
+    size_t          fonttblz;     // Max fonttbl entries
+    size_t          iobufz;       // setvbuf() size for fin/fout/ftxt
+    size_t          arenaz;       // Cap on a private arena, or 0 for none
+    rtfalloc        alloc;        // Allocator, if not using an arena
+} rtfopts;
+
+
+// RESOURCE LIMITS (see set_rtfobj_limits())
+// Zero means no limit. Memory counts what the object grows while it
+// processes: its buffers, font table, and attribute stack.
+typedef struct rtflimits {
+    size_t          maxdepth;     // Group nesting depth
+    uint64_t        maxbytes;     // Input offset processing may pass
+    uint64_t        maxsteps;     // Tokens processed
+    uint64_t        maxnanos;     // Wall time from set_rtfobj_limits()
+    size_t          maxmem;       // Bytes of working memory
+} rtflimits;
+
+
+// MATCH RECORD (see rtfscan())
+typedef struct rtfmatch {
+    size_t          key;          // Index of the matching key
+    size_t          txtpos;       // Offset of the match in the decoded text
+    size_t          rawbeg;       // Input byte range [rawbeg, rawend) that
+    size_t          rawend;       // the match spans, including formatting
+} rtfmatch;
+
+
+// DOCUMENT METADATA (see rtfgetinfo())
+// Strings are UTF-8 and NULL if absent; release them with clear_rtfinfo().
+typedef struct rtftime {
+    int32_t         yr;
+    int32_t         mo;
+    int32_t         dy;
+    int32_t         hr;
+    int32_t         min;
+    int32_t         sec;
+} rtftime;
+
+typedef struct rtfinfo {
+    char         *  title;
+    char         *  subject;
+    char         *  author;
+    char         *  manager;
+    char         *  company;
+    char         *  operatorname; // \operator, the last person to edit
+    char         *  category;
+    char         *  keywords;
+    char         *  comment;
+    char         *  doccomm;
+    char         *  hlinkbase;
+    rtftime         creatim;
+    rtftime         revtim;
+    rtftime         printim;
+    rtftime         buptim;
+    int32_t         version;
+    int32_t         edmins;
+    int32_t         nofpages;
+    int32_t         nofwords;
+    int32_t         nofchars;
+} rtfinfo;
+
+
+// PARSER STATE SUMMARY (see summarize_rtfobj())
+// Enough to resume decoding the body of a document partway through, given
+// the font table in effect at that point.
+typedef struct rtfsummary {
+    uint64_t        offset;       // Input offset
+    uint32_t        depth;        // Number of open groups
+    int32_t         uc;           // \ucN in effect
+    int32_t         codepage;     // Innermost group's code page, 0 if none
+    int32_t         documentcodepage;
+    int32_t         defaultfont;
+} rtfsummary;
+
+
+// PARSER SNAPSHOT (see snapshot_rtfobj())
+// All parser state between two processing steps, including input that has
+// been read but not yet output, as one self-contained block that can be
+// written to disk as is. Integers are in host byte order.
+//
+//   rtfsnaphdr
+//   rtfsnapattr  attrs[nattr]           outermost (top) scope first
+//   int32_t      fontf[nfonts]
+//   int32_t      fontcharset[nfonts]
+//   uint32_t     txtrawmap[ti]
+//   uint32_t     txtrawend[txtended]
+//   char         raw[ri]
+//   char         txt[ti]
+#define   RTFSNAP_MAGIC     "RTFSNAP"
+#define   RTFSNAP_VERSION   1
+
+typedef struct rtfsnaphdr {
+    char            magic[8];
+    uint32_t        version;
+    uint32_t        hdrz;        // sizeof(rtfsnaphdr), guards layout drift
+    uint64_t        offset;      // Input offset at which to resume reading
+    uint64_t        rawpos;
+    uint64_t        txtpos;
+    uint32_t        nattr;
+    uint32_t        nfonts;
+    uint32_t        ri;
+    uint32_t        ti;
+    int32_t         defaultfont;
+    int32_t         documentcodepage;
+    int32_t         highsurrogate;
+    int32_t         rawbraces;
+    uint8_t         rawescaped;
+    uint8_t         txtdeferred;
+    uint8_t         reserved[2];
+    uint32_t        txtended;
+} rtfsnaphdr;
+
+typedef struct rtfsnapattr {
+    uint32_t        uc;
+    uint32_t        uccountdown;
+    int32_t         fonttbl_defn_idx;
+    int32_t         codepage;
+    uint8_t         fonttbl;
+    uint8_t         blkoptional;
+    uint8_t         nocmd;
+    uint8_t         notxt;
+    uint8_t         xtra;
+    uint8_t         infofield;
+    uint8_t         ininfo;
+    uint8_t         reserved;
+} rtfsnapattr;
+
+
+// REPLACEMENT DICTIONARY (see new_rtfdict())
+// An immutable trie over a sorted key list, for very large replacement sets.
+// Nodes are numbered breadth-first, so each node's children are contiguous:
+// the child reached by edge e is node e + 1, and labels[e] is its byte.
+// Keys and values are NUL-terminated strings in a single pool, with entry i
+// at pool[strs[2*i]] (key) and pool[strs[2*i+1]] (value), in key order.
+typedef struct rtfdictnode {
+    uint32_t        first;        // First child edge
+    uint32_t        nkids;        // Number of child edges
+    uint32_t        entry;        // 1 + index of the key ending here, or 0
+} rtfdictnode;
+
+typedef struct rtfdict {
+    size_t          n;            // Number of entries
+    size_t          nnodes;
+    rtfdictnode  *  nodes;        // nodes[0] is the root
+    uint8_t      *  labels;       // nnodes - 1 edge labels
+    size_t       *  strs;
+    char         *  pool;
+    uint64_t        hash;         // rtfhash() of the whole pool
+    rtfalloc        alloc;
+} rtfdict;
+
+
+// OUTPUT HOOKS
+// When a hook is set, raw RTF that would otherwise be written to fout is
+// handed to raw(), and each completed match is handed to match() in place of
+// writing the replacement value.  The matched raw RTF is still in R->raw[]
+// for the duration of the match() call.
+struct rtfobj;
+typedef struct rtfhooks {
+    void         (* raw)(struct rtfobj *R, const char *buf, size_t len, void *data);
+    void         (* match)(struct rtfobj *R, size_t key, int nbraces, void *data);
+    void         *  data;
+} rtfhooks;
+
+
+// PICTURE GROUP (see set_rtfobj_pict_hook())
+// A \pict group, held back from the output until it closes. The hook can
+// set placeholder to RTF to write in its place; otherwise the group is
+// written out unchanged.
+typedef struct rtfpict {
+    uint64_t        hash;         // rtfhash() of rtf[0..len)
+    size_t          len;
+    uint64_t        offset;       // Input offset of the group's "{"
+    const char   *  rtf;          // The group, "{" through "}"
+    const char   *  placeholder;  // Set by the hook, or left NULL
+} rtfpict;
+
+typedef void (*rtfpicthook)(struct rtfobj *R, rtfpict *P, void *data);
+
+
+// PICTURE EXTRACTION (see set_rtfobj_pict_reader())
+// The reader is called with each chunk of a picture's decoded payload, then
+// once more with no data when the group closes. The properties are those
+// seen before the chunk; they normally all come before the payload.
+typedef enum rtfpictfmt {
+    RTF_PICT_UNKNOWN,
+    RTF_PICT_EMF,                 // \emfblip
+    RTF_PICT_PNG,                 // \pngblip
+    RTF_PICT_JPEG,                // \jpegblip
+    RTF_PICT_MAC,                 // \macpict
+    RTF_PICT_OS2,                 // \pmmetafileN
+    RTF_PICT_WMF,                 // \wmetafileN
+    RTF_PICT_DIB,                 // \dibitmapN
+    RTF_PICT_BMP                  // \wbitmapN
+} rtfpictfmt;
+
+typedef struct rtfpictinfo {
+    rtfpictfmt      format;
+    int32_t         formatarg;    // The N of \wmetafileN and the like
+    int32_t         picw;         // Size in pixels (or twips for metafiles)
+    int32_t         pich;
+    int32_t         picwgoal;     // Desired size in twips
+    int32_t         pichgoal;
+    int32_t         picscalex;    // Scaling in percent
+    int32_t         picscaley;
+    uint64_t        offset;       // Input offset of the group's "{"
+    uint64_t        decoded;      // Payload bytes before this chunk
+    bool            binary;       // Some of the payload came from \binN
+    bool            last;         // No data; the group has ended...
+    bool            truncated;    // ...or the input has
+} rtfpictinfo;
+
+typedef void (*rtfpictreader)(struct rtfobj *R, const rtfpictinfo *P, const uint8_t *buf, size_t len, void *data);
+
+
 // RTF OBJECT
 typedef struct rtfobj {
     // Processing variables
     FILE         *  fin;          // RTF file-in
     FILE         *  fout;         // RTF file-out
     FILE         *  ftxt;         // RTF text file-out
+    size_t          iobufz;       // setvbuf() size given to them, or 0
     size_t          ri;           // raw/txt/cmd iterators, buffer
     size_t          ti;           // sizes, and buffers
     size_t          ci;
-    size_t          rawz;
-    size_t          txtz;
-    size_t          cmdz;
-    char            raw[RAW_BUFFER_SIZE];
-    char            txt[TXT_BUFFER_SIZE];
-    char            cmd[CMD_BUFFER_SIZE];
-    size_t          txtrawmap[TXT_BUFFER_SIZE];
+    size_t          rawz;         // Buffers are allocated on first use
+    size_t          txtz;         // and grow on demand, so these are
+    size_t          cmdz;         // current capacities...
+    size_t          rawmax;       // ...and these are the most they may
+    size_t          txtmax;       // grow to before being flushed.
+    size_t          cmdmax;
+    char         *  raw;
+    char         *  txt;
+    char         *  cmd;
+    uint32_t     *  txtrawmap;    // Input offset (mod 2^32) of each txt byte
+    uint32_t     *  txtrawend;    // Input offset after each txt byte's token,
+    size_t          txtended;     // for the first txtended bytes (dictionary only)
+    size_t          txtmatched;   // txt[0..txtmatched) is a pending partial match
+    size_t          walkz;        // txt[0..walkz) leads to dictionary node
+    uint32_t        walknode;     // walknode, passing key walkbest (1-based,
+    size_t          walkbest;     // or 0) of length walkbestlen on the way
+    size_t          walkbestlen;
+    size_t          rawpos;       // Input offset of raw[0]
+    size_t          txtpos;       // Text offset of txt[0]
+    int             rawbraces;    // Net unescaped braces in raw[0..ri)
+    bool            rawescaped;   // raw[ri-1] is an unpaired backslash
 
     // Font table and code page
     size_t          fonttbl_n; 
     size_t          fonttbl_z;
-    int32_t         fonttbl_f[FONTTBL_SIZE];
-    int32_t         fonttbl_charset[FONTTBL_SIZE];
+    size_t          fonttbl_max;
+    int32_t      *  fonttbl_f;
+    int32_t      *  fonttbl_charset;
     int32_t         defaultfont;
     cpg_t           documentcodepage;
 
     // Current/temporary status variables
     int             fatalerr;     // Cf. ERRNO. E.g., EIO, ENOMEM, etc.
+    size_t          depth;        // Attribute scopes above topattr
     int32_t         highsurrogate;
+    bool            txtdeferred;  // Text setup done, first byte still pending
 
     // Search & replace tokens (key-value pair)
     size_t          srchz;        // srch & replace pairs
     size_t          srch_match; 
     char        **  srch_key;
     char        **  srch_val;
-    
+    uint8_t         keyfirst[32]; // Bitmap of bytes that begin some key
+    size_t          nkeyfirst;    // Number of such bytes...
+    uint8_t         keylead;      // ...and the byte, if there's only one
+    const rtfdict *  dict;        // Base layer under the keys above, if set
+    int             matchpolicy;  // RTF_MATCH_*
+
+    // Output hooks
+    rtfhooks        hooks;
+
+    // Picture groups (see rtfpict)
+    rtfpicthook     picthook;
+    void         *  pictdata;
+    char         *  pict;         // Group being held back...
+    size_t          pictz;        // ...its length so far...
+    size_t          pictcap;
+    size_t          pictdepth;    // ...and depth, or 0 if none is
+    uint64_t        picthash;
+    rtfpictreader   pictreader;
+    void         *  pictreaderdata;
+    rtfpictinfo     pictinfo;     // Picture being extracted...
+    size_t          pictreaddepth;// ...its depth, or 0 if none is...
+    int             pictnibble;   // ...a pending high nibble, or -1...
+    uint64_t        pictbinleft;  // ...and \binN bytes yet to come
+
+    // Resource limits (see rtflimits)
+    rtflimits       limits;
+    bool            limited;      // Some limit is checked once per token
+    uint64_t        steps;        // Tokens since the limits were set
+    uint64_t        deadline;     // CLOCK_MONOTONIC nanoseconds, if set
+
+    // Memory (see rtfalloc)
+    rtfalloc        alloc;
+    rtfarena     *  arena;        // Owned by the object, if set
+
+    // Metadata extraction state (see rtfgetinfo())
+    struct infostate *info;
+
     // Attribute stack
     rtfattr         topattr;      // Attribute stack
     rtfattr      *  attr;         // Attribute stack
@@ -103,16 +425,54 @@ typedef struct rtfobj {
 
 // FUNCTION DECLARATIONS
 rtfobj *new_rtfobj(FILE *fin, FILE *fout, FILE *ftxt);
+rtfobj *new_rtfobj_opts(FILE *fin, FILE *fout, FILE *ftxt, const rtfopts *opts);
+rtfobj *new_rtfobj_info(FILE *fin);
 size_t  add_rtfobj_replacements(rtfobj *R, const char **replacements);
 size_t  add_one_rtfobj_replacement(rtfobj *R, const char *key, const char *val);
+void    rtfobj_reset(rtfobj *R, FILE *fin, FILE *fout, FILE *ftxt);
 void    delete_rtfobj(rtfobj *R);
 void    rtfreplace(rtfobj *R);
 void    rtfprocess(rtfobj *R, void (*processfunction)(rtfobj *, void *, int), void *data);
+size_t  rtfscan(rtfobj *R, rtfmatch **matches, size_t *counts, bool stopwhenallseen);
+int     rtfgetinfo(rtfobj *R, rtfinfo *I);
+void    clear_rtfinfo(rtfinfo *I);
+void    rtfreplace_until(rtfobj *R, uint64_t end);
+void    rtfflush(rtfobj *R);
+void    summarize_rtfobj(const rtfobj *R, rtfsummary *S);
+int     resume_rtfobj(rtfobj *R, const rtfsummary *S, const int32_t *fonttbl_f,
+                      const int32_t *fonttbl_charset, size_t fonttbl_n);
+void   *snapshot_rtfobj(const rtfobj *R, size_t *len);
+int     restore_rtfobj(rtfobj *R, const void *snap, size_t len);
 
 void    reset_raw_buffer_by(rtfobj *R, size_t amt);
 void    reset_txt_buffer_by(rtfobj *R, size_t amt);
 void    reset_cmd_buffer_by(rtfobj *R, size_t amt);
 
+const char *find_rtfobj_replacement(const rtfobj *R, const char *key);
+size_t  rtfobj_nkeys(const rtfobj *R);
+const char *rtfobj_key(const rtfobj *R, size_t i);
+const char *rtfobj_val(const rtfobj *R, size_t i);
+
+rtfdict *new_rtfdict(const char **sortedpairs);
+rtfdict *new_rtfdict_alloc(const char **sortedpairs, const rtfalloc *A);
+void    delete_rtfdict(rtfdict *D);
+const char *find_rtfdict_value(const rtfdict *D, const char *key);
+int     set_rtfobj_dictionary(rtfobj *R, const rtfdict *D);
+int     set_rtfobj_match_policy(rtfobj *R, int policy);
+int     set_rtfobj_limits(rtfobj *R, const rtflimits *L);
+int     set_rtfobj_pict_hook(rtfobj *R, rtfpicthook hook, void *data);
+int     set_rtfobj_pict_reader(rtfobj *R, rtfpictreader reader, void *data);
+void    rtfputs(const char *s, FILE *fout);
+uint64_t rtfhash(uint64_t h, const void *buf, size_t len);
+rtfarena *new_rtfarena(size_t cap);
+void    delete_rtfarena(rtfarena *A);
+rtfalloc rtfarena_allocator(rtfarena *A);
+size_t  rtfarena_used(const rtfarena *A);
+int     rtftrace_start(const char *filename, uint64_t minns);
+int     rtftrace_stop(void);
+
+#define   RTFHASH_INIT   UINT64_C(0xcbf29ce484222325)
+
 
 #ifdef __cplusplus
 }
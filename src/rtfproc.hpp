@@ -0,0 +1,324 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#ifndef RTFPROC_HPP__
+#define RTFPROC_HPP__
+
+#include <algorithm>
+#include <cerrno>
+#include <concepts>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <ranges>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "rtfproc.h"
+
+namespace rtfproc {
+
+
+
+// INPUT
+// Processing reads from a span of bytes in place; as_input() views a string
+// the same way.
+using input = std::span<const std::byte>;
+
+inline input as_input(std::string_view s) noexcept {
+    return std::as_bytes(std::span<const char>(s.data(), s.size()));
+}
+
+
+
+// RTF ENCODING
+// A UTF-8 value as rtfputs() would write it
+inline std::string encode(std::string_view value) {
+    char        *buf = nullptr;
+    std::size_t  len = 0;
+    std::FILE   *f   = open_memstream(&buf, &len);
+    std::string  out;
+
+    if (!f) throw std::system_error(errno, std::generic_category(), "open_memstream");
+    rtfputs(std::string(value).c_str(), f);
+    std::fclose(f);
+    out.assign(buf, len);
+    std::free(buf);
+
+    return out;
+}
+
+
+
+// REPLACEMENT SET
+// Keys and values compiled once into an rtfdict, with each value also
+// encoded as RTF up front, so that a match is written without going through
+// rtfputs(). Later duplicates of a key replace earlier ones. Move-only; the
+// processors using a set borrow it, so it must outlive them.
+class replacements {
+public:
+    using pair = std::pair<std::string_view, std::string_view>;
+
+    replacements(std::initializer_list<pair> pairs) {
+        build(std::vector<pair>(pairs));
+    }
+
+    // Any range of pair-likes whose halves convert to std::string_view,
+    // e.g., a std::map<std::string, std::string>
+    template <std::ranges::input_range Range>
+    explicit replacements(const Range &pairs) {
+        std::vector<pair> v;
+        for (const auto &[key, val] : pairs) v.emplace_back(std::string_view(key), std::string_view(val));
+        build(std::move(v));
+    }
+
+    replacements(replacements &&) noexcept            = default;
+    replacements &operator=(replacements &&) noexcept = default;
+    replacements(const replacements &)                = delete;
+    replacements &operator=(const replacements &)     = delete;
+
+    std::size_t      size() const noexcept                  { return dict_->n; }
+    const ::rtfdict *get()  const noexcept                  { return dict_.get(); }
+    std::string_view key(std::size_t i) const noexcept      { return &dict_->pool[dict_->strs[2*i]]; }
+    std::string_view value(std::size_t i) const noexcept    { return &dict_->pool[dict_->strs[2*i+1]]; }
+    std::string_view rtf(std::size_t i) const noexcept      { return rtf_[i]; }
+
+private:
+    struct dict_deleter { void operator()(::rtfdict *D) const noexcept { delete_rtfdict(D); } };
+
+    void build(std::vector<pair> v) {
+        std::vector<std::string> strs;
+        std::vector<const char *> flat;
+
+        // new_rtfdict() wants its keys sorted and unique; keep the last of each
+        std::stable_sort(v.begin(), v.end(), [](const pair &a, const pair &b) { return a.first < b.first; });
+        for (std::size_t i = 0; i < v.size(); i++) {
+            if (i + 1 < v.size() && v[i].first == v[i+1].first) continue;
+            strs.emplace_back(v[i].first);
+            strs.emplace_back(v[i].second);
+        }
+        for (const auto &s : strs) flat.push_back(s.c_str());
+        flat.push_back(nullptr);
+
+        dict_.reset(new_rtfdict(flat.data()));
+        if (!dict_) throw std::bad_alloc();
+
+        rtf_.reserve(dict_->n);
+        for (std::size_t i = 0; i < dict_->n; i++) rtf_.push_back(encode(value(i)));
+    }
+
+    std::unique_ptr<::rtfdict, dict_deleter> dict_;
+    std::vector<std::string>                 rtf_;
+};
+
+
+
+// PROCESSOR
+// Owns an rtfobj bound to one replacement set, reset and reused for every
+// call. Output goes straight from the object's buffers to a sink callable
+// with each run of output as a std::string_view, so nothing is copied on
+// the way to a std::string or output iterator, and no stdio stream sits in
+// between. Callbacks are template parameters: the library still calls
+// through a pointer, but to a trampoline made for that callback type, with
+// the callback's body inlined into it and no type erasure.
+//
+// An exception thrown by a callback stops processing and is rethrown once
+// the library has returned. A fatal error in the library (see rtfobj's
+// fatalerr) throws std::system_error, after whatever output came before it.
+class processor {
+public:
+    explicit processor(const replacements &set, const rtfopts &opts = {}) : set_(&set) {
+        R_.reset(new_rtfobj_opts(nullptr, nullptr, nullptr, &opts));
+        if (!R_ || set_rtfobj_dictionary(R_.get(), set.get())) throw std::bad_alloc();
+    }
+    explicit processor(replacements &&, const rtfopts & = {}) = delete;
+
+    processor(processor &&) noexcept            = default;
+    processor &operator=(processor &&) noexcept = default;
+    processor(const processor &)                = delete;
+    processor &operator=(const processor &)     = delete;
+
+    // For the rest of the C API, e.g., set_rtfobj_limits()
+    ::rtfobj       *get() noexcept       { return R_.get(); }
+    const ::rtfobj *get() const noexcept { return R_.get(); }
+
+    // on_match(key, rtf) returns what to write in place of a match, given
+    // the key and its value encoded as RTF
+    template <class Sink, class OnMatch>
+        requires std::invocable<Sink &, std::string_view> &&
+                 std::invocable<OnMatch &, std::string_view, std::string_view>
+    void replace(input in, Sink &&sink, OnMatch &&on_match) {
+        using ctx = context<std::remove_reference_t<Sink>, std::remove_reference_t<OnMatch>>;
+        ctx        C{ &sink, &on_match, set_, nullptr };
+        ::rtfhooks hooks{};
+
+        hooks.raw   = &ctx::raw;
+        hooks.match = &ctx::match;
+        hooks.data  = &C;
+        run(in, nullptr, hooks, [](::rtfobj *R) { rtfreplace(R); }, C.error);
+    }
+
+    template <class Sink>
+        requires std::invocable<Sink &, std::string_view>
+    void replace(input in, Sink &&sink) {
+        replace(in, sink, [](std::string_view, std::string_view rtf) { return rtf; });
+    }
+
+    template <std::output_iterator<char> Out>
+        requires (!std::invocable<Out &, std::string_view>)
+    Out replace(input in, Out out) {
+        replace(in, [&out](std::string_view s) { out = std::copy(s.begin(), s.end(), out); });
+        return out;
+    }
+
+    std::string replace(input in) {
+        std::string out;
+        out.reserve(in.size());
+        replace(in, [&out](std::string_view s) { out.append(s); });
+        return out;
+    }
+
+    // Plain text, as written to ftxt. Unlike replace(), this goes through a
+    // stdio stream, so it is copied once.
+    std::string text(input in) {
+        char                *buf = nullptr;
+        std::size_t          len = 0;
+        std::FILE           *ftxt = open_memstream(&buf, &len);
+        std::exception_ptr   error;
+        std::string          out;
+
+        if (!ftxt) throw std::system_error(errno, std::generic_category(), "open_memstream");
+        try {
+            run(in, ftxt, ::rtfhooks{}, [](::rtfobj *R) { rtfreplace(R); }, error);
+        }
+        catch (...) {
+            std::fclose(ftxt);
+            std::free(buf);
+            throw;
+        }
+        std::fclose(ftxt);
+        out.assign(buf, len);
+        std::free(buf);
+
+        return out;
+    }
+
+    // step(R, event) for each RTF_PROC_* event of rtfprocess()
+    template <class Step>
+        requires std::invocable<Step &, ::rtfobj &, int>
+    void process(input in, Step &&step) {
+        struct stepper {
+            std::remove_reference_t<Step> *step;
+            std::exception_ptr  error;
+
+            static void call(::rtfobj *R, void *data, int event) {
+                auto *S = static_cast<stepper *>(data);
+                if (S->error) return;
+                try { (*S->step)(*R, event); }
+                catch (...) { S->error = std::current_exception(); R->fatalerr = ECANCELED; }
+            }
+        } S{ &step, nullptr };
+
+        run(in, nullptr, ::rtfhooks{}, [&S](::rtfobj *R) { rtfprocess(R, &stepper::call, &S); }, S.error);
+    }
+
+private:
+    struct obj_deleter { void operator()(::rtfobj *R) const noexcept { delete_rtfobj(R); } };
+
+    template <class Sink, class OnMatch>
+    struct context {
+        Sink               *sink;
+        OnMatch            *on_match;
+        const replacements *set;
+        std::exception_ptr  error;
+
+        static void raw(::rtfobj *R, const char *buf, std::size_t len, void *data) {
+            auto *C = static_cast<context *>(data);
+            if (C->error) return;
+            try { (*C->sink)(std::string_view(buf, len)); }
+            catch (...) { C->error = std::current_exception(); R->fatalerr = ECANCELED; }
+        }
+
+        static void match(::rtfobj *R, std::size_t key, int nbraces, void *data) {
+            static constexpr std::string_view opens  = "{{{{{{{{{{{{{{{{";
+            static constexpr std::string_view closes = "}}}}}}}}}}}}}}}}";
+            auto            *C = static_cast<context *>(data);
+            std::string      added;
+            std::string_view k, v;
+            std::size_t      n;
+
+            if (C->error) return;
+            try {
+                // Keys added through get() come before the set's
+                if (key < R->srchz) {
+                    added = encode(rtfobj_val(R, key));
+                    k     = rtfobj_key(R, key);
+                    v     = added;
+                }
+                else {
+                    k     = C->set->key(key - R->srchz);
+                    v     = C->set->rtf(key - R->srchz);
+                }
+                decltype(auto) rtf = (*C->on_match)(k, v);
+                (*C->sink)(std::string_view(rtf));
+
+                // Keep the net braces of the matched raw RTF, as rtfreplace() does
+                for (; nbraces > 0; nbraces -= (int)n) (*C->sink)(opens.substr(0,  n = std::min((std::size_t) nbraces, opens.size())));
+                for (; nbraces < 0; nbraces += (int)n) (*C->sink)(closes.substr(0, n = std::min((std::size_t)-nbraces, closes.size())));
+            }
+            catch (...) { C->error = std::current_exception(); R->fatalerr = ECANCELED; }
+        }
+    };
+
+    template <class Body>
+    void run(input in, std::FILE *ftxt, const ::rtfhooks &hooks, Body body, const std::exception_ptr &error) {
+        ::rtfobj  *R = R_.get();
+        std::FILE *fin;
+        int        err;
+
+        if (in.empty()) return;
+        fin = fmemopen(const_cast<std::byte *>(in.data()), in.size(), "rb");
+        if (!fin) throw std::system_error(errno, std::generic_category(), "fmemopen");
+
+        rtfobj_reset(R, fin, nullptr, ftxt);
+        R->hooks = hooks;
+        body(R);
+        err = R->fatalerr;
+
+        // Nothing of this call stays bound to the object
+        R->hooks = ::rtfhooks{};
+        rtfobj_reset(R, nullptr, nullptr, nullptr);
+        std::fclose(fin);
+
+        if (error) std::rethrow_exception(error);
+        if (err)   throw std::system_error(err, std::generic_category(), "rtfproc");
+    }
+
+    std::unique_ptr<::rtfobj, obj_deleter> R_;
+    const replacements                    *set_;
+};
+
+}
+
+#endif
@@ -0,0 +1,789 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                        DECLARATIONS & MACROS                        ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "rtfproc.h"
+#include "rtftmpl.h"
+#include "rtfpairs.h"
+#include "rtfprocd.h"
+#include "utillib.h"
+
+#if defined(MSG_NOSIGNAL)
+#define PROCD_SENDFLAGS      MSG_NOSIGNAL
+#else
+#define PROCD_SENDFLAGS      0
+#endif
+
+#define PROCD_BACKLOG        64
+
+// A named replacement set, compiled once and shared by every worker
+typedef struct procdset {
+    char              * name;
+    rtfdict           * dict;
+} procdset;
+
+typedef struct procdtmpl {
+    char              * name;
+    rtftmpl           * T;
+} procdtmpl;
+
+// Each worker keeps one object per set (and one with no set at all), made
+// on first use and reset with rtfobj_reset() before each request
+typedef struct procdworker {
+    struct rtfprocd   * D;
+    pthread_t           thread;
+    rtfobj           ** objs;        // [nsets + 1], the last with no set
+} procdworker;
+
+struct rtfprocd {
+    char              * path;
+    int                 listenfd;
+    int                 stopfd[2];   // Readable once stopping
+    procdset          * sets;
+    size_t              nsets;
+    procdtmpl         * tmpls;
+    size_t              ntmpls;
+    procdworker       * workers;
+    size_t              nworkers;
+
+    // Accepted connections waiting for a worker
+    pthread_mutex_t     lock;
+    pthread_cond_t      ready;
+    int               * queue;
+    size_t              qcap;
+    size_t              qhead;
+    size_t              qlen;
+    bool                stopping;
+    rtfprocdstats       stats;
+};
+
+// Key/value pair, for sorting a set before it is compiled
+typedef struct procdpair {
+    const char        * key;
+    const char        * val;
+} procdpair;
+
+static void *procd_worker(void *arg);
+static void procd_connection(procdworker *W, int fd);
+static int procd_handle(procdworker *W, const rtfprocdreq *q, const char *set, const char *tmpl,
+                        const char *body, char **out, size_t *outlen);
+static rtfobj *procd_object(procdworker *W, size_t set);
+static bool procd_enqueue(rtfprocd *D, int fd);
+static bool procd_wait_readable(const rtfprocd *D, int fd);
+static bool read_full(int fd, void *buf, size_t len);
+static bool write_full(int fd, const void *buf, size_t len);
+static int cmppair(const void *a, const void *b);
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                    SERVER CREATION & DESTRUCTION                    ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+rtfprocd *new_rtfprocd(const char *path, size_t nworkers) {
+    rtfprocd *D;
+
+    BEGIN_FUNCTION
+
+    if (strlen(path) >= sizeof ((struct sockaddr_un *)0)->sun_path) FAIL(NULL, "Socket path too long: %s", path);
+
+    D = malloc(sizeof *D);
+    if (!D) FAIL(NULL, "Failed allocating server.");
+    memzero(D, sizeof *D);
+
+    D->listenfd  = -1;
+    D->stopfd[0] = D->stopfd[1] = -1;
+    D->nworkers  = nworkers ? nworkers : 1;
+    D->path      = strdup(path);
+    if (!D->path || pipe(D->stopfd)) {
+        delete_rtfprocd(D);
+        FAIL(NULL, "Failed allocating server.");
+    }
+    pthread_mutex_init(&D->lock, NULL);
+    pthread_cond_init(&D->ready, NULL);
+
+    RETURN(D);
+}
+
+
+
+void delete_rtfprocd(rtfprocd *D) {
+    BEGIN_FUNCTION
+
+    if (!D) RETURN();
+
+    for (size_t i = 0; i < D->nsets; i++) {
+        free(D->sets[i].name);
+        delete_rtfdict(D->sets[i].dict);
+    }
+    for (size_t i = 0; i < D->ntmpls; i++) {
+        free(D->tmpls[i].name);
+        close_rtftmpl(D->tmpls[i].T);
+    }
+    if (D->stopfd[0] >= 0) close(D->stopfd[0]);
+    if (D->stopfd[1] >= 0) close(D->stopfd[1]);
+    if (D->stopfd[0] >= 0) {
+        pthread_mutex_destroy(&D->lock);
+        pthread_cond_destroy(&D->ready);
+    }
+    free(D->sets);
+    free(D->tmpls);
+    free(D->queue);
+    free(D->path);
+    free(D);
+
+    RETURN();
+}
+
+
+
+int rtfprocd_add_set(rtfprocd *D, const char *name, const char **pairs) {
+    procdpair  *sorted;
+    const char **flat;
+    procdset   *sets;
+    size_t      n, i;
+
+    BEGIN_FUNCTION
+
+    // Sets are only added before serving, so none of this is locked
+    for (n = 0; pairs[2*n]; n++);
+    sorted = malloc((n + 1) * sizeof *sorted);
+    flat   = malloc((2*n + 1) * sizeof *flat);
+    sets   = realloc(D->sets, (D->nsets + 1) * sizeof *sets);
+    if (sets) D->sets = sets;
+    if (!sorted || !flat || !sets) {
+        free(sorted);
+        free(flat);
+        FAIL(ENOMEM, "Out of memory adding set \'%s\'", name);
+    }
+
+    // new_rtfdict() wants its keys sorted
+    for (i = 0; i < n; i++) sorted[i] = (procdpair){ pairs[2*i], pairs[2*i+1] };
+    qsort(sorted, n, sizeof *sorted, cmppair);
+    for (i = 0; i < n; i++) {
+        flat[2*i]   = sorted[i].key;
+        flat[2*i+1] = sorted[i].val;
+    }
+    flat[2*n] = NULL;
+
+    sets = &D->sets[D->nsets];
+    sets->dict = new_rtfdict(flat);
+    sets->name = strdup(name);
+    free(sorted);
+    free(flat);
+    if (!sets->dict || !sets->name) {
+        delete_rtfdict(sets->dict);
+        free(sets->name);
+        FAIL(EINVAL, "Could not compile set \'%s\'", name);
+    }
+    D->nsets++;
+
+    RETURN(0);
+}
+
+
+
+int rtfprocd_load_set(rtfprocd *D, const char *name, const char *path) {
+    char **pairs;
+    int    err;
+
+    BEGIN_FUNCTION
+
+    // See rtfpairs.h for the file formats
+    if (!(pairs = load_rtfpairs(path, NULL))) FAIL(EINVAL, "Could not load set \'%s\' from \'%s\'", name, path);
+    err = rtfprocd_add_set(D, name, (const char **)pairs);
+    free_rtfpairs(pairs);
+
+    RETURN(err);
+}
+
+
+
+int rtfprocd_add_template(rtfprocd *D, const char *name, const char *path) {
+    procdtmpl *tmpls;
+
+    BEGIN_FUNCTION
+
+    tmpls = realloc(D->tmpls, (D->ntmpls + 1) * sizeof *tmpls);
+    if (!tmpls) FAIL(ENOMEM, "Out of memory adding template \'%s\'", name);
+    D->tmpls = tmpls;
+
+    tmpls = &D->tmpls[D->ntmpls];
+    tmpls->T    = open_rtftmpl(path);
+    tmpls->name = strdup(name);
+    if (!tmpls->T || !tmpls->name) {
+        close_rtftmpl(tmpls->T);
+        free(tmpls->name);
+        FAIL(EINVAL, "Could not open template \'%s\'", path);
+    }
+    D->ntmpls++;
+
+    RETURN(0);
+}
+
+
+
+rtfprocdstats rtfprocd_stats(rtfprocd *D) {
+    rtfprocdstats stats;
+
+    pthread_mutex_lock(&D->lock);
+    stats = D->stats;
+    pthread_mutex_unlock(&D->lock);
+
+    return stats;
+}
+
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                               SERVING                               ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+int rtfprocd_serve(rtfprocd *D) {
+    struct sockaddr_un addr;
+    struct pollfd      pfd[2];
+    procdworker       *W;
+    size_t             started = 0;
+    int                fd;
+    int                err = 0;
+
+    BEGIN_FUNCTION
+
+    memzero(&addr, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, D->path);
+
+    // A socket left behind by an earlier run is replaced
+    unlink(D->path);
+    if ((D->listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        bind(D->listenfd, (struct sockaddr *)&addr, sizeof addr) ||
+        listen(D->listenfd, PROCD_BACKLOG)) {
+        err = errno;
+        if (D->listenfd >= 0) close(D->listenfd);
+        D->listenfd = -1;
+        FAIL(err, "Could not listen on \'%s\'", D->path);
+    }
+
+    if (!(D->workers = calloc(D->nworkers, sizeof *D->workers))) err = ENOMEM;
+    for (size_t i = 0; D->workers && i < D->nworkers; i++, started++) {
+        W = &D->workers[i];
+        W->D      = D;
+        W->objs   = calloc(D->nsets + 1, sizeof *W->objs);
+        if (!W->objs || pthread_create(&W->thread, NULL, procd_worker, W)) {
+            free(W->objs);
+            err = ENOMEM;
+            break;
+        }
+    }
+
+    // Hand each connection to the next free worker until told to stop
+    pfd[0] = (struct pollfd){ .fd = D->listenfd,  .events = POLLIN };
+    pfd[1] = (struct pollfd){ .fd = D->stopfd[0], .events = POLLIN };
+    while (!err) {
+        if (poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            err = errno;
+            break;
+        }
+        if (pfd[1].revents) break;
+        if (!(pfd[0].revents & POLLIN)) continue;
+        if ((fd = accept(D->listenfd, NULL, NULL)) < 0) continue;
+        if (!procd_enqueue(D, fd)) close(fd);
+    }
+
+    // Workers finish the request they're on, then leave
+    pthread_mutex_lock(&D->lock);
+    D->stopping = true;
+    pthread_cond_broadcast(&D->ready);
+    pthread_mutex_unlock(&D->lock);
+
+    for (size_t i = 0; i < started; i++) {
+        W = &D->workers[i];
+        pthread_join(W->thread, NULL);
+        for (size_t s = 0; s <= D->nsets; s++) delete_rtfobj(W->objs[s]);
+        free(W->objs);
+    }
+    free(D->workers);
+    D->workers = NULL;
+
+    while (D->qlen) {
+        close(D->queue[D->qhead]);
+        D->qhead = (D->qhead + 1) % D->qcap;
+        D->qlen--;
+    }
+    close(D->listenfd);
+    D->listenfd = -1;
+    unlink(D->path);
+
+    if (err) FAIL(err, "Server failed");
+
+    RETURN(0);
+}
+
+
+
+void rtfprocd_stop(rtfprocd *D) {
+    ssize_t ignored;
+
+    // Only a write(), so it can be called from a signal handler
+    ignored = write(D->stopfd[1], "", 1);
+    (void)ignored;
+}
+
+
+
+static bool procd_enqueue(rtfprocd *D, int fd) {
+    int    *queue;
+    size_t  cap;
+
+    BEGIN_FUNCTION
+
+    pthread_mutex_lock(&D->lock);
+
+    if (D->qlen == D->qcap) {
+        cap = D->qcap ? 2 * D->qcap : 16;
+        if (!(queue = malloc(cap * sizeof *queue))) {
+            pthread_mutex_unlock(&D->lock);
+            FAIL(false, "Out of memory queueing connection");
+        }
+        for (size_t i = 0; i < D->qlen; i++) queue[i] = D->queue[(D->qhead + i) % D->qcap];
+        free(D->queue);
+        D->queue = queue;
+        D->qcap  = cap;
+        D->qhead = 0;
+    }
+    D->queue[(D->qhead + D->qlen) % D->qcap] = fd;
+    D->qlen++;
+    D->stats.connections++;
+    pthread_cond_signal(&D->ready);
+
+    pthread_mutex_unlock(&D->lock);
+
+    RETURN(true);
+}
+
+
+
+static void *procd_worker(void *arg) {
+    procdworker *W = arg;
+    rtfprocd    *D = W->D;
+    int          fd;
+
+    BEGIN_FUNCTION
+
+    for (;;) {
+        pthread_mutex_lock(&D->lock);
+        while (!D->qlen && !D->stopping) pthread_cond_wait(&D->ready, &D->lock);
+        if (D->stopping) { pthread_mutex_unlock(&D->lock); break; }
+        fd = D->queue[D->qhead];
+        D->qhead = (D->qhead + 1) % D->qcap;
+        D->qlen--;
+        pthread_mutex_unlock(&D->lock);
+
+        procd_connection(W, fd);
+        close(fd);
+    }
+
+    RETURN(NULL);
+}
+
+
+
+static void procd_connection(procdworker *W, int fd) {
+    rtfprocd    *D = W->D;
+    rtfprocdreq  q;
+    rtfprocdres  r;
+    char        *set, *tmpl, *body, *out;
+    size_t       outlen;
+    const char  *msg;
+
+    BEGIN_FUNCTION
+
+#if defined(SO_NOSIGPIPE)
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &(int){ 1 }, sizeof(int));
+#endif
+
+    // One request after another until the client hangs up or we stop
+    while (procd_wait_readable(D, fd) && read_full(fd, &q, sizeof q)) {
+        if (memcmp(q.magic, RTFPROCD_MAGIC, sizeof q.magic) ||
+            q.setlen > RTFPROCD_MAXNAME || q.tmpllen > RTFPROCD_MAXNAME ||
+            q.bodylen > RTFPROCD_MAXBODY) {
+            FAIL(VOID, "Malformed request; closing connection");
+        }
+
+        set  = malloc(q.setlen + 1);
+        tmpl = malloc(q.tmpllen + 1);
+        body = malloc((size_t)q.bodylen + 1);
+        out  = NULL;
+        outlen = 0;
+        if (!set || !tmpl || !body ||
+            !read_full(fd, set, q.setlen) || !read_full(fd, tmpl, q.tmpllen) ||
+            !read_full(fd, body, (size_t)q.bodylen)) {
+            free(set);
+            free(tmpl);
+            free(body);
+            FAIL(VOID, "Short request; closing connection");
+        }
+        set[q.setlen] = tmpl[q.tmpllen] = body[q.bodylen] = '\0';
+
+        memcpy(r.magic, RTFPROCD_MAGIC, sizeof r.magic);
+        r.status = procd_handle(W, &q, set, tmpl, body, &out, &outlen);
+        if (r.status) {
+            free(out);
+            msg = strerror(r.status);
+            out = strdup(msg);
+            outlen = out ? strlen(out) : 0;
+        }
+        r.bodylen = outlen;
+
+        pthread_mutex_lock(&D->lock);
+        D->stats.requests++;
+        if (r.status) D->stats.failures++;
+        pthread_mutex_unlock(&D->lock);
+
+        free(set);
+        free(tmpl);
+        free(body);
+        if (!write_full(fd, &r, sizeof r) || !write_full(fd, out, outlen)) {
+            free(out);
+            FAIL(VOID, "Client went away");
+        }
+        free(out);
+    }
+
+    RETURN();
+}
+
+
+
+static int procd_handle(procdworker *W, const rtfprocdreq *q, const char *set, const char *tmpl,
+                        const char *body, char **out, size_t *outlen) {
+    rtfprocd  *D = W->D;
+    rtftmpl   *T = NULL;
+    rtfobj    *R;
+    FILE      *fin = NULL;
+    FILE      *fout;
+    size_t     s = D->nsets;
+    int        err = 0;
+
+    BEGIN_FUNCTION
+
+    if (*set) {
+        for (s = 0; s < D->nsets && strcmp(D->sets[s].name, set); s++);
+        if (s == D->nsets) FAIL(ENOENT, "No set named \'%s\'", set);
+    }
+    if (q->op == RTFPROCD_TEMPLATE) {
+        for (size_t i = 0; i < D->ntmpls && !T; i++) {
+            if (!strcmp(D->tmpls[i].name, tmpl)) T = D->tmpls[i].T;
+        }
+        if (!T) FAIL(ENOENT, "No template named \'%s\'", tmpl);
+    }
+    else if (q->op != RTFPROCD_RENDER && q->op != RTFPROCD_EXTRACT) {
+        FAIL(EINVAL, "Unknown request \'%c\'", (int)q->op);
+    }
+
+    if (!(R = procd_object(W, s))) FAIL(ENOMEM, "Could not set up an object");
+
+    if (!(fout = open_memstream(out, outlen))) FAIL(errno, "Could not open output");
+    if (q->bodylen && !(fin = fmemopen((void *)body, (size_t)q->bodylen, "rb"))) {
+        err = errno;
+        fclose(fout);
+        FAIL(err, "Could not open input");
+    }
+
+    if (q->op == RTFPROCD_EXTRACT) rtfobj_reset(R, fin, NULL, fout);
+    else                           rtfobj_reset(R, fin, fout, NULL);
+    switch (q->op) {
+        case RTFPROCD_RENDER:
+        case RTFPROCD_EXTRACT:
+            if (fin) rtfreplace(R);
+            break;
+        case RTFPROCD_TEMPLATE:
+            render_rtftmpl(T, R);
+            break;
+    }
+    err = R->fatalerr;
+
+    // Nothing of this request stays bound to the object
+    rtfobj_reset(R, NULL, NULL, NULL);
+    if (fin) fclose(fin);
+    if (fclose(fout) && !err) err = EIO;
+
+    RETURN(err);
+}
+
+
+
+static rtfobj *procd_object(procdworker *W, size_t set) {
+    rtfprocd *D = W->D;
+    rtfobj   *R = W->objs[set];
+
+    BEGIN_FUNCTION
+
+    // Reused objects are reset by the caller as it binds the streams
+    if (R) RETURN(R);
+
+    if (!(R = new_rtfobj(NULL, NULL, NULL))) FAIL(NULL, "Could not make object");
+    if (set < D->nsets) set_rtfobj_dictionary(R, D->sets[set].dict);
+    W->objs[set] = R;
+
+    RETURN(R);
+}
+
+
+
+static bool procd_wait_readable(const rtfprocd *D, int fd) {
+    struct pollfd pfd[2];
+
+    BEGIN_FUNCTION
+
+    // Idle connections mustn't hold up stopping
+    pfd[0] = (struct pollfd){ .fd = fd,         .events = POLLIN };
+    pfd[1] = (struct pollfd){ .fd = D->stopfd[0], .events = POLLIN };
+    for (;;) {
+        if (poll(pfd, 2, -1) >= 0) break;
+        if (errno != EINTR) RETURN(false);
+    }
+
+    RETURN(!pfd[1].revents && pfd[0].revents);
+}
+
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                                CLIENT                               ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+int rtfprocd_connect(const char *path) {
+    struct sockaddr_un addr;
+    int fd;
+    int err;
+
+    BEGIN_FUNCTION
+
+    if (strlen(path) >= sizeof addr.sun_path) FAIL(-1, "Socket path too long: %s", path);
+
+    memzero(&addr, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) FAIL(-1, "Could not create socket");
+    if (connect(fd, (struct sockaddr *)&addr, sizeof addr)) {
+        err = errno;
+        close(fd);
+        errno = err;
+        FAIL(-1, "Could not connect to \'%s\'", path);
+    }
+
+#if defined(SO_NOSIGPIPE)
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &(int){ 1 }, sizeof(int));
+#endif
+
+    RETURN(fd);
+}
+
+
+
+int rtfprocd_request(int fd, int op, const char *set, const char *tmpl,
+                     const void *body, size_t bodylen, char **out, size_t *outlen) {
+    rtfprocdreq q;
+    rtfprocdres r;
+
+    BEGIN_FUNCTION
+
+    // The reply's body is returned NUL-terminated, as it's often text
+    *out    = NULL;
+    *outlen = 0;
+    if (!set)  set  = "";
+    if (!tmpl) tmpl = "";
+
+    memcpy(q.magic, RTFPROCD_MAGIC, sizeof q.magic);
+    q.op      = (uint32_t)op;
+    q.setlen  = (uint32_t)strlen(set);
+    q.tmpllen = (uint32_t)strlen(tmpl);
+    q.bodylen = bodylen;
+    if (!write_full(fd, &q, sizeof q) ||
+        !write_full(fd, set, q.setlen) || !write_full(fd, tmpl, q.tmpllen) ||
+        !write_full(fd, body, bodylen)) {
+        FAIL(EIO, "Could not send request");
+    }
+
+    if (!read_full(fd, &r, sizeof r) || memcmp(r.magic, RTFPROCD_MAGIC, sizeof r.magic)) {
+        FAIL(EIO, "Could not read reply");
+    }
+    if (!(*out = malloc((size_t)r.bodylen + 1))) FAIL(ENOMEM, "Out of memory reading reply");
+    if (!read_full(fd, *out, (size_t)r.bodylen)) {
+        free(*out);
+        *out = NULL;
+        FAIL(EIO, "Could not read reply");
+    }
+    (*out)[r.bodylen] = '\0';
+    *outlen = (size_t)r.bodylen;
+
+    RETURN(r.status);
+}
+
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                           HELPER FUNCTIONS                          ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+static bool read_full(int fd, void *buf, size_t len) {
+    ssize_t n;
+
+    while (len > 0) {
+        n = read(fd, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buf  = (char *)buf + n;
+        len -= (size_t)n;
+    }
+
+    return true;
+}
+
+
+
+static bool write_full(int fd, const void *buf, size_t len) {
+    ssize_t n;
+
+    while (len > 0) {
+        n = send(fd, buf, len, PROCD_SENDFLAGS);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buf  = (const char *)buf + n;
+        len -= (size_t)n;
+    }
+
+    return true;
+}
+
+
+
+static int cmppair(const void *a, const void *b) {
+    return strcmp(((const procdpair *)a)->key, ((const procdpair *)b)->key);
+}
+
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                               DAEMON                                ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+#ifdef RTFPROCD_MAIN
+
+static rtfprocd *daemon_server;
+
+static void daemon_stop(int sig) {
+    (void)sig;
+    rtfprocd_stop(daemon_server);
+}
+
+static int daemon_usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [-j JOBS] [-s NAME=FILE.tsv]... [-t NAME=FILE.rtftmpl]... SOCKET\n"
+        "Serves render, template, and extract requests on a Unix domain socket.\n",
+        argv0);
+    return 2;
+}
+
+int main(int argc, char **argv) {
+    rtfprocdstats stats;
+    char  *eq;
+    long   jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int    opt;
+    int    err;
+
+    // Sets and templates load after the server is made, so parse twice
+    while ((opt = getopt(argc, argv, "j:s:t:")) != -1) {
+        if (opt == 'j') jobs = strtol(optarg, NULL, 10);
+        else if (opt != 's' && opt != 't') return daemon_usage(argv[0]);
+    }
+    if (optind != argc - 1 || jobs < 1) return daemon_usage(argv[0]);
+    if (!(daemon_server = new_rtfprocd(argv[optind], (size_t)jobs))) return 1;
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "j:s:t:")) != -1) {
+        if (opt == 'j') continue;
+        if (!(eq = strchr(optarg, '='))) return daemon_usage(argv[0]);
+        *eq = '\0';
+        err = (opt == 's') ? rtfprocd_load_set(daemon_server, optarg, eq + 1)
+                           : rtfprocd_add_template(daemon_server, optarg, eq + 1);
+        if (err) return 1;
+    }
+
+    signal(SIGINT,  daemon_stop);
+    signal(SIGTERM, daemon_stop);
+    signal(SIGPIPE, SIG_IGN);
+
+    err = rtfprocd_serve(daemon_server);
+    stats = rtfprocd_stats(daemon_server);
+    fprintf(stderr, "%llu connections, %llu requests, %llu failed\n",
+            (unsigned long long)stats.connections, (unsigned long long)stats.requests,
+            (unsigned long long)stats.failures);
+    delete_rtfprocd(daemon_server);
+
+    return err ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,100 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#ifndef RTFPROCD_H__
+#define RTFPROCD_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "rtfproc.h"
+
+
+
+#define   RTFPROCD_MAGIC     "RPD1"
+#define   RTFPROCD_MAXNAME   4096             // Longest set or template name
+#define   RTFPROCD_MAXBODY   (UINT64_C(1) << 30)
+
+
+// REQUESTS
+#define   RTFPROCD_RENDER    'R'   // Replace with a set's values
+#define   RTFPROCD_TEMPLATE  'T'   // Render a compiled template with a set
+#define   RTFPROCD_EXTRACT   'X'   // Plain text, with a set's values if named
+
+
+// FRAME LAYOUT
+//
+// A connection carries any number of requests, each answered in turn.
+// Integers are in host byte order, as both ends are on the same machine.
+//
+//   rtfprocdreq
+//   char         set[setlen]            replacement set name, or empty
+//   char         tmpl[tmpllen]          template name (RTFPROCD_TEMPLATE)
+//   char         body[bodylen]          input RTF
+//
+//   rtfprocdres
+//   char         body[bodylen]          output, or an error message
+typedef struct rtfprocdreq {
+    char            magic[4];
+    uint32_t        op;
+    uint32_t        setlen;
+    uint32_t        tmpllen;
+    uint64_t        bodylen;
+} rtfprocdreq;
+
+typedef struct rtfprocdres {
+    char            magic[4];
+    int32_t         status;      // 0, or an errno value
+    uint64_t        bodylen;
+} rtfprocdres;
+
+
+// SERVER STATISTICS
+typedef struct rtfprocdstats {
+    uint64_t        connections;
+    uint64_t        requests;
+    uint64_t        failures;    // Requests answered with an error
+} rtfprocdstats;
+
+
+// Opaque; see rtfprocd.c
+typedef struct rtfprocd rtfprocd;
+
+
+
+// FUNCTION DECLARATIONS
+rtfprocd *new_rtfprocd(const char *path, size_t nworkers);
+void      delete_rtfprocd(rtfprocd *D);
+int       rtfprocd_add_set(rtfprocd *D, const char *name, const char **pairs);
+int       rtfprocd_load_set(rtfprocd *D, const char *name, const char *path);
+int       rtfprocd_add_template(rtfprocd *D, const char *name, const char *path);
+int       rtfprocd_serve(rtfprocd *D);
+void      rtfprocd_stop(rtfprocd *D);
+rtfprocdstats rtfprocd_stats(rtfprocd *D);
+
+int       rtfprocd_connect(const char *path);
+int       rtfprocd_request(int fd, int op, const char *set, const char *tmpl,
+                           const void *body, size_t bodylen, char **out, size_t *outlen);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
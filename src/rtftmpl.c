@@ -0,0 +1,398 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                        DECLARATIONS & MACROS                        ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "rtfproc.h"
+#include "rtftmpl.h"
+#include "utillib.h"
+
+#if !defined(_WIN32) && (defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__)))
+#define RTFTMPL_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Template under construction. Segments and fallback raw RTF share one pool
+// in the order they are produced, so each segment is contiguous.
+typedef struct tmplbuild {
+    char         *  pool;
+    size_t          poolz;
+    size_t          poolcap;
+    rtftmplfld   *  flds;
+    rtftmplstr   *  segs;        // Always room for nflds + 1
+    size_t          nflds;
+    size_t          fldcap;
+    uint64_t        segstart;
+    uint64_t        srchash;
+    uint64_t        srclen;
+    int             err;
+} tmplbuild;
+
+static void tmpl_raw(rtfobj *R, const char *buf, size_t len, void *data);
+static void tmpl_match(rtfobj *R, size_t key, int nbraces, void *data);
+static bool tmpl_append(tmplbuild *B, const char *buf, size_t len);
+static bool tmpl_str_ok(const rtftmpl *T, const rtftmplstr *s);
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                         TEMPLATE COMPILATION                        ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+int compile_rtftmpl(rtfobj *R, FILE *fcomp) {
+    tmplbuild    B = { 0 };
+    rtfhooks     savedhooks;
+    rtftmplhdr   hdr = { 0 };
+    rtftmplstr  *keys = NULL;
+    size_t       i;
+    int          err = 0;
+
+    BEGIN_FUNCTION
+
+    B.srchash = RTFHASH_INIT;
+    B.fldcap  = 16;
+    B.flds    = malloc(B.fldcap * sizeof *B.flds);
+    B.segs    = malloc((B.fldcap + 1) * sizeof *B.segs);
+    keys      = malloc((rtfobj_nkeys(R) + 1) * sizeof *keys);
+    if (!B.flds || !B.segs || !keys) { err = ENOMEM; goto done; }
+
+    // Run a normal replacement pass with output diverted into the builder
+    savedhooks = R->hooks;
+    R->hooks.raw   = tmpl_raw;
+    R->hooks.match = tmpl_match;
+    R->hooks.data  = &B;
+    rtfreplace(R);
+    R->hooks = savedhooks;
+
+    if (R->fatalerr) { err = R->fatalerr; goto done; }
+    if (B.err)       { err = B.err;       goto done; }
+
+    // Close the trailing segment
+    B.segs[B.nflds].off = B.segstart;
+    B.segs[B.nflds].len = B.poolz - B.segstart;
+
+    // Keys go at the end of the pool, NUL-terminated for direct use
+    for (i = 0; i < rtfobj_nkeys(R); i++) {
+        keys[i].off = B.poolz;
+        keys[i].len = strlen(rtfobj_key(R, i));
+        if (!tmpl_append(&B, rtfobj_key(R, i), keys[i].len + 1)) { err = B.err; goto done; }
+    }
+
+    memcpy(hdr.magic, RTFTMPL_MAGIC, sizeof RTFTMPL_MAGIC);
+    hdr.version = RTFTMPL_VERSION;
+    hdr.hdrz    = (uint32_t)sizeof hdr;
+    hdr.srchash = B.srchash;
+    hdr.srclen  = B.srclen;
+    hdr.nkeys   = (uint32_t)rtfobj_nkeys(R);
+    hdr.nflds   = (uint32_t)B.nflds;
+    hdr.poolz   = B.poolz;
+
+    if (fwrite(&hdr,   sizeof hdr,     1,             fcomp) != 1             ||
+        fwrite(keys,   sizeof *keys,   hdr.nkeys,     fcomp) != hdr.nkeys     ||
+        fwrite(B.flds, sizeof *B.flds, B.nflds,       fcomp) != B.nflds       ||
+        fwrite(B.segs, sizeof *B.segs, B.nflds + 1,   fcomp) != B.nflds + 1   ||
+        fwrite(B.pool, 1,              B.poolz,       fcomp) != B.poolz) {
+        err = EIO;
+    }
+
+done:
+    free(B.pool);
+    free(B.flds);
+    free(B.segs);
+    free(keys);
+
+    if (err) FAIL(err, "Failed compiling template (error %d)", err);
+
+    RETURN(0);
+}
+
+
+
+static void tmpl_raw(rtfobj *R, const char *buf, size_t len, void *data) {
+    tmplbuild *B = data;
+
+    BEGIN_FUNCTION
+
+    (void)R;
+
+    B->srchash = rtfhash(B->srchash, buf, len);
+    B->srclen += len;
+    tmpl_append(B, buf, len);
+
+    RETURN();
+}
+
+
+
+static void tmpl_match(rtfobj *R, size_t key, int nbraces, void *data) {
+    tmplbuild  *B = data;
+    rtftmplfld *newflds;
+    rtftmplstr *newsegs;
+
+    BEGIN_FUNCTION
+
+    if (B->nflds + 1 >= B->fldcap) {
+        newflds = realloc(B->flds, 2 * B->fldcap * sizeof *B->flds);
+        if (newflds) B->flds = newflds;
+        newsegs = realloc(B->segs, (2 * B->fldcap + 1) * sizeof *B->segs);
+        if (newsegs) B->segs = newsegs;
+        if (!newflds || !newsegs) {
+            B->err = R->fatalerr = ENOMEM;
+            FAIL(VOID, "Out of memory growing template field table");
+        }
+        B->fldcap *= 2;
+    }
+
+    // Close the literal segment that precedes this field
+    B->segs[B->nflds].off = B->segstart;
+    B->segs[B->nflds].len = B->poolz - B->segstart;
+
+    // The matched raw RTF is kept as a fallback for keys without a value at
+    // render time, and is part of the source for hashing purposes.
+    B->srchash = rtfhash(B->srchash, R->raw, R->ri);
+    B->srclen += R->ri;
+
+    B->flds[B->nflds].key     = (uint32_t)key;
+    B->flds[B->nflds].nbraces = (int32_t)nbraces;
+    B->flds[B->nflds].raw.off = B->poolz;
+    B->flds[B->nflds].raw.len = R->ri;
+    tmpl_append(B, R->raw, R->ri);
+
+    B->nflds++;
+    B->segstart = B->poolz;
+
+    RETURN();
+}
+
+
+
+static bool tmpl_append(tmplbuild *B, const char *buf, size_t len) {
+    size_t newcap;
+    char  *newpool;
+
+    BEGIN_FUNCTION
+
+    if (B->err) RETURN(false);
+
+    if (B->poolz + len > B->poolcap) {
+        newcap = B->poolcap ? B->poolcap : 4096;
+        while (newcap < B->poolz + len) newcap *= 2;
+        newpool = realloc(B->pool, newcap);
+        if (!newpool) {
+            B->err = ENOMEM;
+            FAIL(false, "Out of memory growing template pool");
+        }
+        B->pool = newpool;
+        B->poolcap = newcap;
+    }
+
+    memcpy(&B->pool[B->poolz], buf, len);
+    B->poolz += len;
+
+    RETURN(true);
+}
+
+
+
+
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                      LOADING & RENDERING TEMPLATES                  ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+rtftmpl *open_rtftmpl(const char *path) {
+    rtftmpl *T;
+    const rtftmplhdr *hdr;
+    uint64_t need;
+
+    BEGIN_FUNCTION
+
+    T = malloc(sizeof *T);
+    if (!T) FAIL(NULL, "Failed allocating template object.");
+    memzero(T, sizeof *T);
+
+#ifdef RTFTMPL_MMAP
+    int fd;
+    struct stat st;
+
+    if ((fd = open(path, O_RDONLY)) < 0) { free(T); FAIL(NULL, "Could not open template \'%s\'", path); }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof *hdr) {
+        close(fd);
+        free(T);
+        FAIL(NULL, "Template \'%s\' is truncated", path);
+    }
+    T->basez = (size_t)st.st_size;
+    T->base = mmap(NULL, T->basez, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (T->base == MAP_FAILED) { free(T); FAIL(NULL, "Could not map template \'%s\'", path); }
+    T->mapped = true;
+#else
+    FILE *f;
+    long fz;
+
+    if (!(f = fopen(path, "rb"))) { free(T); FAIL(NULL, "Could not open template \'%s\'", path); }
+    if (fseek(f, 0, SEEK_END) || (fz = ftell(f)) < (long)sizeof *hdr || fseek(f, 0, SEEK_SET)) {
+        fclose(f);
+        free(T);
+        FAIL(NULL, "Template \'%s\' is truncated", path);
+    }
+    T->basez = (size_t)fz;
+    T->base = malloc(T->basez);
+    if (!T->base || fread(T->base, 1, T->basez, f) != T->basez) {
+        fclose(f);
+        close_rtftmpl(T);
+        FAIL(NULL, "Could not read template \'%s\'", path);
+    }
+    fclose(f);
+#endif
+
+    // Point directly into the image; nothing is copied or unpacked.
+    hdr = T->base;
+    if (memcmp(hdr->magic, RTFTMPL_MAGIC, sizeof RTFTMPL_MAGIC) ||
+        hdr->version != RTFTMPL_VERSION ||
+        hdr->hdrz != sizeof *hdr) {
+        close_rtftmpl(T);
+        FAIL(NULL, "\'%s\' is not a compatible compiled template", path);
+    }
+
+    need = sizeof *hdr
+         + (uint64_t)hdr->nkeys       * sizeof(rtftmplstr)
+         + (uint64_t)hdr->nflds       * sizeof(rtftmplfld)
+         + ((uint64_t)hdr->nflds + 1) * sizeof(rtftmplstr);
+    if (need > T->basez || hdr->poolz > T->basez - need) {
+        close_rtftmpl(T);
+        FAIL(NULL, "Template \'%s\' is truncated", path);
+    }
+
+    T->hdr  = hdr;
+    T->keys = (const rtftmplstr *)(hdr + 1);
+    T->flds = (const rtftmplfld *)(T->keys + hdr->nkeys);
+    T->segs = (const rtftmplstr *)(T->flds + hdr->nflds);
+    T->pool = (const char *)(T->segs + hdr->nflds + 1);
+
+    RETURN(T);
+}
+
+
+
+void close_rtftmpl(rtftmpl *T) {
+    BEGIN_FUNCTION
+
+    if (T) {
+#ifdef RTFTMPL_MMAP
+        if (T->mapped) munmap(T->base, T->basez);
+        else           free(T->base);
+#else
+        free(T->base);
+#endif
+    }
+    free(T);
+
+    RETURN();
+}
+
+
+
+int render_rtftmpl(const rtftmpl *T, rtfobj *R) {
+    const char **vals;
+    const rtftmplfld *fld;
+    const rtftmplstr *key;
+    int32_t nbraces;
+    size_t i;
+    bool corrupt = false;
+
+    BEGIN_FUNCTION
+
+    if (!R->fout) RETURN(0);
+
+    // Resolve each key once, rather than once per field
+    vals = malloc((T->hdr->nkeys + 1) * sizeof *vals);
+    if (!vals) { R->fatalerr = ENOMEM; FAIL(ENOMEM, "Out of memory resolving template keys"); }
+
+    for (i = 0; i < T->hdr->nkeys; i++) {
+        key = &T->keys[i];
+        vals[i] = (tmpl_str_ok(T, key) && key->len < T->hdr->poolz - key->off &&
+                   T->pool[key->off + key->len] == '\0')
+                ? find_rtfobj_replacement(R, &T->pool[key->off])
+                : NULL;
+    }
+
+    for (i = 0; i <= T->hdr->nflds; i++) {
+        if (!tmpl_str_ok(T, &T->segs[i])) { corrupt = true; break; }
+        fwrite(&T->pool[T->segs[i].off], 1, T->segs[i].len, R->fout);
+
+        if (i == T->hdr->nflds) break;
+
+        fld = &T->flds[i];
+        if (fld->key < T->hdr->nkeys && vals[fld->key]) {
+            rtfputs(vals[fld->key], R->fout);
+            for (nbraces = fld->nbraces; nbraces > 0; nbraces--) fputc('{', R->fout);
+            for (nbraces = fld->nbraces; nbraces < 0; nbraces++) fputc('}', R->fout);
+        } else if (tmpl_str_ok(T, &fld->raw)) {
+            fwrite(&T->pool[fld->raw.off], 1, fld->raw.len, R->fout);
+        }
+    }
+
+    free(vals);
+
+    // The last segment has no field after it, so i alone can't tell
+    if (corrupt) {
+        R->fatalerr = EINVAL;
+        FAIL(EINVAL, "Corrupt template segment %zu", i);
+    }
+
+    RETURN(0);
+}
+
+
+
+bool rtftmpl_is_stale(const rtftmpl *T, FILE *fsrc) {
+    char buf[16384];
+    uint64_t h = RTFHASH_INIT;
+    uint64_t len = 0;
+    size_t n;
+
+    BEGIN_FUNCTION
+
+    while ((n = fread(buf, 1, sizeof buf, fsrc)) > 0) {
+        h = rtfhash(h, buf, n);
+        len += n;
+    }
+
+    RETURN(ferror(fsrc) || len != T->hdr->srclen || h != T->hdr->srchash);
+}
+
+
+
+static bool tmpl_str_ok(const rtftmpl *T, const rtftmplstr *s) {
+    return s->off <= T->hdr->poolz && s->len <= T->hdr->poolz - s->off;
+}
@@ -0,0 +1,94 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#ifndef RTFTMPL_H__
+#define RTFTMPL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "rtfproc.h"
+
+
+
+#define   RTFTMPL_MAGIC     "RTFTMPL"
+#define   RTFTMPL_VERSION   1
+
+
+// COMPILED TEMPLATE FILE LAYOUT
+//
+// A compiled template is the output of one rtfreplace() pass, split at each
+// match: literal raw RTF segments alternate with placeholder fields. All
+// integers are in host byte order; offsets are relative to the byte pool.
+//
+//   rtftmplhdr
+//   rtftmplstr   keys[nkeys]            NUL-terminated key strings
+//   rtftmplfld   flds[nflds]            placeholder table
+//   rtftmplstr   segs[nflds + 1]        literal raw segments
+//   char         pool[poolz]
+typedef struct rtftmplhdr {
+    char            magic[8];
+    uint32_t        version;
+    uint32_t        hdrz;        // sizeof(rtftmplhdr), guards layout drift
+    uint64_t        srchash;     // rtfhash() of the source RTF
+    uint64_t        srclen;      // Length of the source RTF
+    uint32_t        nkeys;
+    uint32_t        nflds;
+    uint64_t        poolz;
+} rtftmplhdr;
+
+typedef struct rtftmplstr {
+    uint64_t        off;
+    uint64_t        len;
+} rtftmplstr;
+
+typedef struct rtftmplfld {
+    uint32_t        key;         // Index into keys[]
+    int32_t         nbraces;     // Net braces to emit after the value
+    rtftmplstr      raw;         // Original RTF, used if key has no value
+} rtftmplfld;
+
+
+// COMPILED TEMPLATE (read-only view of a mapped file)
+typedef struct rtftmpl {
+    const rtftmplhdr  *  hdr;
+    const rtftmplstr  *  keys;
+    const rtftmplfld  *  flds;
+    const rtftmplstr  *  segs;
+    const char        *  pool;
+    void              *  base;    // Start of the mapping or heap copy
+    size_t               basez;
+    bool                 mapped;
+} rtftmpl;
+
+
+
+// FUNCTION DECLARATIONS
+int      compile_rtftmpl(rtfobj *R, FILE *fcomp);
+rtftmpl *open_rtftmpl(const char *path);
+void     close_rtftmpl(rtftmpl *T);
+int      render_rtftmpl(const rtftmpl *T, rtfobj *R);
+bool     rtftmpl_is_stale(const rtftmpl *T, FILE *fsrc);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,135 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+// Throughput on inputs built to defeat the matcher, compared with prose.
+// Each adversarial input must go at least MINFRACTION as fast, in bytes per
+// second, as the prose does, with the replacement keys on their own and in
+// a dictionary. The fastest of NRUNS runs counts, to ride out noise. A key
+// that overlaps itself is the worst case by design: every byte past its
+// length starts the match over one byte later, at a cost of up to the key
+// length (see pattern_match()).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "rtfproc.h"
+#include "utillib.h"
+
+#define INPUTZ      (2 << 20)
+#define NRUNS       5
+#define MINFRACTION 0.3
+
+static const char *keys[] = {
+    "aaaaaaaaaaaaaaab",                          "A",
+    "«Client Full Name»",                        "Chesty A. Puller",
+    "«Client Last Name»",                        "Puller",
+    "«Client Rank»",                             "Colonel",
+    "«Date»",                                    "13 Sep 21",
+    "«Long Shared Prefix Key Number One»",       "1",
+    "«Long Shared Prefix Key Number Two»",       "2",
+    "«Property Mgr Addr»",                       "1234 Main Street",
+    "«Property Mgr City»",                       "Woodbridge",
+    "«Property Mgr Name»",                       "Shady Management",
+    NULL
+};
+
+typedef struct pattern {
+    const char *name;
+    const char *unit;             // Repeated to fill the input
+} pattern;
+
+static const pattern patterns[] = {
+    { "prose",           "The \\b quick\\b0  brown fox, \\'ab\\'abDate\\'bb\\'bb, jumps over {\\i the} lazy dog.\\par\n" },
+    { "prefix+groups",   "\\'abLong Shared Prefix Key Number {}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}{}. " },
+    { "repeated guill",  "\\'ab\\'ab\\'ab\\'ab\\'ab\\'ab\\'ab\\'ab\\'ab\\'ab\\'ab\\'ab\\'ab\\'ab\\'ab\\'ab" },
+    { "shared prefix",   "\\'abLong Shared Prefix Key Number Thre" },
+    { "self-overlap",    "a{\\i}a{\\i}a{\\i}a{\\i}a{\\i}a{\\i}a{\\i}a{\\i}a{\\i}a{\\i}a{\\i}a{\\i}a{\\i}a{\\i}a{\\i}a{\\i}" },
+    { NULL, NULL }
+};
+
+static FILE *build(const char *unit) {
+    FILE *f;
+    size_t n = 0;
+    size_t z = strlen(unit);
+
+    (f = tmpfile()) || DIE("Could not create temporary file\n");
+    fputs("{\\rtf1\\ansi\\ansicpg1252\\deff0{\\fonttbl{\\f0 Times;}}\n", f);
+    for (n = 0; n < INPUTZ; n += z) fputs(unit, f);
+    fputs("}\n", f);
+    fflush(f);
+
+    return f;
+}
+
+static double seconds(FILE *fin, const rtfdict *D) {
+    struct timespec t0, t1;
+    double best = 0;
+    rtfobj *R;
+
+    for (int run = 0; run < NRUNS; run++) {
+        rewind(fin);
+        R = new_rtfobj(fin, NULL, NULL);
+        if (D) set_rtfobj_dictionary(R, D);
+        else   add_rtfobj_replacements(R, keys);
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        rtfreplace(R);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        R->fatalerr == 0 || DIE("Processing failed with error %d\n", R->fatalerr);
+        delete_rtfobj(R);
+
+        double secs = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+        if (run == 0 || secs < best) best = secs;
+    }
+
+    return best;
+}
+
+int main(void) {
+    FILE *f;
+    rtfdict *D;
+    double prose[2] = { 0 };
+    double mbps;
+    long size;
+    bool ok = true;
+
+    (D = new_rtfdict(keys)) || DIE("new_rtfdict() failed\n");
+
+    printf("\n%-16s %12s %12s\n", "", "keys MB/s", "dict MB/s");
+    for (const pattern *p = patterns; p->name; p++) {
+        f = build(p->unit);
+        fseek(f, 0, SEEK_END);
+        size = ftell(f);
+
+        printf("%-16s", p->name);
+        for (int mode = 0; mode < 2; mode++) {
+            mbps = (double)size / 1e6 / seconds(f, mode ? D : NULL);
+            if (p == patterns) prose[mode] = mbps;
+            printf(" %12.1f", mbps);
+            if (mbps < MINFRACTION * prose[mode]) {
+                printf(" <-- below %.0f%% of prose", 100 * MINFRACTION);
+                ok = false;
+            }
+        }
+        printf("\n");
+        fclose(f);
+    }
+
+    delete_rtfdict(D);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,164 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtfproc.h"
+#include "utillib.h"
+#include "testutil.h"
+
+// Counts live blocks, so a test can tell that everything handed out came back
+typedef struct counts {
+    long live;
+    long calls;
+} counts;
+
+static void *count_alloc(void *ctx, size_t z) {
+    counts *C = ctx;
+    void *p = malloc(z);
+    if (p) { C->live++; C->calls++; }
+    return p;
+}
+
+static void *count_resize(void *ctx, void *p, size_t z) {
+    counts *C = ctx;
+    C->calls++;
+    return realloc(p, z);
+}
+
+static void count_release(void *ctx, void *p) {
+    counts *C = ctx;
+    C->live--;
+    free(p);
+}
+
+// Same keys as the letter test, sorted by key in main() for the dictionaries
+static const char *letter[] = { LETTER_PAIRS, NULL };
+
+static void check_letter(const rtfopts *opts, const rtfdict *D) {
+    FILE *fin, *fout, *fcmp;
+    rtfobj *R;
+    size_t outlen, cmplen;
+    char *out, *cmp;
+
+    (fin  = fopen("TEST/letter-input.rtf",   "rb")) || DIE("Could not read letter input\n");
+    (fcmp = fopen("TEST/letter-correct.rtf", "rb")) || DIE("Could not read letter output\n");
+    (fout = tmpfile())                              || DIE("Could not create temporary file\n");
+    (R = new_rtfobj_opts(fin, fout, NULL, opts))    || DIE("new_rtfobj_opts() failed\n");
+    if (D) set_rtfobj_dictionary(R, D);
+    else   add_rtfobj_replacements(R, letter);
+    rtfreplace(R);
+    R->fatalerr == 0 || DIE("Letter failed with error %d\n", R->fatalerr);
+    delete_rtfobj(R);
+    out = slurp(fout, &outlen);
+    cmp = slurp(fcmp, &cmplen);
+    (outlen == cmplen && !memcmp(out, cmp, cmplen)) || DIE("Letter output differs\n");
+    free(out);
+    free(cmp);
+    fclose(fin);
+    fclose(fcmp);
+    fclose(fout);
+}
+
+int main(void) {
+    FILE *fin, *fout;
+    rtfobj *R;
+    rtfdict *D;
+    rtfarena *A;
+    rtfalloc alloc;
+    rtfopts opts = { 0 };
+    counts C = { 0 };
+    char *p, *q;
+
+    sort_pairs(letter);
+
+    // Every allocation goes through the hooks and is given back
+    opts.alloc = (rtfalloc){ count_alloc, count_resize, count_release, &C };
+    check_letter(&opts, NULL);
+    C.calls > 0 || DIE("Allocator was never called\n");
+    C.live == 0 || DIE("%ld blocks leaked from the object\n", C.live);
+
+    (D = new_rtfdict_alloc(letter, &opts.alloc)) || DIE("new_rtfdict_alloc() failed\n");
+    C.live > 0 || DIE("Dictionary did not use the allocator\n");
+    check_letter(&opts, D);
+    delete_rtfdict(D);
+    C.live == 0 || DIE("%ld blocks leaked from the dictionary\n", C.live);
+
+    // Buffers capped small grow lazily up to the caps and still match. A
+    // command buffer too small for any command is raised to the minimum.
+    opts = (rtfopts){ .rawz = 64, .txtz = 32, .cmdz = 1, .fonttblz = 1 };
+    check_letter(&opts, NULL);
+    (D = new_rtfdict(letter)) || DIE("new_rtfdict() failed\n");
+    check_letter(&opts, D);
+    delete_rtfdict(D);
+    opts = (rtfopts){ 0 };
+
+    // The same inside an arena, released all at once
+    opts.alloc  = (rtfalloc){ 0 };
+    opts.arenaz = 16 << 20;
+    check_letter(&opts, NULL);
+
+    // A shared arena, grown in place and rolled back at the top
+    (A = new_rtfarena(1 << 20)) || DIE("new_rtfarena() failed\n");
+    alloc = rtfarena_allocator(A);
+    (p = alloc.alloc(alloc.ctx, 100)) || DIE("Arena allocation failed\n");
+    memset(p, 'x', 100);
+    (q = alloc.resize(alloc.ctx, p, 5000)) == p || DIE("Top block did not grow in place\n");
+    q[99] == 'x' || DIE("Contents lost in resize\n");
+    alloc.release(alloc.ctx, q);
+    (q = alloc.alloc(alloc.ctx, 10)) == p || DIE("Top block was not rolled back\n");
+    alloc.alloc(alloc.ctx, 2 << 20) == NULL || DIE("Allocation over the cap succeeded\n");
+    rtfarena_used(A) <= 1 << 20 || DIE("Arena grew past its cap\n");
+    (D = new_rtfdict_alloc(letter, &alloc)) || DIE("new_rtfdict_alloc() failed\n");
+    check_letter(&(rtfopts){ .alloc = alloc }, D);
+    delete_rtfdict(D);
+    delete_rtfarena(A);
+
+    // Running out of arena fails cleanly
+    (fin  = fopen("TEST/letter-input.rtf", "rb")) || DIE("Could not read letter input\n");
+    (fout = tmpfile())                            || DIE("Could not create temporary file\n");
+    opts.arenaz = sizeof *R;
+    new_rtfobj_opts(fin, fout, NULL, &opts) == NULL || DIE("Object created in a too-small arena\n");
+    opts.arenaz = sizeof *R + 4096;
+    (R = new_rtfobj_opts(fin, fout, NULL, &opts)) || DIE("new_rtfobj_opts() failed\n");
+    add_rtfobj_replacements(R, letter);
+    rtfreplace(R);
+    R->fatalerr == ENOMEM || DIE("Expected ENOMEM, got %d\n", R->fatalerr);
+    delete_rtfobj(R);
+
+    // So does a replacement too big for what's left, leaving the object
+    // with the replacements it had
+    opts.arenaz = 150000;
+    (p = malloc(200000)) || DIE("Out of memory\n");
+    memset(p, 'k', 199999);
+    p[199999] = '\0';
+    (R = new_rtfobj_opts(fin, fout, NULL, &opts)) || DIE("new_rtfobj_opts() failed\n");
+    add_rtfobj_replacements(R, letter);
+    add_rtfobj_replacements(R, (const char *[]){ "a", "b", p, "c", "d", "e", NULL }) == 0 ||
+        DIE("Replacements past the arena cap were added\n");
+    R->fatalerr == ENOMEM || DIE("Expected ENOMEM, got %d\n", R->fatalerr);
+    R->srchz == sizeof letter / sizeof *letter / 2 || DIE("%zu replacements left\n", R->srchz);
+    !find_rtfobj_replacement(R, "a") || DIE("Replacement kept from a failed call\n");
+    !strcmp(find_rtfobj_replacement(R, "«Date»"), "13 Sep 21") || DIE("Earlier replacement lost\n");
+    delete_rtfobj(R);
+    free(p);
+    fclose(fin);
+    fclose(fout);
+
+    return 0;
+}
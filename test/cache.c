@@ -0,0 +1,182 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#include <stdio.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "rtfproc.h"
+#include "rtfcache.h"
+#include "utillib.h"
+#include "testutil.h"
+
+// Same keys as the letter test, in two different orders
+static const char *letter[] = { LETTER_PAIRS, NULL };
+static const char *reordered[2 * LETTER_NPAIRS + 1];
+
+// Renders the letter through the cache and returns the output
+static char *render(rtfcache *C, const char **keys, const char *date, size_t *len) {
+    FILE *fin, *fout;
+    rtfobj *R;
+    char *out;
+
+    (fin  = fopen("TEST/letter-input.rtf", "rb")) || DIE("Could not read letter input\n");
+    (fout = tmpfile())                            || DIE("Could not create temporary file\n");
+    R = new_rtfobj(fin, fout, NULL);
+    set_rtfobj_match_policy(R, RTF_MATCH_LONGEST);
+    add_rtfobj_replacements(R, keys);
+    if (date) add_one_rtfobj_replacement(R, "«Date»", date);
+    rtfreplace_cached(C, R) == 0 || DIE("rtfreplace_cached() failed\n");
+    delete_rtfobj(R);
+    out = slurp(fout, len);
+    fclose(fin);
+    fclose(fout);
+
+    return out;
+}
+
+static void count_pict(rtfobj *R, rtfpict *P, void *data) {
+    (void)R;
+    (void)P;
+    (*(int *)data)++;
+}
+
+static void count_chunk(rtfobj *R, const rtfpictinfo *P, const uint8_t *buf, size_t len, void *data) {
+    (void)R;
+    (void)P;
+    (void)buf;
+    (void)len;
+    (*(int *)data)++;
+}
+
+// Renders a document with a picture, with a hook or reader that counts
+// the calls it gets
+static void render_pict(rtfcache *C, bool reader, int *ncalls) {
+    FILE *fin, *fout;
+    rtfobj *R;
+
+    (fin  = tmpfile()) || DIE("Could not create temporary file\n");
+    (fout = tmpfile()) || DIE("Could not create temporary file\n");
+    fputs("{\\rtf1 {\\pict\\pngblip 89504e470d0a1a0a}\\'abDate\\'bb}", fin);
+    rewind(fin);
+    R = new_rtfobj(fin, fout, NULL);
+    add_rtfobj_replacements(R, letter);
+    if (reader) set_rtfobj_pict_reader(R, count_chunk, ncalls);
+    else        set_rtfobj_pict_hook(R, count_pict, ncalls);
+    rtfreplace_cached(C, R) == 0 || DIE("rtfreplace_cached() failed\n");
+    delete_rtfobj(R);
+    fclose(fin);
+    fclose(fout);
+}
+
+#define EXPECT_STATS(C, h, d, m) do {                                         \
+    rtfcachestats s = rtfcache_stats(C);                                      \
+    (s.hits == (h) && s.diskhits == (d) && s.misses == (m)) ||                \
+        DIE("Expected %d/%d/%d hits/disk hits/misses, got %llu/%llu/%llu\n",  \
+            h, d, m, (unsigned long long)s.hits,                              \
+            (unsigned long long)s.diskhits, (unsigned long long)s.misses);    \
+} while (0)
+
+int main(void) {
+    FILE *fcmp;
+    rtfcache *C;
+    char dir[] = "/tmp/rtfcacheXXXXXX";
+    char path[512];
+    char *cmp, *out;
+    size_t cmplen, outlen;
+    DIR *d;
+    struct dirent *de;
+    int nfiles = 0;
+    int ncalls;
+
+    (fcmp = fopen("TEST/letter-correct.rtf", "rb")) || DIE("Could not read letter output\n");
+    cmp = slurp(fcmp, &cmplen);
+    fclose(fcmp);
+    reverse_pairs(reordered, letter);
+    mkdtemp(dir) || DIE("Could not create cache directory\n");
+
+    // First render is processed, the second comes from memory, including
+    // with the same keys given in another order
+    (C = new_rtfcache(1 << 20, dir)) || DIE("new_rtfcache() failed\n");
+    out = render(C, letter, NULL, &outlen);
+    (outlen == cmplen && !memcmp(out, cmp, cmplen)) || DIE("Processed output differs\n");
+    free(out);
+    EXPECT_STATS(C, 0, 0, 1);
+    out = render(C, letter, NULL, &outlen);
+    (outlen == cmplen && !memcmp(out, cmp, cmplen)) || DIE("Cached output differs\n");
+    free(out);
+    out = render(C, reordered, NULL, &outlen);
+    (outlen == cmplen && !memcmp(out, cmp, cmplen)) || DIE("Cached output differs\n");
+    free(out);
+    EXPECT_STATS(C, 2, 0, 1);
+
+    // Another value is another entry
+    out = render(C, letter, "14 Sep 21", &outlen);
+    strstr(out, "14 Sep 21") || DIE("Changed value not in output\n");
+    free(out);
+    EXPECT_STATS(C, 2, 0, 2);
+    rtfcache_stats(C).entries == 2 || DIE("Expected 2 entries\n");
+    delete_rtfcache(C);
+
+    // A new cache on the same directory finds both on disk
+    (C = new_rtfcache(1 << 20, dir)) || DIE("new_rtfcache() failed\n");
+    out = render(C, letter, NULL, &outlen);
+    (outlen == cmplen && !memcmp(out, cmp, cmplen)) || DIE("Disk output differs\n");
+    free(out);
+    out = render(C, letter, NULL, &outlen);
+    free(out);
+    EXPECT_STATS(C, 1, 1, 0);
+    delete_rtfcache(C);
+
+    // Room in memory for one entry only: the older one is evicted
+    (C = new_rtfcache(cmplen + 1024, NULL)) || DIE("new_rtfcache() failed\n");
+    free(render(C, letter, NULL, &outlen));
+    free(render(C, letter, "14 Sep 21", &outlen));
+    free(render(C, letter, NULL, &outlen));
+    EXPECT_STATS(C, 0, 0, 3);
+    rtfcache_stats(C).evictions == 2 || DIE("Expected 2 evictions\n");
+    delete_rtfcache(C);
+
+    // Picture hooks and readers have to see every picture, so they bypass
+    // the cache
+    (C = new_rtfcache(1 << 20, NULL)) || DIE("new_rtfcache() failed\n");
+    ncalls = 0;
+    render_pict(C, false, &ncalls);
+    render_pict(C, false, &ncalls);
+    ncalls == 2 || DIE("Picture hook called %d times, expected 2\n", ncalls);
+    ncalls = 0;
+    render_pict(C, true, &ncalls);
+    render_pict(C, true, &ncalls);
+    ncalls == 4 || DIE("Picture reader called %d times, expected 4\n", ncalls);
+    rtfcache_stats(C).bypassed == 4 || DIE("Expected 4 bypasses\n");
+    delete_rtfcache(C);
+
+    // Clean up
+    (d = opendir(dir)) || DIE("Could not list cache directory\n");
+    while ((de = readdir(d))) {
+        if (de->d_name[0] == '.') continue;
+        snprintf(path, sizeof path, "%s/%s", dir, de->d_name);
+        remove(path) == 0 || DIE("Could not remove %s\n", path);
+        nfiles++;
+    }
+    closedir(d);
+    rmdir(dir);
+    nfiles == 2 || DIE("Expected 2 cache files, found %d\n", nfiles);
+    free(cmp);
+
+    return 0;
+}
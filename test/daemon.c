@@ -0,0 +1,171 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "rtfproc.h"
+#include "rtftmpl.h"
+#include "rtfprocd.h"
+#include "utillib.h"
+#include "testutil.h"
+
+#define NCLIENTS    4
+#define NREQUESTS   8
+
+static char *slurp_path(const char *path, size_t *len) {
+    FILE *f;
+    char *buf;
+    (f = fopen(path, "rb")) || DIE("Could not read \'%s\'\n", path);
+    buf = slurp(f, len);
+    fclose(f);
+    return buf;
+}
+
+static const char *letter[] = { LETTER_PAIRS, NULL };
+
+static char   sock[64];
+static char  *input,  *correct;
+static size_t inputlen, correctlen;
+
+static void *serve(void *arg) {
+    rtfprocd_serve(arg) == 0 || DIE("rtfprocd_serve() failed\n");
+    return NULL;
+}
+
+// Several requests down one connection, alongside other clients
+static void *client(void *arg) {
+    char  *out;
+    size_t outlen;
+    int    fd;
+    (void)arg;
+
+    (fd = rtfprocd_connect(sock)) >= 0 || DIE("Could not connect\n");
+    for (int i = 0; i < NREQUESTS; i++) {
+        rtfprocd_request(fd, RTFPROCD_RENDER, "letter", NULL, input, inputlen, &out, &outlen) == 0
+            || DIE("Render failed\n");
+        outlen == correctlen && !memcmp(out, correct, correctlen) || DIE("Rendered output differs\n");
+        free(out);
+    }
+    close(fd);
+
+    return NULL;
+}
+
+int main(void) {
+    char dir[] = "/tmp/rtfprocdXXXXXX";
+    char tsv[64], tmplpath[64];
+    pthread_t server, clients[NCLIENTS];
+    rtfprocd *D;
+    rtfprocdstats stats;
+    rtfobj *R;
+    FILE *f, *ftxt;
+    char *out, *text;
+    size_t outlen, textlen;
+    int fd;
+
+    input   = slurp_path("TEST/letter-input.rtf",   &inputlen);
+    correct = slurp_path("TEST/letter-correct.rtf", &correctlen);
+    mkdtemp(dir) || DIE("Could not create directory\n");
+    snprintf(sock,     sizeof sock,     "%s/sock",         dir);
+    snprintf(tsv,      sizeof tsv,      "%s/letter.tsv",   dir);
+    snprintf(tmplpath, sizeof tmplpath, "%s/letter.tmpl",  dir);
+
+    // The same set from a file, in another order, with an escape
+    (f = fopen(tsv, "wb")) || DIE("Could not write \'%s\'\n", tsv);
+    fprintf(f, "# Letter values\n\n");
+    for (int i = 22; i >= 0; i -= 2) fprintf(f, "%s\t%s\n", letter[i], letter[i+1]);
+    fprintf(f, "«Tab»\tA\\tB\n");
+    fclose(f);
+
+    // A template compiled from the letter
+    (f = fopen(tmplpath, "wb")) || DIE("Could not write \'%s\'\n", tmplpath);
+    (R = new_rtfobj(fmemopen(input, inputlen, "rb"), NULL, NULL)) || DIE("new_rtfobj() failed\n");
+    add_rtfobj_replacements(R, letter);
+    compile_rtftmpl(R, f) == 0 || DIE("Could not compile template\n");
+    fclose(R->fin);
+    delete_rtfobj(R);
+    fclose(f);
+
+    // The text the daemon should extract
+    (ftxt = tmpfile()) || DIE("Could not create temporary file\n");
+    (R = new_rtfobj(fmemopen(input, inputlen, "rb"), NULL, ftxt)) || DIE("new_rtfobj() failed\n");
+    rtfreplace(R);
+    fclose(R->fin);
+    delete_rtfobj(R);
+    text = slurp(ftxt, &textlen);
+    fclose(ftxt);
+
+    (D = new_rtfprocd(sock, 3)) || DIE("new_rtfprocd() failed\n");
+    rtfprocd_add_set(D, "letter", letter) == 0          || DIE("rtfprocd_add_set() failed\n");
+    rtfprocd_load_set(D, "fromfile", tsv) == 0          || DIE("rtfprocd_load_set() failed\n");
+    rtfprocd_add_template(D, "letter", tmplpath) == 0   || DIE("rtfprocd_add_template() failed\n");
+    rtfprocd_load_set(D, "missing", "/nonexistent") != 0 || DIE("Loaded a missing set\n");
+    pthread_create(&server, NULL, serve, D) == 0         || DIE("Could not start server\n");
+    while ((fd = rtfprocd_connect(sock)) < 0) usleep(1000);
+
+    // Render, template, and extract requests on one connection
+    rtfprocd_request(fd, RTFPROCD_RENDER, "fromfile", NULL, input, inputlen, &out, &outlen) == 0
+        || DIE("Render with the loaded set failed\n");
+    outlen == correctlen && !memcmp(out, correct, correctlen) || DIE("Loaded set renders differently\n");
+    free(out);
+    rtfprocd_request(fd, RTFPROCD_TEMPLATE, "letter", "letter", NULL, 0, &out, &outlen) == 0
+        || DIE("Template render failed\n");
+    outlen == correctlen && !memcmp(out, correct, correctlen) || DIE("Template renders differently\n");
+    free(out);
+    rtfprocd_request(fd, RTFPROCD_EXTRACT, NULL, NULL, input, inputlen, &out, &outlen) == 0
+        || DIE("Extract failed\n");
+    outlen == textlen && !memcmp(out, text, textlen) || DIE("Extracted text differs\n");
+    free(out);
+
+    // Errors are answered, and the connection carries on
+    rtfprocd_request(fd, RTFPROCD_RENDER, "nosuchset", NULL, input, inputlen, &out, &outlen) == ENOENT
+        || DIE("Unknown set not reported\n");
+    free(out);
+    rtfprocd_request(fd, RTFPROCD_TEMPLATE, "letter", "nosuchtmpl", NULL, 0, &out, &outlen) == ENOENT
+        || DIE("Unknown template not reported\n");
+    free(out);
+    rtfprocd_request(fd, RTFPROCD_RENDER, "letter", NULL, input, inputlen, &out, &outlen) == 0
+        || DIE("Render after errors failed\n");
+    outlen == correctlen && !memcmp(out, correct, correctlen) || DIE("Render after errors differs\n");
+    free(out);
+
+    // Many clients at once, more than there are workers; one connection
+    // stays open and idle throughout, which mustn't stop the server stopping
+    for (int i = 0; i < NCLIENTS; i++) pthread_create(&clients[i], NULL, client, NULL) == 0 || DIE("Could not start client\n");
+    for (int i = 0; i < NCLIENTS; i++) pthread_join(clients[i], NULL);
+
+    stats = rtfprocd_stats(D);
+    stats.requests == 6 + NCLIENTS * NREQUESTS || DIE("Expected %d requests, got %llu\n",
+        6 + NCLIENTS * NREQUESTS, (unsigned long long)stats.requests);
+    stats.failures == 2 || DIE("Expected 2 failures, got %llu\n", (unsigned long long)stats.failures);
+
+    rtfprocd_stop(D);
+    pthread_join(server, NULL);
+    access(sock, F_OK) != 0 || DIE("Socket left behind\n");
+    close(fd);
+    delete_rtfprocd(D);
+
+    remove(tsv);
+    remove(tmplpath);
+    rmdir(dir);
+    free(text);
+    free(input);
+    free(correct);
+
+    return 0;
+}
@@ -0,0 +1,95 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtfproc.h"
+#include "utillib.h"
+#include "testutil.h"
+
+#define NBIG 100000
+
+int main(void) {
+    FILE *fin, *fout, *fcmp;
+    rtfobj *R;
+    rtfdict *D;
+    size_t outlen, cmplen, i;
+    char *out, *cmp;
+    char **big;
+    char buf[64];
+
+    // Same keys as the letter test, as (key, value) pairs sorted by key
+    const char *letter[] = { LETTER_PAIRS, NULL };
+    sort_pairs(letter);
+
+    (D = new_rtfdict(letter)) || DIE("new_rtfdict() failed\n");
+    !strcmp(find_rtfdict_value(D, "«Date»"), "13 Sep 21") || DIE("Lookup failed\n");
+    find_rtfdict_value(D, "«Dat") == NULL || DIE("Prefix lookup succeeded\n");
+
+    (fin  = fopen("TEST/letter-input.rtf",   "rb")) || DIE("Could not read letter input\n");
+    (fcmp = fopen("TEST/letter-correct.rtf", "rb")) || DIE("Could not read letter output\n");
+    (fout = tmpfile())                              || DIE("Could not create temporary file\n");
+    R = new_rtfobj(fin, fout, NULL);
+    set_rtfobj_dictionary(R, D);
+    rtfreplace(R);
+    delete_rtfobj(R);
+    out = slurp(fout, &outlen);
+    cmp = slurp(fcmp, &cmplen);
+    (outlen == cmplen && !memcmp(out, cmp, cmplen)) || DIE("Letter output differs\n");
+    free(out);
+    free(cmp);
+    fclose(fin);
+    fclose(fcmp);
+    fclose(fout);
+    delete_rtfdict(D);
+
+    // Longest match, including falling back to a shorter key when the
+    // longer one fails, with formatting inside and after the match
+    const char *overlap[] = { "ab", "1", "abcd", "2", "cd", "3", NULL };
+    (D = new_rtfdict(overlap)) || DIE("new_rtfdict() failed\n");
+    EXPECT(RTF_MATCH_DEFAULT, D, NULL, "{\\rtf1 abcd!}",            "{\\rtf1 2!}");
+    EXPECT(RTF_MATCH_DEFAULT, D, NULL, "{\\rtf1 abcx}",             "{\\rtf1 1cx}");
+    EXPECT(RTF_MATCH_DEFAULT, D, NULL, "{\\rtf1 abcdcd}",           "{\\rtf1 23}");
+    EXPECT(RTF_MATCH_DEFAULT, D, NULL, "{\\rtf1 abccd}",            "{\\rtf1 1c3}");
+    EXPECT(RTF_MATCH_DEFAULT, D, NULL, "{\\rtf1 a{\\b b}c{\\i x}}", "{\\rtf1 1{}c{\\i x}}");
+    EXPECT(RTF_MATCH_DEFAULT, D, NULL, "{\\rtf1 a{\\b b}\\i c{d}}", "{\\rtf1 2{}}");
+    delete_rtfdict(D);
+
+    // Keys must be sorted and unique
+    const char *unsorted[] = { "b", "1", "a", "2", NULL };
+    const char *dupes[] = { "a", "1", "a", "2", NULL };
+    new_rtfdict(unsorted) == NULL || DIE("Unsorted keys accepted\n");
+    new_rtfdict(dupes) == NULL || DIE("Duplicate keys accepted\n");
+
+    // A large dictionary
+    (big = malloc((2 * NBIG + 1) * sizeof *big)) || DIE("Out of memory\n");
+    for (i = 0; i < NBIG; i++) {
+        snprintf(buf, sizeof buf, "PC%06zu", i);
+        big[2*i] = strdup(buf);
+        snprintf(buf, sizeof buf, "Product %zu", i);
+        big[2*i+1] = strdup(buf);
+    }
+    big[2 * NBIG] = NULL;
+    (D = new_rtfdict((const char **)big)) || DIE("new_rtfdict() failed on large input\n");
+    D->n == NBIG || DIE("Large dictionary has %zu entries\n", D->n);
+    EXPECT(RTF_MATCH_DEFAULT, D, NULL, "{\\rtf1 PC000000, PC0{\\b 4}2017, PC099999, PC10000.}",
+                                       "{\\rtf1 Product 0, Product 42017, Product 99999, PC10000.}");
+    for (i = 0; i < 2 * NBIG; i++) free(big[i]);
+    free(big);
+    delete_rtfdict(D);
+
+    return 0;
+}
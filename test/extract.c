@@ -0,0 +1,207 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtfproc.h"
+#include "utillib.h"
+#include "testutil.h"
+
+#define MAXPICTS    8
+#define BIGZ        (1 << 20)
+
+// Appends len bytes to a growing buffer
+static void put(char **s, size_t *len, const void *buf, size_t n) {
+    (*s = realloc(*s, *len + n + 1)) || DIE("Out of memory\n");
+    memcpy(*s + *len, buf, n);
+    *len += n;
+    (*s)[*len] = '\0';
+}
+
+#define puts_(s, len, str)   put(s, len, str, strlen(str))
+
+// Hex-encodes a payload the way Word does, but with the line breaks at an
+// odd spacing so that they split bytes, and in both cases
+static void put_hex(char **s, size_t *len, const uint8_t *buf, size_t n) {
+    static const char *digits[2] = { "0123456789abcdef", "0123456789ABCDEF" };
+    char  *hex;
+    size_t h = 0;
+
+    (hex = malloc(3 * n)) || DIE("Out of memory\n");
+    for (size_t i = 0; i < n; i++) {
+        const char *d = digits[(i / 1000) & 1];
+        for (int shift = 4; shift >= 0; shift -= 4) {
+            hex[h++] = d[(buf[i] >> shift) & 0xf];
+            if ((i * 2 + (shift == 0)) % 127 == 126) { hex[h++] = '\r'; hex[h++] = '\n'; }
+        }
+    }
+    put(s, len, hex, h);
+    free(hex);
+}
+
+// What the reader saw
+typedef struct picture {
+    rtfpictinfo  info;
+    char        *data;
+    size_t       len;
+    int          nlast;
+} picture;
+
+typedef struct pictures {
+    picture      p[MAXPICTS];
+    size_t       n;
+    uint64_t     offset;
+} pictures;
+
+static void read_pict(rtfobj *R, const rtfpictinfo *P, const uint8_t *buf, size_t len, void *data) {
+    pictures *S = data;
+    picture  *p;
+    (void)R;
+
+    // A new picture starts with its first chunk, or its end if it's empty
+    if (S->n == 0 || S->p[S->n-1].nlast || S->p[S->n-1].info.offset != P->offset) {
+        S->n < MAXPICTS || DIE("Too many pictures\n");
+        S->n++;
+    }
+    p = &S->p[S->n-1];
+    P->decoded == p->len || DIE("Chunk at %llu, expected %zu\n", (unsigned long long)P->decoded, p->len);
+    (buf && len) || P->last || DIE("Empty chunk\n");
+    p->info = *P;
+    if (P->last) p->nlast++;
+    else         put(&p->data, &p->len, buf, len);
+}
+
+// Runs rtfreplace() over in, with the reader and the hook from test/pict.c
+// hooked up as asked
+static char *replace(const char *in, size_t inlen, pictures *S, rtfpicthook hook, size_t *outlen) {
+    FILE *fin, *fout;
+    rtfobj *R;
+    char *out;
+
+    (fin  = fmemopen((void *)in, inlen, "rb")) || DIE("Could not open input\n");
+    (fout = tmpfile())                         || DIE("Could not create temporary file\n");
+    R = new_rtfobj(fin, fout, NULL);
+    add_one_rtfobj_replacement(R, "NAME", "World");
+    if (S)    set_rtfobj_pict_reader(R, read_pict, S) == 0 || DIE("set_rtfobj_pict_reader() failed\n");
+    if (hook) set_rtfobj_pict_hook(R, hook, NULL) == 0     || DIE("set_rtfobj_pict_hook() failed\n");
+    rtfreplace(R);
+    !R->fatalerr || DIE("rtfreplace() failed\n");
+    delete_rtfobj(R);
+    out = slurp(fout, outlen);
+    fclose(fin);
+    fclose(fout);
+
+    return out;
+}
+
+static void drop_pict(rtfobj *R, rtfpict *P, void *data) {
+    (void)R; (void)data;
+    P->placeholder = "{\\*\\pictref}";
+}
+
+int main(void) {
+    pictures S = { 0 };
+    uint8_t *big, small[300], bin[64];
+    char *in = NULL, *want, *out;
+    size_t inlen = 0, wantlen, outlen;
+    uint64_t offs[3];
+
+    (big = malloc(BIGZ)) || DIE("Out of memory\n");
+    srand(46);
+    for (size_t i = 0; i < BIGZ; i++)         big[i]   = (uint8_t)rand();
+    for (size_t i = 0; i < sizeof small; i++) small[i] = (uint8_t)(255 - i);
+    for (size_t i = 0; i < sizeof bin; i++)   bin[i]   = (uint8_t)(i * 7 + 128);
+
+    // A PNG with a nested group whose hex isn't payload, a metafile given
+    // as \binN, and a big JPEG, with keys right up against each of them
+    puts_(&in, &inlen, "{\\rtf1\\ansi Dear NAME");
+    offs[0] = inlen;
+    puts_(&in, &inlen, "{\\pict{\\*\\blipuid 0123456789abcdef0123456789abcdef}"
+                       "\\pngblip\\picw300\\pich1\\picwgoal4500\\pichgoal15\\picscalex50\\picscaley-1\r\n");
+    put_hex(&in, &inlen, small, sizeof small);
+    puts_(&in, &inlen, "}NAME,\\par {\\*\\shppict");
+    offs[1] = inlen;
+    puts_(&in, &inlen, "{\\pict\\wmetafile8\\picw64 \\bin64 ");
+    put(&in, &inlen, bin, sizeof bin);
+    puts_(&in, &inlen, "}}{\\b NAME}");
+    offs[2] = inlen;
+    puts_(&in, &inlen, "{\\pict\\jpegblip ");
+    put_hex(&in, &inlen, big, BIGZ);
+    puts_(&in, &inlen, "}NAME}");
+
+    // Extraction doesn't change the output
+    want = replace(in, inlen, NULL, NULL, &wantlen);
+    wantlen == inlen + 4 || DIE("Unexpected output length %zu\n", wantlen);
+    out = replace(in, inlen, &S, NULL, &outlen);
+    outlen == wantlen && !memcmp(out, want, wantlen) || DIE("Extraction changed the output\n");
+    free(out);
+
+    // Each picture comes out whole, with its properties
+    S.n == 3 || DIE("Expected 3 pictures, got %zu\n", S.n);
+    for (size_t i = 0; i < 3; i++) {
+        S.p[i].nlast == 1 && !S.p[i].info.truncated || DIE("Picture %zu didn't end once\n", i);
+        S.p[i].info.offset == offs[i] || DIE("Picture %zu at %llu, expected %llu\n", i,
+            (unsigned long long)S.p[i].info.offset, (unsigned long long)offs[i]);
+    }
+    S.p[0].len == sizeof small && !memcmp(S.p[0].data, small, sizeof small) || DIE("PNG payload differs\n");
+    S.p[0].info.format    == RTF_PICT_PNG  || DIE("PNG format wrong\n");
+    S.p[0].info.picw      == 300  && S.p[0].info.pich      == 1    || DIE("PNG size wrong\n");
+    S.p[0].info.picwgoal  == 4500 && S.p[0].info.pichgoal  == 15   || DIE("PNG goal wrong\n");
+    S.p[0].info.picscalex == 50   && S.p[0].info.picscaley == -1   || DIE("PNG scale wrong\n");
+    !S.p[0].info.binary || DIE("PNG marked binary\n");
+    S.p[1].len == sizeof bin && !memcmp(S.p[1].data, bin, sizeof bin) || DIE("Binary payload differs\n");
+    S.p[1].info.format == RTF_PICT_WMF && S.p[1].info.formatarg == 8  || DIE("WMF format wrong\n");
+    S.p[1].info.binary || DIE("WMF not marked binary\n");
+    S.p[2].len == BIGZ && !memcmp(S.p[2].data, big, BIGZ) || DIE("JPEG payload differs\n");
+    S.p[2].info.format == RTF_PICT_JPEG || DIE("JPEG format wrong\n");
+    for (size_t i = 0; i < S.n; i++) free(S.p[i].data);
+
+    // Along with the deduplication hook, pictures are still read, and then
+    // replaced
+    memzero(&S, sizeof S);
+    out = replace(in, inlen, &S, drop_pict, &outlen);
+    S.n == 3 && S.p[2].len == BIGZ || DIE("Pictures not read along with the hook\n");
+    strstr(out, "Dear World{\\*\\pictref}World,\\par {\\*\\shppict{\\*\\pictref}}{\\b World}{\\*\\pictref}World}")
+        || DIE("Unexpected output with the hook: %.200s\n", out);
+    for (size_t i = 0; i < S.n; i++) free(S.p[i].data);
+    free(out);
+
+    // \binN payload may hold anything, even braces and backslashes
+    memzero(&S, sizeof S);
+    free(want);
+    free(in);
+    in = NULL;
+    inlen = 0;
+    puts_(&in, &inlen, "{\\rtf1 {\\pict\\dibitmap0\\bin8 }}{\\{\\\\}}NAME}");
+    out = replace(in, inlen, &S, NULL, &outlen);
+    S.n == 1 && S.p[0].len == 8 && !memcmp(S.p[0].data, "}}{\\{\\\\}", 8) || DIE("Braces in \\bin misread\n");
+    !strcmp(out, "{\\rtf1 {\\pict\\dibitmap0\\bin8 }}{\\{\\\\}}World}") || DIE("Braces in \\bin misparsed\n");
+    free(S.p[0].data);
+    free(out);
+
+    // A picture still open at the end of the input is marked truncated
+    memzero(&S, sizeof S);
+    in[32] = '\0';
+    out = replace(in, 32, &S, NULL, &outlen);
+    S.n == 1 && S.p[0].len == 3 && S.p[0].nlast == 1 && S.p[0].info.truncated || DIE("Open picture not marked truncated\n");
+    free(S.p[0].data);
+    free(out);
+
+    free(in);
+    free(big);
+
+    return 0;
+}
@@ -0,0 +1,131 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtfproc.h"
+#include "rtfindex.h"
+#include "utillib.h"
+#include "testutil.h"
+
+#define NCKPTS 5
+#define NGRPS  4
+
+// Whether X survives a round trip through a file
+static bool reloads(const rtfindex *X) {
+    FILE *f;
+    rtfindex *Y;
+
+    (f = tmpfile()) || DIE("Could not create temporary file\n");
+    write_rtfindex(X, f) == 0 || DIE("write_rtfindex() failed\n");
+    rewind(f);
+    Y = read_rtfindex(f);
+    fclose(f);
+    delete_rtfindex(Y);
+
+    return Y != NULL;
+}
+
+int main(void) {
+    const char *finname = "TEST/index-input.rtf";
+    const uint32_t kinds[NCKPTS] = { RTFIDX_START, RTFIDX_SECT, RTFIDX_PAGE, RTFIDX_PAGE, RTFIDX_SECT };
+    FILE *fin;
+    FILE *fidx;
+    FILE *ftxt;
+    rtfobj *R;
+    rtfindex *X;
+    rtfsummary saved;
+    size_t rtflen, txtlen, seclen, done, i;
+    char *rtf, *txt, *sec;
+
+    (fin  = fopen(finname, "rb")) || DIE("Could not read file \'%s\'\n", finname);
+    (ftxt = tmpfile())            || DIE("Could not create temporary file\n");
+    (fidx = tmpfile())            || DIE("Could not create temporary file\n");
+
+    // Text of the whole document, read straight through
+    R = new_rtfobj(fin, NULL, ftxt);
+    rtfreplace(R);
+    delete_rtfobj(R);
+    txt = slurp(ftxt, &txtlen);
+    rtf = slurp(fin, &rtflen);
+    fclose(ftxt);
+
+    // Build, save, and reload
+    rewind(fin);
+    R = new_rtfobj(fin, NULL, NULL);
+    (X = build_rtfindex(R)) || DIE("build_rtfindex() failed\n");
+    delete_rtfobj(R);
+    write_rtfindex(X, fidx) == 0 || DIE("write_rtfindex() failed\n");
+    delete_rtfindex(X);
+    rewind(fidx);
+    (X = read_rtfindex(fidx)) || DIE("read_rtfindex() failed\n");
+    fclose(fidx);
+
+    X->hdr.srclen == rtflen || DIE("Indexed %llu bytes of %zu\n", (unsigned long long)X->hdr.srclen, rtflen);
+    rewind(fin);
+    !rtfindex_is_stale(X, fin) || DIE("Fresh index reported stale\n");
+
+    X->hdr.ngrps == NGRPS || DIE("Expected %d groups, got %llu\n", NGRPS, (unsigned long long)X->hdr.ngrps);
+    for (i = 0; i < X->hdr.ngrps; i++) {
+        (rtf[X->grps[i].beg] == '{' && rtf[X->grps[i].end - 1] == '}') ||
+            DIE("Group %zu spans |%.*s|\n", i, (int)(X->grps[i].end - X->grps[i].beg), &rtf[X->grps[i].beg]);
+    }
+    !strncmp(&rtf[X->grps[0].beg], "{\\fonttbl", 9) || DIE("First group is not the font table\n");
+
+    X->hdr.nckpts == NCKPTS || DIE("Expected %d checkpoints, got %llu\n", NCKPTS, (unsigned long long)X->hdr.nckpts);
+    for (i = 0; i < NCKPTS; i++) X->ckpts[i].kind == kinds[i] || DIE("Checkpoint %zu has kind %u\n", i, X->ckpts[i].kind);
+    X->ckpts[2].state.uc == 2 || DIE("\\uc2 not captured\n");
+    X->ckpts[3].state.codepage != X->ckpts[2].state.codepage || DIE("\\f1 code page not captured\n");
+    X->hdr.nfonttbls == 2 || DIE("Expected empty and full font tables, got %llu\n", (unsigned long long)X->hdr.nfonttbls);
+
+    // A checkpoint can't be nested deeper than the bytes before it allow,
+    // or lie past the end of the source
+    saved = X->ckpts[1].state;
+    X->ckpts[1].state.depth = UINT32_MAX;
+    !reloads(X) || DIE("Index with an impossible depth loaded\n");
+    X->ckpts[1].state = saved;
+    X->ckpts[1].state.offset = X->hdr.srclen + 1;
+    !reloads(X) || DIE("Index with a checkpoint past the source loaded\n");
+    X->ckpts[1].state = saved;
+    reloads(X) || DIE("Index did not reload\n");
+
+    // Extract each range with one object, resuming out of order; together
+    // they must reproduce the straight-through text exactly.
+    R = new_rtfobj(fin, NULL, NULL);
+    for (done = 0, i = NCKPTS; i-- > 0; ) {
+        (R->ftxt = tmpfile()) || DIE("Could not create temporary file\n");
+        rtfindex_extract(X, R, i, i + 1) == 0 || DIE("Extracting range %zu failed\n", i);
+        sec = slurp(R->ftxt, &seclen);
+        fclose(R->ftxt);
+
+        seclen > 0 || DIE("Range %zu is empty\n", i);
+        seclen <= txtlen - done || DIE("Range %zu is too long\n", i);
+        !memcmp(sec, &txt[txtlen - done - seclen], seclen) ||
+            DIE("Range %zu is |%s|, expected |%.*s|\n", i, sec, (int)seclen, &txt[txtlen - done - seclen]);
+        done += seclen;
+        free(sec);
+    }
+    done == txtlen || DIE("Ranges cover %zu of %zu text bytes\n", done, txtlen);
+    R->ftxt = NULL;
+    delete_rtfobj(R);
+
+    delete_rtfindex(X);
+    free(rtf);
+    free(txt);
+    fclose(fin);
+
+    return 0;
+}
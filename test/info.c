@@ -0,0 +1,97 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "rtfproc.h"
+#include "utillib.h"
+
+#define CHECKSTR(field, want) \
+    ((I.field && !strcmp(I.field, want)) || DIE(#field " is |%s|\n", I.field ? I.field : "(null)"))
+#define CHECKNUM(field, want) \
+    (I.field == (want) || DIE(#field " is %d\n", (int)I.field))
+
+#define BODYZ  (4 << 20)   // Size of the body added to the test input
+
+int main(void) {
+    const char *finname = "TEST/info-input.rtf";
+    const char *bigname = "temp-info.rtf";
+    rtfinfo I;
+    rtfobj *R;
+    FILE *fin, *fbig;
+    char line[256];
+    long bodypos = -1;
+    long pos, diskpos;
+    long n;
+
+    // The test input's header, then a body of several megabytes
+    (fin  = fopen(finname, "rb")) || DIE("Could not read file \'%s\'\n", finname);
+    (fbig = fopen(bigname, "wb")) || DIE("Could not write to file \'%s\'\n", bigname);
+    while (fgets(line, sizeof line, fin)) {
+        fputs(line, fbig);
+        if (!strncmp(line, "\\pard", 5)) { bodypos = ftell(fin); break; }
+    }
+    bodypos > 0 || DIE("No body in test input\n");
+    for (n = 0; n < BODYZ; n += (long)strlen(line)) {
+        snprintf(line, sizeof line, "Paragraph %ld of the body text.\\par\n", n);
+        fputs(line, fbig);
+    }
+    fputs("}\n", fbig);
+    fclose(fin);
+    fclose(fbig);
+
+    // Reading stops at the body, both as parsed and as read from disk
+    (fin = fopen(bigname, "rb")) || DIE("Could not read file \'%s\'\n", bigname);
+    (R = new_rtfobj_info(fin)) || DIE("new_rtfobj_info() failed\n");
+    rtfgetinfo(R, &I) == 0 || DIE("rtfgetinfo() failed\n");
+    pos     = ftell(fin);
+    diskpos = (long)lseek(fileno(fin), 0, SEEK_CUR);
+    delete_rtfobj(R);
+
+    pos <= bodypos || DIE("Read to offset %ld, body starts at %ld\n", pos, bodypos);
+    diskpos <= bodypos + INFO_BUFFER_SIZE || DIE("Read %ld bytes from disk, body starts at %ld\n", diskpos, bodypos);
+
+    CHECKSTR(title,    "Lease Termination § 4 Notice");
+    CHECKSTR(subject,  "Re: 5800 Main St");
+    CHECKSTR(author,   "José Žernik");
+    CHECKSTR(company,  "Acme LLC");
+    CHECKSTR(keywords, "lease, notice");
+    (I.manager == NULL && I.comment == NULL) || DIE("Absent fields are set\n");
+
+    CHECKNUM(creatim.yr,  2023);
+    CHECKNUM(creatim.mo,  4);
+    CHECKNUM(creatim.dy,  17);
+    CHECKNUM(creatim.hr,  9);
+    CHECKNUM(creatim.min, 5);
+    CHECKNUM(creatim.sec, 0);
+    CHECKNUM(revtim.yr,   2024);
+    CHECKNUM(revtim.sec,  30);
+    CHECKNUM(printim.yr,  0);
+    CHECKNUM(version,     7);
+    CHECKNUM(edmins,      42);
+    CHECKNUM(nofpages,    2);
+    CHECKNUM(nofwords,    1234);
+    CHECKNUM(nofchars,    6789);
+
+    clear_rtfinfo(&I);
+    I.title == NULL || DIE("clear_rtfinfo() left title set\n");
+
+    fclose(fin);
+    remove(bigname);
+
+    return 0;
+}
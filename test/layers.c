@@ -0,0 +1,71 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtfproc.h"
+#include "utillib.h"
+#include "testutil.h"
+
+int main(void) {
+    rtfobj *R;
+    rtfdict *D;
+    size_t i;
+
+    const char *base[] = { "ab", "1", "abcd", "2", "cd", "3", "xy", "base", NULL };
+    const char *none[] = { NULL };
+    const char *docA[] = { "cd", "A3", NULL };
+    const char *docB[] = { "abc", "B", "xy", "Bxy", "zz", "Z", NULL };
+
+    (D = new_rtfdict(base)) || DIE("new_rtfdict() failed\n");
+
+    // The base alone, including a key that could still have grown when
+    // the input ended
+    EXPECT(RTF_MATCH_DEFAULT, D, none, "{\\rtf1 abcd cd xy zz}",   "{\\rtf1 2 3 base zz}");
+    EXPECT(RTF_MATCH_DEFAULT, D, none, "{\\rtf1 ab}",              "{\\rtf1 1}");
+
+    // An override replaces the value of a base key, others are untouched
+    EXPECT(RTF_MATCH_DEFAULT, D, docA, "{\\rtf1 abcd cd xy zz}",   "{\\rtf1 2 A3 base zz}");
+
+    // Overrides compete with base keys by length, and may add new keys
+    EXPECT(RTF_MATCH_DEFAULT, D, docB, "{\\rtf1 abcd cd xy zz}",   "{\\rtf1 2 3 Bxy Z}");
+    EXPECT(RTF_MATCH_DEFAULT, D, docB, "{\\rtf1 abcx ab}",         "{\\rtf1 Bx 1}");
+    EXPECT(RTF_MATCH_DEFAULT, D, docB, "{\\rtf1 a{\\b b}c!}",      "{\\rtf1 B!}");
+    EXPECT(RTF_MATCH_DEFAULT, D, docB, "{\\rtf1 abc}",             "{\\rtf1 B}");
+    EXPECT(RTF_MATCH_DEFAULT, D, docB, "{\\rtf1 z{\\i z}}",        "{\\rtf1 Z{}}");
+
+    // Documents sharing the base see only their own overrides
+    EXPECT(RTF_MATCH_DEFAULT, D, docA, "{\\rtf1 xy}",              "{\\rtf1 base}");
+    EXPECT(RTF_MATCH_DEFAULT, D, none, "{\\rtf1 cd}",              "{\\rtf1 3}");
+    !strcmp(find_rtfdict_value(D, "cd"), "3") || DIE("Base dictionary modified\n");
+
+    // Lookups and enumeration see both layers, overrides first
+    R = new_rtfobj(stdin, stdout, NULL);
+    set_rtfobj_dictionary(R, D);
+    add_rtfobj_replacements(R, docA);
+    rtfobj_nkeys(R) == 5 || DIE("Expected 5 keys, got %zu\n", rtfobj_nkeys(R));
+    !strcmp(rtfobj_key(R, 0), "cd") && !strcmp(rtfobj_val(R, 0), "A3") || DIE("Override not listed first\n");
+    !strcmp(find_rtfobj_replacement(R, "cd"), "A3") || DIE("Override not found\n");
+    !strcmp(find_rtfobj_replacement(R, "abcd"), "2") || DIE("Base key not found\n");
+    for (i = 1; i < 5; i++) {
+        !strcmp(rtfobj_key(R, i), base[2*(i-1)]) || DIE("Key %zu is %s\n", i, rtfobj_key(R, i));
+    }
+    delete_rtfobj(R);
+
+    delete_rtfdict(D);
+
+    return 0;
+}
@@ -0,0 +1,124 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#include <stdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtfproc.h"
+#include "utillib.h"
+#include "testutil.h"
+
+// Runs rtfreplace() over in under the given limits, checks that it stopped
+// with the expected error, and returns what was written
+static char *limited(const char *in, size_t inlen, const rtflimits *L, const rtfdict *D, int want) {
+    FILE *fin, *fout;
+    rtfobj *R;
+    size_t len;
+    char *out;
+
+    (fin  = tmpfile()) || DIE("Could not create temporary file\n");
+    (fout = tmpfile()) || DIE("Could not create temporary file\n");
+    fwrite(in, 1, inlen, fin) == inlen || DIE("Short write\n");
+    rewind(fin);
+    R = new_rtfobj(fin, fout, NULL);
+    if (D) set_rtfobj_dictionary(R, D);
+    set_rtfobj_limits(R, L);
+    rtfreplace(R);
+    R->fatalerr == want || DIE("Expected error %d, got %d\n", want, R->fatalerr);
+    delete_rtfobj(R);
+    out = slurp(fout, &len);
+    fclose(fin);
+    fclose(fout);
+
+    return out;
+}
+
+// Output of a document without keys should be a prefix of its input
+#define EXPECT_PREFIX(in, inlen, L, want) do {                                \
+    char *out = limited(in, inlen, L, NULL, want);                            \
+    !strncmp(out, in, strlen(out)) || DIE("Output is not a prefix of input\n"); \
+    free(out);                                                                \
+} while (0)
+
+static char *repeat(const char *head, const char *s, size_t n, const char *tail, size_t *len) {
+    size_t hz = strlen(head), sz = strlen(s), tz = strlen(tail);
+    char *buf;
+
+    *len = hz + n * sz + tz;
+    (buf = malloc(*len + 1)) || DIE("Out of memory\n");
+    memcpy(buf, head, hz);
+    for (size_t i = 0; i < n; i++) memcpy(&buf[hz + i * sz], s, sz);
+    memcpy(&buf[hz + n * sz], tail, tz + 1);
+
+    return buf;
+}
+
+int main(void) {
+    rtfdict *D;
+    char *in, *out;
+    size_t len;
+
+    // Deep nesting stops at the limit, with everything before it written out
+    in = repeat("{\\rtf1 ", "{\\b ", 100000, "}", &len);
+    EXPECT_PREFIX(in, len, &((rtflimits){ .maxdepth = 64 }), RTF_ELIMIT_DEPTH);
+    free(in);
+
+    // Input and token budgets
+    in = repeat("{\\rtf1 ", "Lorem ipsum dolor sit amet. ", 10000, "}", &len);
+    out = limited(in, len, &((rtflimits){ .maxbytes = 1000 }), NULL, RTF_ELIMIT_BYTES);
+    (strlen(out) > 1000 && strlen(out) < 1100 && !strncmp(out, in, strlen(out))) || DIE("Stopped at %zu, not 1000\n", strlen(out));
+    free(out);
+    out = limited(in, len, &((rtflimits){ .maxsteps = 100 }), NULL, RTF_ELIMIT_STEPS);
+    (strlen(out) > 90 && strlen(out) < 110 && !strncmp(out, in, strlen(out))) || DIE("Stopped at %zu, not 100\n", strlen(out));
+    free(out);
+    out = limited(in, len, &((rtflimits){ .maxsteps = 10000000 }), NULL, 0);
+    !strcmp(out, in) || DIE("Output differs under generous limits\n");
+    free(out);
+    free(in);
+
+    // An endless partial match, stopped by the deadline...
+    in = repeat("{\\rtf1 ", "{\\i a}", 2000000, "}", &len);
+    const char *akeys[] = { "aaaaaaaa!", "X", NULL };
+    (D = new_rtfdict(akeys)) || DIE("new_rtfdict() failed\n");
+    out = limited(in, len, &((rtflimits){ .maxnanos = 1000000 }), D, RTF_ELIMIT_TIME);
+    free(out);
+
+    delete_rtfdict(D);
+    free(in);
+
+    // ...and by memory, as formatting piles up in the raw buffer while a
+    // match is pending
+    in = repeat("{\\rtf1 a", "{\\i }", 100000, "}", &len);
+    const char *abkeys[] = { "ab", "X", NULL };
+    (D = new_rtfdict(abkeys)) || DIE("new_rtfdict() failed\n");
+    out = limited(in, len, &((rtflimits){ .maxmem = 16384 }), D, RTF_ELIMIT_MEMORY);
+    !strncmp(out, in, strlen(out)) || DIE("Output is not a prefix of input\n");
+    free(out);
+    delete_rtfdict(D);
+    free(in);
+
+    // A match that was waiting for a longer one is resolved when a limit
+    // stops processing
+    const char *overlap[] = { "ab", "1", "abcd", "2", NULL };
+    (D = new_rtfdict(overlap)) || DIE("new_rtfdict() failed\n");
+    in = "{\\rtf1 abcxxxxxxxx}";
+    out = limited(in, strlen(in), &((rtflimits){ .maxsteps = 4 }), D, RTF_ELIMIT_STEPS);
+    !strcmp(out, "{\\rtf1 1c") || DIE("Expected |{\\rtf1 1c|, got |%s|\n", out);
+    free(out);
+    delete_rtfdict(D);
+
+    return 0;
+}
@@ -0,0 +1,88 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtfpairs.h"
+#include "utillib.h"
+
+static char *write_temp(const char *name, const char *text) {
+    FILE *f;
+    (f = fopen(name, "wb")) || DIE("Could not write \'%s\'\n", name);
+    fputs(text, f);
+    fclose(f);
+    return (char *)name;
+}
+
+static void expect_pairs(char **got, size_t n, const char **want) {
+    size_t i;
+    for (i = 0; want[2*i]; i++) {
+        i < n || DIE("Only %zu pairs, expected more\n", n);
+        !strcmp(got[2*i],   want[2*i])   || DIE("Key %zu is |%s|, expected |%s|\n",   i, got[2*i],   want[2*i]);
+        !strcmp(got[2*i+1], want[2*i+1]) || DIE("Value %zu is |%s|, expected |%s|\n", i, got[2*i+1], want[2*i+1]);
+    }
+    i == n || DIE("%zu pairs, expected %zu\n", n, i);
+    !got[2*n] || DIE("Pairs not NULL-terminated\n");
+}
+
+int main(void) {
+    char **tsv, **json, **pairs;
+    size_t ntsv, njson, n, i;
+
+    // The two letter fixtures hold the same pairs, sorted the same way
+    (tsv  = load_rtfpairs("test/letter.tsv",  &ntsv))  || DIE("Could not load test/letter.tsv\n");
+    (json = load_rtfpairs("test/letter.json", &njson)) || DIE("Could not load test/letter.json\n");
+    ntsv == 12 && njson == 12 || DIE("Loaded %zu and %zu pairs, expected 12\n", ntsv, njson);
+    for (i = 0; i < 2 * ntsv; i++) {
+        !strcmp(tsv[i], json[i]) || DIE("TSV |%s| but JSON |%s|\n", tsv[i], json[i]);
+        !i || i % 2 || strcmp(tsv[i-2], tsv[i]) < 0 || DIE("Keys out of order at |%s|\n", tsv[i]);
+    }
+    free_rtfpairs(tsv);
+    free_rtfpairs(json);
+
+    // TSV escapes, comments, blank lines, CRLF, and the last duplicate winning
+    pairs = load_rtfpairs(write_temp("temp.tsv",
+        "# comment\n"
+        "\n"
+        "b\tone\\ttwo\r\n"
+        "a\tfirst\n"
+        "c\\\\d\tline\\nbreak\n"
+        "a\tsecond\n"
+        "e\t\n"), &n);
+    pairs || DIE("Could not load TSV\n");
+    expect_pairs(pairs, n, (const char *[]){
+        "a", "second",  "b", "one\ttwo",  "c\\d", "line\nbreak",  "e", "",  NULL });
+    free_rtfpairs(pairs);
+
+    // JSON escapes, including \u and surrogate pairs, with no .json suffix
+    pairs = load_rtfpairs(write_temp("temp.tsv",
+        " { \"k\\\"1\" : \"tab\\there\",\n"
+        "   \"\\u00ABDate\\u00BB\": \"\\ud83d\\ude00\",\n"
+        "   \"k\\\"1\": \"again\\/\" }\n"), &n);
+    pairs || DIE("Could not load JSON\n");
+    expect_pairs(pairs, n, (const char *[]){
+        "k\"1", "again/",  "«Date»", "\xF0\x9F\x98\x80",  NULL });
+    free_rtfpairs(pairs);
+
+    // Malformed files fail rather than loading part of the pairs
+    !load_rtfpairs(write_temp("temp.tsv", "a\tb\nno tab here\n"), NULL) || DIE("Accepted a line without a tab\n");
+    !load_rtfpairs(write_temp("temp.tsv", "{ \"a\": 1 }"), NULL)        || DIE("Accepted a number value\n");
+    !load_rtfpairs(write_temp("temp.tsv", "{ \"a\": \"b\" "), NULL)     || DIE("Accepted an unclosed object\n");
+    !load_rtfpairs("test/no-such-file.tsv", NULL)                        || DIE("Loaded a missing file\n");
+    remove("temp.tsv");
+
+    return 0;
+}
@@ -0,0 +1,378 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+// Benchmark driver: wall time plus hardware counters (Linux perf events),
+// per MB of input, for rtfreplace(), rtfprocess(), and text extraction.
+//
+//     perfbench [-n ITERATIONS] [-m replace,process,extract] FILE...
+//
+// Files are grouped into categories by the directory they are in, so a
+// corpus laid out as corpus/wordpad/*.rtf, corpus/word/*.rtf, etc. gets one
+// row per category. Each file is run once cold (its pages dropped from the
+// page cache and the CPU caches flushed first) and then ITERATIONS times
+// warm, of which the fastest run is reported. Where the counters can't be
+// read (not Linux, or perf_event_paranoid forbids it), only times are shown.
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "rtfproc.h"
+#include "utillib.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#define NCOUNTERS   5
+#define NMODES      3
+#define MAXCATS     64
+#define FLUSHZ      (64 << 20)   // Bigger than any last-level cache
+
+static const char *countername[NCOUNTERS] = { "cycles", "instr", "br-miss", "L1d-miss", "LLC-miss" };
+static const char *modename[NMODES]       = { "replace", "process", "extract" };
+
+typedef struct sample {
+    double          secs;
+    uint64_t        count[NCOUNTERS];
+} sample;
+
+typedef struct category {
+    char            name[256];
+    double          mb;
+    sample          cold[NMODES];
+    sample          warm[NMODES];
+} category;
+
+static int  counterfd[NCOUNTERS] = { -1, -1, -1, -1, -1 };
+static bool havecounters = false;
+static FILE *fnull;
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                          HARDWARE COUNTERS                          ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+static void open_counters(void) {
+#if defined(__linux__)
+    struct perf_event_attr pe;
+    const uint64_t cache = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    const uint32_t type[NCOUNTERS]   = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+                                         PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE };
+    const uint64_t config[NCOUNTERS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                         PERF_COUNT_HW_BRANCH_MISSES,
+                                         PERF_COUNT_HW_CACHE_L1D | cache, PERF_COUNT_HW_CACHE_LL | cache };
+    int i;
+    int err = 0;
+
+    // Opened one by one, so that one the CPU lacks doesn't cost the rest
+    for (i = 0; i < NCOUNTERS; i++) {
+        memset(&pe, 0, sizeof pe);
+        pe.size           = sizeof pe;
+        pe.type           = type[i];
+        pe.config         = config[i];
+        pe.disabled       = 1;
+        pe.exclude_kernel = 1;
+        pe.exclude_hv     = 1;
+        pe.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        counterfd[i] = (int)syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0);
+        if (counterfd[i] < 0) err = errno;
+        else                  havecounters = true;
+    }
+
+    if (!havecounters) {
+        fprintf(stderr, "Hardware counters unavailable (perf_event_open: %s); timing only.\n", strerror(err));
+    }
+#else
+    fprintf(stderr, "Hardware counters need Linux perf events; timing only.\n");
+#endif
+}
+
+
+
+static void start_counters(void) {
+#if defined(__linux__)
+    int i;
+    for (i = 0; i < NCOUNTERS; i++) {
+        if (counterfd[i] < 0) continue;
+        ioctl(counterfd[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(counterfd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+
+
+static void stop_counters(sample *s) {
+#if defined(__linux__)
+    uint64_t v[3];   // Value, time enabled, time running
+    int i;
+
+    for (i = 0; i < NCOUNTERS; i++) {
+        s->count[i] = 0;
+        if (counterfd[i] < 0) continue;
+        ioctl(counterfd[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counterfd[i], v, sizeof v) != sizeof v || v[2] == 0) continue;
+
+        // Scale up if the counter was multiplexed with others
+        s->count[i] = (v[2] < v[1]) ? (uint64_t)((double)v[0] * v[1] / v[2]) : v[0];
+    }
+#else
+    memset(s->count, 0, sizeof s->count);
+#endif
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                              WORKLOADS                              ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+static void discard_buffers(rtfobj *R, void *p, int procstage) {
+    (void)p; (void)procstage;
+    reset_txt_buffer_by(R, R->ti);
+    reset_raw_buffer_by(R, R->ri);
+}
+
+
+
+static void extract_text(rtfobj *R, void *p, int procstage) {
+    (void)procstage;
+    fwrite(R->txt, 1, R->ti, (FILE *)p);
+    reset_txt_buffer_by(R, R->ti);
+    reset_raw_buffer_by(R, R->ri);
+}
+
+
+
+static void run(const char *filename, int mode, sample *s) {
+    struct timespec t0, t1;
+    FILE *fin;
+    rtfobj *R;
+
+    const char *replacements[] = {
+        "«SSIC»",                    "1000",
+        "«Office Code»",             "B 0524",
+        "«Date»",                    "13 Sep 21",
+        "«Property Mgr Name»",       "Shady Management",
+        "«Client Rank»",             "Colonel",
+        "«Client Full Name»",        "Chesty A. Puller",
+        "«Client Last Name»",        "Puller",
+        NULL
+    };
+
+    (fin = fopen(filename, "rb")) || DIE("Could not read file \'%s\'\n", filename);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    start_counters();
+
+    R = new_rtfobj(fin, (mode == 0) ? fnull : NULL, NULL);
+    R || DIE("Could not create RTF object\n");
+    if      (mode == 0) { add_rtfobj_replacements(R, replacements); rtfreplace(R); }
+    else if (mode == 1) { rtfprocess(R, discard_buffers, NULL); }
+    else                { rtfprocess(R, extract_text, fnull); }
+    delete_rtfobj(R);
+    fflush(fnull);
+
+    stop_counters(s);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    s->secs = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+    fclose(fin);
+}
+
+
+
+static void make_cold(const char *filename) {
+    static volatile char *junk;
+    int fd;
+    size_t i;
+
+    // Drop the file from the page cache (clean pages need no privileges)...
+#if defined(POSIX_FADV_DONTNEED)
+    if ((fd = open(filename, O_RDONLY)) >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+#else
+    (void)fd; (void)filename;
+#endif
+
+    // ...and push everything else out of the CPU caches
+    if (!junk && !(junk = malloc(FLUSHZ))) return;
+    for (i = 0; i < FLUSHZ; i += 64) junk[i] = (char)i;
+}
+
+
+
+static void add_sample(sample *total, const sample *s) {
+    int i;
+    total->secs += s->secs;
+    for (i = 0; i < NCOUNTERS; i++) total->count[i] += s->count[i];
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                               REPORTS                               ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+static void print_header(void) {
+    int i;
+
+    printf("%-16s %-8s %-4s %9s %9s", "category", "mode", "run", "MB", "MB/s");
+    if (havecounters) {
+        printf(" %7s", "IPC");
+        for (i = 0; i < NCOUNTERS; i++) printf(" %11s", countername[i]);
+    }
+    printf("\n");
+
+    if (havecounters) {
+        printf("%-16s %-8s %-4s %9s %9s %7s", "", "", "", "", "", "");
+        printf(" %11s %11s %11s %11s %11s\n", "M/MB", "M/MB", "k/MB", "k/MB", "k/MB");
+    }
+}
+
+
+
+static void print_row(const category *c, int mode, const char *run, const sample *s) {
+    const double scale[NCOUNTERS] = { 1e6, 1e6, 1e3, 1e3, 1e3 };
+    int i;
+
+    printf("%-16.16s %-8s %-4s %9.3f %9.1f", c->name, modename[mode], run,
+           c->mb, s->secs > 0 ? c->mb / s->secs : 0.0);
+
+    if (havecounters) {
+        if (s->count[0] && counterfd[1] >= 0) printf(" %7.2f", (double)s->count[1] / (double)s->count[0]);
+        else                                  printf(" %7s", "-");
+
+        for (i = 0; i < NCOUNTERS; i++) {
+            if (counterfd[i] < 0) printf(" %11s", "-");
+            else                  printf(" %11.2f", (double)s->count[i] / c->mb / scale[i]);
+        }
+    }
+    printf("\n");
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+////                                                                     ////
+////                                MAIN                                 ////
+////                                                                     ////
+/////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv) {
+    static category cats[MAXCATS];
+    size_t ncats = 0;
+    bool   modes[NMODES] = { true, true, true };
+    int    iterations = 5;
+    int    argi, mode, i;
+    size_t c;
+    sample s, best;
+    category *cat;
+    const char *slash;
+    char dir[256];
+    FILE *f;
+    long len;
+
+    for (argi = 1; argi < argc && argv[argi][0] == '-'; argi++) {
+        if (!strcmp(argv[argi], "-n") && argi + 1 < argc) {
+            iterations = atoi(argv[++argi]);
+            if (iterations < 1) iterations = 1;
+        }
+        else if (!strcmp(argv[argi], "-m") && argi + 1 < argc) {
+            argi++;
+            for (mode = 0; mode < NMODES; mode++) modes[mode] = strstr(argv[argi], modename[mode]) != NULL;
+        }
+        else {
+            argi = argc;
+        }
+    }
+
+    if (argi >= argc) {
+        fprintf(stderr, "Usage: perfbench [-n ITERATIONS] [-m replace,process,extract] FILE...\n");
+        return 1;
+    }
+
+    (fnull = fopen("/dev/null", "wb")) || DIE("Could not open /dev/null\n");
+    open_counters();
+
+    for (; argi < argc; argi++) {
+        (f = fopen(argv[argi], "rb")) || DIE("Could not read file \'%s\'\n", argv[argi]);
+        fseek(f, 0, SEEK_END);
+        len = ftell(f);
+        fclose(f);
+
+        // The category is the name of the directory the file is in
+        slash = strrchr(argv[argi], '/');
+        strcpy(dir, ".");
+        if (slash) snprintf(dir, sizeof dir, "%.*s", (int)(slash - argv[argi]), argv[argi]);
+        if ((slash = strrchr(dir, '/'))) memmove(dir, slash + 1, strlen(slash));
+
+        for (c = 0; c < ncats && strcmp(cats[c].name, dir); c++);
+        if (c == ncats) {
+            ncats < MAXCATS || DIE("Too many categories\n");
+            snprintf(cats[ncats++].name, sizeof cats[c].name, "%s", dir);
+        }
+        cat = &cats[c];
+        cat->mb += (double)len / 1e6;
+
+        for (mode = 0; mode < NMODES; mode++) {
+            if (!modes[mode]) continue;
+
+            make_cold(argv[argi]);
+            run(argv[argi], mode, &s);
+            add_sample(&cat->cold[mode], &s);
+
+            for (i = 0; i < iterations; i++) {
+                run(argv[argi], mode, &s);
+                if (i == 0 || s.secs < best.secs) best = s;
+            }
+            add_sample(&cat->warm[mode], &best);
+        }
+    }
+
+    print_header();
+    for (c = 0; c < ncats; c++) {
+        for (mode = 0; mode < NMODES; mode++) {
+            if (!modes[mode]) continue;
+            print_row(&cats[c], mode, "cold", &cats[c].cold[mode]);
+            print_row(&cats[c], mode, "warm", &cats[c].warm[mode]);
+        }
+    }
+
+    fclose(fnull);
+
+    return 0;
+}
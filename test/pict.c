@@ -0,0 +1,167 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtfproc.h"
+#include "utillib.h"
+#include "testutil.h"
+
+#define MAXBLOBS    8
+#define NREPEATS    4
+
+// A blob store keyed by hash, as a caller deduplicating across documents
+// would keep one
+typedef struct blobstore {
+    const char *in;
+    uint64_t    hash[MAXBLOBS];
+    size_t      nblobs;
+    size_t      ncalls;
+    char        ref[64];
+} blobstore;
+
+static void store_pict(rtfobj *R, rtfpict *P, void *data) {
+    blobstore *S = data;
+    (void)R;
+
+    S->ncalls++;
+    P->rtf[0] == '{' && P->rtf[P->len-1] == '}' || DIE("Picture isn't a whole group\n");
+    !memcmp(S->in + P->offset, P->rtf, P->len)  || DIE("Picture offset is wrong\n");
+    P->hash == rtfhash(RTFHASH_INIT, P->rtf, P->len) || DIE("Picture hash is wrong\n");
+
+    for (size_t i = 0; i < S->nblobs; i++) {
+        if (S->hash[i] != P->hash) continue;
+        snprintf(S->ref, sizeof S->ref, "{\\*\\pictref %016llx}", (unsigned long long)P->hash);
+        P->placeholder = S->ref;
+        return;
+    }
+    S->nblobs < MAXBLOBS || DIE("Too many blobs\n");
+    S->hash[S->nblobs++] = P->hash;
+}
+
+// Appends printf-style to a growing string
+static void cat(char **s, size_t *len, const char *fmt, const char *arg) {
+    size_t n = (size_t)snprintf(NULL, 0, fmt, arg);
+    (*s = realloc(*s, *len + n + 1)) || DIE("Out of memory\n");
+    snprintf(*s + *len, n + 1, fmt, arg);
+    *len += n;
+}
+
+// Runs rtfreplace() over in, optionally with the blob store hooked up
+static char *replace(const char *in, blobstore *S, size_t *outlen) {
+    FILE *fin, *fout;
+    rtfobj *R;
+    char *out;
+
+    (fin  = fmemopen((void *)in, strlen(in), "rb")) || DIE("Could not open input\n");
+    (fout = tmpfile())                              || DIE("Could not create temporary file\n");
+    R = new_rtfobj(fin, fout, NULL);
+    add_one_rtfobj_replacement(R, "NAME", "World");
+    if (S) set_rtfobj_pict_hook(R, store_pict, S) == 0 || DIE("set_rtfobj_pict_hook() failed\n");
+    rtfreplace(R);
+    !R->fatalerr || DIE("rtfreplace() failed\n");
+    delete_rtfobj(R);
+    out = slurp(fout, outlen);
+    fclose(fin);
+    fclose(fout);
+
+    return out;
+}
+
+int main(void) {
+    blobstore S = { 0 };
+    char *pict = NULL, *big = NULL, *in = NULL, *want = NULL, *out;
+    size_t pictlen = 0, biglen = 0, inlen = 0, wantlen = 0, outlen;
+    char ref[64];
+
+    // A small picture with a nested group, and one far bigger than the raw
+    // buffer
+    cat(&pict, &pictlen, "%s", "{\\pict{\\*\\blipuid 0123456789abcdef}\\pngblip\\picw16\\pich16 ");
+    for (int i = 0; i < 64; i++) cat(&pict, &pictlen, "%s", "89504e470d0a1a0a");
+    cat(&pict, &pictlen, "%s", "}");
+    cat(&big, &biglen, "%s", "{\\pict\\jpegblip ");
+    for (int i = 0; i < 32768; i++) cat(&big, &biglen, "%s", "ffd8ffe000104a46");
+    cat(&big, &biglen, "%s", "}");
+
+    // Keys sit right up against the pictures on both sides
+    cat(&in, &inlen, "%s", "{\\rtf1\\ansi Dear NAME,\\par ");
+    for (int i = 0; i < NREPEATS; i++) {
+        cat(&in, &inlen, "%s", "NAME");
+        cat(&in, &inlen, "%s", pict);
+        cat(&in, &inlen, "%s", "NAME, {\\b NAME}\\par ");
+        cat(&in, &inlen, "{\\*\\shppict%s}", big);
+    }
+    cat(&in, &inlen, "%s", "}");
+
+    // Without a hook, pictures pass through as before
+    out = replace(in, NULL, &outlen);
+    !strstr(out, "NAME") || DIE("Key left unreplaced without a hook\n");
+    outlen == inlen + 1 + NREPEATS * 3 || DIE("Unexpected output length %zu\n", outlen);
+    !strstr(out, "pictref") || DIE("Placeholder without a hook\n");
+    strstr(out, pict) && strstr(out, big) || DIE("Picture altered without a hook\n");
+    want = out;
+    wantlen = outlen;
+
+    // With one, each picture is seen once as itself and replaced with its
+    // reference from then on; everything else is the same as without
+    S.in = in;
+    out = replace(in, &S, &outlen);
+    S.ncalls == 2 * NREPEATS || DIE("Hook called %zu times\n", S.ncalls);
+    S.nblobs == 2            || DIE("Expected 2 distinct pictures, got %zu\n", S.nblobs);
+    !strstr(out, "NAME")     || DIE("Key left unreplaced with a hook\n");
+    outlen < wantlen / 2     || DIE("Output didn't shrink (%zu vs %zu)\n", outlen, wantlen);
+    snprintf(ref, sizeof ref, "{\\*\\pictref %016llx}",
+             (unsigned long long)rtfhash(RTFHASH_INIT, pict, pictlen));
+    strstr(out, ref) || DIE("Missing placeholder for the small picture\n");
+    {
+        // Putting the pictures back gives the unhooked output
+        char *p, *restored = NULL;
+        size_t restoredlen = 0;
+        for (p = out; *p; ) {
+            char *q = strstr(p, "{\\*\\pictref ");
+            if (!q) { cat(&restored, &restoredlen, "%s", p); break; }
+            *q = '\0';
+            cat(&restored, &restoredlen, "%s", p);
+            cat(&restored, &restoredlen, "%s", !strncmp(q + 1, ref + 1, strlen(ref) - 1) ? pict : big);
+            p = strchr(q + 1, '}') + 1;
+        }
+        restoredlen == wantlen && !strcmp(restored, want) || DIE("Restored output differs\n");
+        free(restored);
+    }
+    free(out);
+
+    // A second document reuses the store: every picture is a repeat
+    S.ncalls = 0;
+    out = replace(in, &S, &outlen);
+    S.ncalls == 2 * NREPEATS && S.nblobs == 2 || DIE("Store not reused across documents\n");
+    strstr(out, "\\pngblip") == NULL || DIE("Known picture written out again\n");
+    free(out);
+
+    // A picture still open at the end of the input is written out as is
+    S.ncalls = 0;
+    in[inlen - 3] = '\0';
+    out = replace(in, &S, &outlen);
+    S.ncalls == 2 * NREPEATS - 1 || DIE("Hook called on an open picture\n");
+    outlen > biglen && !memcmp(out + outlen - biglen + 1, big, biglen - 1) || DIE("Open picture lost\n");
+
+    free(out);
+    free(want);
+    free(in);
+    free(big);
+    free(pict);
+
+    return 0;
+}
@@ -0,0 +1,77 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtfproc.h"
+#include "utillib.h"
+#include "testutil.h"
+
+int main(void) {
+    rtfobj *R;
+    rtfdict *D;
+
+    // The same overlapping keys, registered shortest first and longest first
+    const char *shortfirst[] = { "Client Name", "N", "Client Name Full", "F", "Name", "M", NULL };
+    const char *longfirst[]  = { "Client Name Full", "F", "Client Name", "N", "Name", "M", NULL };
+    const char *none[]       = { NULL };
+
+    const char *full  = "{\\rtf1 Dear \\b Client\\b0  Name{\\i  Full}, Name}";
+    const char *nofull = "{\\rtf1 Dear \\b Client\\b0  Name{\\i  Fu}ry, Name}";
+
+    // Longest and shortest don't depend on registration order
+    EXPECT(RTF_MATCH_LONGEST,  NULL, shortfirst, full,   "{\\rtf1 Dear \\b F{}, M}");
+    EXPECT(RTF_MATCH_LONGEST,  NULL, longfirst,  full,   "{\\rtf1 Dear \\b F{}, M}");
+    EXPECT(RTF_MATCH_SHORTEST, NULL, shortfirst, full,   "{\\rtf1 Dear \\b N{\\i  Full}, M}");
+    EXPECT(RTF_MATCH_SHORTEST, NULL, longfirst,  full,   "{\\rtf1 Dear \\b N{\\i  Full}, M}");
+
+    // First registered does
+    EXPECT(RTF_MATCH_FIRST,    NULL, shortfirst, full,   "{\\rtf1 Dear \\b N{\\i  Full}, M}");
+    EXPECT(RTF_MATCH_FIRST,    NULL, longfirst,  full,   "{\\rtf1 Dear \\b F{}, M}");
+
+    // A longer key failing partway, inside a group, falls back to the
+    // shorter one, which then ends before the text does
+    EXPECT(RTF_MATCH_LONGEST,  NULL, shortfirst, nofull, "{\\rtf1 Dear \\b N{\\i  Fu}ry, M}");
+    EXPECT(RTF_MATCH_FIRST,    NULL, longfirst,  nofull, "{\\rtf1 Dear \\b N{\\i  Fu}ry, M}");
+
+    // The same with the keys in a dictionary, where first registered
+    // means first in sorted order (and so the shortest)
+    const char *sorted[] = { "Client Name", "N", "Client Name Full", "F", "Name", "M", NULL };
+    (D = new_rtfdict(sorted)) || DIE("new_rtfdict() failed\n");
+    EXPECT(RTF_MATCH_DEFAULT,  D, none, full,   "{\\rtf1 Dear \\b F{}, M}");
+    EXPECT(RTF_MATCH_LONGEST,  D, none, full,   "{\\rtf1 Dear \\b F{}, M}");
+    EXPECT(RTF_MATCH_SHORTEST, D, none, full,   "{\\rtf1 Dear \\b N{\\i  Full}, M}");
+    EXPECT(RTF_MATCH_FIRST,    D, none, full,   "{\\rtf1 Dear \\b N{\\i  Full}, M}");
+    EXPECT(RTF_MATCH_LONGEST,  D, none, nofull, "{\\rtf1 Dear \\b N{\\i  Fu}ry, M}");
+
+    // Overrides count as registered before the dictionary's keys
+    const char *over[] = { "Client Name Full", "O", NULL };
+    EXPECT(RTF_MATCH_FIRST,    D, over, full,   "{\\rtf1 Dear \\b O{}, M}");
+    EXPECT(RTF_MATCH_SHORTEST, D, over, full,   "{\\rtf1 Dear \\b N{\\i  Full}, M}");
+    delete_rtfdict(D);
+
+    // Keys that overlap without either containing the other: the leftmost wins
+    const char *staggered[] = { "Name Full", "X", "Client Name", "N", NULL };
+    EXPECT(RTF_MATCH_LONGEST,  NULL, staggered, full, "{\\rtf1 Dear \\b N{\\i  Full}, Name}");
+    EXPECT(RTF_MATCH_FIRST,    NULL, staggered, full, "{\\rtf1 Dear \\b N{\\i  Full}, Name}");
+
+    R = new_rtfobj(stdin, stdout, NULL);
+    set_rtfobj_match_policy(R, 42) == EINVAL || DIE("Invalid policy accepted\n");
+    delete_rtfobj(R);
+
+    return 0;
+}
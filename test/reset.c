@@ -0,0 +1,137 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtfproc.h"
+#include "utillib.h"
+#include "testutil.h"
+
+#define NDOCS 8
+
+static const char *replacements[] = { LETTER_PAIRS, NULL };
+
+static FILE *open_text(const char *text) {
+    FILE *f;
+    (f = tmpfile()) || DIE("Could not create temporary file\n");
+    fputs(text, f);
+    rewind(f);
+    return f;
+}
+
+static void placeholder(rtfobj *R, rtfpict *P, void *data) {
+    (void)R;
+    (void)data;
+    P->placeholder = "{\\pict PLACEHOLDER}";
+}
+
+static rtfobj *new_letter_rtfobj(void) {
+    rtfobj *R;
+    (R = new_rtfobj(NULL, NULL, NULL)) || DIE("Could not make object\n");
+    add_rtfobj_replacements(R, replacements);
+    set_rtfobj_pict_hook(R, placeholder, NULL) == 0 || DIE("set_rtfobj_pict_hook() failed\n");
+    return R;
+}
+
+// Replaces and extracts text from doc with R, returning both
+static void run(rtfobj *R, FILE *doc, char **out, char **txt) {
+    FILE *fout, *ftxt;
+    size_t len;
+
+    (fout = tmpfile()) || DIE("Could not create temporary file\n");
+    (ftxt = tmpfile()) || DIE("Could not create temporary file\n");
+    rewind(doc);
+    rtfobj_reset(R, doc, fout, ftxt);
+    rtfreplace(R);
+    R->fatalerr == 0 || DIE("Fatal error %d\n", R->fatalerr);
+    *out = slurp(fout, &len);
+    *txt = slurp(ftxt, &len);
+    fclose(fout);
+    fclose(ftxt);
+}
+
+// Leaves R partway through doc, with its buffers, attribute stack, font
+// table, and any picture in whatever state they're in at that point
+static void interrupt(rtfobj *R, FILE *doc, uint64_t at) {
+    FILE *fout;
+
+    (fout = tmpfile()) || DIE("Could not create temporary file\n");
+    rewind(doc);
+    rtfobj_reset(R, doc, fout, NULL);
+    rtfreplace_until(R, at);
+    fclose(fout);
+}
+
+int main(void) {
+    FILE *docs[NDOCS];
+    char *wantout[NDOCS], *wanttxt[NDOCS];
+    char *out, *txt;
+    rtfobj *R;
+    rtflimits L = { 0 };
+    size_t i, pass;
+
+    (docs[0] = fopen("TEST/letter-input.rtf",      "rb")) || DIE("Could not read letter-input.rtf\n");
+    (docs[1] = fopen("TEST/splitkeys-input.rtf",   "rb")) || DIE("Could not read splitkeys-input.rtf\n");
+    (docs[2] = fopen("TEST/latepartial-input.rtf", "rb")) || DIE("Could not read latepartial-input.rtf\n");
+    (docs[3] = fopen("TEST/info-input.rtf",        "rb")) || DIE("Could not read info-input.rtf\n");
+    (docs[4] = fopen("TEST/index-input.rtf",       "rb")) || DIE("Could not read index-input.rtf\n");
+    docs[5] = open_text("{\\rtf1\\ansi\\ansicpg932\\deff0{\\fonttbl{\\f0\\fcharset128 MS Mincho;}}"
+                        "\\f0 \\'81\\'e1Date\\'81\\'e2 {\\*\\shppict{\\pict\\pngblip 89504e47}}"
+                        "\\u171?Date\\u187? }");
+    docs[6] = open_text("{\\rtf1 {{{{{{{{\\uc2 \\u171??Client{\\pict\\jpegblip ffd8ff");
+    docs[7] = open_text("{\\rtf1 \\'abDate\\'bb {\\f0 \\'abDate\\'bb}}");
+
+    // What a new object makes of each document
+    for (i = 0; i < NDOCS; i++) {
+        R = new_letter_rtfobj();
+        run(R, docs[i], &wantout[i], &wanttxt[i]);
+        delete_rtfobj(R);
+    }
+
+    // One object through all of them, cut short in another document each
+    // time, must do the same
+    R = new_letter_rtfobj();
+    for (pass = 0; pass < NDOCS; pass++) {
+        for (i = 0; i < NDOCS; i++) {
+            if (pass > 0) interrupt(R, docs[(i + pass) % NDOCS], 40 * pass + 25);
+            run(R, docs[i], &out, &txt);
+            !strcmp(out, wantout[i]) || DIE("Document %zu output differs after reset (pass %zu)\n", i, pass);
+            !strcmp(txt, wanttxt[i]) || DIE("Document %zu text differs after reset (pass %zu)\n", i, pass);
+            free(out);
+            free(txt);
+        }
+    }
+
+    // Nor does a fatal error outlast the document it happened in
+    L.maxdepth = 3;
+    set_rtfobj_limits(R, &L);
+    interrupt(R, docs[6], UINT64_MAX);
+    R->fatalerr || DIE("Depth limit not reached\n");
+    set_rtfobj_limits(R, NULL);
+    run(R, docs[0], &out, &txt);
+    !strcmp(out, wantout[0]) || DIE("Output differs after a fatal error\n");
+    free(out);
+    free(txt);
+
+    delete_rtfobj(R);
+    for (i = 0; i < NDOCS; i++) {
+        fclose(docs[i]);
+        free(wantout[i]);
+        free(wanttxt[i]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtfproc.h"
+#include "utillib.h"
+#include "testutil.h"
+
+#define NKEYS 7
+
+int main(void) {
+    const char *finname = "TEST/splitkeys-input.rtf";
+    FILE *fin;
+    FILE *ftxt;
+    rtfobj *R;
+    rtfmatch *m = NULL;
+    size_t counts[NKEYS];
+    size_t n, i, rtflen, txtlen;
+    char *rtf, *txt;
+
+    const char *keys[] = {
+        "«Client Name»",       "",
+        "«Case Number»",       "",
+        "«Amount»",            "",
+        "«Open»",              "",
+        "«Close»",             "",
+        "«Br{ace»",            "",
+        "«Slash»",             "",
+        NULL
+    };
+
+    (fin  = fopen(finname, "rb")) || DIE("Could not read file \'%s\'\n", finname);
+    (ftxt = tmpfile())            || DIE("Could not create temporary file\n");
+
+    // Plain text of the whole document, to check text offsets against
+    R = new_rtfobj(fin, NULL, ftxt);
+    rtfreplace(R);
+    delete_rtfobj(R);
+    txt = slurp(ftxt, &txtlen);
+    rtf = slurp(fin, &rtflen);
+
+    // Full scan: every key once, «Amount» twice
+    rewind(fin);
+    R = new_rtfobj(fin, NULL, NULL);
+    add_rtfobj_replacements(R, keys);
+    n = rtfscan(R, &m, counts, false);
+    delete_rtfobj(R);
+
+    n == NKEYS + 1 || DIE("Expected %d matches, got %zu\n", NKEYS + 1, n);
+    counts[2] == 2 || DIE("Expected two «Amount» matches, got %zu\n", counts[2]);
+
+    for (i = 0; i < n; i++) {
+        m[i].key < NKEYS || DIE("Bad key index %zu\n", m[i].key);
+        (i == 0 || m[i].rawbeg >= m[i-1].rawend) || DIE("Match %zu out of order\n", i);
+        m[i].rawend <= rtflen || DIE("Match %zu past end of input\n", i);
+        !strncmp(&rtf[m[i].rawbeg], "\\'ab", 4) || DIE("Match %zu starts at |%.12s|\n", i, &rtf[m[i].rawbeg]);
+        !strncmp(&rtf[m[i].rawend - 4], "\\'bb", 4) || DIE("Match %zu ends at |%.12s|\n", i, &rtf[m[i].rawend - 4]);
+        !strncmp(&txt[m[i].txtpos], keys[2 * m[i].key], strlen(keys[2 * m[i].key])) ||
+            DIE("Match %zu text is |%.16s|\n", i, &txt[m[i].txtpos]);
+    }
+    free(m);
+
+    // Early stop: the second «Amount» is after every key has been seen
+    rewind(fin);
+    R = new_rtfobj(fin, NULL, NULL);
+    add_rtfobj_replacements(R, keys);
+    n = rtfscan(R, NULL, counts, true);
+    delete_rtfobj(R);
+
+    n == NKEYS || DIE("Expected %d matches with early stop, got %zu\n", NKEYS, n);
+    for (i = 0; i < NKEYS; i++) counts[i] == 1 || DIE("Key %zu seen %zu times\n", i, counts[i]);
+
+    free(rtf);
+    free(txt);
+    fclose(ftxt);
+    fclose(fin);
+
+    return 0;
+}
@@ -0,0 +1,229 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtfproc.h"
+#include "utillib.h"
+#include "testutil.h"
+
+static char *replace_all(FILE *fin, const char **replacements, size_t *len) {
+    FILE *fout;
+    rtfobj *R;
+    char *out;
+
+    (fout = tmpfile()) || DIE("Could not create temporary file\n");
+    rewind(fin);
+    R = new_rtfobj(fin, fout, NULL);
+    add_rtfobj_replacements(R, replacements);
+    rtfreplace(R);
+    delete_rtfobj(R);
+    out = slurp(fout, len);
+    fclose(fout);
+
+    return out;
+}
+
+// Overwrites valz bytes of a copy of snap at offset at, which restore_rtfobj()
+// must refuse without crashing
+static void expect_refused(rtfobj *S, const void *snap, size_t snapz, size_t at,
+                           const void *val, size_t valz, const char *what) {
+    char *bad;
+
+    (bad = malloc(snapz)) || DIE("Out of memory\n");
+    memcpy(bad, snap, snapz);
+    memcpy(bad + at, val, valz);
+    restore_rtfobj(S, bad, snapz) == EINVAL || DIE("Snapshot with %s accepted\n", what);
+    free(bad);
+}
+
+// Stop after every token in turn, including in the middle of keys, pass a
+// snapshot through a file, finish with another object, and compare against
+// an uninterrupted run.
+static void resume_everywhere(FILE *fin, const char **replacements) {
+    FILE *fout;
+    FILE *fsnap;
+    rtfobj *R;
+    rtfobj *S;
+    void *snap;
+    size_t snapz, inlen, cmplen, outlen;
+    uint64_t stop, offset;
+    char *cmp, *out;
+
+    cmp = replace_all(fin, replacements, &cmplen);
+    fseek(fin, 0, SEEK_END);
+    inlen = (size_t)ftell(fin);
+
+    // One object is reused to resume from every snapshot
+    S = new_rtfobj(fin, NULL, NULL);
+    add_rtfobj_replacements(S, replacements);
+
+    for (stop = 1; stop < inlen; stop++) {
+        (fout  = tmpfile()) || DIE("Could not create temporary file\n");
+        (fsnap = tmpfile()) || DIE("Could not create temporary file\n");
+
+        rewind(fin);
+        R = new_rtfobj(fin, fout, NULL);
+        add_rtfobj_replacements(R, replacements);
+        rtfreplace_until(R, stop);
+        (snap = snapshot_rtfobj(R, &snapz)) || DIE("snapshot_rtfobj() failed at %llu\n", (unsigned long long)stop);
+        delete_rtfobj(R);
+
+        fwrite(snap, 1, snapz, fsnap) == snapz || DIE("Could not write snapshot\n");
+        memzero(snap, snapz);
+        rewind(fsnap);
+        fread(snap, 1, snapz, fsnap) == snapz || DIE("Could not read snapshot\n");
+        fclose(fsnap);
+
+        offset = ((const rtfsnaphdr *)snap)->offset;
+        offset >= stop || DIE("Snapshot at %llu is for offset %llu\n", (unsigned long long)stop, (unsigned long long)offset);
+        fseek(fin, (long)offset, SEEK_SET);
+        S->fout = fout;
+        restore_rtfobj(S, snap, snapz) == 0 || DIE("restore_rtfobj() failed at %llu\n", (unsigned long long)stop);
+        free(snap);
+        rtfreplace(S);
+
+        out = slurp(fout, &outlen);
+        (outlen == cmplen && !memcmp(out, cmp, cmplen)) ||
+            DIE("Output differs when resuming at offset %llu\n", (unsigned long long)offset);
+        free(out);
+        fclose(fout);
+    }
+
+    S->fout = NULL;
+    delete_rtfobj(S);
+    free(cmp);
+}
+
+int main(void) {
+    FILE *fin;
+    FILE *ftxt;
+    rtfobj *R;
+    rtfobj *S;
+    void *snap;
+    rtfsnaphdr *hdr;
+    rtfsnapattr *sa;
+    uint32_t *map;
+    uint32_t val;
+    uint8_t flag;
+    size_t snapz, txtlen, at;
+    char *txt;
+
+    const char *letter[] = { LETTER_PAIRS, NULL };
+
+    const char *splitkeys[] = {
+        "«Client Name»",       "Jöhn Smith",
+        "«Case Number»",       "2023-CV-0042",
+        "«Amount»",            "$1,000",
+        "«Open»",              "OPENED",
+        "«Close»",             "CLOSED",
+        "«Br{ace»",            "BRACE",
+        "«Slash»",             "SLASH",
+        NULL
+    };
+
+    const char *dbcs[] = { NULL, "KANA", NULL };
+
+    (fin = fopen("TEST/letter-input.rtf", "rb")) || DIE("Could not read letter input\n");
+    resume_everywhere(fin, letter);
+    fclose(fin);
+
+    (fin = fopen("TEST/splitkeys-input.rtf", "rb")) || DIE("Could not read splitkeys input\n");
+    resume_everywhere(fin, splitkeys);
+    fclose(fin);
+
+    // A key that starts with a double-byte character, so that stopping
+    // between its two bytes leaves text setup half done
+    (fin  = tmpfile()) || DIE("Could not create temporary file\n");
+    (ftxt = tmpfile()) || DIE("Could not create temporary file\n");
+    fputs("{\\rtf1\\ansi{\\fonttbl\\f1\\fnil\\fcharset128 Gothic;}\\f1 A\\'82\\'a0{\\b B}C}", fin);
+    rewind(fin);
+    R = new_rtfobj(fin, NULL, ftxt);
+    rtfreplace(R);
+    delete_rtfobj(R);
+    txt = slurp(ftxt, &txtlen);
+    fclose(ftxt);
+    dbcs[0] = &txt[1];
+    resume_everywhere(fin, dbcs);
+    free(txt);
+
+    // A damaged snapshot is refused
+    rewind(fin);
+    R = new_rtfobj(fin, NULL, NULL);
+    S = new_rtfobj(fin, NULL, NULL);
+    (snap = snapshot_rtfobj(R, &snapz)) || DIE("snapshot_rtfobj() failed\n");
+    restore_rtfobj(S, snap, snapz - 1) != 0 || DIE("Truncated snapshot accepted\n");
+    ((char *)snap)[0] = 'X';
+    restore_rtfobj(S, snap, snapz) != 0 || DIE("Snapshot with bad magic accepted\n");
+    free(snap);
+    delete_rtfobj(R);
+    delete_rtfobj(S);
+    fclose(fin);
+
+    // So is one whose values would index past what it holds. Stopping in
+    // the middle of a key leaves two bytes of text pending.
+    (fin = tmpfile()) || DIE("Could not create temporary file\n");
+    fputs("{\\rtf1 AB{\\b C}}", fin);
+    rewind(fin);
+    R = new_rtfobj(fin, NULL, NULL);
+    S = new_rtfobj(fin, NULL, NULL);
+    add_rtfobj_replacements(R, (const char *[]){ "ABC", "x", NULL });
+    rtfreplace_until(R, 11);
+    (snap = snapshot_rtfobj(R, &snapz)) || DIE("snapshot_rtfobj() failed\n");
+    hdr = snap;
+    hdr->ti == 2 && hdr->nfonts == 0 || DIE("Snapshot holds %u bytes of text\n", hdr->ti);
+    restore_rtfobj(S, snap, snapz) == 0 || DIE("restore_rtfobj() failed\n");
+
+    sa  = (rtfsnapattr *)(hdr + 1);
+    at  = (size_t)((char *)&sa[hdr->nattr - 1] - (char *)snap);
+    memcpy(&val, &sa[hdr->nattr - 1].uc, sizeof val);
+    val++;
+    expect_refused(S, snap, snapz, at + offsetof(rtfsnapattr, uccountdown), &val, sizeof val, "a long \\uc skip");
+    flag = 200;
+    expect_refused(S, snap, snapz, at + offsetof(rtfsnapattr, infofield), &flag, 1, "an unknown \\info field");
+
+    map = (uint32_t *)(sa + hdr->nattr);
+    at  = (size_t)((char *)map - (char *)snap);
+    val = map[1] + 1;
+    expect_refused(S, snap, snapz, at, &val, sizeof val, "text mapped out of order");
+    val = (uint32_t)hdr->rawpos + hdr->ri + 1;
+    expect_refused(S, snap, snapz, at + sizeof val, &val, sizeof val, "text mapped past the raw buffer");
+
+    // The font table case needs a font, with one being defined past it
+    free(snap);
+    rewind(fin);
+    fputs("{\\rtf1{\\fonttbl{\\f0\\fnil Arial;}{\\f1\\fnil Gothic;}}}", fin);
+    rewind(fin);
+    delete_rtfobj(R);
+    R = new_rtfobj(fin, NULL, NULL);
+    rtfreplace_until(R, 40);
+    (snap = snapshot_rtfobj(R, &snapz)) || DIE("snapshot_rtfobj() failed\n");
+    hdr = snap;
+    sa  = (rtfsnapattr *)(hdr + 1);
+    sa[hdr->nattr - 1].fonttbl || DIE("Snapshot isn't inside the font table\n");
+    restore_rtfobj(S, snap, snapz) == 0 || DIE("restore_rtfobj() failed\n");
+    at  = (size_t)((char *)&sa[hdr->nattr - 1].fonttbl_defn_idx - (char *)snap);
+    val = 50000000;
+    expect_refused(S, snap, snapz, at, &val, sizeof val, "a font past the table");
+    free(snap);
+    delete_rtfobj(R);
+    delete_rtfobj(S);
+    fclose(fin);
+
+    return 0;
+}
@@ -0,0 +1,52 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#include <stdio.h>
+#include <string.h>
+#include "rtfproc.h"
+#include "utillib.h"
+
+int main(void) {
+    const char *finname  = "TEST/splitkeys-input.rtf";
+    const char *foutname = "temp.rtf";
+    FILE *fin;
+    FILE *fout;
+    rtfobj *R;
+
+    (fin =  fopen(finname,  "rb")) || DIE("Could not read file \'%s\'\n",     finname );
+    (fout = fopen(foutname, "wb")) || DIE("Could not write to file \'%s\'\n", foutname);
+
+    const char *replacements[] = {
+        "«Client Name»",       "Jöhn Smith",
+        "«Case Number»",       "2023-CV-0042",
+        "«Amount»",            "$1,000",
+        "«Open»",              "OPENED",
+        "«Close»",             "CLOSED",
+        "«Br{ace»",            "BRACE",
+        "«Slash»",             "SLASH",
+        "«Em—dash»",           "EMDASH",
+        NULL 
+    };
+
+    R = new_rtfobj(fin, fout, NULL);
+    add_rtfobj_replacements(R, replacements);
+    rtfreplace(R);
+    delete_rtfobj(R);
+
+    fclose(fin);
+    fclose(fout);
+
+    return 0;
+}
@@ -0,0 +1,66 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#include <stdio.h>
+#include <string.h>
+#include "rtfproc.h"
+#include "rtftmpl.h"
+#include "utillib.h"
+#include "testutil.h"
+
+int main(void) {
+    const char *finname   = "TEST/letter-input.rtf";
+    const char *ftmplname = "temp.rtftmpl";
+    const char *foutname  = "temp.rtf";
+    FILE *fin;
+    FILE *ftmpl;
+    FILE *fout;
+    rtfobj *R;
+    rtftmpl *T;
+
+    const char *keys[] = { LETTER_PAIRS, NULL };
+    const char *replacements[2 * LETTER_NPAIRS + 1];
+    size_t i;
+
+    // Values are supplied at render time, in a different order. Blank
+    // the compile-time ones, so only render-time values can show up.
+    reverse_pairs(replacements, keys);
+    for (i = 1; i < 2 * LETTER_NPAIRS; i += 2) keys[i] = "";
+
+    (fin   = fopen(finname,   "rb")) || DIE("Could not read file \'%s\'\n",     finname  );
+    (ftmpl = fopen(ftmplname, "wb")) || DIE("Could not write to file \'%s\'\n", ftmplname);
+
+    R = new_rtfobj(fin, NULL, NULL);
+    add_rtfobj_replacements(R, keys);
+    compile_rtftmpl(R, ftmpl) == 0 || DIE("Could not compile \'%s\'\n", finname);
+    delete_rtfobj(R);
+    fclose(ftmpl);
+
+    (T = open_rtftmpl(ftmplname)) || DIE("Could not open \'%s\'\n", ftmplname);
+
+    rewind(fin);
+    rtftmpl_is_stale(T, fin) && DIE("Fresh template reported as stale\n");
+    fclose(fin);
+
+    (fout = fopen(foutname, "wb")) || DIE("Could not write to file \'%s\'\n", foutname);
+    R = new_rtfobj(NULL, fout, NULL);
+    add_rtfobj_replacements(R, replacements);
+    render_rtftmpl(T, R) == 0 || DIE("Could not render \'%s\'\n", ftmplname);
+    delete_rtfobj(R);
+    close_rtftmpl(T);
+    fclose(fout);
+
+    return 0;
+}
@@ -0,0 +1,118 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#ifndef TESTUTIL_H__
+#define TESTUTIL_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtfproc.h"
+#include "utillib.h"
+
+
+
+// Helpers shared by the tests in this directory. Each test is a single
+// file, so these are static rather than built into anything.
+
+// Reads the whole of f from the start, NUL-terminated. len may be NULL.
+// f may be an input or an output; seeking writes out anything buffered.
+static char *slurp(FILE *f, size_t *len) {
+    size_t n;
+    char *buf;
+    fseek(f, 0, SEEK_END);
+    n = (size_t)ftell(f);
+    rewind(f);
+    (buf = malloc(n + 1)) || DIE("Out of memory\n");
+    fread(buf, 1, n, f) == n || DIE("Short read\n");
+    buf[n] = '\0';
+    if (len) *len = n;
+    return buf;
+}
+
+// Runs rtf through a new object with the given match policy, dictionary,
+// and replacements (either may be NULL), and returns the output.
+static char *replace_with(int policy, const rtfdict *D, const char **pairs, const char *rtf) {
+    FILE *fin, *fout;
+    rtfobj *R;
+    char *out;
+
+    (fin  = tmpfile()) || DIE("Could not create temporary file\n");
+    (fout = tmpfile()) || DIE("Could not create temporary file\n");
+    fputs(rtf, fin);
+    rewind(fin);
+    (R = new_rtfobj(fin, fout, NULL)) || DIE("new_rtfobj() failed\n");
+    set_rtfobj_match_policy(R, policy) == 0 || DIE("set_rtfobj_match_policy() failed\n");
+    if (D) set_rtfobj_dictionary(R, D) == 0 || DIE("set_rtfobj_dictionary() failed\n");
+    if (pairs) add_rtfobj_replacements(R, pairs);
+    rtfreplace(R);
+    delete_rtfobj(R);
+    out = slurp(fout, NULL);
+    fclose(fin);
+    fclose(fout);
+
+    return out;
+}
+
+// The replacements that turn letter-input.rtf into letter-correct.rtf, as
+// (key, value) pairs in the order of letter.tsv. An initializer rather
+// than an array, so each test can sort or extend its own copy.
+#define LETTER_NPAIRS 12
+#define LETTER_PAIRS                                                          \
+    "«SSIC»",                    "1000",                                      \
+    "«Office Code»",             "B 0524",                                    \
+    "«Date»",                    "13 Sep 21",                                 \
+    "«Property Mgr Name»",       "Shady Management",                          \
+    "«Property Mgr Addr»",       "1234 Main Street",                          \
+    "«Property Mgr City»",       "Woodbridge",                                \
+    "«Property Mgr State»",      "VA",                                        \
+    "«Property Mgr ZIP»",        "22192",                                     \
+    "«Client Rank»",             "Colonel",                                   \
+    "«Client Full Name»",        "Chesty A. Puller",                          \
+    "«Client Last Name»",        "Puller",                                    \
+    "こんにちは！",                "Bonjour."
+
+static int cmppair(const void *a, const void *b) {
+    return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+// Sorts NULL-terminated (key, value) pairs by key, as new_rtfdict() wants
+static void sort_pairs(const char **pairs) {
+    size_t n = 0;
+    while (pairs[2 * n]) n++;
+    qsort(pairs, n, 2 * sizeof *pairs, cmppair);
+}
+
+// Copies NULL-terminated (key, value) pairs into dst, last pair first.
+// dst needs as many entries as src, counting the NULL.
+static void reverse_pairs(const char **dst, const char **src) {
+    size_t n = 0, i;
+    while (src[2 * n]) n++;
+    for (i = 0; i < n; i++) {
+        dst[2 * i]     = src[2 * (n - 1 - i)];
+        dst[2 * i + 1] = src[2 * (n - 1 - i) + 1];
+    }
+    dst[2 * n] = NULL;
+}
+
+#define EXPECT(P, D, K, in, want) do {                                        \
+    char *got = replace_with(P, D, K, in);                                    \
+    !strcmp(got, want) || DIE("%s: |%s| became |%s|, expected |%s|\n", #P, in, got, want); \
+    free(got);                                                                \
+} while (0)
+
+
+
+#endif
@@ -0,0 +1,73 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtfproc.h"
+#include "utillib.h"
+
+int main(void) {
+    const char *tracename = "temp.trace";
+    FILE *fin, *fout, *ftrace;
+    rtfobj *R;
+    char *json;
+    long len;
+
+    const char *replacements[] = {
+        "«Client Full Name»",        "Chesty A. Puller",
+        "«Date»",                    "13 Sep 21",
+        NULL
+    };
+
+    rtftrace_stop() == EINVAL || DIE("Stopped a trace that wasn't started\n");
+    rtftrace_start(tracename, 0) == 0 || DIE("Could not start trace\n");
+    rtftrace_start(tracename, 0) == EBUSY || DIE("Started a second trace\n");
+
+    (fin  = fopen("TEST/letter-input.rtf", "rb")) || DIE("Could not read letter input\n");
+    (fout = tmpfile())                            || DIE("Could not create temporary file\n");
+    R = new_rtfobj(fin, fout, NULL);
+    add_rtfobj_replacements(R, replacements);
+    rtfreplace(R);
+    delete_rtfobj(R);
+    fclose(fin);
+    fclose(fout);
+
+    rtftrace_stop() == 0 || DIE("Could not write trace\n");
+
+    (ftrace = fopen(tracename, "rb")) || DIE("Trace file missing\n");
+    fseek(ftrace, 0, SEEK_END);
+    len = ftell(ftrace);
+    rewind(ftrace);
+    (json = calloc((size_t)len + 1, 1)) || DIE("Out of memory\n");
+    fread(json, 1, (size_t)len, ftrace) == (size_t)len || DIE("Short read\n");
+    fclose(ftrace);
+    remove(tracename);
+
+    // Every kind of span, with control words escaped for JSON
+    !strncmp(json, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 38) || DIE("Not a trace: %.40s\n", json);
+    !strcmp(&json[len - 3], "\n]}") || !strcmp(&json[len - 4], "\n]}\n") || DIE("Trace not terminated\n");
+    strstr(json, "{\"name\":\"read\",\"ph\":\"X\"")     || DIE("No read spans\n");
+    strstr(json, "{\"name\":\"tokenize\",\"ph\":\"X\"") || DIE("No tokenize spans\n");
+    strstr(json, "{\"name\":\"command\",\"ph\":\"X\"")  || DIE("No command spans\n");
+    strstr(json, "{\"name\":\"match\",\"ph\":\"X\"")    || DIE("No match spans\n");
+    strstr(json, "{\"name\":\"output\",\"ph\":\"X\"")   || DIE("No output spans\n");
+    strstr(json, "\"args\":{\"cmd\":\"\\\\par")          || DIE("No \\par command\n");
+
+    free(json);
+
+    return 0;
+}
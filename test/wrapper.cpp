@@ -0,0 +1,138 @@
+/*═════════════════════════════════════════════════════════════════════════*\
+║                                                                           ║
+║  RTFPROC - RTF Processing Library                                         ║
+║  Copyright (c) 2019-2023, Joshua Lee Ockert                               ║
+║                                                                           ║
+║  THIS WORK IS PROVIDED 'AS IS' WITH NO WARRANTY OF ANY KIND. THE IMPLIED  ║
+║  WARRANTIES OF MERCHANTABILITY, FITNESS, NON-INFRINGEMENT, AND TITLE ARE  ║
+║  EXPRESSLY DISCLAIMED. NO AUTHOR SHALL BE LIABLE UNDER ANY THEORY OF LAW  ║
+║  FOR ANY DAMAGES OF ANY KIND RESULTING FROM THE USE OF THIS WORK.         ║
+║                                                                           ║
+║  Permission to use, copy, modify, and/or distribute this work for any     ║
+║  purpose is hereby granted, provided this notice appears in all copies.   ║
+║                                                                           ║
+\*═════════════════════════════════════════════════════════════════════════*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "rtfproc.hpp"
+
+// utillib is C; this is its DIE()
+#define DIE(...) (std::fprintf(stderr, __VA_ARGS__), std::exit(1), false)
+
+static std::string slurp(const char *name) {
+    std::ifstream f(name, std::ios::binary);
+    std::stringstream ss;
+    f || DIE("Could not read \'%s\'\n", name);
+    ss << f.rdbuf();
+    return ss.str();
+}
+
+static_assert(!std::is_copy_constructible_v<rtfproc::replacements>);
+static_assert( std::is_nothrow_move_constructible_v<rtfproc::replacements>);
+static_assert(!std::is_copy_constructible_v<rtfproc::processor>);
+static_assert( std::is_nothrow_move_constructible_v<rtfproc::processor>);
+
+int main() {
+    std::string in   = slurp("TEST/letter-input.rtf");
+    std::string want = slurp("TEST/letter-correct.rtf");
+
+    // Later duplicates win, as in a file of pairs
+    rtfproc::replacements letter = {
+        { "«SSIC»",                    "9999"             },
+        { "«SSIC»",                    "1000"             },
+        { "«Office Code»",             "B 0524"           },
+        { "«Date»",                    "13 Sep 21"        },
+        { "«Property Mgr Name»",       "Shady Management" },
+        { "«Property Mgr Addr»",       "1234 Main Street" },
+        { "«Property Mgr City»",       "Woodbridge"       },
+        { "«Property Mgr State»",      "VA"               },
+        { "«Property Mgr ZIP»",        "22192"            },
+        { "«Client Rank»",             "Colonel"          },
+        { "«Client Full Name»",        "Chesty A. Puller" },
+        { "«Client Last Name»",        "Puller"           },
+        { "こんにちは！",                "Bonjour."         },
+    };
+    letter.size() == 12 || DIE("%zu keys, expected 12\n", letter.size());
+
+    rtfproc::processor P(letter);
+
+    // Into a string, an output iterator, and a sink, more than once each
+    for (int i = 0; i < 2; i++) {
+        P.replace(rtfproc::as_input(in)) == want || DIE("String output differs\n");
+
+        std::vector<char> v;
+        P.replace(rtfproc::as_input(in), std::back_inserter(v));
+        std::string(v.begin(), v.end()) == want || DIE("Iterator output differs\n");
+
+        std::string out;
+        P.replace(rtfproc::as_input(in), [&](std::string_view s) { out += s; });
+        out == want || DIE("Sink output differs\n");
+    }
+
+    // A match callback sees each key and decides what goes in its place
+    std::size_t nmatches = 0;
+    std::string marked;
+    P.replace(rtfproc::as_input(in),
+              [&](std::string_view s) { marked += s; },
+              [&](std::string_view key, std::string_view rtf) {
+                  nmatches++;
+                  return key == "«Date»" ? std::string("[DATE]") : std::string(rtf);
+              });
+    nmatches > 0 || DIE("No matches reported\n");
+    marked.find("[DATE]") != std::string::npos || DIE("Match callback output missing\n");
+    marked.find("13 Sep 21") == std::string::npos || DIE("Replaced date still present\n");
+
+    // Sets from any range of pairs, moved between owners
+    std::map<std::string, std::string> m = { { "«Date»", "Tomorrow" } };
+    rtfproc::replacements one(m);
+    rtfproc::replacements moved(std::move(one));
+    rtfproc::processor Q(moved);
+    rtfproc::processor R(std::move(Q));
+    std::string out = R.replace(rtfproc::as_input("{\\rtf1 \\'abDate\\'bb, \\'abDate\\'bb}"));
+    out == "{\\rtf1 Tomorrow, Tomorrow}" || DIE("Got |%s|\n", out.c_str());
+    R.replace(rtfproc::as_input("")).empty() || DIE("Output from empty input\n");
+
+    // Values outside ASCII are written as RTF, just as rtfreplace() would
+    rtfproc::replacements accents = { { "cafe", "café" } };
+    out = rtfproc::processor(accents).replace(rtfproc::as_input("{\\rtf1 cafe}"));
+    out == "{\\rtf1 caf{\\uc0 \\u233}}" || DIE("Got |%s|\n", out.c_str());
+
+    // Plain text, and rtfprocess() events
+    P.text(rtfproc::as_input(in)).find("Woodbridge") == std::string::npos || DIE("Text was replaced\n");
+    P.text(rtfproc::as_input(in)).find("Respectfully") != std::string::npos || DIE("Text missing\n");
+    int starts = 0, steps = 0, ends = 0;
+    P.process(rtfproc::as_input(in), [&](rtfobj &, int event) {
+        starts += event == RTF_PROC_START;
+        steps  += event == RTF_PROC_STEP;
+        ends   += event == RTF_PROC_END;
+    });
+    starts == 1 && ends == 1 && steps > 100 || DIE("Events %d/%d/%d\n", starts, steps, ends);
+
+    // Exceptions from callbacks stop processing and come back out; the
+    // processor is still good afterwards
+    bool caught = false;
+    try { P.replace(rtfproc::as_input(in), [](std::string_view) { throw std::runtime_error("sink"); }); }
+    catch (const std::runtime_error &) { caught = true; }
+    caught || DIE("Sink exception lost\n");
+    P.replace(rtfproc::as_input(in)) == want || DIE("Output differs after an exception\n");
+
+    // Library errors become std::system_error
+    rtflimits L = { };
+    L.maxdepth = 1;
+    set_rtfobj_limits(P.get(), &L);
+    caught = false;
+    try { P.replace(rtfproc::as_input(in)); }
+    catch (const std::system_error &e) { caught = e.code().value() != 0; }
+    caught || DIE("Depth limit not reported\n");
+
+    return 0;
+}